@@ -6,8 +6,11 @@ Flask wrapper for the C sockmap binary
 
 import subprocess
 import json
+import mmap
 import os
+import struct
 import sys
+import time
 from flask import Flask, jsonify, request
 from flask_cors import CORS
 import logging
@@ -22,6 +25,98 @@ logger = logging.getLogger(__name__)
 # Path to the compiled sockmap binary
 SOCKMAP_BINARY = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'bin', 'sockmap')
 
+# Region published by `sockmap --daemon`; see backend/include/shm_snapshot.h
+SHM_PATH = os.environ.get('SOCKMAP_SHM', '/dev/shm/sockmap')
+SHM_MAX_AGE = float(os.environ.get('SOCKMAP_SHM_MAX_AGE', '30'))
+SHM_MAGIC = 0x504d4b53
+SHM_DATA_OFFSET = 4096
+SHM_SLOTS_OFFSET = 40
+SHM_SLOT_SIZE = 32
+
+class ShmSnapshotReader:
+    """Seqlock reader for the daemon's double-buffered snapshot region"""
+
+    def __init__(self, path):
+        self.path = path
+        self.map = None
+
+    def _remap(self):
+        if self.map is not None:
+            self.map.close()
+            self.map = None
+        with open(self.path, 'rb') as f:
+            region = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version = struct.unpack_from('<II', region, 0)
+        if magic != SHM_MAGIC or version != 1:
+            region.close()
+            raise ValueError(f"{self.path} is not a sockmap snapshot region")
+        self.map = region
+
+    def read(self):
+        """Latest consistent (timestamp, json bytes), or None before the first publish"""
+        if self.map is None:
+            self._remap()
+        while True:
+            capacity, = struct.unpack_from('<Q', self.map, 16)
+            retired, current = struct.unpack_from('<II', self.map, 24)
+            if retired:
+                self._remap()
+                continue
+            current &= 1
+            slot = SHM_SLOTS_OFFSET + current * SHM_SLOT_SIZE
+            seq, length, timestamp, _ = struct.unpack_from('<QQqQ', self.map, slot)
+            if seq == 0:
+                return None
+            if seq & 1 or length > capacity:
+                continue
+            start = SHM_DATA_OFFSET + current * capacity
+            data = self.map[start:start + length]
+            if struct.unpack_from('<Q', self.map, slot)[0] == seq:
+                return timestamp, data
+
+shm_reader = ShmSnapshotReader(SHM_PATH)
+
+def read_daemon_snapshot():
+    """The daemon's latest snapshot if one is running and recent, else None"""
+    try:
+        snapshot = shm_reader.read()
+    except (OSError, ValueError):
+        return None
+    if snapshot is None:
+        return None
+    timestamp, data = snapshot
+    if time.time() - timestamp > SHM_MAX_AGE:
+        return None
+    return json.loads(data)
+
+# Log recorded by `sockmap --history`; see backend/include/snapshot_log.h
+HISTORY_PATH = os.environ.get('SOCKMAP_HISTORY', '/var/tmp/sockmap.history')
+
+# Request parameters passed through to the binary as --<name>=<value>;
+# an empty maps= asks for every mapping rather than a page
+QUERY_OPTIONS = ('pid', 'name', 'port', 'protocol', 'state', 'fields', 'smaps', 'maps')
+
+def query_args():
+    """Scanner options for the current request's query parameters"""
+    args = []
+    for option in QUERY_OPTIONS:
+        value = request.args.get(option)
+        if value:
+            args.append(f"--{option}={value}")
+        elif value is not None and option == 'maps':
+            args.append('--maps')
+    return args
+
+def run_query(sections):
+    """Results for the request: the daemon's snapshot when unfiltered, else a scan
+    that collects only the given sections and the requested rows"""
+    args = query_args()
+    if not args:
+        data = read_daemon_snapshot()
+        if data is not None:
+            return data
+    return run_sockmap_command(sections + args)
+
 def run_sockmap_command(args=None):
     """Execute the sockmap binary and return parsed results"""
     try:
@@ -31,7 +126,7 @@ def run_sockmap_command(args=None):
             cmd.extend(args)
         
         # Add single scan mode (no continuous monitoring)
-        cmd.extend(['-t', '0'])
+        cmd.extend(['-i', '0'])
         
         logger.info(f"Executing command: {' '.join(cmd)}")
         
@@ -69,24 +164,29 @@ def run_sockmap_command(args=None):
 
 @app.route('/api/health', methods=['GET'])
 def health_check():
-    """Health check endpoint"""
-    return jsonify({
+    """Health check endpoint; scan_stats come from the daemon's latest scan, if any"""
+    health = {
         'status': 'healthy',
         'binary_exists': os.path.exists(SOCKMAP_BINARY),
-        'binary_path': SOCKMAP_BINARY
-    })
+        'binary_path': SOCKMAP_BINARY,
+        'daemon_snapshot': os.path.exists(SHM_PATH)
+    }
+    snapshot = read_daemon_snapshot()
+    if snapshot is not None and 'scan_stats' in snapshot:
+        health['scan_stats'] = snapshot['scan_stats']
+    return jsonify(health)
 
 @app.route('/api/trace-sockets', methods=['GET'])
 def trace_sockets():
     """Main endpoint to get socket, memory, and process information"""
     try:
-        data = run_sockmap_command()
+        data = run_query([])
         
         if data is None:
             return jsonify({
                 'error': 'Failed to execute sockmap command',
                 'sockets': [],
-                'memory': [],
+                'memory_rollup': [],
                 'processes': []
             }), 500
         
@@ -97,7 +197,7 @@ def trace_sockets():
         return jsonify({
             'error': str(e),
             'sockets': [],
-            'memory': [],
+            'memory_rollup': [],
             'processes': []
         }), 500
 
@@ -105,7 +205,7 @@ def trace_sockets():
 def get_sockets():
     """Get only socket information"""
     try:
-        data = run_sockmap_command()
+        data = run_query(['--sockets'])
         
         if data is None:
             return jsonify({'error': 'Failed to get socket data', 'sockets': []}), 500
@@ -121,27 +221,32 @@ def get_sockets():
 
 @app.route('/api/memory', methods=['GET'])
 def get_memory():
-    """Get only memory mapping information"""
+    """Get per-process memory rollups, plus mappings when asked for"""
     try:
-        data = run_sockmap_command()
+        data = run_query(['--memory'])
         
         if data is None:
-            return jsonify({'error': 'Failed to get memory data', 'memory': []}), 500
+            return jsonify({'error': 'Failed to get memory data', 'memory_rollup': []}), 500
         
-        return jsonify({
-            'memory': data.get('memory', []),
+        # Individual mappings are only present when asked for with maps=
+        result = {
+            'memory_rollup': data.get('memory_rollup', []),
             'timestamp': data.get('timestamp')
-        })
+        }
+        if 'memory' in data:
+            result['memory'] = data['memory']
+            result['memory_total'] = data.get('memory_total', len(data['memory']))
+        return jsonify(result)
         
     except Exception as e:
         logger.error(f"Error in get_memory: {e}")
-        return jsonify({'error': str(e), 'memory': []}), 500
+        return jsonify({'error': str(e), 'memory_rollup': []}), 500
 
 @app.route('/api/processes', methods=['GET'])
 def get_processes():
     """Get only process information"""
     try:
-        data = run_sockmap_command()
+        data = run_query(['--processes'])
         
         if data is None:
             return jsonify({'error': 'Failed to get process data', 'processes': []}), 500
@@ -155,6 +260,27 @@ def get_processes():
         logger.error(f"Error in get_processes: {e}")
         return jsonify({'error': str(e), 'processes': []}), 500
 
+@app.route('/api/history', methods=['GET'])
+def get_history():
+    """Recorded state at from= and the deltas after it up to to=; either may be
+    Unix seconds or, if negative, seconds before now"""
+    try:
+        args = [f"--read-history={HISTORY_PATH}"]
+        for option in ('from', 'to'):
+            value = request.args.get(option)
+            if value:
+                args.append(f"--{option}={value}")
+        data = run_sockmap_command(args)
+        
+        if data is None:
+            return jsonify({'error': 'History is not readable', 'snapshot': None, 'deltas': []}), 503
+        
+        return jsonify(data)
+        
+    except Exception as e:
+        logger.error(f"Error in get_history: {e}")
+        return jsonify({'error': str(e), 'snapshot': None, 'deltas': []}), 500
+
 @app.route('/api/config', methods=['GET', 'POST'])
 def handle_config():
     """Get or set configuration options"""
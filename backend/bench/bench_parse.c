@@ -0,0 +1,233 @@
+/*
+ * SockMap - /proc parser microbenchmarks
+ *
+ * Compares the hand-written field scanners in proc_parse.c against the
+ * sscanf formats they replaced, on synthetic maps, stat, status and
+ * net/tcp content held in memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/proc_parse.h"
+
+#define MAPS_LINES 200000
+#define STAT_RECORDS 50000
+#define NET_LINES 100000
+#define ROUNDS 5
+
+static volatile unsigned long sink;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Copy one line out, as the fgets() loops in the old collectors did */
+static const char *next_line(const char *line, const char *end, char *copy, size_t len) {
+    const char *eol = memchr(line, '\n', end - line);
+    size_t n = (eol ? eol : end) - line;
+    if (n >= len) n = len - 1;
+    memcpy(copy, line, n);
+    copy[n] = '\0';
+    return eol ? eol + 1 : end;
+}
+
+static char *build_maps(size_t *len) {
+    size_t cap = (size_t)MAPS_LINES * 128;
+    char *buf = malloc(cap);
+    size_t off = 0;
+    unsigned long addr = 0x7f0000000000UL;
+    for (int i = 0; i < MAPS_LINES; i++) {
+        const char *path = (i % 4 == 0) ? "/usr/lib/x86_64-linux-gnu/libc.so.6"
+                         : (i % 4 == 1) ? "[heap]" : "";
+        off += snprintf(buf + off, cap - off, "%lx-%lx rw-p %08x 08:01 %d                          %s\n",
+                        addr, addr + 0x21000, i * 4096, i % 3 ? 0 : 1234567, path);
+        addr += 0x22000;
+    }
+    *len = off;
+    return buf;
+}
+
+static char *build_net(size_t *len) {
+    size_t cap = (size_t)NET_LINES * 160;
+    char *buf = malloc(cap);
+    size_t off = 0;
+    for (int i = 0; i < NET_LINES; i++) {
+        off += snprintf(buf + off, cap - off,
+                        "%4d: 0100007F:%04X 0A00000A:%04X 01 00000000:00000000 00:00000000 00000000  1000        0 %d 1 0000000000000000 20 4 30 10 -1\n",
+                        i, 1024 + i % 60000, 443, 100000 + i);
+    }
+    *len = off;
+    return buf;
+}
+
+static const char stat_line[] =
+    "12345 (java worker) S 1 12345 12345 0 -1 4194560 123456 0 12 0 4521 873 0 0 20 0 "
+    "58 0 987654 12345678901 51234 18446744073709551615 1 1 0 0 0 0 0 4096 17415 0 0 0 17 3 0 0 0 0 0\n";
+
+static const char status_block[] =
+    "Name:\tjava\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t12345\nNgid:\t0\nPid:\t12345\n"
+    "PPid:\t1\nTracerPid:\t0\nUid:\t1000\t1000\t1000\t1000\nGid:\t1000\t1000\t1000\t1000\n"
+    "FDSize:\t256\nGroups:\t\nVmPeak:\t 9861236 kB\nVmSize:\t 9861236 kB\nVmLck:\t       0 kB\n"
+    "VmPin:\t       0 kB\nVmHWM:\t 1234568 kB\nVmRSS:\t 1234567 kB\nRssAnon:\t 1200000 kB\n"
+    "VmData:\t 3456789 kB\nVmStk:\t     132 kB\nThreads:\t58\n";
+
+static void bench_maps(void) {
+    size_t len;
+    char *buf = build_maps(&len);
+    const char *end = buf + len;
+    double t0, t_sscanf = 0, t_fast = 0;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        t0 = now_seconds();
+        for (const char *line = buf; line < end; ) {
+            char copy[1024];
+            line = next_line(line, end, copy, sizeof(copy));
+
+            unsigned long start, stop;
+            char perms[8], pathname[256];
+            pathname[0] = '\0';
+            if (sscanf(copy, "%lx-%lx %7s %*x %*x:%*x %*d %255s", &start, &stop, perms, pathname) >= 3) {
+                sink += stop - start + (unsigned char)pathname[0];
+            }
+        }
+        t_sscanf += now_seconds() - t0;
+
+        t0 = now_seconds();
+        const char *eol;
+        for (const char *line = buf; line < end; line = eol + 1) {
+            eol = pp_find_eol(line, end);
+            struct maps_entry entry;
+            if (pp_parse_maps_line(line, eol, &entry) == 0) {
+                sink += entry.end - entry.start + entry.path_len;
+            }
+        }
+        t_fast += now_seconds() - t0;
+    }
+
+    printf("%-10s %10d lines  sscanf %8.1f ns/line  proc_parse %8.1f ns/line  (%.1fx)\n",
+           "maps", MAPS_LINES,
+           t_sscanf / ROUNDS / MAPS_LINES * 1e9, t_fast / ROUNDS / MAPS_LINES * 1e9,
+           t_sscanf / t_fast);
+    free(buf);
+}
+
+static void bench_stat(void) {
+    double t0, t_sscanf = 0, t_fast = 0;
+    size_t len = sizeof(stat_line) - 1;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        t0 = now_seconds();
+        for (int i = 0; i < STAT_RECORDS; i++) {
+            char state;
+            unsigned long utime, stime;
+            const char *fields = strrchr(stat_line, ')');
+            if (sscanf(fields + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                       &state, &utime, &stime) == 3) {
+                sink += utime + stime + state;
+            }
+        }
+        t_sscanf += now_seconds() - t0;
+
+        t0 = now_seconds();
+        for (int i = 0; i < STAT_RECORDS; i++) {
+            struct stat_fields fields;
+            if (pp_parse_stat(stat_line, len, &fields) == 0) {
+                sink += fields.utime + fields.stime + fields.state + fields.starttime;
+            }
+        }
+        t_fast += now_seconds() - t0;
+    }
+
+    printf("%-10s %10d recs   sscanf %8.1f ns/rec   proc_parse %8.1f ns/rec   (%.1fx)\n",
+           "stat", STAT_RECORDS,
+           t_sscanf / ROUNDS / STAT_RECORDS * 1e9, t_fast / ROUNDS / STAT_RECORDS * 1e9,
+           t_sscanf / t_fast);
+}
+
+static void bench_status(void) {
+    double t0, t_sscanf = 0, t_fast = 0;
+    size_t len = sizeof(status_block) - 1;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        t0 = now_seconds();
+        for (int i = 0; i < STAT_RECORDS; i++) {
+            const char *rss = strstr(status_block, "\nVmRSS:");
+            double kb;
+            if (rss && sscanf(rss, "\nVmRSS: %lf kB", &kb) == 1) {
+                sink += (unsigned long)kb;
+            }
+        }
+        t_sscanf += now_seconds() - t0;
+
+        t0 = now_seconds();
+        for (int i = 0; i < STAT_RECORDS; i++) {
+            unsigned long kb;
+            if (pp_status_value(status_block, len, "VmRSS", &kb) == 0) {
+                sink += kb;
+            }
+        }
+        t_fast += now_seconds() - t0;
+    }
+
+    printf("%-10s %10d recs   sscanf %8.1f ns/rec   proc_parse %8.1f ns/rec   (%.1fx)\n",
+           "status", STAT_RECORDS,
+           t_sscanf / ROUNDS / STAT_RECORDS * 1e9, t_fast / ROUNDS / STAT_RECORDS * 1e9,
+           t_sscanf / t_fast);
+}
+
+static void bench_net(void) {
+    size_t len;
+    char *buf = build_net(&len);
+    const char *end = buf + len;
+    double t0, t_sscanf = 0, t_fast = 0;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        t0 = now_seconds();
+        for (const char *line = buf; line < end; ) {
+            char copy[1024];
+            line = next_line(line, end, copy, sizeof(copy));
+
+            char local_hex[40], remote_hex[40];
+            unsigned int local_port, remote_port, state, uid;
+            unsigned long tx_queue, rx_queue, inode;
+            if (sscanf(copy, "%*d: %39[0-9A-Fa-f]:%x %39[0-9A-Fa-f]:%x %x %lx:%lx %*s %*s %u %*d %lu",
+                       local_hex, &local_port, remote_hex, &remote_port, &state,
+                       &tx_queue, &rx_queue, &uid, &inode) == 9) {
+                unsigned int addr;
+                sscanf(local_hex, "%8x", &addr);
+                sink += inode + local_port + addr;
+            }
+        }
+        t_sscanf += now_seconds() - t0;
+
+        t0 = now_seconds();
+        const char *eol;
+        for (const char *line = buf; line < end; line = eol + 1) {
+            eol = pp_find_eol(line, end);
+            struct net_entry entry;
+            if (pp_parse_net_line(line, eol, 1, &entry) == 0) {
+                sink += entry.inode + entry.local_port + entry.local_addr[0];
+            }
+        }
+        t_fast += now_seconds() - t0;
+    }
+
+    printf("%-10s %10d lines  sscanf %8.1f ns/line  proc_parse %8.1f ns/line  (%.1fx)\n",
+           "net/tcp", NET_LINES,
+           t_sscanf / ROUNDS / NET_LINES * 1e9, t_fast / ROUNDS / NET_LINES * 1e9,
+           t_sscanf / t_fast);
+    free(buf);
+}
+
+int main(void) {
+    printf("SockMap parser microbenchmarks (%d rounds)\n", ROUNDS);
+    bench_maps();
+    bench_stat();
+    bench_status();
+    bench_net();
+    return 0;
+}
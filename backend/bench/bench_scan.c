@@ -0,0 +1,242 @@
+/*
+ * SockMap - Scan phase benchmark
+ *
+ * Scans a proc root, normally a tree built by proc_fixture, in the
+ * phases scan_snapshot runs them: the process walk (stat, comm, status,
+ * smaps_rollup and fd/ per pid), the net/ socket tables, and the JSON
+ * document written to a sink that only counts bytes. Reports each phase's
+ * wall time per scan and its syscalls, counted under ptrace on one extra
+ * sequential scan in a child, then the peak RSS. -t and -u select the
+ * threaded and io_uring walks; the syscall count stays sequential.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "../include/sockmap.h"
+#include "../include/proc_walk.h"
+#include "../include/proc_parse.h"
+#include "../include/uring_batch.h"
+#include "../include/history.h"
+#include "../include/json_writer.h"
+
+#define DEFAULT_ROUNDS 5
+
+enum { PHASE_WALK, PHASE_SOCKETS, PHASE_OUTPUT, PHASE_COUNT };
+static const char *phase_names[PHASE_COUNT] = { "walk", "sockets", "output" };
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int count_bytes(void *ctx, const char *data, size_t len) {
+    (void)data;
+    *(size_t *)ctx += len;
+    return 0;
+}
+
+/* Phase boundary for the tracer; nothing in a scan asks for its parent */
+static void mark_phase(int traced) {
+    if (traced) syscall(SYS_getppid);
+}
+
+/* One scan into snap, reusing its arena as the monitoring loop does */
+static int run_scan(const struct sockmap_config *cfg, struct sockmap_snapshot *snap,
+                    double times[PHASE_COUNT], size_t *bytes, int traced) {
+    int processes = snap->processes.count, memory = snap->memory.count;
+    int sockets = snap->sockets.count;
+    arena_reset(&snap->arena);
+    memset(&snap->sockets, 0, sizeof(snap->sockets));
+    snap->timestamp = time(NULL);
+
+    struct proc_walk walk;
+    mark_phase(traced);
+    double t0 = now_seconds();
+    if (proc_walk_init(&walk, &snap->arena, processes, memory) != 0 ||
+        walk_processes(cfg, &walk) < 0) {
+        return -1;
+    }
+    double t1 = now_seconds();
+
+    mark_phase(traced);
+    if (socket_table_reserve(&snap->sockets, &snap->arena, sockets) != 0 ||
+        scan_sockets(cfg, &snap->arena, &walk.owners, &snap->sockets) < 0) {
+        return -1;
+    }
+    snap->memory = walk.memory;
+    snap->rollups = walk.rollups;
+    snap->processes = walk.processes;
+    snap->strings = walk.strings;
+    double t2 = now_seconds();
+
+    mark_phase(traced);
+    struct json_writer out;
+    *bytes = 0;
+    json_writer_init_sink(&out, count_bytes, bytes, 0);
+    output_json(snap, cfg->query, &out);
+    json_flush(&out);
+    json_writer_release(&out);
+    double t3 = now_seconds();
+    mark_phase(traced);
+
+    times[PHASE_WALK] += t1 - t0;
+    times[PHASE_SOCKETS] += t2 - t1;
+    times[PHASE_OUTPUT] += t3 - t2;
+    return 0;
+}
+
+/*
+ * Run one warm scan and then one traced scan in a child, counting the
+ * syscalls it enters between phase marks. Returns -1 if the child could
+ * not be traced.
+ */
+static int count_syscalls(const struct sockmap_config *cfg, long counts[PHASE_COUNT]) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) return -1;
+    if (child == 0) {
+        struct sockmap_snapshot snap;
+        double times[PHASE_COUNT] = { 0 };
+        size_t bytes;
+        memset(&snap, 0, sizeof(snap));
+        if (run_scan(cfg, &snap, times, &bytes, 0) != 0 ||
+            ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) {
+            _exit(1);
+        }
+        raise(SIGSTOP);
+        _exit(run_scan(cfg, &snap, times, &bytes, 1) != 0);
+    }
+
+    int status;
+    if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status) ||
+        ptrace(PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL) != 0) {
+        kill(child, SIGKILL);
+        waitpid(child, NULL, 0);
+        return -1;
+    }
+
+    int phase = -1, signal = 0;
+    memset(counts, 0, PHASE_COUNT * sizeof(long));
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, child, NULL, (void *)(long)signal) != 0 ||
+            waitpid(child, &status, 0) != child || !WIFSTOPPED(status)) {
+            break;
+        }
+        signal = 0;
+        if (WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+            signal = WSTOPSIG(status); // Deliver anything else as it came
+            continue;
+        }
+
+        struct __ptrace_syscall_info info;
+        if (ptrace(PTRACE_GET_SYSCALL_INFO, child, (void *)sizeof(info), &info) <= 0 ||
+            info.op != PTRACE_SYSCALL_INFO_ENTRY) {
+            continue;
+        }
+        if (info.entry.nr == SYS_getppid) {
+            phase++;
+        } else if (phase >= 0 && phase < PHASE_COUNT) {
+            counts[phase]++;
+        }
+    }
+
+    if (!WIFEXITED(status) && !WIFSIGNALED(status)) {
+        kill(child, SIGKILL);
+        waitpid(child, &status, 0);
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 && phase == PHASE_COUNT ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    struct sockmap_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.output_format = OUTPUT_JSON;
+    cfg.socket_backend = SOCKET_BACKEND_PROCFS;
+    cfg.threads = 1;
+    cfg.proc_root = PROC_ROOT;
+    int rounds = DEFAULT_ROUNDS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:un:")) != -1) {
+        switch (opt) {
+            case 'r': cfg.proc_root = optarg; break;
+            case 't': cfg.threads = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'u': cfg.io_uring = 1; break;
+            case 'n': rounds = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-r proc_root] [-t threads] [-u] [-n rounds]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    struct sockmap_snapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    double times[PHASE_COUNT] = { 0 }, warm[PHASE_COUNT] = { 0 };
+    size_t bytes = 0;
+
+    // The first scan sizes the arena; later ones refill it like the monitoring loop
+    if (run_scan(&cfg, &snap, warm, &bytes, 0) != 0) {
+        fprintf(stderr, "Failed to scan %s\n", cfg.proc_root);
+        return 1;
+    }
+    for (int r = 0; r < rounds; r++) {
+        if (run_scan(&cfg, &snap, times, &bytes, 0) != 0) {
+            fprintf(stderr, "Failed to scan %s\n", cfg.proc_root);
+            return 1;
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    struct sockmap_config traced = cfg;
+    traced.threads = 1;
+    long counts[PHASE_COUNT];
+    int counted = count_syscalls(&traced, counts) == 0;
+
+    int processes = snap.processes.count;
+    printf("SockMap scan benchmark: %s, %d processes, %d sockets, %d thread%s%s, %d rounds\n",
+           cfg.proc_root, processes, snap.sockets.count, cfg.threads,
+           cfg.threads == 1 ? "" : "s", cfg.io_uring ? ", io_uring" : "", rounds);
+    printf("%-8s %10s %10s %12s %10s\n", "phase", "ms/scan", "us/pid", "syscalls", "per pid");
+
+    double total_time = 0;
+    long total_calls = 0;
+    for (int p = 0; p <= PHASE_COUNT; p++) {
+        double seconds = p < PHASE_COUNT ? times[p] / rounds : total_time;
+        long calls = p < PHASE_COUNT ? counts[p] : total_calls;
+        if (p < PHASE_COUNT) {
+            total_time += seconds;
+            total_calls += calls;
+        }
+        printf("%-8s %10.1f %10.2f", p < PHASE_COUNT ? phase_names[p] : "total",
+               seconds * 1e3, processes ? seconds / processes * 1e6 : 0.0);
+        if (counted) {
+            printf(" %12ld %10.1f\n", calls, processes ? (double)calls / processes : 0.0);
+        } else {
+            printf(" %12s %10s\n", "-", "-");
+        }
+    }
+    if (!counted) printf("syscalls not counted: ptrace unavailable\n");
+    printf("first scan %.1f ms, peak RSS %.1f MB, arena %.1f MB, document %.1f MB\n",
+           (warm[PHASE_WALK] + warm[PHASE_SOCKETS] + warm[PHASE_OUTPUT]) * 1e3,
+           usage.ru_maxrss / 1024.0, arena_footprint(&snap.arena) / 1048576.0,
+           bytes / 1048576.0);
+
+    free_snapshot(&snap);
+    proc_walk_release();
+    proc_parse_release();
+    uring_batch_release();
+    history_release();
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Shared-memory seqlock stress test
+ *
+ * One writer publishes snapshots back to back, as fast as it can, while
+ * reader threads copy the latest snapshot in a loop. Every snapshot's
+ * length and contents are a function of its sequence number, so a reader
+ * that ever accepts a torn copy notices. Sizes cross the initial slot
+ * capacity, so region replacement is exercised as well.
+ *
+ *   bench_shm [-r READERS] [-n PUBLISHES]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "../include/shm_publish.h"
+#include "../include/shm_snapshot.h"
+
+#define INITIAL_SLOT (64 * 1024)
+#define MAX_SNAPSHOT (512 * 1024)
+
+static char path[128];
+static volatile int writer_done;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Mostly small snapshots, with an occasional one past the slot size */
+static size_t snapshot_length(unsigned long long sequence) {
+    unsigned long long mix = sequence * 0x9E3779B97F4A7C15ULL;
+    size_t length = 64 + (size_t)(mix >> 40) % (INITIAL_SLOT / 2);
+    if (sequence % 5000 == 0) length = (size_t)(mix >> 40) % MAX_SNAPSHOT + INITIAL_SLOT;
+    return length;
+}
+
+struct reader_stats {
+    unsigned long long reads;
+    unsigned long long torn;
+    unsigned long long last_sequence;
+};
+
+static void *reader_main(void *arg) {
+    struct reader_stats *stats = arg;
+    struct shm_reader reader;
+    char *buf = malloc(MAX_SNAPSHOT + INITIAL_SLOT);
+    if (!buf || shm_reader_open(&reader, path) != 0) {
+        stats->torn = 1;
+        free(buf);
+        return NULL;
+    }
+
+    while (!writer_done) {
+        struct shm_snapshot_info info;
+        ssize_t length = shm_reader_read(&reader, buf, MAX_SNAPSHOT + INITIAL_SLOT, &info);
+        if (length <= 0) continue;
+        stats->reads++;
+
+        unsigned char fill = (unsigned char)info.sequence;
+        int ok = (size_t)length == snapshot_length(info.sequence) &&
+                 info.timestamp == (long long)info.sequence &&
+                 info.sequence >= stats->last_sequence;
+        for (ssize_t i = 0; ok && i < length; i++) {
+            ok = (unsigned char)buf[i] == fill;
+        }
+        if (!ok) stats->torn++;
+        stats->last_sequence = info.sequence;
+    }
+
+    shm_reader_close(&reader);
+    free(buf);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int readers = 4;
+    unsigned long long publishes = 200000;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+        if (opt == 'r') readers = atoi(optarg);
+        else if (opt == 'n') publishes = strtoull(optarg, NULL, 10);
+        else {
+            fprintf(stderr, "Usage: %s [-r READERS] [-n PUBLISHES]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (readers < 1) readers = 1;
+
+    snprintf(path, sizeof(path), "/dev/shm/sockmap-bench-%d", (int)getpid());
+    struct shm_publisher pub;
+    if (shm_publisher_open(&pub, path, INITIAL_SLOT) != 0) {
+        perror(path);
+        return 1;
+    }
+
+    char *chunk = malloc(MAX_SNAPSHOT + INITIAL_SLOT);
+    pthread_t *threads = calloc(readers, sizeof(pthread_t));
+    struct reader_stats *stats = calloc(readers, sizeof(struct reader_stats));
+    if (!chunk || !threads || !stats) return 1;
+
+    // Readers attach to a region that already holds a snapshot
+    memset(chunk, 1, snapshot_length(1));
+    shm_publish_begin(&pub);
+    shm_publish_write(&pub, chunk, snapshot_length(1));
+    shm_publish_commit(&pub, 1);
+
+    for (int i = 0; i < readers; i++) {
+        pthread_create(&threads[i], NULL, reader_main, &stats[i]);
+    }
+
+    double start = now();
+    for (unsigned long long sequence = 2; sequence <= publishes; sequence++) {
+        size_t length = snapshot_length(sequence);
+        memset(chunk, (unsigned char)sequence, length);
+
+        // Written in pieces, the way the JSON writer flushes
+        shm_publish_begin(&pub);
+        for (size_t off = 0; off < length; off += 16384) {
+            size_t n = length - off < 16384 ? length - off : 16384;
+            shm_publish_write(&pub, chunk + off, n);
+        }
+        if (shm_publish_commit(&pub, (long long)sequence) != 0) {
+            fprintf(stderr, "publish %llu failed\n", sequence);
+            return 1;
+        }
+    }
+    double elapsed = now() - start;
+    writer_done = 1;
+
+    unsigned long long reads = 0, torn = 0;
+    for (int i = 0; i < readers; i++) {
+        pthread_join(threads[i], NULL);
+        reads += stats[i].reads;
+        torn += stats[i].torn;
+    }
+
+    printf("%llu publishes in %.2f s (%.0f/s), slot grew to %zu KB\n",
+           publishes, elapsed, publishes / elapsed, (size_t)pub.header->slot_capacity / 1024);
+    printf("%d readers: %llu consistent reads (%.0f/s), %llu torn\n",
+           readers, reads - torn, reads / elapsed, torn);
+
+    shm_publisher_close(&pub);
+    free(chunk);
+    free(threads);
+    free(stats);
+    return torn == 0 ? 0 : 1;
+}
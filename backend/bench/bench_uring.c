@@ -0,0 +1,182 @@
+/*
+ * SockMap - io_uring batch read benchmark
+ *
+ * Reads stat, comm, status and maps for every pid in /proc, once with an
+ * openat/read/close per file and once through uring_read_batch, and
+ * reports the wall time of each. Pass -n N to fork N idle children first
+ * so the host has enough pids to be interesting (e.g. -n 10000).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include "../include/uring_batch.h"
+
+#define ROUNDS 3
+#define BATCH_PIDS 64
+#define READ_SIZE 32768
+
+static const char *files[] = { "stat", "comm", "status", "maps" };
+#define FILE_COUNT (int)(sizeof(files) / sizeof(files[0]))
+
+static volatile unsigned long sink;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int list_pids(int **pids) {
+    DIR *dir = opendir("/proc");
+    if (!dir) return -1;
+
+    int count = 0, capacity = 1024;
+    *pids = malloc(capacity * sizeof(int));
+    struct dirent *entry;
+    while (*pids && (entry = readdir(dir)) != NULL) {
+        int pid = atoi(entry->d_name);
+        if (pid <= 0) continue;
+        if (count == capacity) {
+            capacity *= 2;
+            int *grown = realloc(*pids, capacity * sizeof(int));
+            if (!grown) break;
+            *pids = grown;
+        }
+        (*pids)[count++] = pid;
+    }
+    closedir(dir);
+    return count;
+}
+
+static int spawn_children(int count, pid_t *children) {
+    int spawned = 0;
+    for (; spawned < count; spawned++) {
+        pid_t pid = fork();
+        if (pid < 0) break;
+        if (pid == 0) {
+            pause();
+            _exit(0);
+        }
+        children[spawned] = pid;
+    }
+    return spawned;
+}
+
+static void reap_children(pid_t *children, int count) {
+    for (int i = 0; i < count; i++) kill(children[i], SIGKILL);
+    for (int i = 0; i < count; i++) waitpid(children[i], NULL, 0);
+}
+
+static double run_syscalls(const int *pids, int pid_count, char *buf) {
+    double t0 = now_seconds();
+    for (int i = 0; i < pid_count; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/%d", pids[i]);
+        int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0) continue;
+
+        for (int f = 0; f < FILE_COUNT; f++) {
+            int fd = openat(dir_fd, files[f], O_RDONLY | O_CLOEXEC);
+            if (fd < 0) continue;
+            ssize_t n;
+            while ((n = read(fd, buf, READ_SIZE)) > 0) sink += (unsigned long)n;
+            close(fd);
+        }
+        close(dir_fd);
+    }
+    return now_seconds() - t0;
+}
+
+static void on_read(void *ctx, struct uring_read *read) {
+    (void)ctx;
+    if (read->result > 0) sink += (unsigned long)read->result;
+}
+
+static double run_batched(const int *pids, int pid_count, char *bufs) {
+    struct uring_read reads[BATCH_PIDS * FILE_COUNT];
+    int dir_fds[BATCH_PIDS];
+
+    double t0 = now_seconds();
+    for (int base = 0; base < pid_count; base += BATCH_PIDS) {
+        int batch = pid_count - base < BATCH_PIDS ? pid_count - base : BATCH_PIDS;
+        int read_count = 0, dir_count = 0;
+
+        for (int i = 0; i < batch; i++) {
+            char path[32];
+            snprintf(path, sizeof(path), "/proc/%d", pids[base + i]);
+            int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dir_fd < 0) continue;
+            dir_fds[dir_count++] = dir_fd;
+
+            for (int f = 0; f < FILE_COUNT; f++) {
+                struct uring_read *read = &reads[read_count];
+                read->dir_fd = dir_fd;
+                read->name = files[f];
+                read->buf = bufs + (size_t)read_count * READ_SIZE;
+                read->len = READ_SIZE;
+                read->owner = NULL;
+                read_count++;
+            }
+        }
+
+        uring_read_batch(reads, read_count, on_read, NULL);
+        for (int i = 0; i < dir_count; i++) close(dir_fds[i]);
+    }
+    return now_seconds() - t0;
+}
+
+int main(int argc, char *argv[]) {
+    int spawn = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            spawn = atoi(optarg);
+        } else {
+            fprintf(stderr, "Usage: %s [-n children]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    pid_t *children = spawn > 0 ? calloc(spawn, sizeof(pid_t)) : NULL;
+    int spawned = children ? spawn_children(spawn, children) : 0;
+
+    int *pids;
+    int pid_count = list_pids(&pids);
+    char *buf = malloc((size_t)BATCH_PIDS * FILE_COUNT * READ_SIZE);
+    if (pid_count < 0 || !buf) {
+        fprintf(stderr, "Failed to list /proc\n");
+        reap_children(children, spawned);
+        return 1;
+    }
+
+    if (!uring_batch_available()) {
+        printf("io_uring unavailable; the batched run measures the syscall fallback\n");
+    }
+
+    double t_sync = 0, t_uring = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        t_sync += run_syscalls(pids, pid_count, buf);
+        t_uring += run_batched(pids, pid_count, buf);
+    }
+
+    printf("SockMap io_uring benchmark: %d pids (%d spawned), %d files each, %d rounds\n",
+           pid_count, spawned, FILE_COUNT, ROUNDS);
+    printf("%-10s %8.1f ms/scan  %6.2f us/pid\n", "syscalls",
+           t_sync / ROUNDS * 1e3, t_sync / ROUNDS / pid_count * 1e6);
+    printf("%-10s %8.1f ms/scan  %6.2f us/pid  (%.2fx)\n", "io_uring",
+           t_uring / ROUNDS * 1e3, t_uring / ROUNDS / pid_count * 1e6, t_sync / t_uring);
+
+    uring_batch_release();
+    reap_children(children, spawned);
+    free(children);
+    free(pids);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,373 @@
+/*
+ * SockMap - Synthetic /proc fixture generator
+ *
+ * Builds a directory the scanner can walk in place of /proc, for
+ * --proc-root and bench_scan: one directory per pid with stat, comm,
+ * status, smaps_rollup, maps and an fd/ of symlinks, plus net/tcp,
+ * tcp6, udp and udp6 listing every socket those fds point at. Sizes are
+ * set on the command line, e.g. -p 10000 -s 500000 for a busy host.
+ * Content is deterministic, so runs against the same fixture compare.
+ * smaps is not generated; --smaps pids find none and report nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FIRST_PID 100
+#define FIRST_INODE 1000000UL
+#define STD_FDS 3
+
+/* Socket rows go to the tables in these proportions, out of 20 */
+static const struct {
+    const char *name;
+    int share;
+    int ipv6;
+    int udp;
+} net_tables[] = {
+    { "tcp",  12, 0, 0 },
+    { "tcp6",  5, 1, 0 },
+    { "udp",   2, 0, 1 },
+    { "udp6",  1, 1, 1 },
+};
+#define NET_TABLE_COUNT (int)(sizeof(net_tables) / sizeof(net_tables[0]))
+
+static const char *names[] = {
+    "nginx", "postgres", "java", "python3", "redis-server", "envoy", "node", "sshd",
+};
+#define NAME_COUNT (int)(sizeof(names) / sizeof(names[0]))
+
+static const char *libraries[] = {
+    "/usr/lib/x86_64-linux-gnu/libc.so.6", "/usr/lib/x86_64-linux-gnu/libm.so.6",
+    "/usr/lib/x86_64-linux-gnu/libssl.so.3", "/usr/lib/x86_64-linux-gnu/libcrypto.so.3",
+    "/usr/lib/x86_64-linux-gnu/libz.so.1", "/usr/lib/x86_64-linux-gnu/ld-linux-x86-64.so.2",
+};
+#define LIBRARY_COUNT (int)(sizeof(libraries) / sizeof(libraries[0]))
+
+/* Non-socket fd targets, cycled through */
+static const char *fd_targets[] = {
+    "/dev/null", "pipe:[%lu]", "anon_inode:[eventfd]", "/var/log/app/%lu.log",
+    "anon_inode:[eventpoll]", "/dev/urandom",
+};
+#define FD_TARGET_COUNT (int)(sizeof(fd_targets) / sizeof(fd_targets[0]))
+
+struct fixture {
+    int pids;
+    int fds;        /* non-socket fds per process, past 0-2 */
+    int vmas;       /* mappings per process */
+    long sockets;   /* rows across the net tables, each held by one process */
+};
+
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (unsigned long)(rng_state >> 16);
+}
+
+static int write_file(int dir_fd, const char *name, const char *data, size_t len) {
+    int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0444);
+    if (fd < 0) return -1;
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return close(fd);
+}
+
+static int write_stat(int pid_fd, int pid, const char *name, unsigned long rss_pages) {
+    char buf[512];
+    unsigned long utime = next_random() % 100000, stime = next_random() % 20000;
+    unsigned long long starttime = 1000 + (unsigned long long)pid * 3;
+    int len = snprintf(buf, sizeof(buf),
+                       "%d (%s) S 1 %d %d 0 -1 4194560 %lu 0 12 0 %lu %lu 0 0 20 0 4 0 %llu "
+                       "%lu %lu 18446744073709551615 1 1 0 0 0 0 0 4096 17663 0 0 0 17 3 0 0 "
+                       "0 0 0 0 0 0 0 0 0 0\n",
+                       pid, name, pid, pid, next_random() % 50000, utime, stime, starttime,
+                       rss_pages * 4096 * 4, rss_pages);
+    return write_file(pid_fd, "stat", buf, (size_t)len);
+}
+
+static int write_status(int pid_fd, int pid, const char *name, unsigned long rss_kb) {
+    char buf[2048];
+    int len = snprintf(buf, sizeof(buf),
+                       "Name:\t%s\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t%d\nNgid:\t0\n"
+                       "Pid:\t%d\nPPid:\t1\nTracerPid:\t0\nUid:\t1000\t1000\t1000\t1000\n"
+                       "Gid:\t1000\t1000\t1000\t1000\nFDSize:\t256\nGroups:\t1000\n"
+                       "NStgid:\t%d\nNSpid:\t%d\nNSpgid:\t%d\nNSsid:\t%d\n"
+                       "VmPeak:\t%8lu kB\nVmSize:\t%8lu kB\nVmLck:\t       0 kB\n"
+                       "VmPin:\t       0 kB\nVmHWM:\t%8lu kB\nVmRSS:\t%8lu kB\n"
+                       "RssAnon:\t%8lu kB\nRssFile:\t%8lu kB\nRssShmem:\t       0 kB\n"
+                       "VmData:\t%8lu kB\nVmStk:\t     132 kB\nVmExe:\t    2048 kB\n"
+                       "VmLib:\t    8192 kB\nVmPTE:\t     256 kB\nVmSwap:\t       0 kB\n"
+                       "HugetlbPages:\t       0 kB\nCoreDumping:\t0\nTHP_enabled:\t1\n"
+                       "Threads:\t4\nSigQ:\t0/63450\nSigPnd:\t0000000000000000\n"
+                       "ShdPnd:\t0000000000000000\nSigBlk:\t0000000000000000\n"
+                       "SigIgn:\t0000000000001000\nSigCgt:\t0000000180004a02\n"
+                       "CapInh:\t0000000000000000\nCapPrm:\t0000000000000000\n"
+                       "CapEff:\t0000000000000000\nCapBnd:\t000001ffffffffff\n"
+                       "CapAmb:\t0000000000000000\nNoNewPrivs:\t0\nSeccomp:\t0\n"
+                       "Speculation_Store_Bypass:\tthread vulnerable\n"
+                       "Cpus_allowed:\tff\nCpus_allowed_list:\t0-7\n"
+                       "Mems_allowed:\t00000001\nMems_allowed_list:\t0\n"
+                       "voluntary_ctxt_switches:\t%lu\nnonvoluntary_ctxt_switches:\t%lu\n",
+                       name, pid, pid, pid, pid, pid, pid,
+                       rss_kb * 5, rss_kb * 4, rss_kb, rss_kb, rss_kb * 3 / 4, rss_kb / 4,
+                       rss_kb * 2, next_random() % 100000, next_random() % 1000);
+    return write_file(pid_fd, "status", buf, (size_t)len);
+}
+
+static int write_smaps_rollup(int pid_fd, unsigned long rss_kb) {
+    char buf[1024];
+    unsigned long anon = rss_kb * 3 / 4;
+    int len = snprintf(buf, sizeof(buf),
+                       "55d0c0000000-7ffd00000000 ---p 00000000 00:00 0                          "
+                       "[rollup]\n"
+                       "Rss:            %8lu kB\nPss:            %8lu kB\n"
+                       "Pss_Dirty:      %8lu kB\nPss_Anon:       %8lu kB\n"
+                       "Pss_File:       %8lu kB\nPss_Shmem:             0 kB\n"
+                       "Shared_Clean:   %8lu kB\nShared_Dirty:          0 kB\n"
+                       "Private_Clean:  %8lu kB\nPrivate_Dirty:  %8lu kB\n"
+                       "Referenced:     %8lu kB\nAnonymous:      %8lu kB\n"
+                       "LazyFree:              0 kB\nAnonHugePages:         0 kB\n"
+                       "ShmemPmdMapped:        0 kB\nFilePmdMapped:         0 kB\n"
+                       "Shared_Hugetlb:        0 kB\nPrivate_Hugetlb:       0 kB\n"
+                       "Swap:                  0 kB\nSwapPss:               0 kB\n"
+                       "Locked:                0 kB\n",
+                       rss_kb, rss_kb * 9 / 10, anon, anon, rss_kb / 4 * 9 / 10,
+                       rss_kb / 8, rss_kb / 8, anon, rss_kb, anon);
+    return write_file(pid_fd, "smaps_rollup", buf, (size_t)len);
+}
+
+/* Executable, libraries, heap, anonymous regions and the stack, in address order */
+static int write_maps(int pid_fd, const struct fixture *fx, const char *name, char *buf,
+                      size_t capacity) {
+    size_t len = 0;
+    unsigned long address = 0x55d0c0000000UL;
+    for (int i = 0; i < fx->vmas && len + 256 < capacity; i++) {
+        unsigned long size = (1 + next_random() % 64) * 4096;
+        const char *perms = "rw-p";
+        const char *path = "";
+        unsigned long inode = 0;
+        char exe[64];
+
+        if (i == fx->vmas - 1) {
+            address = 0x7ffd00000000UL;
+            perms = "rw-p";
+            path = "[stack]";
+        } else if (i < 2) {
+            snprintf(exe, sizeof(exe), "/usr/bin/%s", name);
+            perms = i == 0 ? "r--p" : "r-xp";
+            path = exe;
+            inode = 400000 + (unsigned long)i;
+        } else if (i == 2) {
+            path = "[heap]";
+        } else if (i % 3 == 0) {
+            perms = (i / 3) % 2 ? "r-xp" : "r--p";
+            path = libraries[(i / 3) % LIBRARY_COUNT];
+            inode = 500000 + (unsigned long)(i / 3) % LIBRARY_COUNT;
+            if (address < 0x7f0000000000UL) address = 0x7f0000000000UL;
+        }
+
+        len += (size_t)snprintf(buf + len, capacity - len,
+                                "%012lx-%012lx %s %08lx %s %lu%*s%s\n",
+                                address, address + size, perms, inode ? (unsigned long)i * 4096 : 0,
+                                inode ? "08:01" : "00:00", inode,
+                                *path ? 26 : 0, "", path);
+        address += size + 4096 * (1 + next_random() % 16);
+    }
+    return write_file(pid_fd, "maps", buf, len);
+}
+
+static int write_fds(int pid_fd, const struct fixture *fx, int index) {
+    if (mkdirat(pid_fd, "fd", 0755) != 0) return -1;
+    int fd_dir = openat(pid_fd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd_dir < 0) return -1;
+
+    char name[16], target[64];
+    int fd = 0;
+    int result = 0;
+    for (; fd < STD_FDS + fx->fds && result == 0; fd++) {
+        if (fd < STD_FDS) {
+            snprintf(target, sizeof(target), "/dev/pts/%d", index % 8);
+        } else {
+            snprintf(target, sizeof(target), fd_targets[fd % FD_TARGET_COUNT],
+                     FIRST_INODE / 2 + (unsigned long)index * 64 + (unsigned long)fd);
+        }
+        snprintf(name, sizeof(name), "%d", fd);
+        result = symlinkat(target, fd_dir, name);
+    }
+
+    // Rows index, index + pids, ... are this process's sockets
+    for (long row = index; row < fx->sockets && result == 0; row += fx->pids, fd++) {
+        snprintf(target, sizeof(target), "socket:[%lu]", FIRST_INODE + (unsigned long)row);
+        snprintf(name, sizeof(name), "%d", fd);
+        result = symlinkat(target, fd_dir, name);
+    }
+    close(fd_dir);
+    return result;
+}
+
+static int write_process(int root_fd, const struct fixture *fx, int index, char *buf,
+                         size_t capacity) {
+    int pid = FIRST_PID + index;
+    const char *name = names[index % NAME_COUNT];
+    unsigned long rss_kb = 4096 + next_random() % (256 * 1024);
+    char pid_name[16];
+    snprintf(pid_name, sizeof(pid_name), "%d", pid);
+
+    if (mkdirat(root_fd, pid_name, 0755) != 0) return -1;
+    int pid_fd = openat(root_fd, pid_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (pid_fd < 0) return -1;
+
+    char comm[32];
+    int comm_len = snprintf(comm, sizeof(comm), "%s\n", name);
+    int result = write_stat(pid_fd, pid, name, rss_kb / 4) != 0 ||
+                 write_file(pid_fd, "comm", comm, (size_t)comm_len) != 0 ||
+                 write_status(pid_fd, pid, name, rss_kb) != 0 ||
+                 write_smaps_rollup(pid_fd, rss_kb) != 0 ||
+                 write_maps(pid_fd, fx, name, buf, capacity) != 0 ||
+                 write_fds(pid_fd, fx, index) != 0 ? -1 : 0;
+    close(pid_fd);
+    return result;
+}
+
+static size_t format_address(char *buf, int ipv6, unsigned long host) {
+    if (!ipv6) return (size_t)sprintf(buf, "%08lX", host & 0xffffffffUL);
+    if (host == 0) return (size_t)sprintf(buf, "%032X", 0);
+    // IPv4-mapped ::ffff:a.b.c.d, in the kernel's word order
+    return (size_t)sprintf(buf, "0000000000000000FFFF0000%08lX", host & 0xffffffffUL);
+}
+
+/* One table's rows: listeners on a few ports, the rest connections to them */
+static int write_net_table(int net_fd, int table, long first_row, long rows, char *buf,
+                           size_t capacity) {
+    static const unsigned int states[] = { 0x01, 0x01, 0x01, 0x01, 0x01, 0x06, 0x08, 0x0A };
+    int ipv6 = net_tables[table].ipv6, udp = net_tables[table].udp;
+    int fd = openat(net_fd, net_tables[table].name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0444);
+    if (fd < 0) return -1;
+
+    size_t len = (size_t)snprintf(buf, capacity, "%s",
+                                  udp ? "   sl  local_address rem_address   st tx_queue rx_queue "
+                                        "tr tm->when retrnsmt   uid  timeout inode ref pointer "
+                                        "drops\n"
+                                      : "  sl  local_address rem_address   st tx_queue rx_queue "
+                                        "tr tm->when retrnsmt   uid  timeout inode\n");
+    int result = 0;
+    for (long i = 0; i < rows && result == 0; i++) {
+        long row = first_row + i;
+        unsigned int state = udp ? 0x07 : states[next_random() % 8];
+        unsigned int local_port = state == 0x0A ? 8000 + (unsigned int)(i % 16)
+                                                : 32768 + (unsigned int)(next_random() % 28000);
+        unsigned long remote = state == 0x0A || udp ? 0 : 0x0AUL | (1 + next_random() % 250) << 24;
+        unsigned int remote_port = remote ? 443 : 0;
+        unsigned long tx = next_random() % 16 == 0 ? next_random() % 65536 : 0;
+        unsigned long rx = next_random() % 32 == 0 ? next_random() % 65536 : 0;
+
+        char local_addr[40], remote_addr[40];
+        format_address(local_addr, ipv6, 0x0100007FUL);
+        format_address(remote_addr, ipv6, remote);
+        len += (size_t)snprintf(buf + len, capacity - len,
+                                "%5ld: %s:%04X %s:%04X %02X %08lX:%08lX 00:00000000 00000000 "
+                                "%5u        0 %lu 2 0000000000000000%s\n",
+                                i, local_addr, local_port, remote_addr, remote_port, state, tx, rx,
+                                1000 + (unsigned int)(row % 4), FIRST_INODE + (unsigned long)row,
+                                udp ? " 0" : " 20 4 30 10 -1");
+        if (len + 256 >= capacity) {
+            result = write(fd, buf, len) == (ssize_t)len ? 0 : -1;
+            len = 0;
+        }
+    }
+    if (result == 0 && len > 0 && write(fd, buf, len) != (ssize_t)len) result = -1;
+    return close(fd) != 0 ? -1 : result;
+}
+
+static int write_net(int root_fd, const struct fixture *fx, char *buf, size_t capacity) {
+    if (mkdirat(root_fd, "net", 0755) != 0) return -1;
+    int net_fd = openat(root_fd, "net", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (net_fd < 0) return -1;
+
+    int shares = 0;
+    for (int t = 0; t < NET_TABLE_COUNT; t++) shares += net_tables[t].share;
+
+    long row = 0;
+    int result = 0;
+    for (int t = 0; t < NET_TABLE_COUNT && result == 0; t++) {
+        long rows = t == NET_TABLE_COUNT - 1 ? fx->sockets - row
+                                             : fx->sockets * net_tables[t].share / shares;
+        result = write_net_table(net_fd, t, row, rows, buf, capacity);
+        row += rows;
+    }
+    close(net_fd);
+    return result;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-p pids] [-f fds] [-m vmas] [-s sockets] DIR\n"
+                    "  -p  processes (default 1000)\n"
+                    "  -f  non-socket fds per process, past 0-2 (default 16)\n"
+                    "  -m  mappings per process (default 32)\n"
+                    "  -s  sockets in net/, dealt round-robin to the processes (default 20000)\n"
+                    "DIR must not exist yet.\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    struct fixture fx = { 1000, 16, 32, 20000 };
+    int opt;
+    while ((opt = getopt(argc, argv, "p:f:m:s:")) != -1) {
+        switch (opt) {
+            case 'p': fx.pids = atoi(optarg); break;
+            case 'f': fx.fds = atoi(optarg); break;
+            case 'm': fx.vmas = atoi(optarg); break;
+            case 's': fx.sockets = atol(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || fx.pids <= 0 || fx.fds < 0 || fx.vmas < 1 || fx.sockets < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *root = argv[optind];
+    if (mkdir(root, 0755) != 0) {
+        fprintf(stderr, "%s: %s\n", root, strerror(errno));
+        return 1;
+    }
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    size_t capacity = 1 << 20;
+    char *buf = malloc(capacity);
+    if (root_fd < 0 || !buf) {
+        fprintf(stderr, "%s: %s\n", root, strerror(errno));
+        return 1;
+    }
+
+    int result = 0;
+    for (int i = 0; i < fx.pids && result == 0; i++) {
+        result = write_process(root_fd, &fx, i, buf, capacity);
+    }
+    if (result == 0) result = write_net(root_fd, &fx, buf, capacity);
+    if (result != 0) {
+        fprintf(stderr, "Failed to write fixture under %s: %s\n", root, strerror(errno));
+    } else {
+        printf("Fixture %s: %d pids, %d fds and %d mappings each, %ld sockets\n",
+               root, fx.pids, STD_FDS + fx.fds, fx.vmas, fx.sockets);
+    }
+
+    close(root_fd);
+    free(buf);
+    return result != 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * SockMap - Aggregation engine
+ * Top-K processes and socket group-bys computed over the snapshot columns
+ */
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "sockmap.h"
+
+/* Rows one list holds at most, and so the largest limit anyone may ask for */
+#define AGGREGATE_MAX_LIMIT 100
+#define AGGREGATE_DEFAULT_LIMIT 20
+
+/* Longest group key: an IPv6 endpoint, or a process name cut to fit */
+#define AGGREGATE_KEY_LEN MAX_ADDRESS_LEN
+
+struct json_writer;
+
+/* What --top and /api/top rank processes by */
+enum { TOP_SOCKETS, TOP_RSS, TOP_CLOSE_WAIT, TOP_CPU, TOP_COUNT };
+
+/* What --group-by and /api/groupby group sockets by */
+enum {
+    GROUP_REMOTE, GROUP_REMOTE_ADDRESS, GROUP_LOCAL_PORT, GROUP_PROCESS, GROUP_STATE,
+    GROUP_COUNT
+};
+
+extern const char *const top_metric_names[TOP_COUNT];
+extern const char *const group_key_names[GROUP_COUNT];
+
+/* The metric or key named by the len bytes at name, or -1 */
+int aggregate_top_metric(const char *name, size_t len);
+int aggregate_group_key(const char *name, size_t len);
+
+/* One ranked process, with every metric a list can rank by */
+struct top_entry {
+    pid_t pid;
+    char name[AGGREGATE_KEY_LEN];
+    int sockets;
+    int close_wait;
+    unsigned long rss_kb;
+    double cpu_usage;
+};
+
+struct top_list {
+    int metric;               /* TOP_* */
+    int count;
+    int total;                /* processes ranked */
+    struct top_entry entries[AGGREGATE_MAX_LIMIT];
+};
+
+/* One group's sockets and what they hold queued */
+struct group_entry {
+    char key[AGGREGATE_KEY_LEN];
+    int sockets;
+    unsigned long long rx_queue;
+    unsigned long long tx_queue;
+    unsigned long long memory;
+};
+
+struct group_list {
+    int key;                  /* GROUP_* */
+    int count;
+    int total;                /* groups found */
+    int sockets;              /* sockets grouped */
+    struct group_entry entries[AGGREGATE_MAX_LIMIT];
+};
+
+/*
+ * The limit processes ranking highest by metric, highest first, ties to
+ * the lower pid. One bounded heap pass over the process table, plus one
+ * over the sockets for CLOSE_WAIT counts. limit is capped at
+ * AGGREGATE_MAX_LIMIT. Returns -1 if the scratch cannot grow.
+ */
+int aggregate_top(const struct sockmap_snapshot *snap, int metric, int limit,
+                  struct top_list *list);
+
+/*
+ * Every socket hashed into its group by key, then the limit largest
+ * groups, largest first, ties to the group seen first. Sockets without
+ * an owner group as process "unknown". Returns -1 if the hash table
+ * cannot grow.
+ */
+int aggregate_groups(const struct sockmap_snapshot *snap, int key, int limit,
+                     struct group_list *list);
+
+/*
+ * "by", the totals and a list's first limit rows, as key/value pairs
+ * inside an object the caller opened
+ */
+void output_top_list(const struct top_list *list, int limit, struct json_writer *out);
+void output_group_list(const struct group_list *list, int limit, struct json_writer *out);
+
+/* Free the scratch and the group hash table */
+void aggregate_release(void);
+
+#endif /* AGGREGATE_H */
@@ -0,0 +1,47 @@
+/*
+ * SockMap - Generation arena
+ * Chunked bump allocator backing one scan generation's tables
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+/*
+ * A zeroed struct arena is ready to use. Chunks are kept across
+ * arena_reset(), so once a generation fits in what earlier generations
+ * already allocated, refilling the arena performs no malloc at all.
+ */
+struct arena {
+    struct arena_chunk *head;
+    struct arena_chunk *current;
+};
+
+/* 16-byte aligned, uninitialized; NULL when out of memory */
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_calloc(struct arena *arena, size_t count, size_t size);
+
+/*
+ * Make room for `needed` items in an arena-backed array, doubling its
+ * capacity. The old block is abandoned until the next reset.
+ */
+int arena_grow(struct arena *arena, void **items, int *capacity, int needed, size_t item_size);
+
+/*
+ * The same for a table stored as parallel columns sharing one capacity:
+ * columns[i] points at a column pointer whose items are widths[i] bytes.
+ */
+int arena_grow_columns(struct arena *arena, void **const columns[], const size_t widths[],
+                       int column_count, int *capacity, int needed);
+
+/* Forget every allocation but keep the chunks for the next generation */
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
+
+/* Bytes held in chunks, used or not */
+size_t arena_footprint(const struct arena *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,39 @@
+/*
+ * SockMap - CPU usage sampling
+ * Turns cumulative utime+stime into a percentage across scans
+ */
+
+#ifndef CPU_SAMPLE_H
+#define CPU_SAMPLE_H
+
+#include <sys/types.h>
+
+/*
+ * Scans bracket their samples with cpu_sample_begin() and
+ * cpu_sample_sweep(). Processes are keyed by (pid, starttime), so a
+ * reused pid starts over instead of inheriting its predecessor's ticks.
+ * Call from one thread only.
+ */
+void cpu_sample_begin(void);
+
+/*
+ * Percent of one CPU used since the previous scan that saw this process,
+ * or over its whole lifetime on first sight. Returns -1 only when the
+ * sample table cannot grow, in which case 0 is the caller's best answer.
+ */
+double cpu_sample_percent(pid_t pid, unsigned long long start_time,
+                          unsigned long long cpu_ticks);
+
+/*
+ * Keep a process's last reading through this scan's sweep without taking
+ * a new one, for a process the scan carried over instead of reading
+ */
+void cpu_sample_keep(pid_t pid, unsigned long long start_time);
+
+/* Forget processes not sampled or kept since cpu_sample_begin() */
+void cpu_sample_sweep(void);
+
+/* Free the sample table */
+void cpu_sample_release(void);
+
+#endif /* CPU_SAMPLE_H */
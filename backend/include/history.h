@@ -0,0 +1,63 @@
+/*
+ * SockMap - Per-socket and per-process sample history
+ * Trend-based hung-socket and leak detection across scans
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <sys/types.h>
+#include "sockmap.h"
+
+/* Samples kept per socket and per process; a power of two */
+#define HISTORY_DEPTH 16
+
+/* Entities tracked per table; beyond this new ones are never flagged */
+#define HISTORY_MAX_ENTRIES (1 << 18)
+
+/* Samples a trend needs before it can flag anything */
+#define HISTORY_TREND_SAMPLES 8
+
+/* Detection thresholds */
+#define HISTORY_CLOSE_WAIT_SECONDS 30
+#define HISTORY_RSS_LEAK_KB_PER_SEC 8.0
+#define HISTORY_RSS_LEAK_MIN_KB 1024
+
+/*
+ * Each table's scans bracket their samples with *_begin() and *_sweep(),
+ * like cpu_sample. An entity neither sampled nor kept in a scan is
+ * forgotten at its sweep, so a filtered scan restarts the history of what
+ * it left out.
+ * Recording a sample is O(1), and memory is fixed per entity. Call from
+ * one thread only.
+ */
+void history_sockets_begin(void);
+void history_processes_begin(void);
+
+/*
+ * Record row's sample and return its SOCKET_FLAG_* from the history:
+ * hung after HISTORY_CLOSE_WAIT_SECONDS in CLOSE_WAIT or while a queue
+ * grows across the whole window, leaking while its memory does. Sockets
+ * without an inode are not tracked and get no flags.
+ */
+unsigned char history_socket(const struct socket_table *sockets, int row);
+
+/*
+ * Record a process's RSS and return PROCESS_FLAG_LEAK when its least-squares
+ * slope over the window and its growth across it both exceed the thresholds
+ */
+unsigned char history_process(pid_t pid, unsigned long long start_time, unsigned long rss_kb);
+
+/*
+ * Keep a process's history through this scan's sweep without a sample, for
+ * a process the scan carried over; its window spans the scans that read it
+ */
+void history_process_keep(pid_t pid, unsigned long long start_time);
+
+void history_sockets_sweep(void);
+void history_processes_sweep(void);
+
+/* Free both tables */
+void history_release(void);
+
+#endif /* HISTORY_H */
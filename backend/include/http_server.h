@@ -0,0 +1,26 @@
+/*
+ * SockMap - Embedded HTTP/JSON API
+ * Serves the dashboard's endpoints from the latest in-memory snapshot
+ */
+
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include "sockmap.h"
+
+#define HTTP_DEFAULT_LISTEN "127.0.0.1:5000"
+
+/*
+ * Scan on a background thread on cfg's schedule (scan_schedule.h) and serve
+ * /api/health, /api/trace-sockets, /api/sockets, /api/memory,
+ * /api/processes, /api/top?by=&limit=, /api/groupby?by=&limit= and the
+ * Prometheus exposition at /metrics on
+ * cfg->http_listen ("[ADDR:]PORT") until *running drops to zero, plus
+ * /api/history?from=&to= when cfg->history_path is set. The snapshot
+ * endpoints also take the query options (pid, name, port, protocol, state,
+ * fields, smaps, maps) as parameters, applied to the latest snapshot.
+ * Returns nonzero if the listener could not be set up.
+ */
+int run_http_server(const struct sockmap_config *cfg, volatile int *running);
+
+#endif /* HTTP_SERVER_H */
@@ -0,0 +1,41 @@
+/*
+ * SockMap - Socket ownership index
+ * Maps socket inodes to the process and file descriptor holding them
+ */
+
+#ifndef INODE_INDEX_H
+#define INODE_INDEX_H
+
+#include <sys/types.h>
+#include "sockmap.h"
+#include "arena.h"
+
+/* One socket inode and the first process/fd found holding it */
+struct inode_owner {
+    unsigned long inode;  /* 0 marks an empty slot */
+    pid_t pid;
+    int fd;
+    int proc_slot;        /* index into the scan's process table */
+};
+
+/* Open-addressing hash table keyed by inode, filled once per scan */
+struct inode_index {
+    struct inode_owner *slots;
+    size_t capacity;      /* always a power of two */
+    size_t count;
+    struct arena *arena;  /* slot tables live as long as the generation */
+};
+
+int inode_index_init(struct inode_index *index, struct arena *arena);
+int inode_index_insert(struct inode_index *index, unsigned long inode,
+                       pid_t pid, int fd, int proc_slot);
+const struct inode_owner *inode_index_lookup(const struct inode_index *index,
+                                             unsigned long inode);
+
+/*
+ * Read the fd/ directory under an open /proc/<pid> directory and record
+ * every socket it holds. Returns the process's socket count.
+ */
+int collect_socket_fds(int pid_fd, pid_t pid, int proc_slot, struct inode_index *index);
+
+#endif /* INODE_INDEX_H */
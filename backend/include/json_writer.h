@@ -0,0 +1,61 @@
+/*
+ * SockMap - Buffered JSON writer
+ * Formats straight into reusable chunks and flushes them with writev
+ */
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stddef.h>
+
+#define JSON_CHUNKS 8
+#define JSON_CHUNK_SIZE (256 * 1024)
+#define JSON_MAX_DEPTH 32
+
+/* Alternative destination for flushed bytes; returns -1 on failure */
+typedef int (*json_sink_fn)(void *ctx, const char *data, size_t len);
+
+struct json_writer {
+    int fd;
+    json_sink_fn sink;               /* replaces writes to fd when set */
+    void *sink_ctx;
+    int pretty;                      /* indent two spaces per level */
+    int depth;
+    unsigned int has_items;          /* bit per depth: a value was written there */
+    int after_key;                   /* the next value completes a key/value pair */
+    int error;                       /* sticky; set when a write fails */
+    char *chunks[JSON_CHUNKS];       /* allocated on first use, kept until release */
+    size_t used[JSON_CHUNKS];
+    int current;
+};
+
+/* A writer is reused across documents; its chunks are kept until release */
+void json_writer_init(struct json_writer *w, int fd, int pretty);
+void json_writer_init_sink(struct json_writer *w, json_sink_fn sink, void *ctx, int pretty);
+
+void json_begin_object(struct json_writer *w);
+void json_end_object(struct json_writer *w);
+void json_begin_array(struct json_writer *w);
+void json_end_array(struct json_writer *w);
+void json_key(struct json_writer *w, const char *key);
+
+/* Strings are escaped; invalid UTF-8 becomes U+FFFD */
+void json_string(struct json_writer *w, const char *str);
+void json_uint(struct json_writer *w, unsigned long long value);
+void json_int(struct json_writer *w, long long value);
+void json_fixed2(struct json_writer *w, double value);   /* like "%.2f" */
+void json_hex_string(struct json_writer *w, unsigned long long value);  /* "0x%llx" */
+void json_bool(struct json_writer *w, int value);
+void json_null(struct json_writer *w);
+
+/* End the current line (between documents) */
+void json_newline(struct json_writer *w);
+
+/* Bytes copied as they are, for documents that are not JSON */
+void json_raw(struct json_writer *w, const char *data, size_t len);
+
+/* Write everything buffered; returns -1 if any write since the last flush failed */
+int json_flush(struct json_writer *w);
+void json_writer_release(struct json_writer *w);
+
+#endif /* JSON_WRITER_H */
@@ -0,0 +1,36 @@
+/*
+ * SockMap - Metrics exporter
+ * Snapshots aggregated into Prometheus text-format gauges and counters
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "sockmap.h"
+
+/* Process names that get their own label when no cap is given */
+#define METRICS_DEFAULT_MAX_PROCESSES 50
+
+struct json_writer;
+
+/*
+ * One scan's metrics in the Prometheus text exposition format 0.0.4:
+ * sockets by protocol, state and process, CLOSE_WAIT, hung and leaking
+ * sockets, per-process resident memory, CPU and sockets, and the scan's
+ * own timings. Processes are grouped by name, never by pid; the
+ * max_processes names with the most sockets (then memory) keep their
+ * label and the rest share process="other", so a host's churn cannot
+ * grow the series count. 0 drops the process label altogether. Sockets
+ * without an owner are process="unknown".
+ *
+ * The *_total counters add up every snapshot rendered, so call once per
+ * scan, from one thread. Returns -1, having written nothing, if the
+ * grouping scratch cannot grow.
+ */
+int output_metrics(const struct sockmap_snapshot *snap, int max_processes,
+                   struct json_writer *out);
+
+/* Free the grouping scratch */
+void metrics_release(void);
+
+#endif /* METRICS_H */
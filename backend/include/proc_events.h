@@ -0,0 +1,56 @@
+/*
+ * SockMap - Process tracking from the netlink proc connector
+ * Keeps the live pid set current from fork and exit events between scans
+ */
+
+#ifndef PROC_EVENTS_H
+#define PROC_EVENTS_H
+
+#include <sys/types.h>
+#include "sockmap.h"
+
+struct scan_query;
+
+/* Scans between full /proc listings that reconcile the tracked set */
+#define PROC_EVENTS_RECONCILE_SCANS 60
+
+/* Processes that exited unseen, held for the next scan; more are dropped */
+#define PROC_EVENTS_EXITED_MAX 4096
+
+/* Receive buffer for events queued between scans */
+#define PROC_EVENTS_RCVBUF (4 << 20)
+
+/*
+ * Subscribe to fork, exec, comm and exit events and start the thread
+ * that applies them. Needs CAP_NET_ADMIN and a kernel with
+ * CONFIG_PROC_EVENTS; returns -1 with errno set otherwise, and scans go
+ * on listing /proc. The functions below are for the one thread that
+ * scans.
+ */
+int proc_events_open(void);
+
+/*
+ * The tracked live pids, copied into arena. Returns -1 when a full
+ * /proc listing is due instead: before the first one, once every
+ * PROC_EVENTS_RECONCILE_SCANS scans, and after events were lost to a
+ * full receive buffer. The listing is then handed to
+ * proc_events_reconcile().
+ */
+int proc_events_pids(struct arena *arena, pid_t **pids);
+
+/* Make the tracked set exactly the listed pids */
+int proc_events_reconcile(const pid_t *pids, int count);
+
+/*
+ * Append a row in state 'X' for each process that was forked and exited
+ * since the last listing without ever being walked, then forget them.
+ * Only pid, name and start time are known for these. The query's pid and
+ * name predicates apply; a NULL table just forgets them.
+ */
+int proc_events_take_exited(struct process_table *processes, struct arena *arena,
+                            struct string_pool *strings, const struct scan_query *query);
+
+/* Stop the listener, unsubscribe and free the tracked set */
+void proc_events_release(void);
+
+#endif /* PROC_EVENTS_H */
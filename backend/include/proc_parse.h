@@ -0,0 +1,84 @@
+/*
+ * SockMap - Zero-allocation /proc parser layer
+ * Reads /proc files into a per-thread buffer and scans fields by hand
+ */
+
+#ifndef PROC_PARSE_H
+#define PROC_PARSE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Fields of one /proc/<pid>/maps line; path points into the read buffer */
+struct maps_entry {
+    unsigned long start;
+    unsigned long end;
+    char perms[5];
+    unsigned long offset;
+    unsigned long inode;
+    const char *path;     /* empty string for anonymous mappings */
+    size_t path_len;
+};
+
+/* Fields of /proc/<pid>/stat that the collectors use */
+struct stat_fields {
+    char state;
+    pid_t ppid;
+    unsigned long utime;
+    unsigned long stime;
+    unsigned long long starttime;
+};
+
+/* One row of /proc/net/{tcp,udp}[6] */
+struct net_entry {
+    unsigned char local_addr[16];
+    unsigned int local_port;
+    unsigned char remote_addr[16];
+    unsigned int remote_port;
+    unsigned int state;
+    unsigned long tx_queue;
+    unsigned long rx_queue;
+    unsigned int uid;
+    unsigned long inode;
+};
+
+/*
+ * Read a whole file relative to dir_fd into the calling thread's reusable
+ * buffer. The result is NUL-terminated and stays valid until the same
+ * thread's next proc_read_at() call. Returns NULL if the file is gone.
+ */
+const char *proc_read_at(int dir_fd, const char *name, size_t *len);
+
+/* Release the calling thread's read buffer */
+void proc_parse_release(void);
+
+/*
+ * Directory listing straight from getdents64 into an embedded buffer, so
+ * walking /proc and fd/ allocates nothing (opendir mallocs per call). The
+ * caller owns fd.
+ */
+struct pp_dir {
+    int fd;
+    size_t pos;
+    size_t len;
+    char buf[8192] __attribute__((aligned(8)));
+};
+
+void pp_dir_open(struct pp_dir *dir, int fd);
+/* Next entry name, skipping "." and ".."; NULL at the end or on error */
+const char *pp_dir_next(struct pp_dir *dir, unsigned char *type);
+
+/* Line and field scanning */
+const char *pp_find_eol(const char *p, const char *end);
+const char *pp_find_space(const char *p, const char *end);
+const char *pp_skip_spaces(const char *p, const char *end);
+const char *pp_parse_hex(const char *p, const char *end, unsigned long *out);
+const char *pp_parse_dec(const char *p, const char *end, unsigned long long *out);
+
+/* Format parsers; each returns 0 on success and -1 on a malformed record */
+int pp_parse_maps_line(const char *line, const char *eol, struct maps_entry *entry);
+int pp_parse_stat(const char *buf, size_t len, struct stat_fields *fields);
+int pp_status_value(const char *buf, size_t len, const char *key, unsigned long *value);
+int pp_parse_net_line(const char *line, const char *eol, int words, struct net_entry *entry);
+
+#endif /* PROC_PARSE_H */
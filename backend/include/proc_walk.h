@@ -0,0 +1,74 @@
+/*
+ * SockMap - Single-pass /proc traversal
+ * One collector per pid fills the process, memory and socket-owner tables
+ */
+
+#ifndef PROC_WALK_H
+#define PROC_WALK_H
+
+#include <sys/types.h>
+#include "sockmap.h"
+#include "inode_index.h"
+
+struct pid_batch;
+struct scan_query;
+
+/* Per-pid collectors beyond stat and comm; a query can leave some out */
+#define COLLECT_FDS    0x01    /* socket owners and counts, from fd/ */
+#define COLLECT_MAPS   0x02    /* individual memory mappings */
+#define COLLECT_STATUS 0x04    /* resident set size */
+#define COLLECT_ROLLUP 0x08    /* smaps rollups */
+#define COLLECT_ALL    0x0f
+
+/* Tables filled while walking /proc once, all carved from one arena */
+struct proc_walk {
+    struct arena *arena;
+    const struct scan_query *query;   /* pids and names to walk; NULL for all */
+    unsigned int collect;             /* COLLECT_* */
+    struct process_table processes;
+    struct memory_table memory;
+    struct rollup_table rollups;
+    struct string_pool strings;   /* process names and mapping paths */
+    struct inode_index owners;
+    struct pid_batch *batch; /* io_uring batch state, reused across batches */
+    char *batch_buffer;      /* io_uring read buffers, reused across batches */
+};
+
+/* Tables are presized to the expected counts; 0 leaves them to grow. The
+   walk collects everything unless its query and collect are changed. */
+int proc_walk_init(struct proc_walk *walk, struct arena *arena,
+                   int expected_processes, int expected_memory);
+int walk_processes(const struct sockmap_config *cfg, struct proc_walk *walk);
+
+/*
+ * Streaming walk: called once per collected process with a walk that holds
+ * only that process, its mappings and its socket inodes. Valid until the
+ * callback returns; a nonzero return stops the walk.
+ */
+typedef int (*process_emit_fn)(void *ctx, const struct proc_walk *walk);
+
+/*
+ * Walk proc_root (NULL for PROC_ROOT) one pid at a time, rebuilding
+ * each process's tables in scratch and skipping what query rules out.
+ * The pid list comes from arena. Always sequential: threads and io_uring batches would need many
+ * processes resident at once. Returns the number of processes emitted.
+ */
+int stream_processes(const char *proc_root, struct arena *arena, struct arena *scratch,
+                     const struct scan_query *query, process_emit_fn emit, void *ctx);
+
+/* Free the parallel walkers' scratch arenas */
+void proc_walk_release(void);
+
+/* Per-pid collectors; pid_fd is an open /proc/<pid> directory */
+int collect_process_info(int pid_fd, pid_t pid, int with_status, struct process_info *proc);
+int collect_memory_usage(int pid_fd, pid_t pid, struct proc_walk *walk);
+
+/* Parsers behind the collectors, for callers that read the files themselves */
+void init_process_info(pid_t pid, struct process_info *proc);
+int parse_process_stat(const char *buf, size_t len, struct process_info *proc);
+void parse_process_comm(const char *buf, size_t len, struct process_info *proc);
+void parse_process_status(const char *buf, size_t len, struct process_info *proc);
+int parse_memory_maps(const char *buf, size_t len, pid_t pid, struct proc_walk *walk);
+int parse_memory_rollup(const char *buf, size_t len, pid_t pid, struct proc_walk *walk);
+
+#endif /* PROC_WALK_H */
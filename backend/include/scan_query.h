@@ -0,0 +1,111 @@
+/*
+ * SockMap - Scan queries
+ * Sections, predicates and projection evaluated inside the scanner
+ */
+
+#ifndef SCAN_QUERY_H
+#define SCAN_QUERY_H
+
+#include <sys/types.h>
+#include "sockmap.h"
+
+/* Output sections */
+#define QUERY_SOCKETS   0x01
+#define QUERY_MEMORY    0x02
+#define QUERY_PROCESSES 0x04
+#define QUERY_ALL       0x07
+
+#define QUERY_MAX_TERMS 16
+#define QUERY_NAME_LEN 16          /* comm is at most 15 bytes */
+
+/*
+ * Terms of one kind are ORed, kinds are ANDed. Pid and name predicates
+ * select processes, so they also limit mappings and sockets to those
+ * processes; protocol, state and port predicates select sockets only.
+ * A port matches either end of a socket.
+ *
+ * The memory section is per-process rollups. Individual mappings are
+ * collected only when maps is set, and output a page at a time; per-type
+ * rollups cost a full smaps read and are taken only for smaps pids.
+ */
+struct scan_query {
+    unsigned int sections;         /* QUERY_* sections collected and output */
+    int pid_count;
+    pid_t pids[QUERY_MAX_TERMS];
+    int name_count;
+    char names[QUERY_MAX_TERMS][QUERY_NAME_LEN];
+    int port_count;
+    unsigned short ports[QUERY_MAX_TERMS];
+    unsigned int protocols;        /* 1 << SOCKET_PROTO_*, 0 for any */
+    unsigned int states;           /* 1 << SOCKET_STATE_*, 0 for any */
+    int maps;                      /* collect and output individual mappings */
+    int map_offset;                /* page of mappings output */
+    int map_limit;                 /* 0 for all */
+    int smaps_count;
+    pid_t smaps[QUERY_MAX_TERMS];  /* pids rolled up per mapping type */
+    unsigned int socket_fields;    /* projections: 1 << *_FIELD_* */
+    unsigned int memory_fields;
+    unsigned int rollup_fields;
+    unsigned int process_fields;
+};
+
+/* Everything: all sections, no predicates, every field */
+void scan_query_init(struct scan_query *query);
+
+/*
+ * Add a comma-separated list of terms for option "pid", "name", "port",
+ * "protocol", "state", "smaps" or "fields", or for "maps" an optional
+ * "OFFSET:LIMIT" page. Returns -1 for an unknown option, a malformed or
+ * unknown term, or more than QUERY_MAX_TERMS terms.
+ */
+int scan_query_add(struct scan_query *query, const char *option, const char *terms);
+
+/* Value of name= in the URL query string [query, end), or NULL */
+const char *scan_query_param(const char *query, const char *end, const char *name);
+
+/*
+ * A URL query string's options, percent-decoded and parsed as the command
+ * line's are. What the URL leaves out, projection and mappings, comes from
+ * base, the command line's query (NULL for everything); its predicates
+ * are already applied to the snapshot. Returns the number of options
+ * given, or -1 with *bad naming the one that did not parse. *fresh_memory
+ * is set when mappings or smaps types must be read for the request.
+ */
+int scan_query_parse_params(const struct scan_query *base, const char *query, const char *end,
+                            struct scan_query *out, int *fresh_memory, const char **bad);
+
+int query_wants_pid(const struct scan_query *query, pid_t pid);
+int query_wants_name(const struct scan_query *query, const char *name);
+int query_wants_socket(const struct scan_query *query, const struct socket_info *socket);
+int query_wants_smaps(const struct scan_query *query, pid_t pid);
+
+/* NULL queries mean everything, so callers need not check */
+static inline int query_section(const struct scan_query *query, unsigned int section) {
+    return !query || (query->sections & section);
+}
+
+static inline int query_wants_maps(const struct scan_query *query) {
+    return query && query->maps;
+}
+
+static inline int query_selects_processes(const struct scan_query *query) {
+    return query && (query->pid_count > 0 || query->name_count > 0);
+}
+
+static inline unsigned int query_socket_fields(const struct scan_query *query) {
+    return query ? query->socket_fields : FIELDS_ALL;
+}
+
+static inline unsigned int query_memory_fields(const struct scan_query *query) {
+    return query ? query->memory_fields : FIELDS_ALL;
+}
+
+static inline unsigned int query_rollup_fields(const struct scan_query *query) {
+    return query ? query->rollup_fields : FIELDS_ALL;
+}
+
+static inline unsigned int query_process_fields(const struct scan_query *query) {
+    return query ? query->process_fields : FIELDS_ALL;
+}
+
+#endif /* SCAN_QUERY_H */
@@ -0,0 +1,59 @@
+/*
+ * SockMap - Scan scheduling
+ * Per-collector cadences on timerfd deadlines, held to a CPU budget
+ */
+
+#ifndef SCAN_SCHEDULE_H
+#define SCAN_SCHEDULE_H
+
+#include <stdint.h>
+#include "sockmap.h"
+
+/* Collectors with a cadence of their own; each refreshes one QUERY_* section */
+enum { SCHEDULE_SOCKETS, SCHEDULE_PROCESSES, SCHEDULE_MEMORY, SCHEDULE_COUNT };
+
+/*
+ * Deadlines sit on a fixed grid per collector on CLOCK_MONOTONIC, so
+ * ticks do not drift by however long a scan took; a tick that falls
+ * behind skips to the next grid point instead of running twice.
+ *
+ * The budget is a share of one core for everything the monitor does,
+ * measured as the process's own CPU time. It accrues with wall time and
+ * each tick spends what it used. Savings are capped at one longest
+ * interval's worth, so a slow memory scan can be paid for but idle time
+ * is never banked for a burst. While the budget is in debt, the next
+ * tick waits until it is repaid, which stretches every cadence on a host
+ * too large to scan at the configured ones.
+ */
+struct scan_schedule {
+    int timer_fd;                          /* -1 when nothing runs again (-i 0) */
+    uint64_t interval_ns[SCHEDULE_COUNT];  /* 0 for a collector that is not needed */
+    uint64_t due_ns[SCHEDULE_COUNT];
+    double budget;                         /* CPU seconds per second; 0 for no limit */
+    int64_t credit_ns;                     /* negative while in debt */
+    int64_t credit_max_ns;
+    uint64_t charged_at_ns;                /* when credit was last brought up to date */
+    uint64_t charged_cpu_ns;               /* CPU time used by then */
+    uint64_t deferred_ns;                  /* ticks held back by the budget, in total */
+};
+
+/*
+ * Cadences from cfg: socket_interval, process_interval and
+ * memory_interval, each falling back to scan_interval, and cpu_budget.
+ * Collectors for sections the query leaves out are not scheduled. The
+ * first deadlines are one interval from now, after the initial full
+ * scan. Returns -1 if the timerfd cannot be created.
+ */
+int scan_schedule_init(struct scan_schedule *schedule, const struct sockmap_config *cfg);
+
+/*
+ * Charge the CPU used since the last call, then block until the next
+ * collector is due and the budget allows it. Returns the QUERY_*
+ * sections due, 0 if a signal or wake_fd (-1 for none) becomes readable
+ * first, or -1 on error. wake_fd is left for the caller to drain.
+ */
+int scan_schedule_wait(struct scan_schedule *schedule, int wake_fd);
+
+void scan_schedule_close(struct scan_schedule *schedule);
+
+#endif /* SCAN_SCHEDULE_H */
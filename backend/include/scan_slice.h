@@ -0,0 +1,50 @@
+/*
+ * SockMap - Sliced /proc walks
+ * A bounded slice of the pid listing per scan, from a cursor kept across scans
+ */
+
+#ifndef SCAN_SLICE_H
+#define SCAN_SLICE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "sockmap.h"
+
+/* Pids a time-budgeted slice walks before it has measured a walk */
+#define SLICE_INITIAL_PIDS 64
+
+/* Of each slice, 1/SLICE_HOT_SHARE at most revisits hot processes */
+#define SLICE_HOT_SHARE 4
+
+/* A process is hot with this many sockets, or using this much CPU */
+#define SLICE_HOT_SOCKETS 8
+#define SLICE_HOT_CPU_PERCENT 1.0
+
+/* Whether cfg asks for sliced walks at all */
+int scan_slice_enabled(const struct sockmap_config *cfg);
+
+/*
+ * Sort the listed pids and choose the ones this scan walks, into arena,
+ * sorted: cfg->slice_pids of them at most, and no more than the last
+ * walks' pace fits into cfg->slice_ms. Up to one slice in
+ * SLICE_HOT_SHARE goes to the hot processes in prev (NULL for none)
+ * that were walked longest ago; the rest continues round the listing
+ * from where the previous slice stopped. Returns the slice's length, or
+ * -1 on allocation failure; *hot is how many of those were hot.
+ */
+int scan_slice_select(const struct sockmap_config *cfg, pid_t *pids, int count,
+                      const struct process_table *prev, struct arena *arena, pid_t **slice,
+                      int *hot);
+
+/*
+ * Record a slice walked in elapsed_ns, and return the percentage of the
+ * listed pids walked in this slice or an earlier one since they were
+ * last listed. Both lists are sorted. Returns -1 on allocation failure.
+ */
+double scan_slice_done(const pid_t *pids, int count, const pid_t *slice, int slice_count,
+                       uint64_t elapsed_ns);
+
+/* Forget the cursor and the walked set */
+void scan_slice_release(void);
+
+#endif /* SCAN_SLICE_H */
@@ -0,0 +1,92 @@
+/*
+ * SockMap - Scan self-instrumentation
+ * Per-phase timers and I/O counters for each scan, kept per thread
+ */
+
+#ifndef SCAN_STATS_H
+#define SCAN_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+struct arena;
+struct json_writer;
+
+/* make STATS=0 defines SOCKMAP_NO_STATS, which compiles the counters out */
+#ifdef SOCKMAP_NO_STATS
+#define SCAN_STATS_ENABLED 0
+#else
+#define SCAN_STATS_ENABLED 1
+#endif
+
+enum scan_phase {
+    SCAN_PHASE_SOCKETS,   /* sock_diag dumps or the net/ tables */
+    SCAN_PHASE_FDS,       /* fd/ walks resolving socket owners */
+    SCAN_PHASE_MAPS,      /* smaps_rollup, smaps and maps */
+    SCAN_PHASE_STAT,      /* stat, comm and status */
+    SCAN_PHASE_OUTPUT,    /* serializing the previous scan, which happens between scans */
+    SCAN_PHASE_COUNT
+};
+
+/* "sockets", "fds", "maps", "stat", "output" */
+extern const char *const scan_phase_names[SCAN_PHASE_COUNT];
+
+struct scan_counters {
+    uint64_t phase_ns[SCAN_PHASE_COUNT];
+    uint64_t files_opened;    /* files and directories, including io_uring opens */
+    uint64_t bytes_read;
+    uint64_t parse_errors;    /* stat, maps and net/ lines that did not parse */
+    uint64_t pids_vanished;   /* listed, then gone before their stat was read */
+};
+
+/*
+ * One scan's totals. Phase times are summed over the threads that ran
+ * them, so with --threads they can add up to more than duration_ns;
+ * with --io-uring, stat and maps time only the parsing of batched reads.
+ */
+struct scan_stats {
+    struct scan_counters counters;
+    uint64_t duration_ns;     /* wall clock from scan_stats_begin() */
+    size_t arena_bytes;       /* snapshot arena after the scan */
+    size_t arena_peak_bytes;  /* most any scan's arena has held */
+    long peak_rss_kb;         /* the process's high-water mark */
+};
+
+/* CLOCK_MONOTONIC in ns; left in with stats compiled out, for slice pacing */
+static inline uint64_t scan_stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#if SCAN_STATS_ENABLED
+extern __thread struct scan_counters scan_counters_local;
+
+/* Hot-loop hooks; each is a thread-local add or a vDSO clock read */
+#define SCAN_STAT_ADD(counter, n) (scan_counters_local.counter += (n))
+#define SCAN_STAT_START(var) uint64_t var = scan_stats_now()
+#define SCAN_STAT_STOP(phase, var) \
+    (scan_counters_local.phase_ns[phase] += scan_stats_now() - (var))
+#else
+#define SCAN_STAT_ADD(counter, n) ((void)0)
+#define SCAN_STAT_START(var) ((void)0)
+#define SCAN_STAT_STOP(phase, var) ((void)0)
+#endif
+
+/*
+ * Bracket one scan on the thread that runs it. begin zeroes every
+ * counter but the output time this thread recorded since the last scan;
+ * end folds in this thread's counters and fills stats.
+ */
+void scan_stats_begin(void);
+void scan_stats_end(const struct arena *arena, struct scan_stats *stats);
+
+/* Fold the calling thread's counters into the scan's; for workers before they exit */
+void scan_stats_flush(void);
+
+/* {"duration_ms":...,"phases_ms":{...},...} as the value of a key the caller wrote */
+void output_scan_stats(const struct scan_stats *stats, struct json_writer *out);
+void print_scan_stats(const struct scan_stats *stats);
+
+#endif /* SCAN_STATS_H */
@@ -0,0 +1,38 @@
+/*
+ * SockMap - Streaming scan-to-output pipeline
+ * Writes newline-delimited records as each process is collected
+ */
+
+#ifndef SCAN_STREAM_H
+#define SCAN_STREAM_H
+
+#include "sockmap.h"
+#include "arena.h"
+
+struct json_writer;
+
+/*
+ * Memory kept across streamed scans. Only sockets, the pid list and the
+ * set of claimed socket inodes are host-wide; mappings and strings are
+ * collected one process at a time in scratch.
+ */
+struct scan_stream {
+    struct arena arena;
+    struct arena scratch;
+};
+
+/*
+ * Scan once, writing one JSON object per line:
+ *   {"record":"scan","timestamp":...}
+ *   {"record":"process",...} followed by its memory and socket records
+ *   {"record":"socket",...} for sockets no process was found holding
+ *   {"record":"end","timestamp":...,"processes":N,"sockets":N,"mappings":N,
+ *    "scan_stats":{...}}
+ * Records carry the same fields as the JSON document's arrays; the
+ * discriminator is "record" because memory rows already have a "type".
+ */
+int stream_scan(const struct sockmap_config *cfg, struct scan_stream *stream,
+                struct json_writer *out);
+void free_scan_stream(struct scan_stream *stream);
+
+#endif /* SCAN_STREAM_H */
@@ -0,0 +1,37 @@
+/*
+ * SockMap - Shared-memory snapshot publisher
+ * Daemon side of the region described in shm_snapshot.h
+ */
+
+#ifndef SHM_PUBLISH_H
+#define SHM_PUBLISH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "shm_snapshot.h"
+
+struct shm_publisher {
+    char path[256];
+    struct shm_header *header;
+    size_t map_size;
+    int slot;                 /* slot being written between begin and commit */
+    uint64_t length;          /* bytes written since begin */
+    uint64_t sequence;        /* snapshots published so far */
+    char *spill;              /* bytes past the slot's capacity, until the region grows */
+    size_t spill_capacity;
+};
+
+/* Create a region at path, retiring whatever region was there before */
+int shm_publisher_open(struct shm_publisher *pub, const char *path, size_t slot_capacity);
+
+/* A publish is begin, any number of writes, then commit */
+void shm_publish_begin(struct shm_publisher *pub);
+int shm_publish_write(void *pub, const char *data, size_t len);   /* a json_sink_fn */
+
+/* Make the snapshot visible; grows the region first if it did not fit */
+int shm_publish_commit(struct shm_publisher *pub, int64_t timestamp);
+
+/* Retire and unlink the region so readers stop trusting it */
+void shm_publisher_close(struct shm_publisher *pub);
+
+#endif /* SHM_PUBLISH_H */
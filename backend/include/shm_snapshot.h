@@ -0,0 +1,75 @@
+/*
+ * SockMap - Shared-memory snapshot region
+ * Layout published by `sockmap --daemon` and the reader library for it
+ */
+
+#ifndef SHM_SNAPSHOT_H
+#define SHM_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHM_SNAPSHOT_PATH "/dev/shm/sockmap"
+#define SHM_SNAPSHOT_MAGIC 0x504d4b53u    /* "SKMP" little-endian */
+#define SHM_SNAPSHOT_VERSION 1
+#define SHM_DATA_OFFSET 4096
+
+/*
+ * One of two snapshot buffers. seq is odd while the daemon is writing
+ * the slot and advances by two per publish, so a reader that sees the
+ * same even seq before and after copying has a consistent snapshot.
+ */
+struct shm_slot {
+    uint64_t seq;
+    uint64_t length;          /* bytes of JSON in the slot */
+    int64_t timestamp;        /* scan time, seconds since the epoch */
+    uint64_t sequence;        /* publish count when written, from 1 */
+};
+
+/*
+ * The region is one file: this header, then two slots of slot_capacity
+ * bytes each starting at SHM_DATA_OFFSET. The daemon writes the slot
+ * readers are not pointed at and then flips current, so readers only
+ * retry when the writer laps them. A region never grows in place: a
+ * larger one is renamed over the path and the old one marked retired,
+ * which tells readers to map the path again.
+ */
+struct shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t region_size;
+    uint64_t slot_capacity;
+    uint32_t retired;
+    uint32_t current;         /* slot holding the latest snapshot */
+    pid_t writer_pid;
+    uint32_t reserved;
+    struct shm_slot slots[2];
+};
+
+struct shm_snapshot_info {
+    int64_t timestamp;
+    uint64_t sequence;
+};
+
+struct shm_reader {
+    char path[256];
+    const unsigned char *map;
+    size_t map_size;
+};
+
+/* Map the region at path (SHM_SNAPSHOT_PATH when NULL); -1 if absent */
+int shm_reader_open(struct shm_reader *reader, const char *path);
+
+/*
+ * Copy the latest consistent snapshot into buf without locking or, unless
+ * the daemon replaced the region, any syscall. Returns its length; when
+ * that exceeds len nothing usable was copied and the caller should retry
+ * with a larger buffer. Returns 0 before the first publish, -1 on error.
+ */
+ssize_t shm_reader_read(struct shm_reader *reader, char *buf, size_t len,
+                        struct shm_snapshot_info *info);
+
+void shm_reader_close(struct shm_reader *reader);
+
+#endif /* SHM_SNAPSHOT_H */
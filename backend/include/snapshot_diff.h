@@ -0,0 +1,71 @@
+/*
+ * SockMap - Snapshot deltas
+ * Rows added, changed and removed between two scans, by stable key
+ */
+
+#ifndef SNAPSHOT_DIFF_H
+#define SNAPSHOT_DIFF_H
+
+#include "sockmap.h"
+
+/*
+ * Rows are identified across scans by keys that survive reordering and
+ * pid reuse: a socket by its inode (by its address tuple when it has none,
+ * as in TIME_WAIT), a process by (pid, starttime), a mapping by
+ * (pid, start address) and a rollup by (pid, type). Every row written
+ * here carries its key as a "key" string ahead of the usual fields.
+ */
+
+/* {"sequence":N,"timestamp":T,"sockets":[...],"memory":[...],"memory_rollup":[...],
+    "processes":[...]} */
+void output_keyed_snapshot(const struct sockmap_snapshot *snap, unsigned long long sequence,
+                           struct json_writer *out);
+
+/*
+ * {"sequence":N,"base":N-1,"timestamp":T,"sockets":{"added":[...],
+ * "changed":[...],"removed":[keys]},"memory":{...},"memory_rollup":{...},"processes":{...}}
+ * Changed rows are written whole. Returns -1, having written nothing, if
+ * the key index cannot grow. Call from one thread only.
+ */
+int output_snapshot_delta(const struct sockmap_snapshot *prev, const struct sockmap_snapshot *cur,
+                          unsigned long long sequence, struct json_writer *out);
+
+/* Tables in the order snapshots and deltas list them */
+enum { DIFF_SOCKETS, DIFF_MEMORY, DIFF_ROLLUPS, DIFF_PROCESSES, DIFF_TABLE_COUNT };
+
+/* A row's key as two integers, for consumers that store it rather than print it */
+struct row_key {
+    unsigned long long high;
+    unsigned long long low;
+};
+
+struct row_key snapshot_row_key(int table, const struct sockmap_snapshot *snap, int row);
+const char *snapshot_table_name(int table);
+
+/* One row of a snapshot or delta: {"key":"...",<fields>} */
+void output_keyed_row(int table, const struct sockmap_snapshot *snap, int row,
+                      struct json_writer *out);
+
+/* A removed row's key as a delta lists it */
+void output_row_key(int table, struct row_key key, struct json_writer *out);
+
+/* How a row differs: added and changed rows belong to cur, removed ones to prev */
+enum { DIFF_ADDED = 1, DIFF_CHANGED, DIFF_REMOVED };
+
+/* A nonzero return stops the diff */
+typedef int (*diff_row_fn)(void *ctx, int table, int change, const struct sockmap_snapshot *snap,
+                           int row, struct row_key key);
+
+/*
+ * The rows of the tables in table_mask (1 << DIFF_*) that differ between
+ * prev and cur, one call each, by the same rules as output_snapshot_delta.
+ * Returns -1 if the key index cannot grow or fn stopped the diff. Shares
+ * the key index with output_snapshot_delta, so the same thread only.
+ */
+int snapshot_diff_rows(const struct sockmap_snapshot *prev, const struct sockmap_snapshot *cur,
+                       unsigned int table_mask, diff_row_fn fn, void *ctx);
+
+/* Free the key index */
+void snapshot_diff_release(void);
+
+#endif /* SNAPSHOT_DIFF_H */
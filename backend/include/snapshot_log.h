@@ -0,0 +1,101 @@
+/*
+ * SockMap - On-disk snapshot history
+ * A fixed-size, memory-mapped log of binary snapshots with a time index
+ */
+
+#ifndef SNAPSHOT_LOG_H
+#define SNAPSHOT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "sockmap.h"
+
+#define SNAPSHOT_LOG_PATH "/var/tmp/sockmap.history"
+#define SNAPSHOT_LOG_DEFAULT_SIZE (64UL << 20)
+#define SNAPSHOT_LOG_MAGIC 0x4c484d53   /* "SMHL" */
+#define SNAPSHOT_LOG_VERSION 1
+
+/* Longest run of deltas between keyframes, which bounds a read's replay */
+#define SNAPSHOT_LOG_KEYFRAME_MAX 300
+/* Deltas one history query returns at most; the rest are left for the next */
+#define SNAPSHOT_LOG_QUERY_MAX 600
+
+/*
+ * File layout: this header, then a ring of index entries, then a ring of
+ * records. Records are numbered from 0 for the life of the file, and
+ * record n's index entry is slot n % index_capacity. Each record is a
+ * keyframe holding every row of the sockets, memory_rollup and processes
+ * tables, or a delta holding the rows added, changed or removed since
+ * the record before it. Mappings are not kept.
+ *
+ * The writer evicts whole keyframe groups from the old end, so record
+ * `first` is always a keyframe and every kept delta can be replayed. It
+ * moves `first` forward before overwriting anything and `next` forward
+ * only after the new record and its index entry are in place. A reader
+ * copies what it needs and then checks that `first` has not passed it.
+ */
+struct snapshot_log_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t file_size;
+    uint64_t index_offset;
+    uint64_t index_capacity;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t first;           /* oldest record kept, always a keyframe */
+    uint64_t next;            /* number the next record gets */
+    uint64_t write_pos;       /* data offset just past the newest record */
+};
+
+enum { SNAPSHOT_LOG_KEYFRAME = 1, SNAPSHOT_LOG_DELTA };
+
+struct snapshot_log_entry {
+    int64_t timestamp;
+    uint64_t offset;          /* into the data ring */
+    uint32_t length;
+    uint32_t kind;            /* SNAPSHOT_LOG_KEYFRAME or SNAPSHOT_LOG_DELTA */
+};
+
+/* Writer side; one per file */
+struct snapshot_log {
+    int fd;
+    struct snapshot_log_header *header;
+    size_t map_size;
+    char *staging;            /* the record being encoded */
+    size_t staging_len;
+    size_t staging_capacity;
+    uint64_t keyframe_bytes;  /* size of the last keyframe */
+    uint64_t delta_bytes;     /* written since it */
+    unsigned int deltas;      /* records since it */
+    int need_keyframe;
+};
+
+/*
+ * Open the log at path, keeping its records if it has the same size, or
+ * create it at size bytes. Returns -1 with errno set on failure.
+ */
+int snapshot_log_open(struct snapshot_log *log, const char *path, size_t size);
+
+/*
+ * Record cur. prev must be the snapshot recorded last, or NULL to write a
+ * keyframe. Costs a diff and a copy of what changed, plus a full copy on
+ * keyframes, which come once the deltas since the last one outweigh it.
+ * A failed append makes the next one a keyframe.
+ */
+int snapshot_log_append(struct snapshot_log *log, const struct sockmap_snapshot *prev,
+                        const struct sockmap_snapshot *cur);
+
+void snapshot_log_close(struct snapshot_log *log);
+
+/*
+ * Write the history between from and to, inclusive, as
+ * {"from":F,"to":T,"oldest":T0,"snapshot":{...},"deltas":[...],"truncated":B}.
+ * "snapshot" is the state as of from (or the first record after it) in
+ * output_keyed_snapshot form, null if nothing was recorded in range, and
+ * "deltas" continue it in output_snapshot_delta form. Only the index and
+ * the records replayed are read. Returns -1 if the log cannot be read.
+ */
+int snapshot_log_query(const char *path, time_t from, time_t to, struct json_writer *out);
+
+#endif /* SNAPSHOT_LOG_H */
@@ -0,0 +1,34 @@
+/*
+ * SockMap - Snapshot views
+ * A query's predicates applied to a snapshot already taken
+ */
+
+#ifndef SNAPSHOT_VIEW_H
+#define SNAPSHOT_VIEW_H
+
+#include "sockmap.h"
+#include "scan_query.h"
+
+/*
+ * The rows of snap that a scan with query's predicates would have kept,
+ * as a snapshot of their own in view's arena: matching processes, the
+ * sockets matching the socket predicates (and held by a matching process
+ * if there are pid or name terms), and those processes' memory rows.
+ * Socket owners are renumbered to view's process rows, and process names
+ * are copied into view's own pool, so view stays valid once snap is
+ * refilled. Returns -1 when view's arena is exhausted.
+ */
+int snapshot_view(const struct sockmap_snapshot *snap, const struct scan_query *query,
+                  struct sockmap_snapshot *view);
+
+/*
+ * Replace view's memory with a fresh read of its processes under
+ * proc_root (NULL for PROC_ROOT): rollups, per-type rollups for query's
+ * smaps pids, and the mappings if query asks for maps. Reads files for
+ * every process view holds, so callers bound that first. Returns -1 when
+ * the arena is exhausted.
+ */
+int snapshot_view_memory(const char *proc_root, const struct scan_query *query,
+                         struct sockmap_snapshot *view);
+
+#endif /* SNAPSHOT_VIEW_H */
@@ -0,0 +1,22 @@
+/*
+ * SockMap - Netlink sock_diag socket enumeration
+ */
+
+#ifndef SOCK_DIAG_H
+#define SOCK_DIAG_H
+
+#include "sockmap.h"
+
+/* Called once per socket; a non-zero return aborts the dump */
+typedef int (*socket_emit_fn)(void *ctx, struct socket_info *socket);
+
+/*
+ * Dump the sockets of one address family and protocol (IPPROTO_TCP or
+ * IPPROTO_UDP) through NETLINK_SOCK_DIAG. The kernel skips sockets whose
+ * state's bit (1 << SOCKET_STATE_*) is clear in states. Returns the number
+ * of sockets emitted, or -1 if the kernel cannot serve this family/protocol.
+ */
+int sock_diag_dump(int family, int protocol, unsigned int states,
+                   socket_emit_fn emit, void *ctx);
+
+#endif /* SOCK_DIAG_H */
@@ -8,62 +8,235 @@
 
 #include <sys/types.h>
 #include <time.h>
+#include "arena.h"
+#include "string_pool.h"
+#include "scan_stats.h"
 
 /* Maximum string lengths */
 #define MAX_PROCESS_NAME 256
 #define MAX_ADDRESS_LEN 64
-#define MAX_STATE_LEN 32
-#define MAX_PROTOCOL_LEN 8
 #define MAX_PERMISSIONS_LEN 8
-#define MAX_TYPE_LEN 16
-#define MAX_STATUS_LEN 16
+
+/* procfs scanned unless the config names another, e.g. a generated fixture */
+#define PROC_ROOT "/proc"
 
 /* Output formats */
 typedef enum {
     OUTPUT_JSON,
-    OUTPUT_TABLE
+    OUTPUT_TABLE,
+    OUTPUT_STREAM,  /* newline-delimited records, written per process */
+    OUTPUT_METRICS  /* aggregated gauges in the Prometheus text format */
 } output_format_t;
 
+/* Socket enumeration backends */
+typedef enum {
+    SOCKET_BACKEND_NETLINK,  /* NETLINK_SOCK_DIAG, falls back per table */
+    SOCKET_BACKEND_PROCFS    /* /proc/net/{tcp,udp}[6] text tables */
+} socket_backend_t;
+
+struct scan_query;
+
 /* Configuration structure */
 struct sockmap_config {
     output_format_t output_format;
+    socket_backend_t socket_backend;
     int scan_interval;
+    int socket_interval;     /* seconds between collector runs; 0 follows scan_interval */
+    int process_interval;
+    int memory_interval;
+    double cpu_budget;       /* percent of one core the monitor may use; 0 for no limit */
+    int slice_pids;          /* pids one walk visits at most; 0 walks them all */
+    int slice_ms;            /* milliseconds one walk may take, paced by pid count; 0 for any */
+    int threads;             /* /proc walker threads; 1 scans inline */
+    int io_uring;            /* batch per-pid file reads through io_uring */
+    int proc_events;         /* track processes from the proc connector between listings */
+    const char *proc_root;   /* procfs to walk; NULL for PROC_ROOT */
+    int pretty;              /* indent JSON output */
+    const char *shm_path;    /* --daemon: publish snapshots here instead of printing */
+    const char *http_listen; /* --serve: "[ADDR:]PORT" of the built-in API server */
+    const char *history_path; /* --history: record every scan to this log */
+    size_t history_size;     /* bytes the history log keeps */
+    const struct scan_query *query; /* what to collect and output; NULL for everything */
+    int metrics_max_processes; /* process names labelled in metrics; 0 drops the label */
+    int top_metric;          /* --top: TOP_* (aggregate.h) to rank processes by */
+    int top_limit;           /* processes --top lists; 0 for no --top */
+    int group_key;           /* --group-by: GROUP_* to group sockets by */
+    int group_limit;         /* groups --group-by lists; 0 for no --group-by */
     int verbose;
 };
 
-/* Socket information structure */
+/* Transport protocols */
+typedef enum {
+    SOCKET_PROTO_TCP,
+    SOCKET_PROTO_UDP
+} socket_protocol_t;
+
+/* Socket states, numbered like the kernel's TCP_* states */
+typedef enum {
+    SOCKET_STATE_UNKNOWN = 0,
+    SOCKET_STATE_ESTABLISHED,
+    SOCKET_STATE_SYN_SENT,
+    SOCKET_STATE_SYN_RECV,
+    SOCKET_STATE_FIN_WAIT1,
+    SOCKET_STATE_FIN_WAIT2,
+    SOCKET_STATE_TIME_WAIT,
+    SOCKET_STATE_CLOSE,
+    SOCKET_STATE_CLOSE_WAIT,
+    SOCKET_STATE_LAST_ACK,
+    SOCKET_STATE_LISTEN,
+    SOCKET_STATE_CLOSING,
+    SOCKET_STATE_NEW_SYN_RECV
+} socket_state_t;
+
+/* Socket row flags, from the trends in history.h */
+#define SOCKET_FLAG_HUNG 0x01
+#define SOCKET_FLAG_LEAK 0x02
+
+/* Process row flags */
+#define PROCESS_FLAG_LEAK 0x01
+
+/* Binary address in network byte order; IPv4 uses the first 4 bytes */
+struct socket_endpoint {
+    unsigned char addr[16];
+    unsigned short port;
+};
+
+/* One socket as a backend reports it, before it is added to the table */
 struct socket_info {
-    pid_t pid;
-    char process_name[MAX_PROCESS_NAME];
-    char local_address[MAX_ADDRESS_LEN];
-    char remote_address[MAX_ADDRESS_LEN];
-    char state[MAX_STATE_LEN];
-    char protocol[MAX_PROTOCOL_LEN];
+    unsigned char family;     /* AF_INET or AF_INET6 */
+    unsigned char protocol;   /* socket_protocol_t */
+    unsigned char state;      /* socket_state_t */
+    struct socket_endpoint local;
+    struct socket_endpoint remote;
+    unsigned long inode;
+    uid_t uid;
+    unsigned int rx_queue;
+    unsigned int tx_queue;
+    unsigned int rmem;        /* receive queue allocation (sock_diag only) */
+    unsigned int wmem;        /* queued write memory (sock_diag only) */
+    unsigned int fwd_alloc;   /* forward-allocated memory (sock_diag only) */
     unsigned long memory_usage;
-    int is_hung;
-    int has_leak;
 };
 
-/* Memory segment information structure */
-struct memory_info {
-    pid_t pid;
-    char address[MAX_ADDRESS_LEN];
-    unsigned long size;
-    char permissions[MAX_PERMISSIONS_LEN];
-    char type[MAX_TYPE_LEN];
-    int is_shared;
+/* Sockets as parallel columns; row i of every column is one socket */
+struct socket_table {
+    int count;
+    int capacity;
+    unsigned char *family;
+    unsigned char *protocol;
+    unsigned char *state;
+    unsigned char *flags;     /* SOCKET_FLAG_* */
+    struct socket_endpoint *local;
+    struct socket_endpoint *remote;
+    unsigned long *inode;
+    uid_t *uid;
+    unsigned int *rx_queue;
+    unsigned int *tx_queue;
+    unsigned int *rmem;
+    unsigned int *wmem;
+    unsigned int *fwd_alloc;
+    unsigned long *memory_usage;
+    int *owner;               /* process table row, -1 if no owner was found */
 };
 
-/* Process information structure */
+/* Mapping kinds */
+typedef enum {
+    MEMORY_TYPE_ANONYMOUS,
+    MEMORY_TYPE_HEAP,
+    MEMORY_TYPE_STACK,
+    MEMORY_TYPE_LIBRARY,
+    MEMORY_TYPE_FILE,
+    MEMORY_TYPE_TOTAL         /* rollup rows only: all of a process's mappings */
+} memory_type_t;
+
+/* Mapping permission bits */
+#define MEMORY_PERM_READ   0x01
+#define MEMORY_PERM_WRITE  0x02
+#define MEMORY_PERM_EXEC   0x04
+#define MEMORY_PERM_SHARED 0x08
+
+/* Memory mappings as parallel columns */
+struct memory_table {
+    int count;
+    int capacity;
+    pid_t *pid;
+    unsigned long *start;
+    unsigned long *size;
+    unsigned char *perms;     /* MEMORY_PERM_* */
+    unsigned char *type;      /* memory_type_t */
+    unsigned int *path;       /* interned; STRING_NONE for anonymous mappings */
+};
+
+/* Resident usage as smaps reports it, in kB */
+struct memory_usage {
+    unsigned long rss_kb;
+    unsigned long pss_kb;
+    unsigned long swap_kb;
+    unsigned long shared_dirty_kb;
+    unsigned long private_dirty_kb;
+};
+
+/*
+ * Memory rollups as parallel columns: a MEMORY_TYPE_TOTAL row per process
+ * from smaps_rollup, plus a row per mapping type for processes whose full
+ * smaps was read
+ */
+struct rollup_table {
+    int count;
+    int capacity;
+    pid_t *pid;
+    unsigned char *type;      /* memory_type_t */
+    struct memory_usage *usage;
+};
+
+/* One process as its collector fills it, before it is added to the table */
 struct process_info {
     pid_t pid;
     char name[MAX_PROCESS_NAME];
     int socket_count;
-    double memory_usage;  /* in MB */
-    double cpu_usage;     /* percentage */
-    char status[MAX_STATUS_LEN];
+    unsigned long rss_kb;
+    unsigned long long cpu_ticks;   /* utime + stime */
+    unsigned long long start_time;  /* ticks after boot; with pid, identifies the process */
+    double cpu_usage;         /* percent of one CPU, filled in after the walk */
+    char state;               /* stat state letter */
+};
+
+/* Processes as parallel columns */
+struct process_table {
+    int count;
+    int capacity;
+    pid_t *pid;
+    unsigned int *name;       /* interned */
+    int *socket_count;
+    unsigned long *rss_kb;
+    unsigned long long *cpu_ticks;
+    unsigned long long *start_time;
+    double *cpu_usage;
+    char *state;
+    unsigned char *flags;     /* PROCESS_FLAG_*, filled in after the walk */
+    time_t *scanned_at;       /* when the row was last walked; 0 until the scan stamps it */
 };
 
+/*
+ * One complete scan generation. Every table and string lives in the
+ * snapshot's arena, so a snapshot is refilled in place by the next
+ * scan_snapshot() on it and only released with free_snapshot(). Strings
+ * are formatted from the binary columns only when the snapshot is output.
+ */
+struct sockmap_snapshot {
+    struct socket_table sockets;
+    struct memory_table memory;   /* mappings, only when asked for */
+    struct rollup_table rollups;
+    struct process_table processes;
+    struct string_pool strings;
+    time_t timestamp;
+    double coverage;              /* percent of listed pids walked so far; below 100 if sliced */
+    struct scan_stats stats;      /* how this scan went */
+    struct arena arena;
+};
+
+struct inode_index;
+
 /* Function declarations */
 
 /* Main functions */
@@ -73,40 +246,141 @@ int run_monitoring_loop(struct sockmap_config *cfg);
 void print_usage(const char *program_name);
 
 /* Scanning functions */
-int scan_sockets(struct socket_info **sockets);
-int scan_memory(struct memory_info **memory);
-int scan_processes(struct process_info **processes);
-
-/* Output functions */
-void output_results(struct sockmap_config *cfg, 
-                   struct socket_info *sockets, int socket_count,
-                   struct memory_info *memory, int memory_count,
-                   struct process_info *processes, int process_count);
-
-void output_json(struct socket_info *sockets, int socket_count,
-                struct memory_info *memory, int memory_count,
-                struct process_info *processes, int process_count,
-                time_t timestamp);
-
-void output_table(struct socket_info *sockets, int socket_count,
-                 struct memory_info *memory, int memory_count,
-                 struct process_info *processes, int process_count,
-                 time_t timestamp);
-
-/* Memory management functions */
-void free_socket_info(struct socket_info *sockets, int count);
-void free_memory_info(struct memory_info *memory, int count);
-void free_process_info(struct process_info *processes, int count);
-
-/* Utility functions */
-int is_socket_hung(struct socket_info *socket);
-int detect_memory_leak(struct socket_info *socket);
-char* get_process_name(pid_t pid);
-char* get_process_name_by_inode(unsigned long inode);
-int count_process_sockets(pid_t pid);
-double get_process_memory_usage(pid_t pid);
-double get_process_cpu_usage(pid_t pid);
-void get_process_status(pid_t pid, char *status, size_t status_len);
-int get_socket_memory_usage(pid_t pid, int socket_fd);
+int scan_snapshot(const struct sockmap_config *cfg, struct sockmap_snapshot *snap);
+
+/*
+ * Refill snap like scan_snapshot, but rescan only the QUERY_* sections in
+ * refresh and carry the rest over from prev, the generation before it.
+ * A memory refresh walks every pid, so it refreshes processes as well.
+ * Carried sockets are matched to a rescanned process table by inode.
+ * Sockets rescanned without a walk keep the owners prev found, so one
+ * opened since the last walk shows no owner until the next. prev may be
+ * NULL only if refresh holds every section.
+ *
+ * With cfg->slice_pids or cfg->slice_ms set, a walk visits only a slice
+ * of the listed pids (scan_slice.h) and, for every other pid still
+ * listed, carries prev's process, memory and owner rows over unchanged,
+ * scanned_at included. A slice reads memory along with processes, so
+ * the memory cadence has no effect of its own then.
+ */
+int scan_snapshot_update(const struct sockmap_config *cfg, struct sockmap_snapshot *snap,
+                         const struct sockmap_snapshot *prev, unsigned int refresh);
+void free_snapshot(struct sockmap_snapshot *snap);
+int scan_sockets(const struct sockmap_config *cfg, struct arena *arena,
+                 const struct inode_index *owners, struct socket_table *sockets);
+
+/* Table construction; each returns -1 when the arena is exhausted */
+int socket_table_reserve(struct socket_table *table, struct arena *arena, int needed);
+int socket_table_append(struct socket_table *table, struct arena *arena,
+                        const struct socket_info *socket);
+int memory_table_reserve(struct memory_table *table, struct arena *arena, int needed);
+int memory_table_append(struct memory_table *table, struct arena *arena, pid_t pid,
+                        unsigned long start, unsigned long size, unsigned char perms,
+                        unsigned char type, unsigned int path);
+int rollup_table_reserve(struct rollup_table *table, struct arena *arena, int needed);
+int rollup_table_append(struct rollup_table *table, struct arena *arena, pid_t pid,
+                        unsigned char type, const struct memory_usage *usage);
+int process_table_reserve(struct process_table *table, struct arena *arena, int needed);
+int process_table_append(struct process_table *table, struct arena *arena,
+                         struct string_pool *strings, const struct process_info *proc);
+
+/* Replace a table's rows with a copy of from's, e.g. the previous generation's */
+int socket_table_copy(struct socket_table *table, struct arena *arena,
+                      const struct socket_table *from);
+int memory_table_copy(struct memory_table *table, struct arena *arena,
+                      const struct memory_table *from);
+int rollup_table_copy(struct rollup_table *table, struct arena *arena,
+                      const struct rollup_table *from);
+int process_table_copy(struct process_table *table, struct arena *arena,
+                       const struct process_table *from);
+
+/* Replace a table's rows with copies of the count rows of from listed in rows */
+int socket_table_select(struct socket_table *table, struct arena *arena,
+                        const struct socket_table *from, const int *rows, int count);
+int memory_table_select(struct memory_table *table, struct arena *arena,
+                        const struct memory_table *from, const int *rows, int count);
+int rollup_table_select(struct rollup_table *table, struct arena *arena,
+                        const struct rollup_table *from, const int *rows, int count);
+int process_table_select(struct process_table *table, struct arena *arena,
+                         const struct process_table *from, const int *rows, int count);
+
+/* Serialization-time formatting */
+const char *socket_state_name(int state);
+const char *socket_protocol_name(int protocol);
+void format_socket_address(char *buf, size_t len, int family,
+                           const void *addr, unsigned int port);
+const char *memory_type_name(int type);
+void format_memory_perms(unsigned char perms, char *buf);
+const char *process_status_name(char state);
+
+/* Owning process's pid and name for a socket row; 0 and "unknown" if unowned */
+pid_t socket_pid(const struct sockmap_snapshot *snap, int row);
+const char *socket_process_name(const struct sockmap_snapshot *snap, int row);
+
+/* Row fields in output order; a projection selects field f with bit (1 << f) */
+#define FIELDS_ALL (~0u)
+
+enum {
+    SOCKET_FIELD_PID, SOCKET_FIELD_PROCESS_NAME, SOCKET_FIELD_LOCAL_ADDRESS,
+    SOCKET_FIELD_REMOTE_ADDRESS, SOCKET_FIELD_STATE, SOCKET_FIELD_PROTOCOL, SOCKET_FIELD_INODE,
+    SOCKET_FIELD_UID, SOCKET_FIELD_RX_QUEUE, SOCKET_FIELD_TX_QUEUE, SOCKET_FIELD_RMEM,
+    SOCKET_FIELD_WMEM, SOCKET_FIELD_FWD_ALLOC, SOCKET_FIELD_MEMORY_USAGE, SOCKET_FIELD_IS_HUNG,
+    SOCKET_FIELD_HAS_LEAK, SOCKET_FIELD_COUNT
+};
+
+enum {
+    MEMORY_FIELD_PID, MEMORY_FIELD_ADDRESS, MEMORY_FIELD_SIZE, MEMORY_FIELD_PERMISSIONS,
+    MEMORY_FIELD_TYPE, MEMORY_FIELD_PATH, MEMORY_FIELD_IS_SHARED, MEMORY_FIELD_COUNT
+};
+
+enum {
+    ROLLUP_FIELD_PID, ROLLUP_FIELD_TYPE, ROLLUP_FIELD_RSS_KB, ROLLUP_FIELD_PSS_KB,
+    ROLLUP_FIELD_SWAP_KB, ROLLUP_FIELD_SHARED_DIRTY_KB, ROLLUP_FIELD_PRIVATE_DIRTY_KB,
+    ROLLUP_FIELD_COUNT
+};
+
+enum {
+    PROCESS_FIELD_PID, PROCESS_FIELD_NAME, PROCESS_FIELD_SOCKET_COUNT, PROCESS_FIELD_MEMORY_USAGE,
+    PROCESS_FIELD_CPU_USAGE, PROCESS_FIELD_STATUS, PROCESS_FIELD_HAS_LEAK, PROCESS_FIELD_SCANNED_AT,
+    PROCESS_FIELD_COUNT
+};
+
+extern const char *const socket_field_names[SOCKET_FIELD_COUNT];
+extern const char *const memory_field_names[MEMORY_FIELD_COUNT];
+extern const char *const rollup_field_names[ROLLUP_FIELD_COUNT];
+extern const char *const process_field_names[PROCESS_FIELD_COUNT];
+
+/* Output functions; a NULL query writes every section and field */
+struct json_writer;
+void output_results(const struct sockmap_config *cfg, const struct sockmap_snapshot *snap,
+                    struct json_writer *out);
+void output_json(const struct sockmap_snapshot *snap, const struct scan_query *query,
+                 struct json_writer *out);
+
+/* The document's arrays on their own, as the value of a key the caller wrote */
+void output_socket_array(const struct sockmap_snapshot *snap, unsigned int fields,
+                         struct json_writer *out);
+void output_memory_array(const struct sockmap_snapshot *snap, unsigned int fields,
+                         struct json_writer *out);
+void output_rollup_array(const struct sockmap_snapshot *snap, unsigned int fields,
+                         struct json_writer *out);
+void output_process_array(const struct sockmap_snapshot *snap, unsigned int fields,
+                          struct json_writer *out);
+
+/* "memory_rollup", then, if the query asks for mappings, their page as
+   "memory" and the mapping count as "memory_total" */
+void output_memory_section(const struct sockmap_snapshot *snap, const struct scan_query *query,
+                           struct json_writer *out);
+
+/* The projected fields of one row as key/value pairs, inside an object the caller opened */
+void output_socket_fields(struct json_writer *out, const struct socket_table *sockets, int row,
+                          pid_t pid, const char *process_name, unsigned int fields);
+void output_memory_fields(struct json_writer *out, const struct memory_table *memory, int row,
+                          const struct string_pool *strings, unsigned int fields);
+void output_rollup_fields(struct json_writer *out, const struct rollup_table *rollups, int row,
+                          unsigned int fields);
+void output_process_fields(struct json_writer *out, const struct process_table *processes, int row,
+                           const struct string_pool *strings, unsigned int fields);
+void output_table(const struct sockmap_snapshot *snap, const struct scan_query *query);
 
 #endif /* SOCKMAP_H */
\ No newline at end of file
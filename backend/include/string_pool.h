@@ -0,0 +1,35 @@
+/*
+ * SockMap - Interned strings
+ * Each distinct process name or mapping path is stored once per snapshot
+ */
+
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <stddef.h>
+#include "arena.h"
+
+/* Id 0 is always the empty string */
+#define STRING_NONE 0
+
+/* Open-addressing set of NUL-terminated strings, addressed by dense id */
+struct string_pool {
+    struct arena *arena;
+    const char **strings;    /* id -> string */
+    unsigned int *hashes;    /* id -> hash */
+    int count;
+    int capacity;
+    unsigned int *slots;     /* id + 1, 0 marks an empty slot */
+    size_t slot_capacity;    /* always a power of two */
+};
+
+int string_pool_init(struct string_pool *pool, struct arena *arena);
+
+/* Returns the id of the string, adding a copy on first sight; -1 on OOM */
+int string_pool_intern(struct string_pool *pool, const char *str, size_t len);
+
+static inline const char *string_pool_get(const struct string_pool *pool, unsigned int id) {
+    return pool->strings[id];
+}
+
+#endif /* STRING_POOL_H */
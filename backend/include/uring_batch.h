@@ -0,0 +1,40 @@
+/*
+ * SockMap - Batched /proc file reads through io_uring
+ */
+
+#ifndef URING_BATCH_H
+#define URING_BATCH_H
+
+#include <sys/types.h>
+
+/* One whole-file read: openat(dir_fd, name) + read + close */
+struct uring_read {
+    int dir_fd;
+    const char *name;
+    char *buf;
+    size_t len;          /* buffer size; one byte is kept for the terminator */
+    ssize_t result;      /* bytes read, or -errno */
+    int done;            /* set once the completion callback has run */
+    void *owner;         /* caller cookie */
+};
+
+/* Called as each read completes, in completion order */
+typedef void (*uring_complete_fn)(void *ctx, struct uring_read *read);
+
+/*
+ * Read every file on the calling thread's ring, using direct descriptors
+ * so no fd ever enters the file table. Reads the ring cannot serve (no
+ * io_uring support, or a ring failure mid-batch) fall back to plain
+ * syscalls; every read gets exactly one callback either way. Returns the
+ * number of reads served by the ring.
+ */
+int uring_read_batch(struct uring_read *reads, int count,
+                     uring_complete_fn on_complete, void *ctx);
+
+/* Whether the calling thread can set up a ring */
+int uring_batch_available(void);
+
+/* Tear down the calling thread's ring */
+void uring_batch_release(void);
+
+#endif /* URING_BATCH_H */
@@ -0,0 +1,25 @@
+/*
+ * SockMap - Work-stealing thread pool
+ */
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+/* Process one item; worker is the index of the calling thread */
+typedef void (*work_fn)(void *ctx, int worker, int item);
+
+/*
+ * Run fn over items [0, item_count) on `threads` workers and wait for all
+ * of them. Each worker starts on a contiguous slice and steals half of a
+ * busier worker's remaining range once its own slice runs dry, so uneven
+ * per-item cost does not leave threads idle. thread_exit, if set, runs on
+ * every worker just before it finishes so thread-local state can be
+ * released. Returns -1 if the pool could not be set up.
+ */
+int work_pool_run(int threads, int item_count, work_fn fn,
+                  void (*thread_exit)(void), void *ctx);
+
+/* Number of online CPUs, at least 1 */
+int work_pool_default_threads(void);
+
+#endif /* WORK_POOL_H */
@@ -0,0 +1,392 @@
+/*
+ * Aggregation engine
+ *
+ * Answers the questions dashboards ask most, such as the top processes by
+ * sockets or the busiest remote endpoints, without shipping every row.
+ * Top-K keeps a min-heap of the best K rows seen, so ranking costs
+ * O(n log K) and never sorts the table. Group-by hashes each socket's
+ * key into an open-addressing table that is grown by rehashing into a
+ * spare, like cpu_sample's, and then ranks the groups the same way. Keys
+ * are formatted only for the groups that make the list.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "../include/aggregate.h"
+#include "../include/json_writer.h"
+
+#define INITIAL_CAPACITY 1024
+
+const char *const top_metric_names[TOP_COUNT] = {
+    "sockets", "rss", "close_wait", "cpu",
+};
+
+const char *const group_key_names[GROUP_COUNT] = {
+    "remote", "remote_address", "local_port", "process", "state",
+};
+
+/* A socket's group; zeroed before it is filled, so it compares bytewise */
+struct group_key {
+    unsigned char addr[16];
+    unsigned int value;       /* port, name id + 1, or state, as the key has it */
+    unsigned char family;
+};
+
+struct group_slot {
+    struct group_key key;
+    int first_row;
+    int sockets;              /* 0 marks an empty slot */
+    unsigned long long rx_queue;
+    unsigned long long tx_queue;
+    unsigned long long memory;
+};
+
+/* a ranks below b */
+typedef int (*below_fn)(const void *ctx, int a, int b);
+
+struct top_rank {
+    const struct process_table *processes;
+    const int *close_wait;
+    int metric;
+};
+
+static int *close_wait;              /* per process row */
+static size_t close_wait_capacity;
+static struct group_slot *slots;
+static struct group_slot *spare;     /* rehash target */
+static size_t capacity;              /* in use this call; always a power of two */
+static size_t allocated;             /* of both slots and spare */
+
+static int lookup(const char *const *names, int count, const char *name, size_t len) {
+    for (int i = 0; i < count; i++) {
+        if (strlen(names[i]) == len && memcmp(names[i], name, len) == 0) return i;
+    }
+    return -1;
+}
+
+int aggregate_top_metric(const char *name, size_t len) {
+    return lookup(top_metric_names, TOP_COUNT, name, len);
+}
+
+int aggregate_group_key(const char *name, size_t len) {
+    return lookup(group_key_names, GROUP_COUNT, name, len);
+}
+
+static void sift_down(int *heap, int count, int i, below_fn below, const void *ctx) {
+    for (;;) {
+        int left = 2 * i + 1, right = left + 1, least = i;
+        if (left < count && below(ctx, heap[left], heap[least])) least = left;
+        if (right < count && below(ctx, heap[right], heap[least])) least = right;
+        if (least == i) return;
+        int swap = heap[i];
+        heap[i] = heap[least];
+        heap[least] = swap;
+        i = least;
+    }
+}
+
+/* Keep item if it is among the best limit offered so far; the worst kept is the root */
+static void heap_offer(int *heap, int *count, int limit, int item, below_fn below,
+                       const void *ctx) {
+    if (*count < limit) {
+        int i = (*count)++;
+        heap[i] = item;
+        while (i > 0 && below(ctx, heap[i], heap[(i - 1) / 2])) {
+            int parent = (i - 1) / 2;
+            heap[i] = heap[parent];
+            heap[parent] = item;
+            i = parent;
+        }
+    } else if (limit > 0 && below(ctx, heap[0], item)) {
+        heap[0] = item;
+        sift_down(heap, *count, 0, below, ctx);
+    }
+}
+
+/* Empty the heap into order, best first */
+static void heap_drain(int *heap, int count, int *order, below_fn below, const void *ctx) {
+    for (int n = count - 1; n >= 0; n--) {
+        order[n] = heap[0];
+        heap[0] = heap[n];
+        sift_down(heap, n, 0, below, ctx);
+    }
+}
+
+static double top_score(const struct top_rank *rank, int row) {
+    switch (rank->metric) {
+        case TOP_SOCKETS: return rank->processes->socket_count[row];
+        case TOP_RSS: return (double)rank->processes->rss_kb[row];
+        case TOP_CLOSE_WAIT: return rank->close_wait[row];
+        default: return rank->processes->cpu_usage[row];
+    }
+}
+
+static int top_below(const void *ctx, int a, int b) {
+    const struct top_rank *rank = ctx;
+    double x = top_score(rank, a), y = top_score(rank, b);
+    if (x != y) return x < y;
+    return rank->processes->pid[a] > rank->processes->pid[b];
+}
+
+/* Sockets in CLOSE_WAIT per owning process row */
+static int count_close_wait(const struct sockmap_snapshot *snap) {
+    size_t rows = (size_t)snap->processes.count;
+    if (rows > close_wait_capacity) {
+        int *grown = realloc(close_wait, rows * sizeof(*close_wait));
+        if (!grown) return -1;
+        close_wait = grown;
+        close_wait_capacity = rows;
+    }
+    if (rows > 0) memset(close_wait, 0, rows * sizeof(*close_wait));
+
+    const struct socket_table *sockets = &snap->sockets;
+    for (int i = 0; i < sockets->count; i++) {
+        if (sockets->state[i] == SOCKET_STATE_CLOSE_WAIT && sockets->owner[i] >= 0) {
+            close_wait[sockets->owner[i]]++;
+        }
+    }
+    return 0;
+}
+
+int aggregate_top(const struct sockmap_snapshot *snap, int metric, int limit,
+                  struct top_list *list) {
+    const struct process_table *processes = &snap->processes;
+    if (limit > AGGREGATE_MAX_LIMIT) limit = AGGREGATE_MAX_LIMIT;
+    if (count_close_wait(snap) != 0) return -1;
+
+    struct top_rank rank = { processes, close_wait, metric };
+    int heap[AGGREGATE_MAX_LIMIT], order[AGGREGATE_MAX_LIMIT];
+    int count = 0;
+    for (int row = 0; row < processes->count; row++) {
+        heap_offer(heap, &count, limit, row, top_below, &rank);
+    }
+    heap_drain(heap, count, order, top_below, &rank);
+
+    list->metric = metric;
+    list->count = count;
+    list->total = processes->count;
+    for (int i = 0; i < count; i++) {
+        struct top_entry *entry = &list->entries[i];
+        int row = order[i];
+        entry->pid = processes->pid[row];
+        snprintf(entry->name, sizeof(entry->name), "%s",
+                 string_pool_get(&snap->strings, processes->name[row]));
+        entry->sockets = processes->socket_count[row];
+        entry->close_wait = close_wait[row];
+        entry->rss_kb = processes->rss_kb[row];
+        entry->cpu_usage = processes->cpu_usage[row];
+    }
+    return 0;
+}
+
+static size_t hash_key(const struct group_key *key, size_t cap) {
+    uint64_t low, high;
+    memcpy(&low, key->addr, sizeof(low));
+    memcpy(&high, key->addr + sizeof(low), sizeof(high));
+    uint64_t hash = (low * 0x9E3779B97F4A7C15ULL + high) ^ ((uint64_t)key->value << 8 | key->family);
+    // murmur3's finalizer, so every input bit reaches the low bits the table uses
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return (size_t)hash & (cap - 1);
+}
+
+/* The slot for key in table, empty if the key is not there yet */
+static struct group_slot *probe(struct group_slot *table, size_t cap, const struct group_key *key) {
+    size_t pos = hash_key(key, cap);
+    while (table[pos].sockets != 0 && memcmp(&table[pos].key, key, sizeof(*key)) != 0) {
+        pos = (pos + 1) & (cap - 1);
+    }
+    return &table[pos];
+}
+
+/* Both tables hold at least cap slots; only what is in use gets cleared */
+static int reserve_slots(size_t cap) {
+    if (cap <= allocated) return 0;
+    struct group_slot *grown = realloc(slots, cap * sizeof(*slots));
+    if (!grown) return -1;
+    slots = grown;
+    grown = realloc(spare, cap * sizeof(*spare));
+    if (!grown) return -1;
+    spare = grown;
+    allocated = cap;
+    return 0;
+}
+
+static int grow_slots(void) {
+    size_t grown = capacity * 2;
+    if (reserve_slots(grown) != 0) return -1;
+
+    memset(spare, 0, grown * sizeof(*spare));
+    for (size_t i = 0; i < capacity; i++) {
+        if (slots[i].sockets != 0) *probe(spare, grown, &slots[i].key) = slots[i];
+    }
+    struct group_slot *rehashed = spare;
+    spare = slots;
+    slots = rehashed;
+    capacity = grown;
+    return 0;
+}
+
+static void group_key_of(const struct sockmap_snapshot *snap, int key, int row,
+                         struct group_key *out) {
+    const struct socket_table *sockets = &snap->sockets;
+    memset(out, 0, sizeof(*out));
+    if (key == GROUP_REMOTE || key == GROUP_REMOTE_ADDRESS) {
+        out->family = sockets->family[row];
+        memcpy(out->addr, sockets->remote[row].addr, out->family == AF_INET6 ? 16 : 4);
+        if (key == GROUP_REMOTE) out->value = sockets->remote[row].port;
+    } else if (key == GROUP_LOCAL_PORT) {
+        out->value = sockets->local[row].port;
+    } else if (key == GROUP_PROCESS) {
+        int owner = sockets->owner[row];
+        out->value = owner >= 0 ? snap->processes.name[owner] + 1 : 0;
+    } else {
+        // Request sockets are listed as SYN_RECV, so they group with them
+        int state = sockets->state[row];
+        out->value = state == SOCKET_STATE_NEW_SYN_RECV ? SOCKET_STATE_SYN_RECV : state;
+    }
+}
+
+static void format_group_key(const struct sockmap_snapshot *snap, int key,
+                             const struct group_key *group, char *buf, size_t len) {
+    if (key == GROUP_REMOTE) {
+        format_socket_address(buf, len, group->family, group->addr, group->value);
+    } else if (key == GROUP_REMOTE_ADDRESS) {
+        if (!inet_ntop(group->family, group->addr, buf, (socklen_t)len)) snprintf(buf, len, "?");
+    } else if (key == GROUP_LOCAL_PORT) {
+        snprintf(buf, len, "%u", group->value);
+    } else if (key == GROUP_PROCESS) {
+        snprintf(buf, len, "%s",
+                 group->value ? string_pool_get(&snap->strings, group->value - 1) : "unknown");
+    } else {
+        snprintf(buf, len, "%s", socket_state_name((int)group->value));
+    }
+}
+
+static int group_below(const void *ctx, int a, int b) {
+    (void)ctx;
+    if (slots[a].sockets != slots[b].sockets) return slots[a].sockets < slots[b].sockets;
+    return slots[a].first_row > slots[b].first_row;
+}
+
+int aggregate_groups(const struct sockmap_snapshot *snap, int key, int limit,
+                     struct group_list *list) {
+    const struct socket_table *sockets = &snap->sockets;
+    if (limit > AGGREGATE_MAX_LIMIT) limit = AGGREGATE_MAX_LIMIT;
+    if (reserve_slots(INITIAL_CAPACITY) != 0) return -1;
+    capacity = INITIAL_CAPACITY;
+    memset(slots, 0, capacity * sizeof(*slots));
+
+    // Keep the load factor below 70% so probe chains stay short
+    int groups = 0;
+    for (int row = 0; row < sockets->count; row++) {
+        if ((size_t)(groups + 1) * 10 > capacity * 7 && grow_slots() != 0) return -1;
+
+        struct group_key group;
+        group_key_of(snap, key, row, &group);
+        struct group_slot *slot = probe(slots, capacity, &group);
+        if (slot->sockets == 0) {
+            slot->key = group;
+            slot->first_row = row;
+            groups++;
+        }
+        slot->sockets++;
+        slot->rx_queue += sockets->rx_queue[row];
+        slot->tx_queue += sockets->tx_queue[row];
+        slot->memory += sockets->memory_usage[row];
+    }
+
+    int heap[AGGREGATE_MAX_LIMIT], order[AGGREGATE_MAX_LIMIT];
+    int count = 0;
+    for (size_t i = 0; i < capacity; i++) {
+        if (slots[i].sockets != 0) heap_offer(heap, &count, limit, (int)i, group_below, NULL);
+    }
+    heap_drain(heap, count, order, group_below, NULL);
+
+    list->key = key;
+    list->count = count;
+    list->total = groups;
+    list->sockets = sockets->count;
+    for (int i = 0; i < count; i++) {
+        const struct group_slot *slot = &slots[order[i]];
+        struct group_entry *entry = &list->entries[i];
+        format_group_key(snap, key, &slot->key, entry->key, sizeof(entry->key));
+        entry->sockets = slot->sockets;
+        entry->rx_queue = slot->rx_queue;
+        entry->tx_queue = slot->tx_queue;
+        entry->memory = slot->memory;
+    }
+    return 0;
+}
+
+void output_top_list(const struct top_list *list, int limit, struct json_writer *out) {
+    json_key(out, "by");
+    json_string(out, top_metric_names[list->metric]);
+    json_key(out, "total");
+    json_int(out, list->total);
+    json_key(out, "processes");
+    json_begin_array(out);
+    for (int i = 0; i < list->count && i < limit; i++) {
+        const struct top_entry *entry = &list->entries[i];
+        json_begin_object(out);
+        json_key(out, "pid");
+        json_int(out, entry->pid);
+        json_key(out, "name");
+        json_string(out, entry->name);
+        json_key(out, "socket_count");
+        json_int(out, entry->sockets);
+        json_key(out, "close_wait");
+        json_int(out, entry->close_wait);
+        json_key(out, "memory_usage");
+        json_fixed2(out, entry->rss_kb / 1024.0);
+        json_key(out, "cpu_usage");
+        json_fixed2(out, entry->cpu_usage);
+        json_end_object(out);
+    }
+    json_end_array(out);
+}
+
+void output_group_list(const struct group_list *list, int limit, struct json_writer *out) {
+    json_key(out, "by");
+    json_string(out, group_key_names[list->key]);
+    json_key(out, "total");
+    json_int(out, list->total);
+    json_key(out, "sockets");
+    json_int(out, list->sockets);
+    json_key(out, "groups");
+    json_begin_array(out);
+    for (int i = 0; i < list->count && i < limit; i++) {
+        const struct group_entry *entry = &list->entries[i];
+        json_begin_object(out);
+        json_key(out, "key");
+        json_string(out, entry->key);
+        json_key(out, "sockets");
+        json_int(out, entry->sockets);
+        json_key(out, "rx_queue");
+        json_uint(out, entry->rx_queue);
+        json_key(out, "tx_queue");
+        json_uint(out, entry->tx_queue);
+        json_key(out, "memory_usage");
+        json_uint(out, entry->memory);
+        json_end_object(out);
+    }
+    json_end_array(out);
+}
+
+void aggregate_release(void) {
+    free(close_wait);
+    free(slots);
+    free(spare);
+    close_wait = NULL;
+    slots = NULL;
+    spare = NULL;
+    close_wait_capacity = 0;
+    capacity = 0;
+    allocated = 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Generation arena
+ *
+ * Allocations bump a cursor through a list of chunks. Reset rewinds the
+ * cursor to the first chunk instead of freeing anything, so the monitoring
+ * loop settles at its high-water mark and stops calling malloc.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../include/arena.h"
+
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    unsigned char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static struct arena_chunk *chunk_create(size_t size) {
+    if (size < ARENA_CHUNK_SIZE) size = ARENA_CHUNK_SIZE;
+
+    struct arena_chunk *chunk = malloc(sizeof(struct arena_chunk) + size);
+    if (!chunk) return NULL;
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+    size = align_up(size ? size : 1);
+
+    // Move along the retained chunks until one has room
+    struct arena_chunk *chunk = arena->current;
+    while (chunk && chunk->size - chunk->used < size) {
+        chunk = chunk->next;
+    }
+
+    if (!chunk) {
+        chunk = chunk_create(size);
+        if (!chunk) return NULL;
+
+        // Append so earlier chunks keep their order for the next generation
+        struct arena_chunk **link = arena->current ? &arena->current->next : &arena->head;
+        while (*link) link = &(*link)->next;
+        *link = chunk;
+    }
+
+    arena->current = chunk;
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void *arena_calloc(struct arena *arena, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) return NULL;
+
+    void *ptr = arena_alloc(arena, count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+int arena_grow(struct arena *arena, void **items, int *capacity, int needed, size_t item_size) {
+    if (needed <= *capacity) return 0;
+
+    int new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+
+    void *grown = arena_alloc(arena, (size_t)new_capacity * item_size);
+    if (!grown) return -1;
+    if (*items) memcpy(grown, *items, (size_t)*capacity * item_size);
+    *items = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+int arena_grow_columns(struct arena *arena, void **const columns[], const size_t widths[],
+                       int column_count, int *capacity, int needed) {
+    if (needed <= *capacity) return 0;
+
+    int new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+
+    for (int i = 0; i < column_count; i++) {
+        void *grown = arena_alloc(arena, (size_t)new_capacity * widths[i]);
+        if (!grown) return -1;
+        if (*columns[i]) memcpy(grown, *columns[i], (size_t)*capacity * widths[i]);
+        *columns[i] = grown;
+    }
+    *capacity = new_capacity;
+    return 0;
+}
+
+void arena_reset(struct arena *arena) {
+    for (struct arena_chunk *chunk = arena->head; chunk; chunk = chunk->next) {
+        chunk->used = 0;
+    }
+    arena->current = arena->head;
+}
+
+void arena_free(struct arena *arena) {
+    struct arena_chunk *chunk = arena->head;
+    while (chunk) {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+    arena->current = NULL;
+}
+
+size_t arena_footprint(const struct arena *arena) {
+    size_t total = 0;
+    for (const struct arena_chunk *chunk = arena->head; chunk; chunk = chunk->next) {
+        total += chunk->size;
+    }
+    return total;
+}
@@ -0,0 +1,165 @@
+/*
+ * CPU usage sampling
+ *
+ * /proc/<pid>/stat only carries cumulative ticks, so a percentage needs
+ * the previous scan's reading of the same process. Readings live in an
+ * open-addressing table keyed by (pid, starttime) that is probed once per
+ * pid per scan. Instead of tombstones, each scan ends with a generation
+ * sweep that rehashes the surviving entries into a spare table, which
+ * keeps probe chains as short as a freshly built table.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/cpu_sample.h"
+
+#define INITIAL_CAPACITY 1024
+#define NSEC_PER_SEC 1000000000.0
+
+struct cpu_entry {
+    pid_t pid;                      /* 0 marks an empty slot */
+    unsigned int generation;        /* last scan that sampled this process */
+    unsigned long long start_time;  /* ticks after boot, from stat */
+    unsigned long long cpu_ticks;   /* utime + stime at that scan */
+    unsigned long long sampled_ns;  /* CLOCK_BOOTTIME at that scan */
+};
+
+static struct cpu_entry *slots;
+static struct cpu_entry *spare;     /* sweep target, same capacity as slots */
+static size_t capacity;             /* always a power of two */
+static size_t count;
+static unsigned int generation;
+static unsigned long long scan_ns;
+static double ticks_per_second;
+
+/* Same clock as starttime, so lifetime averages need no /proc/uptime */
+static unsigned long long boottime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static size_t hash_key(pid_t pid, unsigned long long start_time, size_t cap) {
+    unsigned long long key = ((unsigned long long)(unsigned int)pid << 32) ^ start_time;
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 16) & (cap - 1);
+}
+
+static void place(struct cpu_entry *table, size_t cap, const struct cpu_entry *entry) {
+    size_t pos = hash_key(entry->pid, entry->start_time, cap);
+    while (table[pos].pid != 0) {
+        pos = (pos + 1) & (cap - 1);
+    }
+    table[pos] = *entry;
+}
+
+static int table_grow(void) {
+    size_t new_capacity = capacity ? capacity * 2 : INITIAL_CAPACITY;
+    struct cpu_entry *new_slots = calloc(new_capacity, sizeof(struct cpu_entry));
+    struct cpu_entry *new_spare = malloc(new_capacity * sizeof(struct cpu_entry));
+    if (!new_slots || !new_spare) {
+        free(new_slots);
+        free(new_spare);
+        return -1;
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        if (slots[i].pid != 0) place(new_slots, new_capacity, &slots[i]);
+    }
+
+    free(slots);
+    free(spare);
+    slots = new_slots;
+    spare = new_spare;
+    capacity = new_capacity;
+    return 0;
+}
+
+void cpu_sample_begin(void) {
+    if (ticks_per_second == 0) {
+        long hz = sysconf(_SC_CLK_TCK);
+        ticks_per_second = hz > 0 ? (double)hz : 100.0;
+    }
+    generation++;
+    scan_ns = boottime_ns();
+}
+
+double cpu_sample_percent(pid_t pid, unsigned long long start_time,
+                          unsigned long long cpu_ticks) {
+    // Keep the load factor below 70% so probe chains stay short
+    if ((count + 1) * 10 > capacity * 7) {
+        if (table_grow() != 0) return -1;
+    }
+
+    size_t pos = hash_key(pid, start_time, capacity);
+    while (slots[pos].pid != 0 &&
+           (slots[pos].pid != pid || slots[pos].start_time != start_time)) {
+        pos = (pos + 1) & (capacity - 1);
+    }
+
+    struct cpu_entry *entry = &slots[pos];
+    unsigned long long since_ns;
+    unsigned long long ticks;
+    if (entry->pid != 0 && entry->sampled_ns < scan_ns) {
+        since_ns = scan_ns - entry->sampled_ns;
+        ticks = cpu_ticks > entry->cpu_ticks ? cpu_ticks - entry->cpu_ticks : 0;
+    } else {
+        // First sight: average over the process's lifetime so far
+        unsigned long long started_ns =
+            (unsigned long long)(start_time / ticks_per_second * NSEC_PER_SEC);
+        since_ns = scan_ns > started_ns ? scan_ns - started_ns : 0;
+        ticks = cpu_ticks;
+    }
+
+    if (entry->pid == 0) {
+        entry->pid = pid;
+        entry->start_time = start_time;
+        count++;
+    }
+    entry->generation = generation;
+    entry->cpu_ticks = cpu_ticks;
+    entry->sampled_ns = scan_ns;
+
+    if (since_ns == 0) return 0.0;
+    return ticks / ticks_per_second / (since_ns / NSEC_PER_SEC) * 100.0;
+}
+
+void cpu_sample_keep(pid_t pid, unsigned long long start_time) {
+    if (capacity == 0) return;
+
+    size_t pos = hash_key(pid, start_time, capacity);
+    while (slots[pos].pid != 0) {
+        if (slots[pos].pid == pid && slots[pos].start_time == start_time) {
+            slots[pos].generation = generation;
+            return;
+        }
+        pos = (pos + 1) & (capacity - 1);
+    }
+}
+
+void cpu_sample_sweep(void) {
+    if (capacity == 0) return;
+
+    memset(spare, 0, capacity * sizeof(struct cpu_entry));
+    count = 0;
+    for (size_t i = 0; i < capacity; i++) {
+        if (slots[i].pid != 0 && slots[i].generation == generation) {
+            place(spare, capacity, &slots[i]);
+            count++;
+        }
+    }
+
+    struct cpu_entry *swept = spare;
+    spare = slots;
+    slots = swept;
+}
+
+void cpu_sample_release(void) {
+    free(slots);
+    free(spare);
+    slots = NULL;
+    spare = NULL;
+    capacity = 0;
+    count = 0;
+}
@@ -0,0 +1,386 @@
+/*
+ * Per-socket and per-process sample history
+ *
+ * Every tracked entity owns a fixed ring of its last HISTORY_DEPTH samples.
+ * A socket is sampled every scan and its sample g lives in slot
+ * g % HISTORY_DEPTH. Processes may skip scans that carry them over, so
+ * each counts its own samples and keeps their times. What detection asks of a window is
+ * kept up to date as samples enter and leave it: the number of adjacent
+ * pairs where a value fell, and least-squares sums for the RSS slope.
+ * Entities are found through an open-addressing index that, like
+ * cpu_sample's table, is rebuilt at each sweep instead of carrying
+ * tombstones.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/history.h"
+
+#define DEPTH_MASK (HISTORY_DEPTH - 1)
+#define INITIAL_CAPACITY 1024
+#define NSEC_PER_SEC 1000000000.0
+
+struct history_slot {
+    unsigned long long key[2];
+    unsigned int entry;             /* entry index + 1; 0 marks an empty slot */
+};
+
+/* First member of every entry type */
+struct history_entry {
+    unsigned long long key[2];
+    unsigned int first;             /* generation of the oldest sample ever recorded */
+    unsigned int generation;        /* last scan that sampled it; 0 marks a free entry */
+};
+
+struct history_table {
+    struct history_slot *slots;
+    size_t capacity;                /* always a power of two */
+    char *entries;
+    size_t entry_size;
+    int entry_count;                /* entries handed out, free ones included */
+    int entry_capacity;
+    int *free_entries;
+    int free_count;
+    int stale;                      /* entries the next sweep frees */
+    unsigned int generation;
+    unsigned long long scan_ns;     /* CLOCK_BOOTTIME of this generation's scan */
+};
+
+struct socket_history {
+    struct history_entry head;
+    unsigned long long state_since_ns;
+    unsigned char state;
+    unsigned char rx_drops;         /* adjacent samples in the window where a value fell */
+    unsigned char tx_drops;
+    unsigned char memory_drops;
+    unsigned int rx_queue[HISTORY_DEPTH];
+    unsigned int tx_queue[HISTORY_DEPTH];
+    unsigned int memory[HISTORY_DEPTH];
+};
+
+struct process_history {
+    struct history_entry head;
+    unsigned int samples;           /* samples ever recorded; sample n lives in slot n % depth */
+    unsigned long long base_ns;     /* time origin of the sums */
+    double sum_t;                   /* seconds since base_ns */
+    double sum_rss;
+    double sum_tt;
+    double sum_t_rss;
+    unsigned long long sample_ns[HISTORY_DEPTH];  /* CLOCK_BOOTTIME of each sample */
+    unsigned long rss_kb[HISTORY_DEPTH];
+};
+
+static struct history_table sockets = { .entry_size = sizeof(struct socket_history) };
+static struct history_table processes = { .entry_size = sizeof(struct process_history) };
+
+static unsigned long long boottime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static struct history_entry *entry_at(const struct history_table *table, int index) {
+    return (struct history_entry *)(table->entries + (size_t)index * table->entry_size);
+}
+
+static size_t hash_key(unsigned long long key0, unsigned long long key1, size_t cap) {
+    unsigned long long key = key0 ^ (key1 * 0xC2B2AE3D27D4EB4FULL);
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 16) & (cap - 1);
+}
+
+static void place(struct history_slot *slots, size_t cap, const struct history_entry *entry,
+                  int index) {
+    size_t pos = hash_key(entry->key[0], entry->key[1], cap);
+    while (slots[pos].entry != 0) {
+        pos = (pos + 1) & (cap - 1);
+    }
+    slots[pos].key[0] = entry->key[0];
+    slots[pos].key[1] = entry->key[1];
+    slots[pos].entry = (unsigned int)index + 1;
+}
+
+/* Rebuild the index from the live entries, at new_capacity slots */
+static int reindex(struct history_table *table, size_t new_capacity) {
+    struct history_slot *slots = table->slots;
+    if (new_capacity != table->capacity) {
+        slots = malloc(new_capacity * sizeof(struct history_slot));
+        if (!slots) return -1;
+        free(table->slots);
+        table->slots = slots;
+        table->capacity = new_capacity;
+    }
+
+    memset(slots, 0, new_capacity * sizeof(struct history_slot));
+    for (int i = 0; i < table->entry_count; i++) {
+        const struct history_entry *entry = entry_at(table, i);
+        if (entry->generation != 0) place(slots, new_capacity, entry, i);
+    }
+    return 0;
+}
+
+static void table_begin(struct history_table *table) {
+    table->generation++;
+    table->scan_ns = boottime_ns();
+    table->stale = table->entry_count - table->free_count;
+}
+
+/* The entity's entry, claimed for this generation; NULL when it cannot be tracked */
+static struct history_entry *table_sample(struct history_table *table, unsigned long long key0,
+                                          unsigned long long key1) {
+    size_t pos = hash_key(key0, key1, table->capacity);
+    while (table->capacity != 0 && table->slots[pos].entry != 0) {
+        const struct history_slot *slot = &table->slots[pos];
+        if (slot->key[0] == key0 && slot->key[1] == key1) {
+            struct history_entry *entry = entry_at(table, (int)slot->entry - 1);
+            if (entry->generation == table->generation) return NULL; // sampled twice
+            if (entry->generation + 1 != table->generation) {
+                // Missed a scan whose sweep never ran; its ring has a gap
+                memset((char *)entry + sizeof(*entry), 0, table->entry_size - sizeof(*entry));
+                entry->first = table->generation;
+            }
+            entry->generation = table->generation;
+            table->stale--;
+            return entry;
+        }
+        pos = (pos + 1) & (table->capacity - 1);
+    }
+
+    // Keep the load factor below 70% so probe chains stay short
+    int live = table->entry_count - table->free_count;
+    if (live >= HISTORY_MAX_ENTRIES) return NULL;
+    if ((size_t)(live + 1) * 10 > table->capacity * 7 &&
+        reindex(table, table->capacity ? table->capacity * 2 : INITIAL_CAPACITY) != 0) {
+        return NULL;
+    }
+
+    int index;
+    if (table->free_count > 0) {
+        index = table->free_entries[--table->free_count];
+    } else {
+        if (table->entry_count == table->entry_capacity) {
+            int new_capacity = table->entry_capacity ? table->entry_capacity * 2 : INITIAL_CAPACITY;
+            char *entries = realloc(table->entries, (size_t)new_capacity * table->entry_size);
+            if (!entries) return NULL;
+            table->entries = entries;
+            int *free_entries = realloc(table->free_entries, new_capacity * sizeof(int));
+            if (!free_entries) return NULL;
+            table->free_entries = free_entries;
+            table->entry_capacity = new_capacity;
+        }
+        index = table->entry_count++;
+    }
+
+    struct history_entry *entry = entry_at(table, index);
+    memset(entry, 0, table->entry_size);
+    entry->key[0] = key0;
+    entry->key[1] = key1;
+    entry->first = table->generation;
+    entry->generation = table->generation;
+    place(table->slots, table->capacity, entry, index);
+    return entry;
+}
+
+/* Keep the entity's entry through this generation's sweep, without a sample */
+static void table_keep(struct history_table *table, unsigned long long key0,
+                       unsigned long long key1) {
+    size_t pos = hash_key(key0, key1, table->capacity);
+    while (table->capacity != 0 && table->slots[pos].entry != 0) {
+        const struct history_slot *slot = &table->slots[pos];
+        if (slot->key[0] == key0 && slot->key[1] == key1) {
+            struct history_entry *entry = entry_at(table, (int)slot->entry - 1);
+            if (entry->generation != table->generation) {
+                entry->generation = table->generation;
+                table->stale--;
+            }
+            return;
+        }
+        pos = (pos + 1) & (table->capacity - 1);
+    }
+}
+
+static void table_sweep(struct history_table *table) {
+    if (table->stale == 0) return;
+
+    for (int i = 0; i < table->entry_count; i++) {
+        struct history_entry *entry = entry_at(table, i);
+        if (entry->generation != 0 && entry->generation != table->generation) {
+            entry->generation = 0;
+            table->free_entries[table->free_count++] = i;
+        }
+    }
+    table->stale = 0;
+    reindex(table, table->capacity);
+}
+
+static void table_release(struct history_table *table) {
+    free(table->slots);
+    free(table->entries);
+    free(table->free_entries);
+    size_t entry_size = table->entry_size;
+    memset(table, 0, sizeof(*table));
+    table->entry_size = entry_size;
+}
+
+/* Samples in the window before this generation's is added */
+static unsigned int window_before(const struct history_table *table,
+                                  const struct history_entry *entry) {
+    unsigned int seen = table->generation - entry->first;
+    return seen < HISTORY_DEPTH ? seen : HISTORY_DEPTH;
+}
+
+/*
+ * Slide the window of one series: the pair (previous, value) enters it
+ * and, once it is full, the pair starting at the overwritten sample
+ * leaves. Returns the window's falls.
+ */
+static unsigned char push_series(unsigned int *series, unsigned char drops, unsigned int window,
+                                 unsigned int generation, unsigned int value) {
+    unsigned int slot = generation & DEPTH_MASK;
+    if (window == HISTORY_DEPTH &&
+        series[(slot + 1) & DEPTH_MASK] < series[slot]) {
+        drops--;
+    }
+    if (window > 0 && value < series[(generation - 1) & DEPTH_MASK]) drops++;
+    series[slot] = value;
+    return drops;
+}
+
+/* Grew across the whole window without ever falling */
+static int series_rising(const unsigned int *series, unsigned char drops, unsigned int window,
+                         unsigned int generation) {
+    if (window < HISTORY_TREND_SAMPLES || drops != 0) return 0;
+    unsigned int oldest = (generation - window + 1) & DEPTH_MASK;
+    return series[generation & DEPTH_MASK] > series[oldest];
+}
+
+static unsigned int clamp_uint(unsigned long value) {
+    return value > 0xffffffffUL ? 0xffffffffU : (unsigned int)value;
+}
+
+void history_sockets_begin(void) {
+    table_begin(&sockets);
+}
+
+unsigned char history_socket(const struct socket_table *table, int row) {
+    if (table->inode[row] == 0) return 0;
+
+    struct socket_history *history =
+        (struct socket_history *)table_sample(&sockets, table->inode[row], 0);
+    if (!history) return 0;
+
+    unsigned int generation = sockets.generation;
+    unsigned long long now = sockets.scan_ns;
+    unsigned int window = window_before(&sockets, &history->head);
+    if (window == 0 || history->state != table->state[row]) {
+        history->state = table->state[row];
+        history->state_since_ns = now;
+    }
+
+    history->rx_drops = push_series(history->rx_queue, history->rx_drops, window, generation,
+                                    table->rx_queue[row]);
+    history->tx_drops = push_series(history->tx_queue, history->tx_drops, window, generation,
+                                    table->tx_queue[row]);
+    history->memory_drops = push_series(history->memory, history->memory_drops, window,
+                                        generation, clamp_uint(table->memory_usage[row]));
+    window = window < HISTORY_DEPTH ? window + 1 : HISTORY_DEPTH;
+
+    unsigned char flags = 0;
+    if ((history->state == SOCKET_STATE_CLOSE_WAIT &&
+         now - history->state_since_ns >= HISTORY_CLOSE_WAIT_SECONDS * 1000000000ULL) ||
+        series_rising(history->rx_queue, history->rx_drops, window, generation) ||
+        series_rising(history->tx_queue, history->tx_drops, window, generation)) {
+        flags |= SOCKET_FLAG_HUNG;
+    }
+    if (series_rising(history->memory, history->memory_drops, window, generation)) {
+        flags |= SOCKET_FLAG_LEAK;
+    }
+    return flags;
+}
+
+void history_sockets_sweep(void) {
+    table_sweep(&sockets);
+}
+
+void history_processes_begin(void) {
+    table_begin(&processes);
+}
+
+static double seconds_since(unsigned long long base_ns, unsigned long long ns) {
+    return (double)(ns - base_ns) / NSEC_PER_SEC;
+}
+
+/* Recompute the sums over the window, relative to its oldest sample */
+static void rebase_sums(struct process_history *history, unsigned int window) {
+    unsigned int oldest = history->samples - window;
+    history->base_ns = history->sample_ns[oldest & DEPTH_MASK];
+    history->sum_t = history->sum_rss = history->sum_tt = history->sum_t_rss = 0;
+    for (unsigned int n = oldest; n != history->samples; n++) {
+        double t = seconds_since(history->base_ns, history->sample_ns[n & DEPTH_MASK]);
+        double rss = (double)history->rss_kb[n & DEPTH_MASK];
+        history->sum_t += t;
+        history->sum_rss += rss;
+        history->sum_tt += t * t;
+        history->sum_t_rss += t * rss;
+    }
+}
+
+unsigned char history_process(pid_t pid, unsigned long long start_time, unsigned long rss_kb) {
+    struct process_history *history =
+        (struct process_history *)table_sample(&processes, (unsigned long long)(unsigned int)pid,
+                                               start_time);
+    if (!history) return 0;
+
+    unsigned long long now = processes.scan_ns;
+    unsigned int window = history->samples < HISTORY_DEPTH ? history->samples : HISTORY_DEPTH;
+    unsigned int slot = history->samples & DEPTH_MASK;
+
+    if (window == HISTORY_DEPTH) {
+        double t = seconds_since(history->base_ns, history->sample_ns[slot]);
+        double rss = (double)history->rss_kb[slot];
+        history->sum_t -= t;
+        history->sum_rss -= rss;
+        history->sum_tt -= t * t;
+        history->sum_t_rss -= t * rss;
+    }
+    history->rss_kb[slot] = rss_kb;
+    history->sample_ns[slot] = now;
+    history->samples++;
+    window = window < HISTORY_DEPTH ? window + 1 : HISTORY_DEPTH;
+
+    // Once per window the sums start over from the ring, so rounding
+    // cannot build up and times stay small
+    if (window == 1 || slot == 0) {
+        rebase_sums(history, window);
+    } else {
+        double t = seconds_since(history->base_ns, now);
+        double rss = (double)rss_kb;
+        history->sum_t += t;
+        history->sum_rss += rss;
+        history->sum_tt += t * t;
+        history->sum_t_rss += t * rss;
+    }
+
+    if (window < HISTORY_TREND_SAMPLES) return 0;
+    unsigned long oldest = history->rss_kb[(history->samples - window) & DEPTH_MASK];
+    if (rss_kb < oldest + HISTORY_RSS_LEAK_MIN_KB) return 0;
+
+    double n = (double)window;
+    double spread = n * history->sum_tt - history->sum_t * history->sum_t;
+    if (spread <= 0) return 0;
+    double slope = (n * history->sum_t_rss - history->sum_t * history->sum_rss) / spread;
+    return slope >= HISTORY_RSS_LEAK_KB_PER_SEC ? PROCESS_FLAG_LEAK : 0;
+}
+
+void history_process_keep(pid_t pid, unsigned long long start_time) {
+    table_keep(&processes, (unsigned long long)(unsigned int)pid, start_time);
+}
+
+void history_processes_sweep(void) {
+    table_sweep(&processes);
+}
+
+void history_release(void) {
+    table_release(&sockets);
+    table_release(&processes);
+}
@@ -0,0 +1,1512 @@
+/*
+ * Embedded HTTP/JSON API
+ *
+ * A scanner thread refreshes one snapshot on the configured cadences and
+ * serializes every endpoint's body once per scan, gzipping them too once
+ * any client has asked for gzip. It hands each finished response set to
+ * the server thread through an eventfd. The server thread runs a single
+ * non-blocking epoll loop speaking HTTP/1.1 with keep-alive and
+ * pipelining. Answering a request is only a header snprintf and a
+ * sendmsg of bytes that are already prepared.
+ *
+ * Response sets are reference counted by the server thread alone: the
+ * current set holds one reference and each connection still sending a
+ * body from a set holds another, so a new scan never frees bytes that
+ * are halfway out of a socket.
+ *
+ * /api/events is a Server-Sent Events stream. A new stream starts with
+ * a "snapshot" event holding every row under its stable key. After that
+ * it gets one "delta" event per scan, listing the rows added, changed
+ * and removed since the previous scan. Delta frames chain oldest to
+ * newest and the server keeps the last EVENT_HISTORY of them. A client
+ * that reconnects with a Last-Event-ID still in that window resumes
+ * where it left off. Any other client, and any stream that falls out of
+ * the window, is resynced with a fresh snapshot event.
+ *
+ * Those bodies follow the command line's query. A request that brings
+ * its own pid, name, port, protocol, state, fields, smaps or maps
+ * parameters is answered from a view of the snapshot its set was built
+ * from (snapshot_view.h), written on the server thread. Each of the
+ * scanner's two snapshots has a reader-writer lock, held only while a
+ * view copies its rows, so the scanner never refills one under it. Only
+ * maps and smaps read /proc again, for the processes the view kept: up
+ * to MEMORY_QUERY_MAX of them, picked by pid or name. A memory reader
+ * thread does those reads and hands the body back through an eventfd,
+ * and its connection reads nothing more until the answer is sent, so
+ * the epoll loop never waits on a file.
+ *
+ * /metrics is one more body of the same set, the snapshot aggregated into
+ * Prometheus gauges, so a scrape never triggers a scan of its own.
+ *
+ * /api/top and /api/groupby answer from rankings the scanner also builds
+ * once per scan: every metric's top processes and every key's largest
+ * socket groups, AGGREGATE_MAX_LIMIT rows each. A request only picks one
+ * and writes as many rows as it asked for, a few kilobytes whatever the
+ * snapshot's size.
+ *
+ * With --history the scanner also records each scan to the snapshot log,
+ * and /api/history?from=&to= answers from that file. Those answers are
+ * built on the server thread per request, from the index and the records
+ * in range only, so they stay short next to a scan.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+#include "../include/sockmap.h"
+#include "../include/json_writer.h"
+#include "../include/proc_parse.h"
+#include "../include/uring_batch.h"
+#include "../include/http_server.h"
+#include "../include/snapshot_diff.h"
+#include "../include/scan_query.h"
+#include "../include/snapshot_log.h"
+#include "../include/metrics.h"
+#include "../include/scan_schedule.h"
+#include "../include/aggregate.h"
+#include "../include/snapshot_view.h"
+
+#define MAX_EVENTS 64
+#define REQUEST_MAX 8192
+#define MAX_CONNECTIONS 1024
+#define IDLE_TIMEOUT 60
+#define EVENT_HISTORY 32          /* delta frames kept for resuming streams */
+#define HEARTBEAT_INTERVAL 15     /* seconds of silence before a stream gets a comment */
+#define MEMORY_QUERY_MAX 64       /* processes one maps or smaps request may read */
+
+#define JSON_TYPE "application/json"
+#define METRICS_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+enum { BODY_TRACE, BODY_SOCKETS, BODY_MEMORY, BODY_PROCESSES, BODY_METRICS, BODY_COUNT };
+
+static const char *const body_paths[BODY_COUNT] = {
+    "/api/trace-sockets", "/api/sockets", "/api/memory", "/api/processes", "/metrics",
+};
+
+static const char *const body_types[BODY_COUNT] = {
+    JSON_TYPE, JSON_TYPE, JSON_TYPE, JSON_TYPE, METRICS_TYPE,
+};
+
+struct http_body {
+    char *data;
+    size_t len;
+    size_t capacity;
+    char *gzip;               /* NULL until some client accepted gzip */
+    size_t gzip_len;
+};
+
+/* One scan's "delta" event; each frame holds a reference to the next */
+struct event_frame {
+    int refs;
+    unsigned long long sequence;
+    struct event_frame *next;
+    struct http_body body;
+};
+
+/* Every endpoint's body for one snapshot */
+struct response_set {
+    int refs;
+    time_t timestamp;
+    unsigned long long sequence;
+    struct scan_stats stats;        /* of the scan the set was built from, for /api/health */
+    struct http_body bodies[BODY_COUNT];
+    struct http_body resync;        /* "snapshot" event starting a stream at this set */
+    struct event_frame *delta;      /* from the previous set; NULL if it could not be built */
+    int slot;                       /* scanner snapshot the set was built from */
+    struct top_list top[TOP_COUNT]; /* for /api/top, by every metric */
+    struct group_list groups[GROUP_COUNT]; /* for /api/groupby, by every key */
+    struct response_set *next_pending;
+};
+
+struct scanner {
+    const struct sockmap_config *cfg;
+    pthread_mutex_t lock;
+    int wake_fd;                    /* eventfd the server writes to stop the scanner */
+    int stop;
+    struct scan_schedule schedule;  /* -i 0 scans once, then only waits for wake_fd */
+    struct response_set *pending;   /* sets the loop has not taken yet, oldest first */
+    struct response_set *pending_tail;
+    int gzip_wanted;                /* set by the loop, read by the scanner */
+    int event_fd;
+    unsigned long long sequence;    /* of the last set built */
+    unsigned int stream_id;         /* tells this run's event ids from a previous run's */
+    struct snapshot_log history;
+    int recording;                  /* history is open */
+    struct json_writer out;
+    struct json_writer events;      /* event data is single-line JSON, never pretty */
+
+    // Scans alternate between two snapshots so each can be diffed against the last
+    struct sockmap_snapshot snaps[2];
+    pthread_rwlock_t snap_locks[2]; /* written only while the scanner refills that snapshot */
+    int snap_valid[2];              /* the last refill completed */
+};
+
+struct connection;
+
+/* A request whose memory is read afresh, answered by the memory reader */
+struct memory_job {
+    struct connection *conn;        /* NULL once the connection closed; server thread only */
+    int body;
+    int head_only;
+    int slot;                       /* scanner snapshot the view is taken from */
+    struct scan_query query;
+    int status;                     /* 200, or the error to answer with */
+    const char *error;
+    struct http_body reply;
+    struct memory_job *next;
+};
+
+/* Thread reading fresh memory for requests, off the epoll loop */
+struct memory_reader {
+    struct scanner *scanner;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    struct memory_job *queue;       /* waiting, oldest first */
+    struct memory_job *queue_tail;
+    struct memory_job *done;        /* answered, for the server thread to send */
+    int done_fd;                    /* eventfd the reader signals when it answers one */
+    int stop;
+    struct sockmap_snapshot view;
+    struct json_writer out;
+};
+
+struct connection {
+    int fd;
+    unsigned int events;            /* what epoll is watching for */
+    time_t last_active;
+    int keep_alive;
+    int writing;
+    struct connection *prev, *next;
+    size_t in_len;
+    size_t head_len, head_sent;
+    const char *body;
+    size_t body_len, body_sent;
+    struct response_set *set;       /* keeps body alive while it is sent */
+    int streaming;                  /* answering /api/events; no more requests are read */
+    unsigned long long sequence;    /* last event queued on the stream */
+    struct event_frame *frame;      /* keeps a delta alive while it is sent */
+    struct http_body reply;         /* bodies built per request that need more than small */
+    struct memory_job *job;         /* memory read the reply waits on; no requests are read */
+
+    // Buffers last, so accepting only clears the fields above
+    char in[REQUEST_MAX];
+    char head[512];
+    char small[512];                /* bodies built per request */
+};
+
+struct server {
+    int listen_fd;
+    int epoll_fd;
+    struct scanner *scanner;
+    struct response_set *current;
+    struct event_frame *history;    /* oldest delta kept; the rest follow via next */
+    struct event_frame *latest;
+    struct connection *connections;
+    int connection_count;
+    struct json_writer replies;     /* writes health and history answers into a reply */
+    struct sockmap_snapshot view;   /* a request's own query applied to a snapshot */
+    struct memory_reader *reader;
+    char binary_path[256];
+};
+
+/* epoll tags for the non-connection descriptors */
+static int listener_tag, scanner_tag, reader_tag;
+
+static const char heartbeat[] = ": keepalive\n\n";
+
+static void frame_release(struct event_frame *frame) {
+    // Iterative, so dropping a long chain cannot recurse deeply
+    while (frame && --frame->refs == 0) {
+        struct event_frame *next = frame->next;
+        free(frame->body.data);
+        free(frame);
+        frame = next;
+    }
+}
+
+static void set_release(struct response_set *set) {
+    if (!set || --set->refs > 0) return;
+    for (int i = 0; i < BODY_COUNT; i++) {
+        free(set->bodies[i].data);
+        free(set->bodies[i].gzip);
+    }
+    free(set->resync.data);
+    frame_release(set->delta);
+    free(set);
+}
+
+/* json_sink_fn appending to a body */
+static int body_append(void *ctx, const char *data, size_t len) {
+    struct http_body *body = ctx;
+    if (body->len + len > body->capacity) {
+        size_t capacity = body->capacity ? body->capacity : 64 * 1024;
+        while (capacity < body->len + len) capacity *= 2;
+        char *grown = realloc(body->data, capacity);
+        if (!grown) return -1;
+        body->data = grown;
+        body->capacity = capacity;
+    }
+    memcpy(body->data + body->len, data, len);
+    body->len += len;
+    return 0;
+}
+
+static int gzip_body(struct http_body *body) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits 15 + 16 asks zlib for a gzip wrapper
+    if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+
+    size_t bound = deflateBound(&zs, body->len);
+    body->gzip = malloc(bound);
+    if (!body->gzip) {
+        deflateEnd(&zs);
+        return -1;
+    }
+
+    zs.next_in = (Bytef *)body->data;
+    zs.avail_in = (uInt)body->len;
+    zs.next_out = (Bytef *)body->gzip;
+    zs.avail_out = (uInt)bound;
+    int status = deflate(&zs, Z_FINISH);
+    body->gzip_len = zs.total_out;
+    deflateEnd(&zs);
+
+    if (status != Z_STREAM_END) {
+        free(body->gzip);
+        body->gzip = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void end_section(struct json_writer *out, const struct sockmap_snapshot *snap) {
+    json_key(out, "timestamp");
+    json_int(out, (long long)snap->timestamp);
+    json_end_object(out);
+    json_newline(out);
+    json_flush(out);
+}
+
+/* One endpoint's document: {"<key>": [...], "timestamp": N} */
+static void write_section(struct json_writer *out, const struct sockmap_snapshot *snap,
+                          const char *key, unsigned int fields,
+                          void (*section)(const struct sockmap_snapshot *, unsigned int,
+                                          struct json_writer *)) {
+    json_begin_object(out);
+    json_key(out, key);
+    section(snap, fields, out);
+    end_section(out, snap);
+}
+
+/* One of the JSON bodies, BODY_TRACE to BODY_PROCESSES, for snap under query */
+static void write_body(struct json_writer *out, const struct sockmap_snapshot *snap,
+                       const struct scan_query *query, int body) {
+    if (body == BODY_TRACE) {
+        output_json(snap, query, out);
+    } else if (body == BODY_SOCKETS) {
+        write_section(out, snap, "sockets", query_socket_fields(query), output_socket_array);
+    } else if (body == BODY_MEMORY) {
+        json_begin_object(out);
+        output_memory_section(snap, query, out);
+        end_section(out, snap);
+    } else {
+        write_section(out, snap, "processes", query_process_fields(query), output_process_array);
+    }
+}
+
+/* "id:" and "event:" lines, then the start of the data line */
+static int begin_event(struct scanner *scanner, struct http_body *body, const char *event,
+                       unsigned long long sequence) {
+    char head[96];
+    int len = snprintf(head, sizeof(head), "id: %x.%llu\nevent: %s\ndata: ",
+                       scanner->stream_id, sequence, event);
+    scanner->events.sink_ctx = body;
+    return body_append(body, head, (size_t)len);
+}
+
+static int finish_event(struct scanner *scanner, struct http_body *body) {
+    if (json_flush(&scanner->events) != 0) return -1;
+    return body_append(body, "\n\n", 2);
+}
+
+static struct event_frame *build_delta(struct scanner *scanner, const struct sockmap_snapshot *prev,
+                                       const struct sockmap_snapshot *snap,
+                                       unsigned long long sequence) {
+    struct event_frame *frame = calloc(1, sizeof(*frame));
+    if (!frame) return NULL;
+    frame->refs = 1;
+    frame->sequence = sequence;
+
+    if (begin_event(scanner, &frame->body, "delta", sequence) != 0 ||
+        output_snapshot_delta(prev, snap, sequence, &scanner->events) != 0 ||
+        finish_event(scanner, &frame->body) != 0) {
+        frame_release(frame);
+        return NULL;
+    }
+    return frame;
+}
+
+/* prev is the snapshot of the last set built, or NULL for the first */
+static struct response_set *build_response_set(struct scanner *scanner,
+                                               const struct sockmap_snapshot *snap,
+                                               const struct sockmap_snapshot *prev) {
+    struct response_set *set = calloc(1, sizeof(*set));
+    if (!set) return NULL;
+    set->refs = 1;
+    set->timestamp = snap->timestamp;
+    set->sequence = scanner->sequence + 1;
+    set->stats = snap->stats;
+
+    // One writer serves every body and only its destination changes. The
+    // bodies follow the command line's query; requests with their own are
+    // answered from a view of snap instead (query_response)
+    struct json_writer *out = &scanner->out;
+    SCAN_STAT_START(started);
+    for (int i = 0; i < BODY_METRICS; i++) {
+        out->sink_ctx = &set->bodies[i];
+        write_body(out, snap, scanner->cfg->query, i);
+    }
+    out->sink_ctx = &set->bodies[BODY_METRICS];
+    if (output_metrics(snap, scanner->cfg->metrics_max_processes, out) == 0) json_flush(out);
+
+    for (int i = 0; i < TOP_COUNT; i++) {
+        if (aggregate_top(snap, i, AGGREGATE_MAX_LIMIT, &set->top[i]) != 0) {
+            set_release(set);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < GROUP_COUNT; i++) {
+        if (aggregate_groups(snap, i, AGGREGATE_MAX_LIMIT, &set->groups[i]) != 0) {
+            set_release(set);
+            return NULL;
+        }
+    }
+
+    int gzip = __atomic_load_n(&scanner->gzip_wanted, __ATOMIC_RELAXED);
+    for (int i = 0; i < BODY_COUNT; i++) {
+        if (!set->bodies[i].data) {
+            set_release(set);
+            return NULL;
+        }
+        if (gzip) gzip_body(&set->bodies[i]);
+    }
+
+    if (begin_event(scanner, &set->resync, "snapshot", set->sequence) != 0) {
+        set_release(set);
+        return NULL;
+    }
+    output_keyed_snapshot(snap, set->sequence, &scanner->events);
+    if (finish_event(scanner, &set->resync) != 0) {
+        set_release(set);
+        return NULL;
+    }
+
+    // Without a delta, streams still get this set by resyncing to it
+    if (prev) set->delta = build_delta(scanner, prev, snap, set->sequence);
+    SCAN_STAT_STOP(SCAN_PHASE_OUTPUT, started);
+    return set;
+}
+
+static void *scanner_main(void *arg) {
+    struct scanner *scanner = arg;
+    const struct sockmap_config *cfg = scanner->cfg;
+
+    struct sockmap_snapshot *snaps = scanner->snaps;
+    int current = 0, have_previous = 0;
+
+    // Collectors rerun on their own cadences; the first scan takes everything
+    unsigned int refresh = QUERY_ALL;
+
+    for (;;) {
+        struct sockmap_snapshot *snap = &snaps[current];
+        const struct sockmap_snapshot *prev = have_previous ? &snaps[current ^ 1] : NULL;
+
+        // Requests may still be reading this snapshot's previous contents
+        pthread_rwlock_wrlock(&scanner->snap_locks[current]);
+        int scanned = scan_snapshot_update(cfg, snap, prev, refresh) >= 0;
+        scanner->snap_valid[current] = scanned;
+        pthread_rwlock_unlock(&scanner->snap_locks[current]);
+
+        if (!scanned) {
+            fprintf(stderr, "Error scanning /proc\n");
+        } else {
+            struct response_set *set = build_response_set(scanner, snap, prev);
+            if (set) {
+                set->slot = current;
+                // Recorded only with its set, so the other snapshot is always the last recorded
+                if (scanner->recording && snapshot_log_append(&scanner->history, prev, snap) != 0) {
+                    fprintf(stderr, "Failed to record snapshot to %s\n", cfg->history_path);
+                }
+                scanner->sequence = set->sequence;
+                current ^= 1;
+                have_previous = 1;
+                refresh = 0;
+
+                // Queued rather than replaced, so no delta is skipped
+                pthread_mutex_lock(&scanner->lock);
+                if (scanner->pending_tail) scanner->pending_tail->next_pending = set;
+                else scanner->pending = set;
+                scanner->pending_tail = set;
+                pthread_mutex_unlock(&scanner->lock);
+
+                uint64_t one = 1;
+                if (write(scanner->event_fd, &one, sizeof(one)) < 0) {
+                    perror("eventfd");
+                }
+            }
+            if (cfg->verbose) {
+                fprintf(stderr, "Scanned %d processes, %d sockets, %d mappings (arena %zu KB)\n",
+                        snap->processes.count, snap->sockets.count, snap->memory.count,
+                        arena_footprint(&snap->arena) / 1024);
+            }
+        }
+
+        // Wait for the next collector, or until the server stops
+        int due;
+        do {
+            due = scan_schedule_wait(&scanner->schedule, scanner->wake_fd);
+        } while (due == 0 && !__atomic_load_n(&scanner->stop, __ATOMIC_RELAXED));
+        if (due < 0) {
+            perror("timerfd");
+            break;
+        }
+        if (__atomic_load_n(&scanner->stop, __ATOMIC_RELAXED)) break;
+        refresh |= (unsigned int)due;
+    }
+
+    free_snapshot(&snaps[0]);
+    free_snapshot(&snaps[1]);
+    snapshot_diff_release();
+    proc_parse_release();
+    uring_batch_release();
+    return NULL;
+}
+
+/* "[ADDR:]PORT" */
+static int parse_listen(const char *spec, struct sockaddr_in *addr) {
+    char host[64] = "127.0.0.1";
+    const char *port = spec;
+    const char *colon = strrchr(spec, ':');
+    if (colon) {
+        size_t len = (size_t)(colon - spec);
+        if (len >= sizeof(host)) return -1;
+        memcpy(host, spec, len);
+        host[len] = '\0';
+        port = colon + 1;
+    }
+
+    char *end;
+    long value = strtol(port, &end, 10);
+    if (*port == '\0' || *end != '\0' || value <= 0 || value > 65535) return -1;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((unsigned short)value);
+    return inet_pton(AF_INET, host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+static int open_listener(const char *spec) {
+    struct sockaddr_in addr;
+    if (parse_listen(spec, &addr) != 0) {
+        fprintf(stderr, "Invalid listen address: %s\n", spec);
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        perror(spec);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void close_connection(struct server *server, struct connection *conn) {
+    if (conn->job) conn->job->conn = NULL; // The reader finishes it and the loop frees it
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    set_release(conn->set);
+    frame_release(conn->frame);
+    free(conn->reply.data);
+
+    if (conn->prev) conn->prev->next = conn->next;
+    else server->connections = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    server->connection_count--;
+    free(conn);
+}
+
+static void watch(struct server *server, struct connection *conn, unsigned int events) {
+    if (conn->events == events) return;
+    struct epoll_event ev = { .events = events, .data.ptr = conn };
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->events = events;
+}
+
+static void accept_connections(struct server *server) {
+    for (;;) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return; // EAGAIN, or out of descriptors until some close
+        }
+
+        struct connection *conn = server->connection_count < MAX_CONNECTIONS
+                                  ? malloc(sizeof(*conn)) : NULL;
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        memset(conn, 0, offsetof(struct connection, in));
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        conn->last_active = time(NULL);
+        conn->next = server->connections;
+        if (conn->next) conn->next->prev = conn;
+        server->connections = conn;
+        server->connection_count++;
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close_connection(server, conn);
+        }
+    }
+}
+
+static const char *status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 431: return "Request Header Fields Too Large";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        default: return "Internal Server Error";
+    }
+}
+
+static void start_response(struct connection *conn, int status, const char *type,
+                           const char *body, size_t len, int gzip, int head_only) {
+    conn->head_len = (size_t)snprintf(conn->head, sizeof(conn->head),
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %zu\r\n"
+        "%s"
+        "Vary: Accept-Encoding\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: %s\r\n"
+        "\r\n",
+        status, status_text(status), type, len,
+        gzip ? "Content-Encoding: gzip\r\n" : "",
+        conn->keep_alive ? "keep-alive" : "close");
+    conn->head_sent = 0;
+    conn->body = head_only ? NULL : body;
+    conn->body_len = head_only ? 0 : len;
+    conn->body_sent = 0;
+    conn->writing = 1;
+}
+
+static void error_response(struct connection *conn, int status, const char *message) {
+    size_t len = (size_t)snprintf(conn->small, sizeof(conn->small), "{\"error\":\"%s\"}\n", message);
+    start_response(conn, status, JSON_TYPE, conn->small, len, 0, 0);
+}
+
+static void options_response(struct connection *conn) {
+    conn->head_len = (size_t)snprintf(conn->head, sizeof(conn->head),
+        "HTTP/1.1 204 No Content\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Access-Control-Allow-Methods: GET, HEAD, OPTIONS\r\n"
+        "Access-Control-Allow-Headers: *\r\n"
+        "Access-Control-Max-Age: 86400\r\n"
+        "Connection: %s\r\n"
+        "\r\n",
+        conn->keep_alive ? "keep-alive" : "close");
+    conn->head_sent = 0;
+    conn->body = NULL;
+    conn->body_len = conn->body_sent = 0;
+    conn->writing = 1;
+}
+
+static void health_response(struct server *server, struct connection *conn, int head_only) {
+    const struct response_set *set = server->current;
+    if (!set) {
+        int len = snprintf(conn->small, sizeof(conn->small),
+                           "{\"status\":\"starting\",\"binary_exists\":true,\"binary_path\":\"%s\","
+                           "\"snapshot_timestamp\":null,\"connections\":%d}\n",
+                           server->binary_path, server->connection_count);
+        start_response(conn, 200, JSON_TYPE, conn->small, (size_t)len, 0, head_only);
+        return;
+    }
+
+    // The latest scan's stats outgrow small, so this one is written into the reply
+    struct json_writer *out = &server->replies;
+    out->sink_ctx = &conn->reply;
+    json_begin_object(out);
+    json_key(out, "status");
+    json_string(out, "healthy");
+    json_key(out, "binary_exists");
+    json_bool(out, 1);
+    json_key(out, "binary_path");
+    json_string(out, server->binary_path);
+    json_key(out, "snapshot_timestamp");
+    json_int(out, (long long)set->timestamp);
+    json_key(out, "sequence");
+    json_uint(out, set->sequence);
+    json_key(out, "connections");
+    json_int(out, server->connection_count);
+    if (SCAN_STATS_ENABLED) {
+        json_key(out, "scan_stats");
+        output_scan_stats(&set->stats, out);
+    }
+    json_end_object(out);
+    json_newline(out);
+    if (json_flush(out) != 0 || !conn->reply.data) {
+        free(conn->reply.data);
+        memset(&conn->reply, 0, sizeof(conn->reply));
+        error_response(conn, 503, "Health could not be written");
+        return;
+    }
+    start_response(conn, 200, JSON_TYPE, conn->reply.data, conn->reply.len, 0, head_only);
+}
+
+static struct event_frame *find_frame(const struct server *server, unsigned long long sequence) {
+    for (struct event_frame *frame = server->history; frame; frame = frame->next) {
+        if (frame->sequence >= sequence) return frame->sequence == sequence ? frame : NULL;
+    }
+    return NULL;
+}
+
+static void stream_body(struct connection *conn, const char *data, size_t len) {
+    conn->body = data;
+    conn->body_len = len;
+    conn->body_sent = 0;
+    conn->writing = 1;
+    conn->last_active = time(NULL);
+}
+
+/* Queue the stream's next event, if there is one it has not had */
+static void stream_next(struct server *server, struct connection *conn) {
+    struct event_frame *frame = find_frame(server, conn->sequence + 1);
+    if (frame) {
+        frame->refs++;
+        conn->frame = frame;
+        conn->sequence = frame->sequence;
+        stream_body(conn, frame->body.data, frame->body.len);
+    } else if (server->current && server->current->sequence > conn->sequence) {
+        // New, or behind the kept deltas: start over from a full snapshot
+        conn->set = server->current;
+        conn->set->refs++;
+        conn->sequence = conn->set->sequence;
+        stream_body(conn, conn->set->resync.data, conn->set->resync.len);
+    }
+}
+
+/* since is the last sequence the client applied, 0 if it has none */
+static void start_stream(struct server *server, struct connection *conn, unsigned long long since) {
+    conn->streaming = 1;
+    conn->keep_alive = 0;
+    conn->head_len = (size_t)snprintf(conn->head, sizeof(conn->head),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "retry: 2000\n\n");
+    conn->head_sent = 0;
+    conn->body = NULL;
+    conn->body_len = conn->body_sent = 0;
+    conn->writing = 1;
+
+    // Resume only from a point the kept deltas continue
+    int current = server->current && since == server->current->sequence;
+    conn->sequence = current || find_frame(server, since + 1) ? since : 0;
+    stream_next(server, conn);
+}
+
+/* A from= or to= time: Unix seconds, or seconds before now if negative */
+static time_t query_time(const char *value, time_t now, time_t fallback) {
+    if (!value) return fallback;
+    char *end;
+    long long t = strtoll(value, &end, 10);
+    if (end == value) return fallback;
+    return t < 0 ? now + (time_t)t : (time_t)t;
+}
+
+static void history_response(struct server *server, struct connection *conn, const char *query,
+                             const char *target_end, int head_only) {
+    const char *path = server->scanner->cfg->history_path;
+    if (!path) {
+        error_response(conn, 404, "History is not being recorded; start with --history");
+        return;
+    }
+
+    time_t now = time(NULL);
+    time_t from = query_time(scan_query_param(query, target_end, "from"), now, 0);
+    time_t to = query_time(scan_query_param(query, target_end, "to"), now, now);
+    // Flushed even after a failure, so nothing is left over for the next reply
+    server->replies.sink_ctx = &conn->reply;
+    int failed = snapshot_log_query(path, from, to, &server->replies) != 0;
+    if (json_flush(&server->replies) != 0 || failed || !conn->reply.data) {
+        free(conn->reply.data);
+        memset(&conn->reply, 0, sizeof(conn->reply));
+        error_response(conn, 503, "History is not readable");
+        return;
+    }
+    start_response(conn, 200, JSON_TYPE, conn->reply.data, conn->reply.len, 0, head_only);
+}
+
+/* The value of by= in the query, as lookup resolves it; fallback if absent, -1 if unknown */
+static int query_choice(const char *query, const char *end, int (*lookup)(const char *, size_t),
+                        int fallback) {
+    const char *value = scan_query_param(query, end, "by");
+    if (!value) return fallback;
+    const char *stop = memchr(value, '&', (size_t)(end - value));
+    return lookup(value, (size_t)((stop ? stop : end) - value));
+}
+
+/* /api/top?by=&limit= or /api/groupby?by=&limit=, from the current set's rankings */
+static void aggregate_response(struct server *server, struct connection *conn, const char *query,
+                               const char *target_end, int top, int head_only) {
+    int choice = top ? query_choice(query, target_end, aggregate_top_metric, TOP_SOCKETS)
+                     : query_choice(query, target_end, aggregate_group_key, GROUP_REMOTE);
+    if (choice < 0) {
+        error_response(conn, 400, top ? "Unknown metric; use sockets, rss, close_wait or cpu"
+                                      : "Unknown key; use remote, remote_address, local_port,"
+                                        " process or state");
+        return;
+    }
+
+    int limit = AGGREGATE_DEFAULT_LIMIT;
+    const char *value = scan_query_param(query, target_end, "limit");
+    if (value) {
+        char *end;
+        long n = strtol(value, &end, 10);
+        if (end == value || (end != target_end && *end != '&') || n < 1 ||
+            n > AGGREGATE_MAX_LIMIT) {
+            error_response(conn, 400, "limit must be between 1 and 100");
+            return;
+        }
+        limit = (int)n;
+    }
+
+    const struct response_set *set = server->current;
+    if (!set) {
+        error_response(conn, 503, "No snapshot yet");
+        return;
+    }
+
+    struct json_writer *out = &server->replies;
+    out->sink_ctx = &conn->reply;
+    json_begin_object(out);
+    json_key(out, "timestamp");
+    json_int(out, (long long)set->timestamp);
+    if (top) {
+        output_top_list(&set->top[choice], limit, out);
+    } else {
+        output_group_list(&set->groups[choice], limit, out);
+    }
+    json_end_object(out);
+    json_newline(out);
+    if (json_flush(out) != 0 || !conn->reply.data) {
+        free(conn->reply.data);
+        memset(&conn->reply, 0, sizeof(conn->reply));
+        error_response(conn, 503, "Ranking could not be written");
+        return;
+    }
+    start_response(conn, 200, JSON_TYPE, conn->reply.data, conn->reply.len, 0, head_only);
+}
+
+/* Empty the view for the next request, keeping its arena's chunks */
+static void reset_view(struct sockmap_snapshot *view) {
+    struct arena arena = view->arena;
+    memset(view, 0, sizeof(*view));
+    view->arena = arena;
+    arena_reset(&view->arena);
+}
+
+/* The view of a scanner snapshot for query; the slot is read-locked only while it is copied */
+static int take_view(struct scanner *scanner, int slot, const struct scan_query *query,
+                     struct sockmap_snapshot *view) {
+    // A scanner that has already refilled the slot leaves a newer, equally whole snapshot
+    reset_view(view);
+    pthread_rwlock_rdlock(&scanner->snap_locks[slot]);
+    int failed = !scanner->snap_valid[slot] ||
+                 snapshot_view(&scanner->snaps[slot], query, view) != 0;
+    pthread_rwlock_unlock(&scanner->snap_locks[slot]);
+    return failed ? -1 : 0;
+}
+
+/* A JSON body for the request's own query, from a view of the current set's snapshot */
+static void query_response(struct server *server, struct connection *conn, int body,
+                           const struct scan_query *query, int head_only) {
+    const struct response_set *set = server->current;
+    if (!set) {
+        error_response(conn, 503, "No snapshot yet");
+        return;
+    }
+
+    struct sockmap_snapshot *view = &server->view;
+    int failed = take_view(server->scanner, set->slot, query, view) != 0;
+    server->replies.sink_ctx = &conn->reply;
+    if (!failed) write_body(&server->replies, view, query, body);
+
+    // Flushed even after a failure, so nothing is left over for the next reply
+    if (json_flush(&server->replies) != 0 || failed || !conn->reply.data) {
+        free(conn->reply.data);
+        memset(&conn->reply, 0, sizeof(conn->reply));
+        error_response(conn, 503, "Query could not be answered");
+        return;
+    }
+    start_response(conn, 200, JSON_TYPE, conn->reply.data, conn->reply.len, 0, head_only);
+}
+
+/* Hand a request that reads memory afresh to the reader; the answer is sent when it is done */
+static void memory_response(struct server *server, struct connection *conn, int body,
+                            const struct scan_query *query, int head_only) {
+    if (!server->current) {
+        error_response(conn, 503, "No snapshot yet");
+        return;
+    }
+    struct memory_job *job = calloc(1, sizeof(*job));
+    if (!job) {
+        error_response(conn, 503, "Query could not be answered");
+        return;
+    }
+    job->conn = conn;
+    job->body = body;
+    job->head_only = head_only;
+    job->slot = server->current->slot;
+    job->query = *query;
+    conn->job = job;
+
+    struct memory_reader *reader = server->reader;
+    pthread_mutex_lock(&reader->lock);
+    if (reader->queue_tail) reader->queue_tail->next = job;
+    else reader->queue = job;
+    reader->queue_tail = job;
+    pthread_cond_signal(&reader->queued);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+/* Build a job's reply: its view of the snapshot, with memory read for at most MEMORY_QUERY_MAX */
+static void answer_memory_job(struct memory_reader *reader, struct memory_job *job) {
+    struct sockmap_snapshot *view = &reader->view;
+    job->status = 503;
+    job->error = "Query could not be answered";
+    if (take_view(reader->scanner, job->slot, &job->query, view) != 0) return;
+    if (view->processes.count > MEMORY_QUERY_MAX) {
+        job->status = 400;
+        job->error = "Too many processes for maps or smaps";
+        return;
+    }
+    if (snapshot_view_memory(reader->scanner->cfg->proc_root, &job->query, view) != 0) return;
+
+    reader->out.sink_ctx = &job->reply;
+    write_body(&reader->out, view, &job->query, job->body);
+    if (json_flush(&reader->out) == 0 && job->reply.data) job->status = 200;
+}
+
+static void *reader_main(void *arg) {
+    struct memory_reader *reader = arg;
+    for (;;) {
+        pthread_mutex_lock(&reader->lock);
+        while (!reader->queue && !reader->stop) pthread_cond_wait(&reader->queued, &reader->lock);
+        struct memory_job *job = reader->stop ? NULL : reader->queue;
+        if (job) {
+            reader->queue = job->next;
+            if (!reader->queue) reader->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&reader->lock);
+        if (!job) break;
+
+        answer_memory_job(reader, job);
+
+        pthread_mutex_lock(&reader->lock);
+        job->next = reader->done;
+        reader->done = job;
+        pthread_mutex_unlock(&reader->lock);
+        uint64_t one = 1;
+        if (write(reader->done_fd, &one, sizeof(one)) < 0) {
+            perror("eventfd");
+        }
+    }
+
+    free_snapshot(&reader->view);
+    proc_parse_release();
+    return NULL;
+}
+
+static void free_jobs(struct memory_job *job) {
+    while (job) {
+        struct memory_job *next = job->next;
+        free(job->reply.data);
+        free(job);
+        job = next;
+    }
+}
+
+/* "<stream id>.<sequence>"; 0 unless it is an id this run handed out */
+static unsigned long long parse_event_id(const struct server *server, const char *value) {
+    while (*value == ' ') value++;
+    char *dot;
+    unsigned long id = strtoul(value, &dot, 16);
+    if (dot == value || *dot != '.' || id != server->scanner->stream_id) return 0;
+    return strtoull(dot + 1, NULL, 10);
+}
+
+/* Case-insensitive search for needle within [value, end) */
+static int header_has(const char *value, const char *end, const char *needle) {
+    size_t n = strlen(needle);
+    for (const char *p = value; p + n <= end; p++) {
+        if (strncasecmp(p, needle, n) == 0) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Parse the request at the start of the input buffer and set up its
+ * response. Returns the request's length, 0 if it is still incomplete,
+ * or -1 when the connection should be answered with an error and closed.
+ */
+static long handle_request(struct server *server, struct connection *conn) {
+    const char *start = conn->in;
+    const char *end = memmem(start, conn->in_len, "\r\n\r\n", 4);
+    if (!end) {
+        if (conn->in_len == sizeof(conn->in)) {
+            conn->keep_alive = 0;
+            error_response(conn, 431, "Request headers too large");
+            return -1;
+        }
+        return 0;
+    }
+    end += 2; // Keep the last header's CRLF
+
+    // Request line: METHOD SP TARGET SP VERSION CRLF
+    const char *line_end = memchr(start, '\r', (size_t)(end - start));
+    const char *method_end = memchr(start, ' ', (size_t)(line_end - start));
+    const char *target = method_end ? method_end + 1 : NULL;
+    const char *target_end = target ? memchr(target, ' ', (size_t)(line_end - target)) : NULL;
+    if (!target_end) {
+        conn->keep_alive = 0;
+        error_response(conn, 400, "Malformed request line");
+        return -1;
+    }
+    const char *version = target_end + 1;
+    conn->keep_alive = (size_t)(line_end - version) == 8 && memcmp(version, "HTTP/1.1", 8) == 0;
+
+    int accepts_gzip = 0;
+    size_t content_length = 0;
+    unsigned long long last_event = 0;
+    for (const char *line = line_end + 2; line < end; ) {
+        const char *eol = memchr(line, '\r', (size_t)(end - line));
+        const char *colon = memchr(line, ':', (size_t)(eol - line));
+        if (colon) {
+            size_t name_len = (size_t)(colon - line);
+            const char *value = colon + 1;
+            if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+                if (header_has(value, eol, "close")) conn->keep_alive = 0;
+                else if (header_has(value, eol, "keep-alive")) conn->keep_alive = 1;
+            } else if (name_len == 15 && strncasecmp(line, "Accept-Encoding", 15) == 0) {
+                accepts_gzip = header_has(value, eol, "gzip");
+            } else if (name_len == 13 && strncasecmp(line, "Last-Event-ID", 13) == 0) {
+                last_event = parse_event_id(server, value);
+            } else if (name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+                content_length = strtoul(value, NULL, 10);
+            } else if (name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+                conn->keep_alive = 0;
+                error_response(conn, 501, "Chunked request bodies are not supported");
+                return -1;
+            }
+        }
+        line = eol + 2;
+    }
+
+    // Request bodies are ignored, but must be skipped to find the next request
+    size_t total = (size_t)(end + 2 - start) + content_length;
+    if (total > sizeof(conn->in)) {
+        conn->keep_alive = 0;
+        error_response(conn, 431, "Request too large");
+        return -1;
+    }
+    if (total > conn->in_len) return 0;
+
+    size_t method_len = (size_t)(method_end - start);
+    int head_only = method_len == 4 && memcmp(start, "HEAD", 4) == 0;
+    if (method_len == 7 && memcmp(start, "OPTIONS", 7) == 0) {
+        options_response(conn);
+        return (long)total;
+    }
+    if (!head_only && !(method_len == 3 && memcmp(start, "GET", 3) == 0)) {
+        error_response(conn, 405, "Method not allowed");
+        return (long)total;
+    }
+
+    const char *query = memchr(target, '?', (size_t)(target_end - target));
+    size_t path_len = (size_t)((query ? query : target_end) - target);
+
+    if (path_len == 11 && memcmp(target, "/api/health", 11) == 0) {
+        health_response(server, conn, head_only);
+        return (long)total;
+    }
+
+    if (path_len == 12 && memcmp(target, "/api/history", 12) == 0) {
+        history_response(server, conn, query, target_end, head_only);
+        return (long)total;
+    }
+
+    if ((path_len == 8 && memcmp(target, "/api/top", 8) == 0) ||
+        (path_len == 12 && memcmp(target, "/api/groupby", 12) == 0)) {
+        aggregate_response(server, conn, query, target_end, path_len == 8, head_only);
+        return (long)total;
+    }
+
+    if (path_len == 11 && memcmp(target, "/api/events", 11) == 0) {
+        if (head_only) {
+            error_response(conn, 405, "The event stream needs GET");
+            return (long)total;
+        }
+        // ?since= does what Last-Event-ID does, for clients that cannot set headers
+        const char *since = scan_query_param(query, target_end, "since");
+        if (since) last_event = parse_event_id(server, since);
+        start_stream(server, conn, last_event);
+        return (long)total;
+    }
+
+    for (int i = 0; i < BODY_COUNT; i++) {
+        if (strlen(body_paths[i]) != path_len || memcmp(target, body_paths[i], path_len) != 0) {
+            continue;
+        }
+
+        struct scan_query request;
+        int fresh_memory;
+        const char *bad = NULL;
+        int given = query ? scan_query_parse_params(server->scanner->cfg->query, query,
+                                                    target_end, &request, &fresh_memory, &bad)
+                          : 0;
+        if (given < 0) {
+            char message[64];
+            snprintf(message, sizeof(message), "Invalid %s", bad);
+            error_response(conn, 400, message);
+            return (long)total;
+        }
+        if (given > 0 && i == BODY_METRICS) {
+            error_response(conn, 400, "Metrics take no query options");
+            return (long)total;
+        }
+        if (given > 0 && fresh_memory && (i == BODY_TRACE || i == BODY_MEMORY)) {
+            // Reads files per process, so the processes must be named
+            if (!query_selects_processes(&request) &&
+                !query_selects_processes(server->scanner->cfg->query)) {
+                error_response(conn, 400, "maps and smaps need a pid or name");
+            } else {
+                memory_response(server, conn, i, &request, head_only);
+            }
+            return (long)total;
+        }
+        if (given > 0) {
+            query_response(server, conn, i, &request, head_only);
+            return (long)total;
+        }
+
+        if (!server->current) {
+            error_response(conn, 503, "No snapshot yet");
+            return (long)total;
+        }
+
+        const struct http_body *body = &server->current->bodies[i];
+        if (accepts_gzip && !body->gzip) {
+            // Compress from the next scan on
+            __atomic_store_n(&server->scanner->gzip_wanted, 1, __ATOMIC_RELAXED);
+        }
+        int gzip = accepts_gzip && body->gzip;
+
+        conn->set = server->current;
+        conn->set->refs++;
+        start_response(conn, 200, body_types[i], gzip ? body->gzip : body->data,
+                       gzip ? body->gzip_len : body->len, gzip, head_only);
+        return (long)total;
+    }
+
+    error_response(conn, 404, "Endpoint not found");
+    return (long)total;
+}
+
+/* Returns 1 when the response is fully sent, 0 if the socket is full, -1 on error */
+static int send_response(struct connection *conn) {
+    while (conn->head_sent < conn->head_len || conn->body_sent < conn->body_len) {
+        struct iovec iov[2];
+        int count = 0;
+        if (conn->head_sent < conn->head_len) {
+            iov[count].iov_base = conn->head + conn->head_sent;
+            iov[count].iov_len = conn->head_len - conn->head_sent;
+            count++;
+        }
+        if (conn->body_sent < conn->body_len) {
+            iov[count].iov_base = (char *)conn->body + conn->body_sent;
+            iov[count].iov_len = conn->body_len - conn->body_sent;
+            count++;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)count;
+        ssize_t n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        size_t sent = (size_t)n;
+        size_t head_part = conn->head_len - conn->head_sent;
+        if (sent < head_part) {
+            conn->head_sent += sent;
+        } else {
+            conn->head_sent = conn->head_len;
+            conn->body_sent += sent - head_part;
+        }
+    }
+
+    conn->writing = 0;
+    set_release(conn->set);
+    conn->set = NULL;
+    frame_release(conn->frame);
+    conn->frame = NULL;
+    free(conn->reply.data);
+    memset(&conn->reply, 0, sizeof(conn->reply));
+    return 1;
+}
+
+/* Answer every complete request in the buffer, in order, as far as the socket allows */
+static void serve_connection(struct server *server, struct connection *conn) {
+    for (;;) {
+        if (conn->writing) {
+            int sent = send_response(conn);
+            if (sent < 0) {
+                close_connection(server, conn);
+                return;
+            }
+            if (sent == 0) {
+                watch(server, conn, EPOLLOUT);
+                return;
+            }
+            if (!conn->streaming && !conn->keep_alive) {
+                close_connection(server, conn);
+                return;
+            }
+        }
+
+        if (conn->streaming) {
+            stream_next(server, conn);
+            if (conn->writing) continue;
+            break;
+        }
+        if (conn->job) {
+            watch(server, conn, 0); // Only hangups, until the memory reader answers
+            return;
+        }
+
+        long consumed = handle_request(server, conn);
+        if (consumed == 0) break;
+        if (consumed < 0) {
+            conn->in_len = 0; // Answer the error, then close
+            continue;
+        }
+        memmove(conn->in, conn->in + consumed, conn->in_len - (size_t)consumed);
+        conn->in_len -= (size_t)consumed;
+    }
+    watch(server, conn, EPOLLIN);
+}
+
+static void read_connection(struct server *server, struct connection *conn) {
+    conn->last_active = time(NULL);
+    while (!conn->writing && conn->in_len < sizeof(conn->in)) {
+        ssize_t n = recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+        if (n > 0) {
+            // A stream only listens for the peer closing
+            conn->in_len = conn->streaming ? 0 : conn->in_len + (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        close_connection(server, conn); // Peer closed, or a hard error
+        return;
+    }
+    serve_connection(server, conn);
+}
+
+/* Append a delta to the kept chain and drop whatever falls out of the window */
+static void publish_frame(struct server *server, struct event_frame *frame) {
+    frame->refs++;
+    if (server->latest && server->latest->sequence + 1 == frame->sequence) {
+        server->latest->next = frame;
+    } else {
+        // A delta went missing; streams behind the gap resync
+        frame_release(server->history);
+        server->history = frame;
+    }
+    server->latest = frame;
+
+    while (frame->sequence - server->history->sequence >= EVENT_HISTORY) {
+        struct event_frame *oldest = server->history;
+        server->history = oldest->next;
+        server->history->refs++;
+        frame_release(oldest);
+    }
+}
+
+/* Take the sets the scanner published, in order, and pass their deltas on */
+static void take_pending(struct server *server) {
+    uint64_t count;
+    if (read(server->scanner->event_fd, &count, sizeof(count)) < 0) return;
+
+    pthread_mutex_lock(&server->scanner->lock);
+    struct response_set *set = server->scanner->pending;
+    server->scanner->pending = server->scanner->pending_tail = NULL;
+    pthread_mutex_unlock(&server->scanner->lock);
+
+    while (set) {
+        struct response_set *next = set->next_pending;
+        if (set->delta) publish_frame(server, set->delta);
+        set_release(server->current);
+        server->current = set;
+        set = next;
+    }
+
+    struct connection *conn = server->connections;
+    while (conn) {
+        struct connection *next = conn->next;
+        if (conn->streaming && conn->writing && server->current &&
+            server->current->sequence - conn->sequence >= EVENT_HISTORY) {
+            // Stalled so long its frame pins the whole chain; it can reconnect
+            close_connection(server, conn);
+        } else if (conn->streaming && !conn->writing) {
+            serve_connection(server, conn);
+        }
+        conn = next;
+    }
+}
+
+/* Send the answers the memory reader finished, and read on for their connections */
+static void take_answers(struct server *server) {
+    struct memory_reader *reader = server->reader;
+    uint64_t count;
+    if (read(reader->done_fd, &count, sizeof(count)) < 0) return;
+
+    pthread_mutex_lock(&reader->lock);
+    struct memory_job *job = reader->done;
+    reader->done = NULL;
+    pthread_mutex_unlock(&reader->lock);
+
+    while (job) {
+        struct memory_job *next = job->next;
+        struct connection *conn = job->conn;
+        if (conn) {
+            conn->job = NULL;
+            if (job->status == 200) {
+                conn->reply = job->reply;
+                memset(&job->reply, 0, sizeof(job->reply));
+                start_response(conn, 200, JSON_TYPE, conn->reply.data, conn->reply.len, 0,
+                               job->head_only);
+            } else {
+                error_response(conn, job->status, job->error);
+            }
+            serve_connection(server, conn);
+        }
+        job->next = NULL;
+        free_jobs(job);
+        job = next;
+    }
+}
+
+static void close_idle(struct server *server, time_t now) {
+    struct connection *conn = server->connections;
+    while (conn) {
+        struct connection *next = conn->next;
+        if (conn->streaming) {
+            // Keeps proxies from timing the stream out, and finds dead peers
+            if (!conn->writing && now - conn->last_active >= HEARTBEAT_INTERVAL) {
+                stream_body(conn, heartbeat, sizeof(heartbeat) - 1);
+                serve_connection(server, conn);
+            }
+        } else if (!conn->writing && now - conn->last_active > IDLE_TIMEOUT) {
+            close_connection(server, conn);
+        }
+        conn = next;
+    }
+}
+
+int run_http_server(const struct sockmap_config *cfg, volatile int *running) {
+    struct scanner scanner;
+    struct server server;
+    struct memory_reader reader;
+    memset(&scanner, 0, sizeof(scanner));
+    memset(&server, 0, sizeof(server));
+    memset(&reader, 0, sizeof(reader));
+    scanner.cfg = cfg;
+    reader.scanner = &scanner;
+    server.reader = &reader;
+    scanner.stream_id = (unsigned int)time(NULL) ^ ((unsigned int)getpid() << 16);
+    server.scanner = &scanner;
+
+    ssize_t path_len = readlink("/proc/self/exe", server.binary_path, sizeof(server.binary_path) - 1);
+    if (path_len > 0) server.binary_path[path_len] = '\0';
+
+    const char *listen_spec = cfg->http_listen ? cfg->http_listen : HTTP_DEFAULT_LISTEN;
+    server.listen_fd = open_listener(listen_spec);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    scanner.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    scanner.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    reader.done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int scheduled = scan_schedule_init(&scanner.schedule, cfg) == 0;
+    if (server.listen_fd < 0 || server.epoll_fd < 0 || scanner.event_fd < 0 ||
+        scanner.wake_fd < 0 || reader.done_fd < 0 || !scheduled) {
+        if (server.listen_fd >= 0) close(server.listen_fd);
+        if (server.epoll_fd >= 0) close(server.epoll_fd);
+        if (scanner.event_fd >= 0) close(scanner.event_fd);
+        if (scanner.wake_fd >= 0) close(scanner.wake_fd);
+        if (reader.done_fd >= 0) close(reader.done_fd);
+        scan_schedule_close(&scanner.schedule);
+        return 1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &listener_tag };
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &ev);
+    ev.data.ptr = &scanner_tag;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, scanner.event_fd, &ev);
+    ev.data.ptr = &reader_tag;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, reader.done_fd, &ev);
+
+    pthread_mutex_init(&scanner.lock, NULL);
+    pthread_rwlock_init(&scanner.snap_locks[0], NULL);
+    pthread_rwlock_init(&scanner.snap_locks[1], NULL);
+    pthread_mutex_init(&reader.lock, NULL);
+    pthread_cond_init(&reader.queued, NULL);
+    json_writer_init_sink(&reader.out, body_append, NULL, 0);
+    json_writer_init_sink(&scanner.out, body_append, NULL, cfg->pretty);
+    json_writer_init_sink(&scanner.events, body_append, NULL, 0);
+    json_writer_init_sink(&server.replies, body_append, NULL, 0);
+    if (cfg->history_path) {
+        scanner.recording = snapshot_log_open(&scanner.history, cfg->history_path,
+                                              cfg->history_size) == 0;
+        if (!scanner.recording) perror(cfg->history_path);
+    }
+
+    pthread_t thread, reader_thread;
+    int result = pthread_create(&thread, NULL, scanner_main, &scanner) != 0;
+    if (result == 0 && pthread_create(&reader_thread, NULL, reader_main, &reader) != 0) {
+        __atomic_store_n(&scanner.stop, 1, __ATOMIC_RELAXED);
+        uint64_t one = 1;
+        if (write(scanner.wake_fd, &one, sizeof(one)) < 0) {
+            perror("eventfd");
+        }
+        pthread_join(thread, NULL);
+        result = 1;
+    }
+    if (result == 0) {
+        if (cfg->verbose) fprintf(stderr, "Serving on http://%s/api\n", listen_spec);
+
+        time_t last_sweep = time(NULL);
+        struct epoll_event events[MAX_EVENTS];
+        while (*running) {
+            int n = epoll_wait(server.epoll_fd, events, MAX_EVENTS, 1000);
+            for (int i = 0; i < n; i++) {
+                void *tag = events[i].data.ptr;
+                if (tag == &listener_tag) {
+                    accept_connections(&server);
+                } else if (tag == &scanner_tag) {
+                    take_pending(&server);
+                } else if (tag == &reader_tag) {
+                    take_answers(&server);
+                } else {
+                    struct connection *conn = tag;
+                    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        close_connection(&server, conn);
+                    } else if (conn->writing) {
+                        serve_connection(&server, conn);
+                    } else {
+                        read_connection(&server, conn);
+                    }
+                }
+            }
+
+            time_t now = time(NULL);
+            if (now != last_sweep) {
+                close_idle(&server, now);
+                last_sweep = now;
+            }
+        }
+
+        uint64_t one = 1;
+        __atomic_store_n(&scanner.stop, 1, __ATOMIC_RELAXED);
+        if (write(scanner.wake_fd, &one, sizeof(one)) < 0) {
+            perror("eventfd");
+        }
+        pthread_join(thread, NULL);
+
+        pthread_mutex_lock(&reader.lock);
+        reader.stop = 1;
+        pthread_cond_signal(&reader.queued);
+        pthread_mutex_unlock(&reader.lock);
+        pthread_join(reader_thread, NULL);
+    }
+
+    // Connections first, so none points at a job freed after them
+    while (server.connections) close_connection(&server, server.connections);
+    free_jobs(reader.queue);
+    free_jobs(reader.done);
+    set_release(server.current);
+    frame_release(server.history);
+    while (scanner.pending) {
+        struct response_set *next = scanner.pending->next_pending;
+        set_release(scanner.pending);
+        scanner.pending = next;
+    }
+    if (scanner.recording) snapshot_log_close(&scanner.history);
+    json_writer_release(&scanner.out);
+    json_writer_release(&scanner.events);
+    json_writer_release(&server.replies);
+    json_writer_release(&reader.out);
+    close(scanner.wake_fd);
+    close(reader.done_fd);
+    pthread_mutex_destroy(&reader.lock);
+    pthread_cond_destroy(&reader.queued);
+    scan_schedule_close(&scanner.schedule);
+    pthread_mutex_destroy(&scanner.lock);
+    pthread_rwlock_destroy(&scanner.snap_locks[0]);
+    pthread_rwlock_destroy(&scanner.snap_locks[1]);
+    free_snapshot(&server.view);
+    close(scanner.event_fd);
+    close(server.epoll_fd);
+    close(server.listen_fd);
+    return result;
+}
@@ -0,0 +1,127 @@
+/*
+ * Socket ownership index
+ *
+ * Records which process holds each socket inode while the per-pid
+ * collector walks every fd table once, so socket rows resolve with a
+ * single lookup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "../include/sockmap.h"
+#include "../include/inode_index.h"
+#include "../include/proc_parse.h"
+
+#define INITIAL_CAPACITY 1024
+
+static size_t hash_inode(unsigned long inode, size_t capacity) {
+    // Fibonacci hashing spreads the mostly sequential inode numbers
+    return (size_t)((inode * 0x9E3779B97F4A7C15ULL) >> 16) & (capacity - 1);
+}
+
+static int index_grow(struct inode_index *index) {
+    size_t new_capacity = index->capacity ? index->capacity * 2 : INITIAL_CAPACITY;
+    struct inode_owner *new_slots = arena_calloc(index->arena, new_capacity,
+                                                 sizeof(struct inode_owner));
+    if (!new_slots) return -1;
+
+    for (size_t i = 0; i < index->capacity; i++) {
+        struct inode_owner *old = &index->slots[i];
+        if (old->inode == 0) continue;
+
+        size_t pos = hash_inode(old->inode, new_capacity);
+        while (new_slots[pos].inode != 0) {
+            pos = (pos + 1) & (new_capacity - 1);
+        }
+        new_slots[pos] = *old;
+    }
+
+    // The old table stays in the arena until the generation is reset
+    index->slots = new_slots;
+    index->capacity = new_capacity;
+    return 0;
+}
+
+int inode_index_init(struct inode_index *index, struct arena *arena) {
+    memset(index, 0, sizeof(*index));
+    index->arena = arena;
+    return index_grow(index);
+}
+
+int inode_index_insert(struct inode_index *index, unsigned long inode,
+                       pid_t pid, int fd, int proc_slot) {
+    // Keep the load factor below 70% so probe chains stay short
+    if ((index->count + 1) * 10 > index->capacity * 7) {
+        if (index_grow(index) != 0) return -1;
+    }
+
+    size_t pos = hash_inode(inode, index->capacity);
+    while (index->slots[pos].inode != 0) {
+        if (index->slots[pos].inode == inode) {
+            return 0; // Shared after fork: first owner wins
+        }
+        pos = (pos + 1) & (index->capacity - 1);
+    }
+
+    index->slots[pos].inode = inode;
+    index->slots[pos].pid = pid;
+    index->slots[pos].fd = fd;
+    index->slots[pos].proc_slot = proc_slot;
+    index->count++;
+    return 1;
+}
+
+/* Parse "socket:[12345]" link targets; returns 0 for anything else */
+static unsigned long parse_socket_inode(const char *target) {
+    if (strncmp(target, "socket:[", 8) != 0) return 0;
+    return strtoul(target + 8, NULL, 10);
+}
+
+int collect_socket_fds(int pid_fd, pid_t pid, int proc_slot, struct inode_index *index) {
+    SCAN_STAT_START(started);
+    int fd_dir_fd = openat(pid_fd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd_dir_fd < 0) return 0;
+    SCAN_STAT_ADD(files_opened, 1);
+
+    struct pp_dir fd_dir;
+    pp_dir_open(&fd_dir, fd_dir_fd);
+
+    int socket_count = 0;
+    const char *fd_name;
+    while ((fd_name = pp_dir_next(&fd_dir, NULL)) != NULL) {
+        char target[64];
+        ssize_t len = readlinkat(fd_dir_fd, fd_name, target, sizeof(target) - 1);
+        if (len <= 0) continue;
+        target[len] = '\0';
+
+        unsigned long inode = parse_socket_inode(target);
+        if (inode == 0) continue;
+
+        socket_count++;
+        if (inode_index_insert(index, inode, pid, atoi(fd_name), proc_slot) < 0) {
+            break;
+        }
+    }
+    close(fd_dir_fd);
+
+    SCAN_STAT_STOP(SCAN_PHASE_FDS, started);
+    return socket_count;
+}
+
+const struct inode_owner *inode_index_lookup(const struct inode_index *index,
+                                             unsigned long inode) {
+    if (inode == 0 || index->capacity == 0) return NULL;
+
+    size_t pos = hash_inode(inode, index->capacity);
+    while (index->slots[pos].inode != 0) {
+        if (index->slots[pos].inode == inode) {
+            return &index->slots[pos];
+        }
+        pos = (pos + 1) & (index->capacity - 1);
+    }
+    return NULL;
+}
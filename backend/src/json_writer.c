@@ -0,0 +1,365 @@
+/*
+ * Buffered JSON writer
+ *
+ * Output is formatted directly into a ring of fixed chunks, which are
+ * handed to the kernel with a single writev once all of them are full (or
+ * on an explicit flush). Integers and two-decimal floats are formatted by
+ * hand; strings are escaped and sanitized to valid UTF-8 so consumers such
+ * as Python's json.loads never choke on an odd comm or path.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "../include/json_writer.h"
+
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char hex_digits[] = "0123456789abcdef";
+
+void json_writer_init(struct json_writer *w, int fd, int pretty) {
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->pretty = pretty;
+}
+
+void json_writer_init_sink(struct json_writer *w, json_sink_fn sink, void *ctx, int pretty) {
+    json_writer_init(w, -1, pretty);
+    w->sink = sink;
+    w->sink_ctx = ctx;
+}
+
+static void writev_chunks(struct json_writer *w) {
+    struct iovec iov[JSON_CHUNKS];
+    int count = 0;
+    for (int i = 0; i <= w->current; i++) {
+        if (w->used[i] == 0) continue;
+        iov[count].iov_base = w->chunks[i];
+        iov[count].iov_len = w->used[i];
+        count++;
+    }
+
+    struct iovec *next = iov;
+    while (count > 0 && !w->error) {
+        ssize_t n = writev(w->fd, next, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            w->error = 1;
+            break;
+        }
+        // Skip past whatever the kernel took, which may end mid-chunk
+        while (count > 0 && (size_t)n >= next->iov_len) {
+            n -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = (char *)next->iov_base + n;
+            next->iov_len -= n;
+        }
+    }
+}
+
+static void sink_chunks(struct json_writer *w) {
+    for (int i = 0; i <= w->current && !w->error; i++) {
+        if (w->used[i] > 0 && w->sink(w->sink_ctx, w->chunks[i], w->used[i]) != 0) {
+            w->error = 1;
+        }
+    }
+}
+
+static int write_chunks(struct json_writer *w) {
+    if (w->sink) {
+        sink_chunks(w);
+    } else {
+        writev_chunks(w);
+    }
+
+    memset(w->used, 0, sizeof(w->used));
+    w->current = 0;
+    return w->error ? -1 : 0;
+}
+
+/* Pointer to n contiguous free bytes (n is small), or NULL after an error */
+static char *reserve(struct json_writer *w, size_t n) {
+    if (w->chunks[w->current] && w->used[w->current] + n > JSON_CHUNK_SIZE) {
+        if (w->current + 1 == JSON_CHUNKS) {
+            write_chunks(w);
+        } else {
+            w->current++;
+        }
+    }
+
+    if (!w->chunks[w->current]) {
+        w->chunks[w->current] = malloc(JSON_CHUNK_SIZE);
+        if (!w->chunks[w->current]) {
+            w->error = 1;
+            return NULL;
+        }
+    }
+    return w->error ? NULL : w->chunks[w->current] + w->used[w->current];
+}
+
+static void put_bytes(struct json_writer *w, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        char *dst = reserve(w, 1);
+        if (!dst) return;
+
+        size_t room = JSON_CHUNK_SIZE - w->used[w->current];
+        size_t n = len < room ? len : room;
+        memcpy(dst, p, n);
+        w->used[w->current] += n;
+        p += n;
+        len -= n;
+    }
+}
+
+static void put_char(struct json_writer *w, char c) {
+    char *dst = reserve(w, 1);
+    if (!dst) return;
+    *dst = c;
+    w->used[w->current]++;
+}
+
+static void newline_indent(struct json_writer *w) {
+    size_t n = 1 + 2 * (size_t)w->depth;
+    char *dst = reserve(w, n);
+    if (!dst) return;
+    dst[0] = '\n';
+    memset(dst + 1, ' ', n - 1);
+    w->used[w->current] += n;
+}
+
+static unsigned int depth_bit(int depth) {
+    return depth < JSON_MAX_DEPTH ? 1u << depth : 0;
+}
+
+/* Separator and indentation before an array element or a key */
+static void begin_item(struct json_writer *w) {
+    if (w->depth == 0) return;
+    if (w->has_items & depth_bit(w->depth)) put_char(w, ',');
+    w->has_items |= depth_bit(w->depth);
+    if (w->pretty) newline_indent(w);
+}
+
+static void begin_value(struct json_writer *w) {
+    if (w->after_key) {
+        w->after_key = 0;
+    } else {
+        begin_item(w);
+    }
+}
+
+static void open_container(struct json_writer *w, char bracket) {
+    begin_value(w);
+    put_char(w, bracket);
+    w->depth++;
+    w->has_items &= ~depth_bit(w->depth);
+}
+
+static void close_container(struct json_writer *w, char bracket) {
+    int had_items = (w->has_items & depth_bit(w->depth)) != 0;
+    w->depth--;
+    if (w->pretty && had_items) newline_indent(w);
+    put_char(w, bracket);
+}
+
+void json_begin_object(struct json_writer *w) { open_container(w, '{'); }
+void json_end_object(struct json_writer *w) { close_container(w, '}'); }
+void json_begin_array(struct json_writer *w) { open_container(w, '['); }
+void json_end_array(struct json_writer *w) { close_container(w, ']'); }
+
+/* Keys are literals from the caller and are written without escaping */
+void json_key(struct json_writer *w, const char *key) {
+    begin_item(w);
+    put_char(w, '"');
+    put_bytes(w, key, strlen(key));
+    put_bytes(w, w->pretty ? "\": " : "\":", w->pretty ? 3 : 2);
+    w->after_key = 1;
+}
+
+/* Length of a valid UTF-8 sequence starting at s, or 0 */
+static int utf8_sequence(const unsigned char *s) {
+    unsigned char c = s[0];
+    if (c >= 0xC2 && c <= 0xDF) {
+        return (s[1] & 0xC0) == 0x80 ? 2 : 0;
+    }
+    if (c >= 0xE0 && c <= 0xEF) {
+        unsigned char lo = (c == 0xE0) ? 0xA0 : 0x80;
+        unsigned char hi = (c == 0xED) ? 0x9F : 0xBF; // No UTF-16 surrogates
+        if (s[1] < lo || s[1] > hi) return 0;
+        return (s[2] & 0xC0) == 0x80 ? 3 : 0;
+    }
+    if (c >= 0xF0 && c <= 0xF4) {
+        unsigned char lo = (c == 0xF0) ? 0x90 : 0x80;
+        unsigned char hi = (c == 0xF4) ? 0x8F : 0xBF;
+        if (s[1] < lo || s[1] > hi) return 0;
+        if ((s[2] & 0xC0) != 0x80) return 0;
+        return (s[3] & 0xC0) == 0x80 ? 4 : 0;
+    }
+    return 0;
+}
+
+void json_string(struct json_writer *w, const char *str) {
+    const unsigned char *s = (const unsigned char *)str;
+    begin_value(w);
+    put_char(w, '"');
+
+    while (*s) {
+        // Copy runs of plain printable ASCII in one go
+        const unsigned char *run = s;
+        while (*s >= 0x20 && *s < 0x80 && *s != '"' && *s != '\\') s++;
+        if (s > run) put_bytes(w, run, s - run);
+        if (!*s) break;
+
+        if (*s >= 0x80) {
+            int len = utf8_sequence(s);
+            if (len > 0) {
+                put_bytes(w, s, len);
+                s += len;
+            } else {
+                put_bytes(w, "\\ufffd", 6);
+                s++;
+            }
+            continue;
+        }
+
+        char escaped[6] = { '\\', 0, 0, 0, 0, 0 };
+        size_t n = 2;
+        switch (*s) {
+            case '"': escaped[1] = '"'; break;
+            case '\\': escaped[1] = '\\'; break;
+            case '\n': escaped[1] = 'n'; break;
+            case '\r': escaped[1] = 'r'; break;
+            case '\t': escaped[1] = 't'; break;
+            default:
+                escaped[1] = 'u';
+                escaped[2] = '0';
+                escaped[3] = '0';
+                escaped[4] = hex_digits[*s >> 4];
+                escaped[5] = hex_digits[*s & 0xF];
+                n = 6;
+                break;
+        }
+        put_bytes(w, escaped, n);
+        s++;
+    }
+
+    put_char(w, '"');
+}
+
+/* Decimal digits of value, written backwards ending at end; returns the start */
+static char *format_uint(char *end, unsigned long long value) {
+    char *p = end;
+    while (value >= 100) {
+        unsigned int pair = (unsigned int)(value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        unsigned int pair = (unsigned int)value * 2;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    } else {
+        *--p = (char)('0' + value);
+    }
+    return p;
+}
+
+void json_uint(struct json_writer *w, unsigned long long value) {
+    char buf[24];
+    char *start = format_uint(buf + sizeof(buf), value);
+    begin_value(w);
+    put_bytes(w, start, buf + sizeof(buf) - start);
+}
+
+void json_int(struct json_writer *w, long long value) {
+    char buf[24];
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value
+                                             : (unsigned long long)value;
+    char *start = format_uint(buf + sizeof(buf), magnitude);
+    if (value < 0) *--start = '-';
+    begin_value(w);
+    put_bytes(w, start, buf + sizeof(buf) - start);
+}
+
+void json_fixed2(struct json_writer *w, double value) {
+    char buf[32];
+    char *end = buf + sizeof(buf);
+
+    // JSON has no NaN or infinity; clamp to something parsable
+    if (value != value) value = 0.0;
+    int negative = value < 0;
+    if (negative) value = -value;
+    if (value > 1e15) value = 1e15;
+
+    unsigned long long cents = (unsigned long long)(value * 100.0 + 0.5);
+    unsigned int fraction = (unsigned int)(cents % 100) * 2;
+    char *p = end;
+    *--p = digit_pairs[fraction + 1];
+    *--p = digit_pairs[fraction];
+    *--p = '.';
+    p = format_uint(p, cents / 100);
+    if (negative && cents != 0) *--p = '-';
+
+    begin_value(w);
+    put_bytes(w, p, end - p);
+}
+
+void json_hex_string(struct json_writer *w, unsigned long long value) {
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    *--p = '"';
+    do {
+        *--p = hex_digits[value & 0xF];
+        value >>= 4;
+    } while (value);
+    *--p = 'x';
+    *--p = '0';
+    *--p = '"';
+
+    begin_value(w);
+    put_bytes(w, p, buf + sizeof(buf) - p);
+}
+
+void json_bool(struct json_writer *w, int value) {
+    begin_value(w);
+    put_bytes(w, value ? "true" : "false", value ? 4 : 5);
+}
+
+void json_null(struct json_writer *w) {
+    begin_value(w);
+    put_bytes(w, "null", 4);
+}
+
+void json_newline(struct json_writer *w) {
+    put_char(w, '\n');
+}
+
+void json_raw(struct json_writer *w, const char *data, size_t len) {
+    put_bytes(w, data, len);
+}
+
+int json_flush(struct json_writer *w) {
+    int result = write_chunks(w);
+
+    // Report a failure once; the next document starts clean
+    w->error = 0;
+    w->depth = 0;
+    w->after_key = 0;
+    return result;
+}
+
+void json_writer_release(struct json_writer *w) {
+    for (int i = 0; i < JSON_CHUNKS; i++) {
+        free(w->chunks[i]);
+        w->chunks[i] = NULL;
+    }
+}
@@ -1,110 +1,185 @@
 /*
  * Memory mapping functionality
+ *
+ * Every process gets one rollup row from smaps_rollup, which the kernel
+ * sums in a single pass over the VMAs, so its cost does not grow with the
+ * number of mappings written out. Individual mappings and per-type
+ * rollups from the full smaps are only collected when asked for.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
-#include <dirent.h>
 #include <sys/types.h>
 #include "../include/sockmap.h"
+#include "../include/proc_walk.h"
+#include "../include/proc_parse.h"
+#include "../include/scan_query.h"
 
-int scan_memory(struct memory_info **memory) {
-    DIR *proc_dir = opendir("/proc");
-    if (!proc_dir) {
-        return -1;
+static int path_contains(const struct maps_entry *entry, const char *needle) {
+    return memmem(entry->path, entry->path_len, needle, strlen(needle)) != NULL;
+}
+
+static unsigned char classify_mapping(const struct maps_entry *entry) {
+    if (path_contains(entry, "[heap]")) {
+        return MEMORY_TYPE_HEAP;
+    } else if (path_contains(entry, "[stack]")) {
+        return MEMORY_TYPE_STACK;
+    } else if (path_contains(entry, ".so")) {
+        return MEMORY_TYPE_LIBRARY;
+    } else if (entry->path_len > 0 && entry->path[0] == '/') {
+        return MEMORY_TYPE_FILE;
     }
+    return MEMORY_TYPE_ANONYMOUS;
+}
+
+static unsigned char perm_bits(const char *perms) {
+    unsigned char bits = 0;
+    if (perms[0] == 'r') bits |= MEMORY_PERM_READ;
+    if (perms[1] == 'w') bits |= MEMORY_PERM_WRITE;
+    if (perms[2] == 'x') bits |= MEMORY_PERM_EXEC;
+    if (perms[3] == 's') bits |= MEMORY_PERM_SHARED;
+    return bits;
+}
+
+static int append_mapping(struct proc_walk *walk, pid_t pid, const struct maps_entry *entry) {
+    // Libraries and files repeat across processes; keep one copy of each path
+    int path = string_pool_intern(&walk->strings, entry->path, entry->path_len);
+    if (path < 0) return -1;
+    return memory_table_append(&walk->memory, walk->arena, pid, entry->start,
+                               entry->end - entry->start, perm_bits(entry->perms),
+                               classify_mapping(entry), (unsigned int)path);
+}
 
-    // First pass: count total memory segments
-    int total_count = 0;
-    struct dirent *proc_entry;
-    while ((proc_entry = readdir(proc_dir)) != NULL) {
-        if (proc_entry->d_type != DT_DIR) continue;
-        
-        pid_t pid = atoi(proc_entry->d_name);
-        if (pid <= 0) continue;
-
-        char maps_path[256];
-        snprintf(maps_path, sizeof(maps_path), "/proc/%d/maps", pid);
-        
-        FILE *maps_file = fopen(maps_path, "r");
-        if (!maps_file) continue;
-
-        char line[1024];
-        while (fgets(line, sizeof(line), maps_file)) {
-            total_count++;
+int parse_memory_maps(const char *buf, size_t len, pid_t pid, struct proc_walk *walk) {
+    const char *end = buf + len;
+    int added = 0;
+    const char *eol;
+    for (const char *line = buf; line < end; line = eol + 1) {
+        eol = pp_find_eol(line, end);
+        struct maps_entry entry;
+        if (pp_parse_maps_line(line, eol, &entry) != 0) {
+            SCAN_STAT_ADD(parse_errors, 1);
+            continue;
         }
-        fclose(maps_file);
+        if (append_mapping(walk, pid, &entry) != 0) return -1;
+        added++;
     }
-    closedir(proc_dir);
 
-    if (total_count == 0) {
-        *memory = NULL;
-        return 0;
-    }
+    return added;
+}
 
-    *memory = malloc(total_count * sizeof(struct memory_info));
-    if (!*memory) {
-        return -1;
+/* smaps counters kept in a rollup */
+static const struct {
+    const char *key;
+    size_t offset;
+} usage_keys[] = {
+    { "Rss:", offsetof(struct memory_usage, rss_kb) },
+    { "Pss:", offsetof(struct memory_usage, pss_kb) },
+    { "Swap:", offsetof(struct memory_usage, swap_kb) },
+    { "Shared_Dirty:", offsetof(struct memory_usage, shared_dirty_kb) },
+    { "Private_Dirty:", offsetof(struct memory_usage, private_dirty_kb) },
+};
+
+/* Add a "Key:   N kB" line to usage if it is one of the counters kept */
+static void add_usage_line(const char *line, const char *eol, struct memory_usage *usage) {
+    for (size_t i = 0; i < sizeof(usage_keys) / sizeof(usage_keys[0]); i++) {
+        size_t key_len = strlen(usage_keys[i].key);
+        if ((size_t)(eol - line) <= key_len || memcmp(line, usage_keys[i].key, key_len) != 0) {
+            continue;
+        }
+        unsigned long long value;
+        if (pp_parse_dec(pp_skip_spaces(line + key_len, eol), eol, &value)) {
+            *(unsigned long *)((char *)usage + usage_keys[i].offset) += (unsigned long)value;
+        }
+        return;
     }
+}
 
-    // Second pass: collect memory information
-    proc_dir = opendir("/proc");
-    if (!proc_dir) {
-        free(*memory);
-        return -1;
+int parse_memory_rollup(const char *buf, size_t len, pid_t pid, struct proc_walk *walk) {
+    const char *end = buf + len;
+    struct memory_usage usage;
+    memset(&usage, 0, sizeof(usage));
+
+    const char *eol;
+    for (const char *line = buf; line < end; line = eol + 1) {
+        eol = pp_find_eol(line, end);
+        add_usage_line(line, eol, &usage);
     }
+    return rollup_table_append(&walk->rollups, walk->arena, pid, MEMORY_TYPE_TOTAL, &usage);
+}
+
+/* Per-type rollups and their total from a full smaps, plus the mappings if collected */
+static int parse_smaps(const char *buf, size_t len, pid_t pid, struct proc_walk *walk) {
+    struct memory_usage types[MEMORY_TYPE_TOTAL + 1];
+    int seen[MEMORY_TYPE_TOTAL] = { 0 };
+    struct memory_usage *current = NULL;
+    memset(types, 0, sizeof(types));
+
+    const char *end = buf + len;
+    const char *eol;
+    for (const char *line = buf; line < end; line = eol + 1) {
+        eol = pp_find_eol(line, end);
 
-    int index = 0;
-    while ((proc_entry = readdir(proc_dir)) != NULL && index < total_count) {
-        if (proc_entry->d_type != DT_DIR) continue;
-        
-        pid_t pid = atoi(proc_entry->d_name);
-        if (pid <= 0) continue;
-
-        char maps_path[256];
-        snprintf(maps_path, sizeof(maps_path), "/proc/%d/maps", pid);
-        
-        FILE *maps_file = fopen(maps_path, "r");
-        if (!maps_file) continue;
-
-        char line[1024];
-        while (fgets(line, sizeof(line), maps_file) && index < total_count) {
-            unsigned long start_addr, end_addr;
-            char perms[8], pathname[256];
-            
-            if (sscanf(line, "%lx-%lx %7s %*x %*x:%*x %*d %255s",
-                       &start_addr, &end_addr, perms, pathname) >= 3) {
-                
-                struct memory_info *mem = &(*memory)[index];
-                mem->pid = pid;
-                
-                snprintf(mem->address, sizeof(mem->address), "0x%lx", start_addr);
-                mem->size = end_addr - start_addr;
-                strncpy(mem->permissions, perms, sizeof(mem->permissions) - 1);
-                mem->permissions[sizeof(mem->permissions) - 1] = '\0';
-                
-                // Determine memory type
-                if (strstr(pathname, "[heap]")) {
-                    strcpy(mem->type, "heap");
-                } else if (strstr(pathname, "[stack]")) {
-                    strcpy(mem->type, "stack");
-                } else if (strstr(pathname, ".so")) {
-                    strcpy(mem->type, "library");
-                } else if (pathname[0] == '/') {
-                    strcpy(mem->type, "file");
-                } else {
-                    strcpy(mem->type, "anonymous");
-                }
-                
-                mem->is_shared = (perms[3] == 's');
-                
-                index++;
+        // A maps-format header starts each mapping; counter lines follow it
+        struct maps_entry entry;
+        if (pp_parse_maps_line(line, eol, &entry) == 0) {
+            unsigned char type = classify_mapping(&entry);
+            current = &types[type];
+            seen[type] = 1;
+            if ((walk->collect & COLLECT_MAPS) && append_mapping(walk, pid, &entry) != 0) {
+                return -1;
             }
+        } else if (current) {
+            add_usage_line(line, eol, current);
         }
-        fclose(maps_file);
     }
-    closedir(proc_dir);
 
-    return index;
-}
\ No newline at end of file
+    struct memory_usage *total = &types[MEMORY_TYPE_TOTAL];
+    for (int type = 0; type < MEMORY_TYPE_TOTAL; type++) {
+        total->rss_kb += types[type].rss_kb;
+        total->pss_kb += types[type].pss_kb;
+        total->swap_kb += types[type].swap_kb;
+        total->shared_dirty_kb += types[type].shared_dirty_kb;
+        total->private_dirty_kb += types[type].private_dirty_kb;
+    }
+    if (rollup_table_append(&walk->rollups, walk->arena, pid, MEMORY_TYPE_TOTAL, total) != 0) {
+        return -1;
+    }
+    for (int type = 0; type < MEMORY_TYPE_TOTAL; type++) {
+        if (seen[type] &&
+            rollup_table_append(&walk->rollups, walk->arena, pid, type, &types[type]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int read_memory_usage(int pid_fd, pid_t pid, struct proc_walk *walk) {
+    const char *buf;
+    size_t len;
+
+    // smaps repeats maps with counters after each line, so one read covers both
+    if ((walk->collect & COLLECT_ROLLUP) && query_wants_smaps(walk->query, pid)) {
+        buf = proc_read_at(pid_fd, "smaps", &len);
+        return buf ? parse_smaps(buf, len, pid, walk) : 0;
+    }
+
+    if (walk->collect & COLLECT_ROLLUP) {
+        buf = proc_read_at(pid_fd, "smaps_rollup", &len);
+        if (buf && parse_memory_rollup(buf, len, pid, walk) != 0) return -1;
+    }
+    if (walk->collect & COLLECT_MAPS) {
+        buf = proc_read_at(pid_fd, "maps", &len);
+        if (buf && parse_memory_maps(buf, len, pid, walk) < 0) return -1;
+    }
+    return 0;
+}
+
+int collect_memory_usage(int pid_fd, pid_t pid, struct proc_walk *walk) {
+    SCAN_STAT_START(started);
+    int result = read_memory_usage(pid_fd, pid, walk);
+    SCAN_STAT_STOP(SCAN_PHASE_MAPS, started);
+    return result;
+}
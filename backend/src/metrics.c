@@ -0,0 +1,351 @@
+/*
+ * Metrics exporter
+ *
+ * A snapshot is folded into a handful of gauges in one pass over each
+ * table. Process names are interned, so a name id already groups every
+ * process and socket of that name; the groups are ranked and all but the
+ * largest collapse into one label slot before any series is written.
+ * Every label set is therefore bounded by the cap, whatever the host
+ * runs, and series are written in a stable order so scrapes diff cleanly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "../include/metrics.h"
+#include "../include/json_writer.h"
+
+#define STATE_COUNT (SOCKET_STATE_NEW_SYN_RECV + 1)
+#define PROTOCOL_COUNT 2
+#define LABEL_MAX (2 * MAX_PROCESS_NAME + 16)
+
+/* Everything one process name accounts for */
+struct name_group {
+    const char *name;
+    int slot;                 /* label slot once ranked */
+    int processes;
+    int sockets;
+    unsigned long rss_kb;
+};
+
+/* One label value's series */
+struct slot_totals {
+    const char *name;         /* NULL for "other", "unknown" and the unlabelled slot */
+    int processes;
+    int sockets;
+    int close_wait;
+    int hung;
+    int leaking;
+    unsigned long rss_kb;
+    double cpu_usage;
+};
+
+static struct name_group *groups;    /* by name id */
+static struct name_group **ranked;   /* groups with processes, largest first */
+static size_t group_capacity;
+static struct slot_totals *slots;
+static unsigned int *cells;          /* sockets by protocol, state and slot */
+static size_t slot_capacity;
+
+/* Cumulative over every snapshot rendered */
+static unsigned long long scans;
+#if SCAN_STATS_ENABLED
+static struct scan_counters counter_totals;
+#endif
+
+/* Scratch for names name ids and slot_count slots, cleared */
+static int reserve_scratch(size_t names, int slot_count) {
+    size_t cell_count = (size_t)PROTOCOL_COUNT * STATE_COUNT * slot_count;
+    if (names > group_capacity) {
+        size_t capacity = group_capacity ? group_capacity : 256;
+        while (capacity < names) capacity *= 2;
+        struct name_group *grown_groups = realloc(groups, capacity * sizeof(*groups));
+        if (!grown_groups) return -1;
+        groups = grown_groups;
+        struct name_group **grown_ranked = realloc(ranked, capacity * sizeof(*ranked));
+        if (!grown_ranked) return -1;
+        ranked = grown_ranked;
+        group_capacity = capacity;
+    }
+    if ((size_t)slot_count > slot_capacity) {
+        struct slot_totals *grown_slots = realloc(slots, slot_count * sizeof(*slots));
+        if (!grown_slots) return -1;
+        slots = grown_slots;
+        unsigned int *grown_cells = realloc(cells, cell_count * sizeof(*cells));
+        if (!grown_cells) return -1;
+        cells = grown_cells;
+        slot_capacity = (size_t)slot_count;
+    }
+
+    memset(groups, 0, names * sizeof(*groups));
+    memset(slots, 0, slot_count * sizeof(*slots));
+    memset(cells, 0, cell_count * sizeof(*cells));
+    return 0;
+}
+
+/* Most sockets first, then most memory, then by name */
+static int compare_groups(const void *a, const void *b) {
+    const struct name_group *x = *(const struct name_group *const *)a;
+    const struct name_group *y = *(const struct name_group *const *)b;
+    if (x->sockets != y->sockets) return x->sockets > y->sockets ? -1 : 1;
+    if (x->rss_kb != y->rss_kb) return x->rss_kb > y->rss_kb ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+/* SYN_RECV request sockets share SYN_RECV's label; anything odd is UNKNOWN */
+static int state_index(unsigned char state) {
+    if (state == SOCKET_STATE_NEW_SYN_RECV) return SOCKET_STATE_SYN_RECV;
+    return state < STATE_COUNT ? state : SOCKET_STATE_UNKNOWN;
+}
+
+static void emit(struct json_writer *out, const char *format, ...) {
+    char line[LABEL_MAX + 256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len > 0) json_raw(out, line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+}
+
+static void describe(struct json_writer *out, const char *metric, const char *type,
+                     const char *help) {
+    emit(out, "# HELP %s %s\n# TYPE %s %s\n", metric, help, metric, type);
+}
+
+/*
+ * `process="..."` with the value escaped as the text format wants,
+ * followed by sep, or "" when the process label is dropped. Bytes outside
+ * printable ASCII become '?' so a stray comm cannot break the exposition.
+ */
+static const char *process_label(char *buf, const struct slot_totals *slot, int labelled,
+                                 int other, const char *sep) {
+    if (!labelled) return "";
+    const char *name = slot->name ? slot->name : other ? "other" : "unknown";
+    size_t len = (size_t)snprintf(buf, LABEL_MAX, "process=\"");
+    for (const unsigned char *p = (const unsigned char *)name; *p && len + 8 < LABEL_MAX; p++) {
+        if (*p == '\\' || *p == '"') {
+            buf[len++] = '\\';
+            buf[len++] = (char)*p;
+        } else if (*p == '\n') {
+            buf[len++] = '\\';
+            buf[len++] = 'n';
+        } else {
+            buf[len++] = *p >= 0x20 && *p < 0x7f ? (char)*p : '?';
+        }
+    }
+    snprintf(buf + len, LABEL_MAX - len, "\"%s", sep);
+    return buf;
+}
+
+/*
+ * One gauge per slot, skipping slots with nothing to report; gauges of
+ * processes leave out "unknown", which only ever holds sockets
+ */
+static void emit_slots(struct json_writer *out, int slot_count, int other, int labelled,
+                       int of_processes, const char *metric, const char *help,
+                       double (*value)(const struct slot_totals *)) {
+    char label[LABEL_MAX];
+    describe(out, metric, "gauge", help);
+    for (int s = 0; s < slot_count; s++) {
+        const struct slot_totals *slot = &slots[s];
+        if (slot->processes == 0 && (of_processes || slot->sockets == 0)) continue;
+        if (labelled) {
+            emit(out, "%s{%s} %.9g\n", metric,
+                 process_label(label, slot, labelled, s == other, ""), value(slot));
+        } else {
+            emit(out, "%s %.9g\n", metric, value(slot));
+        }
+    }
+}
+
+static double slot_processes(const struct slot_totals *slot) { return slot->processes; }
+static double slot_sockets(const struct slot_totals *slot) { return slot->sockets; }
+static double slot_close_wait(const struct slot_totals *slot) { return slot->close_wait; }
+static double slot_hung(const struct slot_totals *slot) { return slot->hung; }
+static double slot_leaking(const struct slot_totals *slot) { return slot->leaking; }
+static double slot_rss(const struct slot_totals *slot) { return slot->rss_kb * 1024.0; }
+static double slot_cpu(const struct slot_totals *slot) { return slot->cpu_usage / 100.0; }
+
+int output_metrics(const struct sockmap_snapshot *snap, int max_processes,
+                   struct json_writer *out) {
+    const struct process_table *processes = &snap->processes;
+    const struct socket_table *sockets = &snap->sockets;
+    size_t names = (size_t)(snap->strings.count > 0 ? snap->strings.count : 1);
+    int labelled = max_processes > 0;
+
+    // Slots 0..max_processes-1 are named, then "other", then "unknown"
+    int named = labelled ? max_processes : 0;
+    int other = named, unknown = named + labelled;
+    int slot_count = unknown + 1;
+    if (reserve_scratch(names, slot_count) != 0) return -1;
+
+    // Group by name; exited processes are counted apart, having no usage left
+    int exited = 0, leaking_processes = 0;
+    for (int i = 0; i < processes->count; i++) {
+        if (processes->state[i] == 'X') {
+            exited++;
+            continue;
+        }
+        struct name_group *group = &groups[processes->name[i]];
+        group->processes++;
+        group->sockets += processes->socket_count[i];
+        group->rss_kb += processes->rss_kb[i];
+        if (processes->flags[i] & PROCESS_FLAG_LEAK) leaking_processes++;
+    }
+
+    int ranked_count = 0;
+    for (size_t id = 0; id < names && labelled; id++) {
+        if (groups[id].processes == 0) continue;
+        groups[id].name = string_pool_get(&snap->strings, (unsigned int)id);
+        ranked[ranked_count++] = &groups[id];
+    }
+    qsort(ranked, (size_t)ranked_count, sizeof(*ranked), compare_groups);
+    int dropped = ranked_count > named ? ranked_count - named : 0;
+    for (int r = 0; r < ranked_count; r++) {
+        ranked[r]->slot = r < named ? r : other;
+        if (r < named) slots[r].name = ranked[r]->name;
+    }
+
+    for (int i = 0; i < processes->count; i++) {
+        if (processes->state[i] == 'X') continue;
+        struct slot_totals *slot = &slots[groups[processes->name[i]].slot];
+        slot->processes++;
+        slot->rss_kb += processes->rss_kb[i];
+        slot->cpu_usage += processes->cpu_usage[i];
+    }
+
+    unsigned long long rx_queue[PROTOCOL_COUNT] = { 0 }, tx_queue[PROTOCOL_COUNT] = { 0 };
+    for (int i = 0; i < sockets->count; i++) {
+        int owner = sockets->owner[i];
+        int s = !labelled ? 0 : unknown;
+        if (labelled && owner >= 0 && processes->state[owner] != 'X') {
+            s = groups[processes->name[owner]].slot;
+        }
+        int protocol = sockets->protocol[i] == SOCKET_PROTO_UDP;
+        int state = state_index(sockets->state[i]);
+        struct slot_totals *slot = &slots[s];
+
+        cells[((size_t)protocol * STATE_COUNT + state) * slot_count + s]++;
+        slot->sockets++;
+        slot->close_wait += state == SOCKET_STATE_CLOSE_WAIT;
+        slot->hung += (sockets->flags[i] & SOCKET_FLAG_HUNG) != 0;
+        slot->leaking += (sockets->flags[i] & SOCKET_FLAG_LEAK) != 0;
+        rx_queue[protocol] += sockets->rx_queue[i];
+        tx_queue[protocol] += sockets->tx_queue[i];
+    }
+
+    char label[LABEL_MAX];
+    describe(out, "sockmap_sockets", "gauge", "Sockets by protocol, state and owning process.");
+    for (int protocol = 0; protocol < PROTOCOL_COUNT; protocol++) {
+        for (int state = 0; state < STATE_COUNT; state++) {
+            const unsigned int *row = &cells[((size_t)protocol * STATE_COUNT + state) * slot_count];
+            for (int s = 0; s < slot_count; s++) {
+                unsigned int count = row[s];
+                if (count == 0) continue;
+                emit(out, "sockmap_sockets{%sprotocol=\"%s\",state=\"%s\"} %u\n",
+                     process_label(label, &slots[s], labelled, s == other, ","),
+                     socket_protocol_name(protocol), socket_state_name(state), count);
+            }
+        }
+    }
+
+    emit_slots(out, slot_count, other, labelled, 0, "sockmap_close_wait_sockets",
+               "Sockets in CLOSE_WAIT, whose owner has not closed them.", slot_close_wait);
+    emit_slots(out, slot_count, other, labelled, 0, "sockmap_hung_sockets",
+               "Sockets flagged hung by their trend across scans.", slot_hung);
+    emit_slots(out, slot_count, other, labelled, 0, "sockmap_leaking_sockets",
+               "Sockets whose memory grew across the whole trend window.", slot_leaking);
+
+    describe(out, "sockmap_socket_queue_bytes", "gauge", "Bytes queued on sockets.");
+    for (int protocol = 0; protocol < PROTOCOL_COUNT; protocol++) {
+        emit(out, "sockmap_socket_queue_bytes{protocol=\"%s\",direction=\"rx\"} %llu\n"
+                  "sockmap_socket_queue_bytes{protocol=\"%s\",direction=\"tx\"} %llu\n",
+             socket_protocol_name(protocol), rx_queue[protocol],
+             socket_protocol_name(protocol), tx_queue[protocol]);
+    }
+
+    emit_slots(out, slot_count, other, labelled, 1, "sockmap_processes",
+               "Running processes.", slot_processes);
+    emit_slots(out, slot_count, other, labelled, 1, "sockmap_process_sockets",
+               "Sockets the processes own.", slot_sockets);
+    emit_slots(out, slot_count, other, labelled, 1, "sockmap_process_resident_bytes",
+               "Resident memory.", slot_rss);
+    emit_slots(out, slot_count, other, labelled, 1, "sockmap_process_cpu_ratio",
+               "CPU time per second of wall time since the previous scan.", slot_cpu);
+    describe(out, "sockmap_exited_processes", "gauge",
+             "Processes that exited between scans, as the proc connector saw them.");
+    emit(out, "sockmap_exited_processes %d\n", exited);
+    describe(out, "sockmap_leaking_processes", "gauge",
+             "Processes whose memory grew across the whole trend window.");
+    emit(out, "sockmap_leaking_processes %d\n", leaking_processes);
+    describe(out, "sockmap_metrics_process_names_dropped", "gauge",
+             "Process names folded into process=\"other\" by the label cap.");
+    emit(out, "sockmap_metrics_process_names_dropped %d\n", dropped);
+
+    scans++;
+    describe(out, "sockmap_scans_total", "counter", "Scans rendered.");
+    emit(out, "sockmap_scans_total %llu\n", scans);
+    describe(out, "sockmap_last_scan_timestamp_seconds", "gauge", "When the scan started.");
+    emit(out, "sockmap_last_scan_timestamp_seconds %lld\n", (long long)snap->timestamp);
+
+    // Sliced scans carry most rows over, so say how much and how stale
+    time_t oldest = snap->timestamp;
+    for (int i = 0; i < snap->processes.count; i++) {
+        if (snap->processes.scanned_at[i] < oldest) oldest = snap->processes.scanned_at[i];
+    }
+    describe(out, "sockmap_scan_coverage_ratio", "gauge",
+             "Share of listed processes walked by this scan or, when sliced, an earlier one.");
+    emit(out, "sockmap_scan_coverage_ratio %.4f\n", snap->coverage / 100.0);
+    describe(out, "sockmap_oldest_process_age_seconds", "gauge",
+             "Time since the least recently walked process was read.");
+    emit(out, "sockmap_oldest_process_age_seconds %lld\n", (long long)(snap->timestamp - oldest));
+
+#if SCAN_STATS_ENABLED
+    const struct scan_stats *stats = &snap->stats;
+    counter_totals.files_opened += stats->counters.files_opened;
+    counter_totals.bytes_read += stats->counters.bytes_read;
+    counter_totals.parse_errors += stats->counters.parse_errors;
+    counter_totals.pids_vanished += stats->counters.pids_vanished;
+
+    describe(out, "sockmap_scan_duration_seconds", "gauge", "Wall time of the scan.");
+    emit(out, "sockmap_scan_duration_seconds %.9f\n", stats->duration_ns / 1e9);
+    describe(out, "sockmap_scan_phase_seconds", "gauge",
+             "Time in each scan phase, summed over the threads that ran it.");
+    for (int p = 0; p < SCAN_PHASE_COUNT; p++) {
+        emit(out, "sockmap_scan_phase_seconds{phase=\"%s\"} %.9f\n", scan_phase_names[p],
+             stats->counters.phase_ns[p] / 1e9);
+    }
+    describe(out, "sockmap_scan_files_opened_total", "counter", "Files and directories opened.");
+    emit(out, "sockmap_scan_files_opened_total %llu\n",
+         (unsigned long long)counter_totals.files_opened);
+    describe(out, "sockmap_scan_read_bytes_total", "counter", "Bytes read from procfs.");
+    emit(out, "sockmap_scan_read_bytes_total %llu\n",
+         (unsigned long long)counter_totals.bytes_read);
+    describe(out, "sockmap_scan_parse_errors_total", "counter", "Lines that did not parse.");
+    emit(out, "sockmap_scan_parse_errors_total %llu\n",
+         (unsigned long long)counter_totals.parse_errors);
+    describe(out, "sockmap_scan_vanished_pids_total", "counter",
+             "Pids gone between being listed and being read.");
+    emit(out, "sockmap_scan_vanished_pids_total %llu\n",
+         (unsigned long long)counter_totals.pids_vanished);
+    describe(out, "sockmap_arena_bytes", "gauge", "Snapshot arena after the scan.");
+    emit(out, "sockmap_arena_bytes %zu\n", stats->arena_bytes);
+    describe(out, "sockmap_peak_resident_bytes", "gauge",
+             "The scanner's own peak resident memory.");
+    emit(out, "sockmap_peak_resident_bytes %lld\n", (long long)stats->peak_rss_kb * 1024);
+#endif
+    return 0;
+}
+
+void metrics_release(void) {
+    free(groups);
+    free(ranked);
+    free(slots);
+    free(cells);
+    groups = NULL;
+    ranked = NULL;
+    slots = NULL;
+    cells = NULL;
+    group_capacity = slot_capacity = 0;
+}
@@ -0,0 +1,433 @@
+/*
+ * Process tracking from the netlink proc connector
+ *
+ * The kernel multicasts an event for every fork, exec, comm change and
+ * exit. A listener thread applies them as they come to a set of live
+ * pids that stands in for the /proc listing, so discovering processes
+ * costs work per fork and exit instead of a readdir of every pid. A full
+ * listing still runs now and then, and after any overflow, to repair
+ * whatever the events missed. The listener reads a process's comm when
+ * it forks or execs, while it is almost certainly still there; the kernel
+ * sends no comm event for exec.
+ *
+ * Each tracked pid remembers whether a listing has handed it out yet. A
+ * process that exits before that was born and died between two scans;
+ * its pid, comm and start time go to a small queue that the next scan
+ * reports, so short-lived workers show up at all.
+ *
+ * Events only concern thread-group leaders here: thread creation and
+ * thread exit are skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include "../include/proc_events.h"
+#include "../include/proc_walk.h"
+#include "../include/scan_query.h"
+
+#define INITIAL_CAPACITY 1024
+#define COMM_LEN 16
+
+struct tracked {
+    pid_t pid;                      /* 0 marks an empty slot */
+    pid_t ppid;
+    unsigned int generation;        /* last reconcile that listed it */
+    int listed;                     /* handed out by a listing since it forked */
+    unsigned long long start_time;  /* ticks after boot, as stat reports it */
+    char comm[COMM_LEN];            /* empty until known */
+};
+
+struct exited {
+    pid_t pid;
+    pid_t ppid;
+    unsigned long long start_time;
+    char comm[COMM_LEN];
+};
+
+/* Everything below the descriptors is shared with the listener under lock */
+static int nl_fd = -1;
+static int stop_fd = -1;
+static pthread_t listener;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tracked *slots;
+static size_t capacity;             /* always a power of two */
+static size_t count;
+static unsigned int generation;
+static int need_listing = 1;
+static int scans_since_listing;
+static struct exited *exited;
+static int exited_count;
+static double ticks_per_ns;
+
+/* Event stamps are CLOCK_MONOTONIC; starttime counts from boot, suspend included */
+static unsigned long long monotonic_to_ticks(unsigned long long ns) {
+    struct timespec boot, mono;
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    long long offset = (long long)(boot.tv_sec - mono.tv_sec) * 1000000000LL +
+                       (boot.tv_nsec - mono.tv_nsec);
+    return (unsigned long long)((double)(ns + (unsigned long long)offset) * ticks_per_ns);
+}
+
+static size_t hash_pid(pid_t pid, size_t cap) {
+    return (size_t)(((unsigned long long)(unsigned int)pid * 0x9E3779B97F4A7C15ULL) >> 16) &
+           (cap - 1);
+}
+
+/* Slot holding pid, or the empty slot where it would go */
+static size_t find_slot(pid_t pid) {
+    size_t pos = hash_pid(pid, capacity);
+    while (slots[pos].pid != 0 && slots[pos].pid != pid) {
+        pos = (pos + 1) & (capacity - 1);
+    }
+    return pos;
+}
+
+static int table_grow(void) {
+    size_t new_capacity = capacity ? capacity * 2 : INITIAL_CAPACITY;
+    struct tracked *new_slots = calloc(new_capacity, sizeof(struct tracked));
+    if (!new_slots) return -1;
+
+    struct tracked *old = slots;
+    size_t old_capacity = capacity;
+    slots = new_slots;
+    capacity = new_capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].pid != 0) slots[find_slot(old[i].pid)] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static struct tracked *lookup(pid_t pid) {
+    if (capacity == 0) return NULL;
+    struct tracked *entry = &slots[find_slot(pid)];
+    return entry->pid != 0 ? entry : NULL;
+}
+
+/* The entry for pid, added blank if it is new; NULL if the table cannot grow */
+static struct tracked *insert(pid_t pid) {
+    if ((count + 1) * 2 > capacity && table_grow() != 0) return NULL;
+    struct tracked *entry = &slots[find_slot(pid)];
+    if (entry->pid == 0) {
+        memset(entry, 0, sizeof(*entry));
+        entry->pid = pid;
+        count++;
+    }
+    return entry;
+}
+
+/* Backward-shift deletion, so probe chains never hold tombstones */
+static void remove_entry(struct tracked *entry) {
+    size_t mask = capacity - 1;
+    size_t hole = (size_t)(entry - slots);
+    for (size_t pos = (hole + 1) & mask; slots[pos].pid != 0; pos = (pos + 1) & mask) {
+        size_t home = hash_pid(slots[pos].pid, capacity);
+        if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+            slots[hole] = slots[pos];
+            hole = pos;
+        }
+    }
+    slots[hole].pid = 0;
+    count--;
+}
+
+static void copy_comm(char *dst, const char *src) {
+    size_t len = strnlen(src, COMM_LEN - 1);
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/* comm from /proc; left empty if the process is already gone */
+static void read_comm(pid_t pid, char *comm) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t n = read(fd, comm, COMM_LEN - 1);
+    close(fd);
+    if (n <= 0) return;
+    comm[n] = '\0';
+    if (comm[n - 1] == '\n') comm[n - 1] = '\0';
+}
+
+static void fork_event(const struct proc_event *ev) {
+    pid_t child = ev->event_data.fork.child_tgid;
+    if (ev->event_data.fork.child_pid != child) return; // A new thread
+
+    // Already there only if a listing beat this event to it; that one saw it
+    struct tracked *existing = lookup(child);
+    struct tracked *entry = existing ? existing : insert(child);
+    if (!entry) {
+        need_listing = 1;
+        return;
+    }
+    entry->ppid = ev->event_data.fork.parent_tgid;
+    entry->start_time = monotonic_to_ticks(ev->timestamp_ns);
+    if (existing) return;
+
+    // Children that never exec keep their parent's comm
+    struct tracked *parent = lookup(entry->ppid);
+    if (parent && !parent->comm[0]) read_comm(parent->pid, parent->comm);
+    if (parent) memcpy(entry->comm, parent->comm, COMM_LEN);
+    else read_comm(entry->ppid, entry->comm);
+}
+
+static void exec_event(const struct proc_event *ev) {
+    if (ev->event_data.exec.process_pid != ev->event_data.exec.process_tgid) return;
+    struct tracked *entry = lookup(ev->event_data.exec.process_tgid);
+    if (entry) {
+        entry->comm[0] = '\0';
+        read_comm(entry->pid, entry->comm);
+    }
+}
+
+static void comm_event(const struct proc_event *ev) {
+    if (ev->event_data.comm.process_pid != ev->event_data.comm.process_tgid) return;
+    struct tracked *entry = lookup(ev->event_data.comm.process_tgid);
+    if (entry) copy_comm(entry->comm, ev->event_data.comm.comm);
+}
+
+static void exit_event(const struct proc_event *ev) {
+    if (ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid) return;
+    struct tracked *entry = lookup(ev->event_data.exit.process_tgid);
+    if (!entry) return;
+
+    if (!entry->listed && exited && exited_count < PROC_EVENTS_EXITED_MAX) {
+        struct exited *gone = &exited[exited_count++];
+        gone->pid = entry->pid;
+        gone->ppid = entry->ppid;
+        gone->start_time = entry->start_time;
+        memcpy(gone->comm, entry->comm, COMM_LEN);
+    }
+    remove_entry(entry);
+}
+
+static int subscribe(int fd, enum proc_cn_mcast_op op) {
+    struct {
+        struct nlmsghdr nl;
+        struct cn_msg cn;
+        enum proc_cn_mcast_op op;
+    } __attribute__((packed)) msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.nl.nlmsg_len = sizeof(msg);
+    msg.nl.nlmsg_type = NLMSG_DONE;
+    msg.nl.nlmsg_pid = (__u32)getpid();
+    msg.cn.id.idx = CN_IDX_PROC;
+    msg.cn.id.val = CN_VAL_PROC;
+    msg.cn.len = sizeof(op);
+    msg.op = op;
+    return send(fd, &msg, sizeof(msg), 0) == (ssize_t)sizeof(msg) ? 0 : -1;
+}
+
+static void apply_events(const char *buf, ssize_t n) {
+    pthread_mutex_lock(&lock);
+    for (const struct nlmsghdr *nl = (const struct nlmsghdr *)buf; NLMSG_OK(nl, (size_t)n);
+         nl = NLMSG_NEXT(nl, n)) {
+        if (nl->nlmsg_type == NLMSG_NOOP || nl->nlmsg_type == NLMSG_ERROR) continue;
+        const struct cn_msg *cn = NLMSG_DATA(nl);
+        if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) continue;
+
+        const struct proc_event *ev = (const struct proc_event *)cn->data;
+        switch (ev->what) {
+            case PROC_EVENT_FORK: fork_event(ev); break;
+            case PROC_EVENT_EXEC: exec_event(ev); break;
+            case PROC_EVENT_COMM: comm_event(ev); break;
+            case PROC_EVENT_EXIT: exit_event(ev); break;
+            default: break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void *listener_main(void *arg) {
+    (void)arg;
+    char buf[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct pollfd fds[2] = { { nl_fd, POLLIN, 0 }, { stop_fd, POLLIN, 0 } };
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+        if (fds[1].revents) break;
+
+        for (;;) {
+            struct sockaddr_nl from;
+            socklen_t from_len = sizeof(from);
+            ssize_t n = recvfrom(nl_fd, buf, sizeof(buf), MSG_DONTWAIT,
+                                 (struct sockaddr *)&from, &from_len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                // Dropped events leave holes only a listing can fill
+                if (errno == ENOBUFS) {
+                    pthread_mutex_lock(&lock);
+                    need_listing = 1;
+                    pthread_mutex_unlock(&lock);
+                    continue;
+                }
+                break; // EAGAIN: caught up
+            }
+            if (from.nl_pid == 0) apply_events(buf, n); // Only the kernel sends these
+        }
+    }
+    return NULL;
+}
+
+int proc_events_open(void) {
+    if (nl_fd >= 0) return 0;
+
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (fd < 0) return -1;
+
+    // Room for the events of a busy interval; the forced size needs CAP_NET_ADMIN,
+    // which subscribing needs anyway
+    int size = PROC_EVENTS_RCVBUF;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    exited = malloc(PROC_EVENTS_EXITED_MAX * sizeof(struct exited));
+    if (!exited || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        subscribe(fd, PROC_CN_MCAST_LISTEN) != 0) {
+        int err = errno;
+        close(fd);
+        free(exited);
+        exited = NULL;
+        errno = err;
+        return -1;
+    }
+
+    long hz = sysconf(_SC_CLK_TCK);
+    ticks_per_ns = (hz > 0 ? (double)hz : 100.0) / 1e9;
+    nl_fd = fd;
+    need_listing = 1;
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd < 0 || pthread_create(&listener, NULL, listener_main, NULL) != 0) {
+        int err = errno;
+        if (stop_fd >= 0) close(stop_fd);
+        stop_fd = -1;
+        subscribe(nl_fd, PROC_CN_MCAST_IGNORE);
+        close(nl_fd);
+        nl_fd = -1;
+        free(exited);
+        exited = NULL;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_pids(const void *a, const void *b) {
+    pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+    return (x > y) - (x < y);
+}
+
+int proc_events_pids(struct arena *arena, pid_t **pids) {
+    if (nl_fd < 0) return -1;
+
+    pthread_mutex_lock(&lock);
+    int n = -1;
+    if (!need_listing && ++scans_since_listing < PROC_EVENTS_RECONCILE_SCANS) {
+        *pids = arena_alloc(arena, (count ? count : 1) * sizeof(pid_t));
+        n = *pids ? 0 : -1;
+        for (size_t i = 0; *pids && i < capacity; i++) {
+            if (slots[i].pid == 0) continue;
+            slots[i].listed = 1;
+            (*pids)[n++] = slots[i].pid;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    // In /proc's order, so output does not depend on where pids hash
+    if (n > 0) qsort(*pids, (size_t)n, sizeof(pid_t), compare_pids);
+    return n;
+}
+
+int proc_events_reconcile(const pid_t *pids, int n) {
+    if (nl_fd < 0) return 0;
+
+    pthread_mutex_lock(&lock);
+    generation++;
+    for (int i = 0; i < n; i++) {
+        struct tracked *entry = insert(pids[i]);
+        if (!entry) {
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        entry->generation = generation;
+        entry->listed = 1;
+    }
+
+    // Whatever the listing no longer has exited without us hearing of it
+    for (size_t i = 0; i < capacity; ) {
+        if (slots[i].pid != 0 && slots[i].generation != generation) {
+            remove_entry(&slots[i]);   // may shift a later entry into slot i
+        } else {
+            i++;
+        }
+    }
+
+    need_listing = 0;
+    scans_since_listing = 0;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int proc_events_take_exited(struct process_table *processes, struct arena *arena,
+                            struct string_pool *strings, const struct scan_query *query) {
+    if (nl_fd < 0) return 0;
+
+    pthread_mutex_lock(&lock);
+    int result = 0;
+    for (int i = 0; processes && i < exited_count && result == 0; i++) {
+        const struct exited *gone = &exited[i];
+        const char *name = gone->comm[0] ? gone->comm : "unknown";
+        if (!query_wants_pid(query, gone->pid) || !query_wants_name(query, name)) continue;
+
+        struct process_info proc;
+        init_process_info(gone->pid, &proc);
+        snprintf(proc.name, sizeof(proc.name), "%s", name);
+        proc.start_time = gone->start_time;
+        proc.state = 'X';
+        result = process_table_append(processes, arena, strings, &proc);
+    }
+    exited_count = 0;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+void proc_events_release(void) {
+    if (stop_fd >= 0) {
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) == sizeof(one)) pthread_join(listener, NULL);
+        close(stop_fd);
+        stop_fd = -1;
+    }
+    if (nl_fd >= 0) {
+        subscribe(nl_fd, PROC_CN_MCAST_IGNORE);
+        close(nl_fd);
+        nl_fd = -1;
+    }
+    free(slots);
+    free(exited);
+    slots = NULL;
+    exited = NULL;
+    capacity = count = 0;
+    exited_count = 0;
+    need_listing = 1;
+    scans_since_listing = 0;
+}
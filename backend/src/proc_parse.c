@@ -0,0 +1,314 @@
+/*
+ * Zero-allocation /proc parser layer
+ *
+ * Files are read with openat/read into a per-thread buffer that is reused
+ * across calls, and fields are scanned by hand instead of going through
+ * stdio and sscanf format parsing.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "../include/proc_parse.h"
+#include "../include/scan_stats.h"
+
+#define READ_BUFFER_INITIAL (64 * 1024)
+
+static __thread char *read_buffer;
+static __thread size_t read_capacity;
+
+const char *proc_read_at(int dir_fd, const char *name, size_t *len) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    SCAN_STAT_ADD(files_opened, 1);
+
+    if (!read_buffer) {
+        read_buffer = malloc(READ_BUFFER_INITIAL);
+        if (!read_buffer) {
+            close(fd);
+            return NULL;
+        }
+        read_capacity = READ_BUFFER_INITIAL;
+    }
+
+    size_t total = 0;
+    for (;;) {
+        // Keep one byte spare for the terminator
+        if (total + 1 >= read_capacity) {
+            char *grown = realloc(read_buffer, read_capacity * 2);
+            if (!grown) {
+                close(fd);
+                return NULL;
+            }
+            read_buffer = grown;
+            read_capacity *= 2;
+        }
+
+        ssize_t n = read(fd, read_buffer + total, read_capacity - 1 - total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return NULL;
+        }
+        if (n == 0) break;
+        total += n;
+    }
+    close(fd);
+    SCAN_STAT_ADD(bytes_read, total);
+
+    read_buffer[total] = '\0';
+    if (len) *len = total;
+    return read_buffer;
+}
+
+void proc_parse_release(void) {
+    free(read_buffer);
+    read_buffer = NULL;
+    read_capacity = 0;
+}
+
+/* Kernel layout of a getdents64 record */
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+void pp_dir_open(struct pp_dir *dir, int fd) {
+    dir->fd = fd;
+    dir->pos = 0;
+    dir->len = 0;
+}
+
+const char *pp_dir_next(struct pp_dir *dir, unsigned char *type) {
+    for (;;) {
+        if (dir->pos >= dir->len) {
+            long n = syscall(SYS_getdents64, dir->fd, dir->buf, sizeof(dir->buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return NULL;
+            dir->len = (size_t)n;
+            dir->pos = 0;
+        }
+
+        struct linux_dirent64 *entry = (struct linux_dirent64 *)(dir->buf + dir->pos);
+        dir->pos += entry->d_reclen;
+
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        if (type) *type = entry->d_type;
+        return name;
+    }
+}
+
+const char *pp_find_eol(const char *p, const char *end) {
+    // glibc memchr is already vectorized for the single-byte case
+    const char *eol = memchr(p, '\n', end - p);
+    return eol ? eol : end;
+}
+
+/* First space or newline at or after p, or end */
+const char *pp_find_space(const char *p, const char *end) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+                                                  _mm_cmpeq_epi8(chunk, newline)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != ' ' && *p != '\n') p++;
+    return p;
+}
+
+const char *pp_skip_spaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+static inline int hex_digit(unsigned char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20; // Fold to lower case
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/* Returns the position after the digits, or NULL if there were none */
+const char *pp_parse_hex(const char *p, const char *end, unsigned long *out) {
+    const char *start = p;
+    unsigned long value = 0;
+    int digit;
+    while (p < end && (digit = hex_digit((unsigned char)*p)) >= 0) {
+        value = (value << 4) | (unsigned long)digit;
+        p++;
+    }
+    if (p == start) return NULL;
+    *out = value;
+    return p;
+}
+
+const char *pp_parse_dec(const char *p, const char *end, unsigned long long *out) {
+    const char *start = p;
+    unsigned long long value = 0;
+    while (p < end && (unsigned)(*p - '0') < 10) {
+        value = value * 10 + (unsigned)(*p - '0');
+        p++;
+    }
+    if (p == start) return NULL;
+    *out = value;
+    return p;
+}
+
+/* Skip one whitespace-delimited field and the spaces after it */
+static const char *skip_field(const char *p, const char *end) {
+    return pp_skip_spaces(pp_find_space(p, end), end);
+}
+
+int pp_parse_maps_line(const char *line, const char *eol, struct maps_entry *entry) {
+    // 7f1c2a000000-7f1c2a021000 rw-p 00000000 00:00 0          [heap]
+    const char *p = pp_parse_hex(line, eol, &entry->start);
+    if (!p || p >= eol || *p != '-') return -1;
+    p = pp_parse_hex(p + 1, eol, &entry->end);
+    if (!p || eol - p < 6 || *p != ' ') return -1;
+
+    memcpy(entry->perms, p + 1, 4);
+    entry->perms[4] = '\0';
+    p = pp_skip_spaces(p + 5, eol);
+
+    p = pp_parse_hex(p, eol, &entry->offset);
+    if (!p) return -1;
+    p = skip_field(pp_skip_spaces(p, eol), eol); // dev major:minor
+
+    unsigned long long inode;
+    p = pp_parse_dec(p, eol, &inode);
+    if (!p) return -1;
+    entry->inode = inode;
+
+    // The path runs to the end of the line and may itself contain spaces
+    p = pp_skip_spaces(p, eol);
+    entry->path = p;
+    entry->path_len = eol - p;
+    return 0;
+}
+
+int pp_parse_stat(const char *buf, size_t len, struct stat_fields *fields) {
+    // comm may contain spaces and ')', so fields start after the last ')'
+    const char *end = buf + len;
+    const char *p = memrchr(buf, ')', len);
+    if (!p || end - p < 4) return -1;
+
+    p = pp_skip_spaces(p + 1, end);
+    fields->state = *p;
+    p = pp_skip_spaces(p + 1, end);
+
+    // Field numbers follow proc(5): 4 is ppid, 14/15 utime/stime, 22 starttime
+    unsigned long long value;
+    for (int field = 4; field <= 22; field++) {
+        if (field == 4 || field == 14 || field == 15 || field == 22) {
+            p = pp_parse_dec(p, end, &value);
+            if (!p) return -1;
+            switch (field) {
+                case 4: fields->ppid = (pid_t)value; break;
+                case 14: fields->utime = (unsigned long)value; break;
+                case 15: fields->stime = (unsigned long)value; break;
+                case 22: fields->starttime = value; break;
+            }
+            p = pp_skip_spaces(p, end);
+        } else {
+            p = skip_field(p, end);
+        }
+        if (p >= end && field < 22) return -1;
+    }
+    return 0;
+}
+
+int pp_status_value(const char *buf, size_t len, const char *key, unsigned long *value) {
+    size_t key_len = strlen(key);
+    const char *end = buf + len;
+    const char *p = buf;
+
+    // Keys only count at the start of a line and must be followed by ':'
+    while ((p = memmem(p, end - p, key, key_len)) != NULL) {
+        const char *after = p + key_len;
+        if ((p == buf || p[-1] == '\n') && after < end && *after == ':') {
+            unsigned long long parsed;
+            const char *eol = pp_find_eol(after, end);
+            if (!pp_parse_dec(pp_skip_spaces(after + 1, eol), eol, &parsed)) return -1;
+            *value = (unsigned long)parsed;
+            return 0;
+        }
+        p = after;
+    }
+    return -1;
+}
+
+/* Decode an address column: 8 hex digits per 32-bit word in host byte order */
+static const char *parse_net_address(const char *p, const char *end, int words,
+                                     unsigned char *addr) {
+    if (end - p < words * 8) return NULL;
+    for (int i = 0; i < words; i++) {
+        unsigned int word = 0;
+        for (int j = 0; j < 8; j++) {
+            int digit = hex_digit((unsigned char)p[j]);
+            if (digit < 0) return NULL;
+            word = (word << 4) | (unsigned int)digit;
+        }
+        memcpy(addr + i * 4, &word, 4);
+        p += 8;
+    }
+    return p;
+}
+
+int pp_parse_net_line(const char *line, const char *eol, int words, struct net_entry *entry) {
+    //   0: 0100007F:1F90 00000000:0000 0A 00000000:00000000 00:00000000 00000000  1000  0 12345 ...
+    unsigned long value;
+    const char *p = pp_skip_spaces(line, eol);
+    p = skip_field(p, eol); // slot number
+
+    p = parse_net_address(p, eol, words, entry->local_addr);
+    if (!p || p >= eol || *p != ':') return -1;
+    p = pp_parse_hex(p + 1, eol, &value);
+    if (!p) return -1;
+    entry->local_port = (unsigned int)value;
+
+    p = parse_net_address(pp_skip_spaces(p, eol), eol, words, entry->remote_addr);
+    if (!p || p >= eol || *p != ':') return -1;
+    p = pp_parse_hex(p + 1, eol, &value);
+    if (!p) return -1;
+    entry->remote_port = (unsigned int)value;
+
+    p = pp_parse_hex(pp_skip_spaces(p, eol), eol, &value);
+    if (!p) return -1;
+    entry->state = (unsigned int)value;
+
+    p = pp_parse_hex(pp_skip_spaces(p, eol), eol, &entry->tx_queue);
+    if (!p || p >= eol || *p != ':') return -1;
+    p = pp_parse_hex(p + 1, eol, &entry->rx_queue);
+    if (!p) return -1;
+
+    p = pp_skip_spaces(p, eol);
+    p = skip_field(p, eol); // tr:tm->when
+    p = skip_field(p, eol); // retrnsmt
+
+    unsigned long long parsed;
+    p = pp_parse_dec(p, eol, &parsed);
+    if (!p) return -1;
+    entry->uid = (unsigned int)parsed;
+
+    p = skip_field(pp_skip_spaces(p, eol), eol); // timeout
+    p = pp_parse_dec(p, eol, &parsed);
+    if (!p) return -1;
+    entry->inode = (unsigned long)parsed;
+    return 0;
+}
@@ -0,0 +1,953 @@
+/*
+ * Single-pass /proc traversal
+ *
+ * Opens each /proc/<pid> directory once and reads stat, status, comm,
+ * smaps_rollup and fd/ relative to that dirfd, filling the process,
+ * memory and socket-owner tables from the same pass. With more than one thread the
+ * pid list is sharded across a work-stealing pool; each worker fills its
+ * own tables, which are concatenated once all workers are done. With
+ * --io-uring the per-pid files are fetched in batched submissions.
+ *
+ * Everything a scan produces is carved from the snapshot's arena, so a
+ * snapshot refilled at a steady process count touches no allocator.
+ *
+ * A query narrows the walk before any work is done: pid predicates replace
+ * the /proc listing, a name predicate is checked from comm before any
+ * other file is read, and collectors for sections nobody asked for never
+ * run. With --proc-events the proc connector's live set replaces the
+ * listing too, except on the scans that reconcile it.
+ *
+ * A sliced walk visits only the pids scan_slice picks and merges what it
+ * read with the previous generation's rows for every other listed pid,
+ * in listing order, so the snapshot stands complete between slices.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "../include/sockmap.h"
+#include "../include/inode_index.h"
+#include "../include/proc_walk.h"
+#include "../include/work_pool.h"
+#include "../include/proc_parse.h"
+#include "../include/uring_batch.h"
+#include "../include/cpu_sample.h"
+#include "../include/history.h"
+#include "../include/scan_query.h"
+#include "../include/proc_events.h"
+#include "../include/scan_slice.h"
+
+/* Collectors the query's sections need; sockets need owners only to output them */
+static unsigned int walk_collectors(const struct scan_query *query) {
+    unsigned int owner_fields = (1u << SOCKET_FIELD_PID) | (1u << SOCKET_FIELD_PROCESS_NAME);
+    unsigned int collect = 0;
+
+    if (query_section(query, QUERY_PROCESSES) ||
+        (query_section(query, QUERY_SOCKETS) &&
+         ((query_socket_fields(query) & owner_fields) || query_selects_processes(query)))) {
+        collect |= COLLECT_FDS;
+    }
+    if (query_section(query, QUERY_MEMORY)) collect |= COLLECT_ROLLUP;
+    if (query_section(query, QUERY_MEMORY) && query_wants_maps(query)) collect |= COLLECT_MAPS;
+    if (query_section(query, QUERY_PROCESSES)) collect |= COLLECT_STATUS;
+    return collect;
+}
+
+/* Whether a name predicate passes, from comm alone */
+static int comm_matches(int pid_fd, const struct scan_query *query) {
+    if (!query || query->name_count == 0) return 1;
+
+    size_t len;
+    const char *buf = proc_read_at(pid_fd, "comm", &len);
+    if (!buf) return 0;
+
+    struct process_info proc;
+    init_process_info(0, &proc);
+    parse_process_comm(buf, len, &proc);
+    return query_wants_name(query, proc.name);
+}
+
+static int walk_one_pid(int proc_fd, pid_t pid, struct proc_walk *walk) {
+    char pid_name[16];
+    snprintf(pid_name, sizeof(pid_name), "%d", pid);
+
+    int pid_fd = openat(proc_fd, pid_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (pid_fd < 0) {
+        SCAN_STAT_ADD(pids_vanished, 1); // Process exited before we got here
+        return 0;
+    }
+    SCAN_STAT_ADD(files_opened, 1);
+
+    struct process_info proc;
+    if (!comm_matches(pid_fd, walk->query) ||
+        collect_process_info(pid_fd, pid, walk->collect & COLLECT_STATUS, &proc) != 0) {
+        close(pid_fd);
+        return 0;
+    }
+
+    // The process lands in the next row once its sockets and maps are in
+    int slot = walk->processes.count;
+    if (walk->collect & COLLECT_FDS) {
+        proc.socket_count = collect_socket_fds(pid_fd, pid, slot, &walk->owners);
+    }
+    int result = 0;
+    if (((walk->collect & (COLLECT_ROLLUP | COLLECT_MAPS)) &&
+         collect_memory_usage(pid_fd, pid, walk) != 0) ||
+        process_table_append(&walk->processes, walk->arena, &walk->strings, &proc) != 0) {
+        result = -1;
+    }
+
+    close(pid_fd);
+    return result;
+}
+
+/* Per-pid files fetched by the io_uring batch walker, in read order */
+enum { FILE_STAT, FILE_COMM, FILE_STATUS, FILE_ROLLUP, FILE_MAPS, FILES_PER_PID };
+
+static const struct {
+    const char *name;
+    size_t size;
+} batch_files[FILES_PER_PID] = {
+    { "stat",         1024 },
+    { "comm",         64 },
+    { "status",       8192 },
+    { "smaps_rollup", 4096 },
+    { "maps",         32768 },
+};
+
+#define PID_BATCH 64
+#define BATCH_BYTES_PER_PID (1024 + 64 + 8192 + 4096 + 32768)
+
+struct batch_entry {
+    pid_t pid;
+    int pid_fd;
+    int stat_ok;
+    int deferred;            /* memory read synchronously after the batch */
+    struct uring_read *memory[2]; /* completed smaps_rollup and maps reads, parsed once stat is */
+    struct process_info proc;
+};
+
+struct pid_batch {
+    struct proc_walk *walk;
+    struct batch_entry entries[PID_BATCH];
+    struct uring_read reads[PID_BATCH * FILES_PER_PID];
+    unsigned char read_entry[PID_BATCH * FILES_PER_PID];   /* entries index of each read */
+    unsigned char read_kind[PID_BATCH * FILES_PER_PID];    /* FILE_* of each read */
+};
+
+/* Parse each process file as its read completes; memory files are only noted */
+static void on_batch_read(void *ctx, struct uring_read *read) {
+    struct pid_batch *batch = ctx;
+    int index = (int)(read - batch->reads);
+    struct batch_entry *entry = &batch->entries[batch->read_entry[index]];
+    int kind = batch->read_kind[index];
+
+    if (read->result < 0) {
+        // The ring's openat fails once the process is gone
+        if (kind == FILE_STAT && read->dir_fd >= 0) SCAN_STAT_ADD(pids_vanished, 1);
+        return;
+    }
+    SCAN_STAT_ADD(files_opened, 1);
+    SCAN_STAT_ADD(bytes_read, read->result);
+
+    // Memory waits for stat, so a process that is gone leaves no rows behind
+    if (kind == FILE_ROLLUP || kind == FILE_MAPS) {
+        entry->memory[kind - FILE_ROLLUP] = read;
+        return;
+    }
+
+    const char *buf = read->buf;
+    size_t len = (size_t)read->result;
+
+    // A full buffer means the file may be longer; re-read it whole
+    if (len == read->len - 1) {
+        buf = proc_read_at(read->dir_fd, read->name, &len);
+        if (!buf) return;
+    }
+
+    SCAN_STAT_START(started);
+    switch (kind) {
+        case FILE_STAT:
+            entry->stat_ok = (parse_process_stat(buf, len, &entry->proc) == 0);
+            if (!entry->stat_ok) SCAN_STAT_ADD(parse_errors, 1);
+            break;
+        case FILE_COMM:
+            parse_process_comm(buf, len, &entry->proc);
+            break;
+        case FILE_STATUS:
+            parse_process_status(buf, len, &entry->proc);
+            break;
+    }
+    SCAN_STAT_STOP(SCAN_PHASE_STAT, started);
+}
+
+/* Parse the memory files a kept entry read in the batch, as walk_one_pid would */
+static int parse_batch_memory(struct batch_entry *entry, struct proc_walk *walk) {
+    SCAN_STAT_START(started);
+    int result = 0;
+    for (int i = 0; i < 2 && result == 0; i++) {
+        const struct uring_read *read = entry->memory[i];
+        if (!read) continue;
+
+        const char *buf = read->buf;
+        size_t len = (size_t)read->result;
+        if (len == read->len - 1) {
+            buf = proc_read_at(read->dir_fd, read->name, &len);
+            if (!buf) continue;
+        }
+        if (i == 0 ? parse_memory_rollup(buf, len, entry->pid, walk) != 0
+                   : parse_memory_maps(buf, len, entry->pid, walk) < 0) {
+            result = -1;
+        }
+    }
+    SCAN_STAT_STOP(SCAN_PHASE_MAPS, started);
+    return result;
+}
+
+/* Collect up to PID_BATCH pids with one batched io_uring submission */
+static int walk_pid_batch(int proc_fd, const pid_t *pids, int count, struct proc_walk *walk) {
+    // One batch and its read buffers per walk, reused for every batch
+    if (!walk->batch) {
+        walk->batch = arena_alloc(walk->arena, sizeof(struct pid_batch));
+        walk->batch_buffer = arena_alloc(walk->arena, (size_t)PID_BATCH * BATCH_BYTES_PER_PID);
+        if (!walk->batch || !walk->batch_buffer) return -1;
+    }
+
+    struct pid_batch *batch = walk->batch;
+    memset(batch, 0, sizeof(*batch));
+    batch->walk = walk;
+
+    // With a name predicate, memory waits until comm has been checked, and
+    // smaps pids read their memory in one synchronous pass over smaps
+    int names = walk->query && walk->query->name_count > 0;
+    unsigned int memory = ((walk->collect & COLLECT_ROLLUP) ? 1u << FILE_ROLLUP : 0) |
+                          ((walk->collect & COLLECT_MAPS) ? 1u << FILE_MAPS : 0);
+    unsigned int wanted = (1u << FILE_STAT) | (1u << FILE_COMM) | memory |
+                          ((walk->collect & COLLECT_STATUS) ? 1u << FILE_STATUS : 0);
+
+    int read_count = 0;
+    char *buf = walk->batch_buffer;
+    for (int i = 0; i < count; i++) {
+        struct batch_entry *entry = &batch->entries[i];
+        char pid_name[16];
+        snprintf(pid_name, sizeof(pid_name), "%d", pids[i]);
+
+        entry->pid = pids[i];
+        entry->pid_fd = openat(proc_fd, pid_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        SCAN_STAT_ADD(files_opened, entry->pid_fd >= 0);
+        SCAN_STAT_ADD(pids_vanished, entry->pid_fd < 0);
+        init_process_info(pids[i], &entry->proc);
+        entry->deferred = memory && (names || query_wants_smaps(walk->query, pids[i]));
+        unsigned int files = entry->deferred ? wanted & ~memory : wanted;
+
+        for (int f = 0; f < FILES_PER_PID; f++) {
+            if (!(files & (1u << f))) continue;
+            struct uring_read *read = &batch->reads[read_count];
+            batch->read_entry[read_count] = (unsigned char)i;
+            batch->read_kind[read_count] = (unsigned char)f;
+            read->dir_fd = entry->pid_fd;
+            read->name = batch_files[f].name;
+            read->buf = buf;
+            read->len = batch_files[f].size;
+            buf += batch_files[f].size;
+            read_count++;
+        }
+    }
+
+    // Pids that exited before openat keep dir_fd -1 and simply fail to read
+    uring_read_batch(batch->reads, read_count, on_batch_read, batch);
+
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        struct batch_entry *entry = &batch->entries[i];
+        if (entry->pid_fd < 0) continue;
+
+        if (result == 0 && entry->stat_ok && query_wants_name(walk->query, entry->proc.name)) {
+            if (entry->deferred ? collect_memory_usage(entry->pid_fd, entry->pid, walk) != 0
+                                : parse_batch_memory(entry, walk) != 0) {
+                result = -1;
+            }
+            if (walk->collect & COLLECT_FDS) {
+                entry->proc.socket_count = collect_socket_fds(entry->pid_fd, entry->pid,
+                                                              walk->processes.count,
+                                                              &walk->owners);
+            }
+            if (result == 0 && process_table_append(&walk->processes, walk->arena,
+                                                    &walk->strings, &entry->proc) != 0) {
+                result = -1;
+            }
+        }
+        close(entry->pid_fd);
+    }
+
+    return result;
+}
+
+/*
+ * Read the pid list up front so it can be sharded across workers. Pids
+ * appearing while the list is read are picked up or not; either way every
+ * listed pid gets exactly one collection attempt. Pid predicates are the
+ * list themselves, and pids that do not exist fail their openat.
+ */
+static int list_pids(int proc_fd, struct arena *arena, const struct scan_query *query,
+                     pid_t **pids) {
+    int count = 0, capacity = 0;
+    *pids = NULL;
+
+    if (query && query->pid_count > 0) {
+        *pids = arena_alloc(arena, query->pid_count * sizeof(pid_t));
+        if (!*pids) return -1;
+        memcpy(*pids, query->pids, query->pid_count * sizeof(pid_t));
+        return query->pid_count;
+    }
+
+    struct pp_dir proc_dir;
+    pp_dir_open(&proc_dir, proc_fd);
+
+    const char *name;
+    unsigned char type;
+    while ((name = pp_dir_next(&proc_dir, &type)) != NULL) {
+        if (type != DT_DIR) continue;
+
+        pid_t pid = atoi(name);
+        if (pid <= 0) continue;
+
+        if (arena_grow(arena, (void **)pids, &capacity, count + 1, sizeof(pid_t)) != 0) {
+            return -1;
+        }
+        (*pids)[count++] = pid;
+    }
+    return count;
+}
+
+/* Shared state for a parallel walk; each worker fills its own tables */
+struct parallel_walk {
+    int proc_fd;
+    const pid_t *pids;
+    int pid_count;
+    int batched;             /* items are PID_BATCH-sized io_uring batches */
+    struct proc_walk *locals;
+    int *failed;
+};
+
+static void walk_pid_item(void *ctx, int worker, int item) {
+    struct parallel_walk *pw = ctx;
+    if (pw->failed[worker]) return;
+
+    int result;
+    if (pw->batched) {
+        int start = item * PID_BATCH;
+        int count = pw->pid_count - start < PID_BATCH ? pw->pid_count - start : PID_BATCH;
+        result = walk_pid_batch(pw->proc_fd, pw->pids + start, count, &pw->locals[worker]);
+    } else {
+        result = walk_one_pid(pw->proc_fd, pw->pids[item], &pw->locals[worker]);
+    }
+    if (result != 0) {
+        pw->failed[worker] = 1;
+    }
+}
+
+/* Worker threads hand in their counters and release their parser buffer and ring */
+static void release_thread_state(void) {
+    scan_stats_flush();
+    proc_parse_release();
+    uring_batch_release();
+}
+
+/* Re-intern a string from another pool, e.g. a worker's, into the walk's */
+static int reintern(struct proc_walk *walk, const struct string_pool *strings, unsigned int id) {
+    const char *str = string_pool_get(strings, id);
+    return string_pool_intern(&walk->strings, str, strlen(str));
+}
+
+/* Copy process row i of from into row of to, under the already re-interned name */
+static void copy_process_row(struct process_table *to, int row, const struct process_table *from,
+                             int i, unsigned int name) {
+    to->pid[row] = from->pid[i];
+    to->name[row] = name;
+    to->socket_count[row] = from->socket_count[i];
+    to->rss_kb[row] = from->rss_kb[i];
+    to->cpu_ticks[row] = from->cpu_ticks[i];
+    to->start_time[row] = from->start_time[i];
+    to->cpu_usage[row] = from->cpu_usage[i];
+    to->state[row] = from->state[i];
+    to->flags[row] = from->flags[i];
+    to->scanned_at[row] = from->scanned_at[i];
+}
+
+/* Append one worker's tables, rebasing its process slots and string ids */
+static int merge_local(struct proc_walk *walk, struct proc_walk *local) {
+    struct process_table *procs = &walk->processes;
+    struct memory_table *memory = &walk->memory;
+    struct rollup_table *rollups = &walk->rollups;
+    const struct process_table *local_procs = &local->processes;
+    const struct memory_table *local_memory = &local->memory;
+    const struct rollup_table *local_rollups = &local->rollups;
+    int base = procs->count;
+
+    if (process_table_reserve(procs, walk->arena, base + local_procs->count) != 0 ||
+        memory_table_reserve(memory, walk->arena, memory->count + local_memory->count) != 0 ||
+        rollup_table_reserve(rollups, walk->arena, rollups->count + local_rollups->count) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < local_procs->count; i++) {
+        int name = reintern(walk, &local->strings, local_procs->name[i]);
+        if (name < 0) return -1;
+        copy_process_row(procs, procs->count++, local_procs, i, (unsigned int)name);
+    }
+
+    // Columns without string ids copy straight across
+    int mem_base = memory->count;
+    int n = local_memory->count;
+    memcpy(memory->pid + mem_base, local_memory->pid, n * sizeof(*memory->pid));
+    memcpy(memory->start + mem_base, local_memory->start, n * sizeof(*memory->start));
+    memcpy(memory->size + mem_base, local_memory->size, n * sizeof(*memory->size));
+    memcpy(memory->perms + mem_base, local_memory->perms, n * sizeof(*memory->perms));
+    memcpy(memory->type + mem_base, local_memory->type, n * sizeof(*memory->type));
+    for (int i = 0; i < n; i++) {
+        int path = reintern(walk, &local->strings, local_memory->path[i]);
+        if (path < 0) return -1;
+        memory->path[mem_base + i] = (unsigned int)path;
+    }
+    memory->count += n;
+
+    n = local_rollups->count;
+    memcpy(rollups->pid + rollups->count, local_rollups->pid, n * sizeof(*rollups->pid));
+    memcpy(rollups->type + rollups->count, local_rollups->type, n * sizeof(*rollups->type));
+    memcpy(rollups->usage + rollups->count, local_rollups->usage, n * sizeof(*rollups->usage));
+    rollups->count += n;
+
+    for (size_t i = 0; i < local->owners.capacity; i++) {
+        const struct inode_owner *owner = &local->owners.slots[i];
+        if (owner->inode == 0) continue;
+        if (inode_index_insert(&walk->owners, owner->inode, owner->pid, owner->fd,
+                               base + owner->proc_slot) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Scratch arenas for parallel workers, kept across scans and reset each time */
+static struct arena *worker_arenas;
+static int worker_arena_count;
+
+static int reserve_worker_arenas(int threads) {
+    if (threads <= worker_arena_count) return 0;
+
+    struct arena *grown = realloc(worker_arenas, threads * sizeof(struct arena));
+    if (!grown) return -1;
+    memset(grown + worker_arena_count, 0, (threads - worker_arena_count) * sizeof(struct arena));
+    worker_arenas = grown;
+    worker_arena_count = threads;
+    return 0;
+}
+
+static int walk_parallel(int proc_fd, const pid_t *pids, int pid_count, int threads,
+                         int batched, struct proc_walk *walk) {
+    struct parallel_walk pw = { proc_fd, pids, pid_count, batched, NULL, NULL };
+    int item_count = batched ? (pid_count + PID_BATCH - 1) / PID_BATCH : pid_count;
+    pw.locals = arena_calloc(walk->arena, threads, sizeof(struct proc_walk));
+    pw.failed = arena_calloc(walk->arena, threads, sizeof(int));
+    if (!pw.locals || !pw.failed || reserve_worker_arenas(threads) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        arena_reset(&worker_arenas[i]);
+        if (proc_walk_init(&pw.locals[i], &worker_arenas[i], 0, 0) != 0) {
+            return -1;
+        }
+        pw.locals[i].query = walk->query;
+        pw.locals[i].collect = walk->collect;
+    }
+
+    if (work_pool_run(threads, item_count, walk_pid_item, release_thread_state, &pw) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        if (pw.failed[i] || merge_local(walk, &pw.locals[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int proc_walk_init(struct proc_walk *walk, struct arena *arena,
+                   int expected_processes, int expected_memory) {
+    memset(walk, 0, sizeof(*walk));
+    walk->arena = arena;
+    walk->collect = COLLECT_ALL;
+
+    if (process_table_reserve(&walk->processes, arena, expected_processes) != 0 ||
+        memory_table_reserve(&walk->memory, arena, expected_memory) != 0 ||
+        rollup_table_reserve(&walk->rollups, arena, expected_processes) != 0 ||
+        string_pool_init(&walk->strings, arena) != 0) {
+        return -1;
+    }
+    return inode_index_init(&walk->owners, arena);
+}
+
+/* The pids to walk, into arena */
+static int walk_pids(const struct sockmap_config *cfg, int proc_fd, struct arena *arena,
+                     pid_t **pids) {
+    // Pid predicates list themselves; otherwise tracked pids spare the readdir
+    int tracked = cfg->proc_events && !(cfg->query && cfg->query->pid_count > 0);
+    int pid_count = tracked ? proc_events_pids(arena, pids) : -1;
+    if (pid_count < 0) {
+        pid_count = list_pids(proc_fd, arena, cfg->query, pids);
+        if (tracked && pid_count >= 0 && proc_events_reconcile(*pids, pid_count) != 0) {
+            pid_count = -1;
+        }
+    }
+    return pid_count;
+}
+
+/* Walk every pid in pids, with the threads and io_uring batches cfg asks for */
+static int walk_pid_list(const struct sockmap_config *cfg, int proc_fd, const pid_t *pids,
+                         int pid_count, struct proc_walk *walk) {
+    int batched = cfg->io_uring && uring_batch_available();
+    if (cfg->io_uring && !batched && cfg->verbose) {
+        fprintf(stderr, "io_uring unavailable, reading /proc with plain syscalls\n");
+    }
+
+    int result = 0;
+    if (cfg->threads > 1) {
+        result = walk_parallel(proc_fd, pids, pid_count, cfg->threads, batched, walk);
+    } else if (batched) {
+        for (int i = 0; i < pid_count && result == 0; i += PID_BATCH) {
+            int count = pid_count - i < PID_BATCH ? pid_count - i : PID_BATCH;
+            result = walk_pid_batch(proc_fd, pids + i, count, walk);
+        }
+    } else {
+        for (int i = 0; i < pid_count && result == 0; i++) {
+            result = walk_one_pid(proc_fd, pids[i], walk);
+        }
+    }
+    return result;
+}
+
+int walk_processes(const struct sockmap_config *cfg, struct proc_walk *walk) {
+    int proc_fd = open(cfg->proc_root ? cfg->proc_root : PROC_ROOT,
+                       O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (proc_fd < 0) {
+        return -1;
+    }
+
+    walk->query = cfg->query;
+    walk->collect &= walk_collectors(cfg->query);
+
+    pid_t *pids;
+    int pid_count = walk_pids(cfg, proc_fd, walk->arena, &pids);
+    int result = pid_count < 0 ? -1 : walk_pid_list(cfg, proc_fd, pids, pid_count, walk);
+
+    close(proc_fd);
+    return result != 0 ? -1 : walk->processes.count;
+}
+
+/* Where one pid's rows sit in a set of tables */
+struct pid_rows {
+    pid_t pid;
+    int process;
+    int memory, memory_count;
+    int rollup, rollup_count;
+};
+
+/* Tables a sliced walk takes rows from: the slice's own, or the last generation's */
+struct row_source {
+    const struct process_table *processes;
+    const struct memory_table *memory;
+    const struct rollup_table *rollups;
+    const struct string_pool *strings;
+    struct pid_rows *rows;    /* one per process row, sorted by pid */
+    int *moved_to;            /* each process row's row in the walk, -1 if not taken */
+};
+
+static int compare_pid_rows(const void *a, const void *b) {
+    pid_t x = ((const struct pid_rows *)a)->pid, y = ((const struct pid_rows *)b)->pid;
+    return (x > y) - (x < y);
+}
+
+static struct pid_rows *find_pid_rows(const struct row_source *source, pid_t pid) {
+    struct pid_rows key = { .pid = pid };
+    if (source->processes->count == 0) return NULL;
+    return bsearch(&key, source->rows, (size_t)source->processes->count, sizeof(key),
+                   compare_pid_rows);
+}
+
+/* Index a source by pid; each process's mappings and rollups are contiguous */
+static int index_source(struct row_source *source, struct arena *arena) {
+    int count = source->processes->count;
+    source->rows = arena_calloc(arena, count ? count : 1, sizeof(struct pid_rows));
+    source->moved_to = arena_alloc(arena, (count ? count : 1) * sizeof(int));
+    if (!source->rows || !source->moved_to) return -1;
+
+    for (int i = 0; i < count; i++) {
+        source->rows[i].pid = source->processes->pid[i];
+        source->rows[i].process = i;
+        source->moved_to[i] = -1;
+    }
+    qsort(source->rows, (size_t)count, sizeof(struct pid_rows), compare_pid_rows);
+
+    struct pid_rows *rows = NULL;
+    for (int i = 0; i < source->memory->count; i++) {
+        if (i == 0 || source->memory->pid[i] != source->memory->pid[i - 1]) {
+            rows = find_pid_rows(source, source->memory->pid[i]);
+            if (rows) rows->memory = i;
+        }
+        if (rows) rows->memory_count++;
+    }
+    for (int i = 0; i < source->rollups->count; i++) {
+        if (i == 0 || source->rollups->pid[i] != source->rollups->pid[i - 1]) {
+            rows = find_pid_rows(source, source->rollups->pid[i]);
+            if (rows) rows->rollup = i;
+        }
+        if (rows) rows->rollup_count++;
+    }
+    return 0;
+}
+
+/* Append one process's rows from source to the walk, re-interning its strings */
+static int append_pid_rows(struct proc_walk *walk, struct row_source *source,
+                           const struct pid_rows *rows) {
+    const struct memory_table *memory = source->memory;
+    const struct rollup_table *rollups = source->rollups;
+    int name = reintern(walk, source->strings, source->processes->name[rows->process]);
+    if (name < 0 || process_table_reserve(&walk->processes, walk->arena,
+                                          walk->processes.count + 1) != 0) {
+        return -1;
+    }
+    source->moved_to[rows->process] = walk->processes.count;
+    copy_process_row(&walk->processes, walk->processes.count++, source->processes,
+                     rows->process, (unsigned int)name);
+
+    for (int i = rows->memory; i < rows->memory + rows->memory_count; i++) {
+        int path = reintern(walk, source->strings, memory->path[i]);
+        if (path < 0 || memory_table_append(&walk->memory, walk->arena, memory->pid[i],
+                                            memory->start[i], memory->size[i], memory->perms[i],
+                                            memory->type[i], (unsigned int)path) != 0) {
+            return -1;
+        }
+    }
+    for (int i = rows->rollup; i < rows->rollup + rows->rollup_count; i++) {
+        if (rollup_table_append(&walk->rollups, walk->arena, rollups->pid[i], rollups->type[i],
+                                &rollups->usage[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Fill the walk from a slice read into fresh and from prev: every listed
+ * pid in order, with fresh's rows if the slice walked it and prev's if
+ * not. A walked pid with no fresh rows exited or was filtered out.
+ */
+static int merge_slice(const struct sockmap_snapshot *prev, struct proc_walk *fresh,
+                       const pid_t *pids, int count, const pid_t *slice, int slice_count,
+                       struct proc_walk *walk) {
+    struct row_source sources[2] = {
+        { &fresh->processes, &fresh->memory, &fresh->rollups, &fresh->strings, NULL, NULL },
+        { &prev->processes, &prev->memory, &prev->rollups, &prev->strings, NULL, NULL },
+    };
+    if (index_source(&sources[0], walk->arena) != 0 ||
+        index_source(&sources[1], walk->arena) != 0) {
+        return -1;
+    }
+
+    for (int i = 0, s = 0; i < count; i++) {
+        while (s < slice_count && slice[s] < pids[i]) s++;
+        struct row_source *source = &sources[s < slice_count && slice[s] == pids[i] ? 0 : 1];
+        struct pid_rows *rows = find_pid_rows(source, pids[i]);
+        if (rows && append_pid_rows(walk, source, rows) != 0) return -1;
+    }
+
+    // The slice's owners go in first, so prev's never override a fresh read
+    for (size_t i = 0; i < fresh->owners.capacity; i++) {
+        const struct inode_owner *owner = &fresh->owners.slots[i];
+        if (owner->inode == 0 || sources[0].moved_to[owner->proc_slot] < 0) continue;
+        if (inode_index_insert(&walk->owners, owner->inode, owner->pid, owner->fd,
+                               sources[0].moved_to[owner->proc_slot]) < 0) {
+            return -1;
+        }
+    }
+    const struct socket_table *sockets = &prev->sockets;
+    for (int i = 0; i < sockets->count; i++) {
+        int owner = sockets->owner[i];
+        if (owner < 0 || sockets->inode[i] == 0 || sources[1].moved_to[owner] < 0) continue;
+        if (inode_index_insert(&walk->owners, sockets->inode[i], prev->processes.pid[owner], -1,
+                               sources[1].moved_to[owner]) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Walk one slice of the listing and merge it with prev's rows into walk */
+static int walk_slice(const struct sockmap_config *cfg, const struct sockmap_snapshot *prev,
+                      struct proc_walk *walk, double *coverage) {
+    int proc_fd = open(cfg->proc_root ? cfg->proc_root : PROC_ROOT,
+                       O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (proc_fd < 0) {
+        return -1;
+    }
+
+    walk->query = cfg->query;
+    walk->collect &= walk_collectors(cfg->query);
+
+    pid_t *pids = NULL, *slice = NULL;
+    int hot = 0;
+    int pid_count = walk_pids(cfg, proc_fd, walk->arena, &pids);
+    int slice_count = pid_count < 0 ? -1
+        : scan_slice_select(cfg, pids, pid_count, &prev->processes, walk->arena, &slice, &hot);
+
+    struct proc_walk fresh;
+    int result = slice_count < 0 ? -1 : proc_walk_init(&fresh, walk->arena, slice_count, 0);
+    uint64_t started = scan_stats_now();
+    if (result == 0) {
+        fresh.query = walk->query;
+        fresh.collect = walk->collect;
+        result = walk_pid_list(cfg, proc_fd, slice, slice_count, &fresh);
+    }
+    close(proc_fd);
+    if (result != 0) return -1;
+
+    *coverage = scan_slice_done(pids, pid_count, slice, slice_count, scan_stats_now() - started);
+    if (cfg->verbose) {
+        fprintf(stderr, "Walked %d of %d pids (%d hot), %.1f%% covered\n", slice_count,
+                pid_count, hot, *coverage);
+    }
+    if (*coverage < 0) return -1;
+    return merge_slice(prev, &fresh, pids, pid_count, slice, slice_count, walk);
+}
+
+int stream_processes(const char *proc_root, struct arena *arena, struct arena *scratch,
+                     const struct scan_query *query, process_emit_fn emit, void *ctx) {
+    int proc_fd = open(proc_root ? proc_root : PROC_ROOT, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (proc_fd < 0) {
+        return -1;
+    }
+
+    pid_t *pids;
+    int pid_count = list_pids(proc_fd, arena, query, &pids);
+    int result = pid_count < 0 ? -1 : 0;
+    int emitted = 0;
+    unsigned int collect = walk_collectors(query);
+    cpu_sample_begin();
+    history_processes_begin();
+
+    // Each pid gets a fresh walk in the scratch arena, which therefore
+    // never holds more than the largest single process
+    for (int i = 0; i < pid_count && result == 0; i++) {
+        struct proc_walk walk;
+        arena_reset(scratch);
+        if (proc_walk_init(&walk, scratch, 1, 0) != 0) {
+            result = -1;
+            break;
+        }
+        walk.query = query;
+        walk.collect = collect;
+        if (walk_one_pid(proc_fd, pids[i], &walk) != 0) {
+            result = -1;
+        } else if (walk.processes.count == 1) {
+            double percent = cpu_sample_percent(pids[i], walk.processes.start_time[0],
+                                                walk.processes.cpu_ticks[0]);
+            walk.processes.cpu_usage[0] = percent < 0 ? 0.0 : percent;
+            walk.processes.flags[0] = history_process(pids[i], walk.processes.start_time[0],
+                                                      walk.processes.rss_kb[0]);
+            walk.processes.scanned_at[0] = time(NULL);
+            result = emit(ctx, &walk);
+            emitted++;
+        }
+    }
+
+    // A failed walk keeps the previous readings rather than dropping them
+    if (result == 0) {
+        cpu_sample_sweep();
+        history_processes_sweep();
+    }
+    close(proc_fd);
+    return result != 0 ? -1 : emitted;
+}
+
+void proc_walk_release(void) {
+    for (int i = 0; i < worker_arena_count; i++) {
+        arena_free(&worker_arenas[i]);
+    }
+    free(worker_arenas);
+    worker_arenas = NULL;
+    worker_arena_count = 0;
+}
+
+/*
+ * CPU percentages and RSS trends from this scan's readings and earlier
+ * scans'. Rows a slice carried over are already stamped and keep their
+ * readings and flags, and their samples until a slice walks them again.
+ */
+static void sample_processes(struct process_table *processes) {
+    cpu_sample_begin();
+    history_processes_begin();
+    for (int i = 0; i < processes->count; i++) {
+        if (processes->scanned_at[i] != 0) {
+            cpu_sample_keep(processes->pid[i], processes->start_time[i]);
+            history_process_keep(processes->pid[i], processes->start_time[i]);
+            continue;
+        }
+        double percent = cpu_sample_percent(processes->pid[i], processes->start_time[i],
+                                            processes->cpu_ticks[i]);
+        processes->cpu_usage[i] = percent < 0 ? 0.0 : percent;
+        processes->flags[i] = history_process(processes->pid[i], processes->start_time[i],
+                                              processes->rss_kb[i]);
+    }
+    cpu_sample_sweep();
+    history_processes_sweep();
+}
+
+/* Headroom over the previous generation's counts when presizing tables */
+static int expected_count(int previous) {
+    return previous > 0 ? previous + previous / 8 : 0;
+}
+
+/* prev's process rows and names, with the socket owners prev resolved */
+static int carry_processes(const struct sockmap_snapshot *prev, struct proc_walk *walk) {
+    // Interned in id order into an empty pool, every name keeps its id
+    for (int id = 1; id < prev->strings.count; id++) {
+        const char *str = string_pool_get(&prev->strings, (unsigned int)id);
+        if (string_pool_intern(&walk->strings, str, strlen(str)) != id) return -1;
+    }
+    if (process_table_copy(&walk->processes, walk->arena, &prev->processes) != 0) return -1;
+
+    const struct socket_table *sockets = &prev->sockets;
+    for (int i = 0; i < sockets->count; i++) {
+        int owner = sockets->owner[i];
+        if (owner >= 0 && sockets->inode[i] != 0 &&
+            inode_index_insert(&walk->owners, sockets->inode[i], prev->processes.pid[owner], -1,
+                               owner) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* prev's mappings and rollups, their paths interned into this walk's pool */
+static int carry_memory(const struct sockmap_snapshot *prev, struct proc_walk *walk) {
+    if (memory_table_copy(&walk->memory, walk->arena, &prev->memory) != 0 ||
+        rollup_table_copy(&walk->rollups, walk->arena, &prev->rollups) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < walk->memory.count; i++) {
+        const char *path = string_pool_get(&prev->strings, prev->memory.path[i]);
+        int id = string_pool_intern(&walk->strings, path, strlen(path));
+        if (id < 0) return -1;
+        walk->memory.path[i] = (unsigned int)id;
+    }
+    return 0;
+}
+
+/* prev's sockets, re-pointed at this walk's process rows when it walked */
+static int carry_sockets(const struct sockmap_snapshot *prev, const struct proc_walk *walk,
+                         int walked, struct arena *arena, struct socket_table *sockets) {
+    if (socket_table_copy(sockets, arena, &prev->sockets) != 0) return -1;
+    for (int i = 0; walked && i < sockets->count; i++) {
+        const struct inode_owner *owner = inode_index_lookup(&walk->owners, sockets->inode[i]);
+        sockets->owner[i] = owner ? owner->proc_slot : -1;
+    }
+    return 0;
+}
+
+int scan_snapshot(const struct sockmap_config *cfg, struct sockmap_snapshot *snap) {
+    return scan_snapshot_update(cfg, snap, NULL, QUERY_ALL);
+}
+
+int scan_snapshot_update(const struct sockmap_config *cfg, struct sockmap_snapshot *snap,
+                         const struct sockmap_snapshot *prev, unsigned int refresh) {
+    // A memory refresh walks every pid, so processes come fresh with it
+    if (!prev) refresh = QUERY_ALL;
+    if (refresh & QUERY_MEMORY) refresh |= QUERY_PROCESSES;
+    int walking = (refresh & QUERY_PROCESSES) != 0;
+
+    // This buffer's previous generation sizes the new tables
+    int expected_processes = expected_count(snap->processes.count);
+    int expected_memory = expected_count(snap->memory.count);
+    int expected_sockets = expected_count(snap->sockets.count);
+
+    scan_stats_begin();
+    arena_reset(&snap->arena);
+    memset(&snap->sockets, 0, sizeof(snap->sockets));
+    memset(&snap->memory, 0, sizeof(snap->memory));
+    memset(&snap->rollups, 0, sizeof(snap->rollups));
+    memset(&snap->processes, 0, sizeof(snap->processes));
+    memset(&snap->strings, 0, sizeof(snap->strings));
+    snap->timestamp = time(NULL);
+    snap->coverage = 100.0;
+
+    // Sockets alone, without their owners, need no /proc walk at all
+    const struct scan_query *query = cfg->query;
+    int walk_needed = query_section(query, QUERY_MEMORY | QUERY_PROCESSES) ||
+                      (walk_collectors(query) & COLLECT_FDS);
+    int sliced = walking && walk_needed && scan_slice_enabled(cfg);
+
+    // A slice reads memory whenever it walks, as its rows replace prev's whole
+    struct proc_walk walk;
+    if (proc_walk_init(&walk, &snap->arena, expected_processes, expected_memory) != 0) {
+        return -1;
+    }
+    if (!(refresh & QUERY_MEMORY) && !sliced) walk.collect &= ~(COLLECT_ROLLUP | COLLECT_MAPS);
+
+    if (!walking) {
+        if (carry_processes(prev, &walk) != 0) return -1;
+        snap->coverage = prev->coverage;
+    } else {
+        if (sliced) {
+            struct sockmap_snapshot none;
+            memset(&none, 0, sizeof(none));
+            if (walk_slice(cfg, prev ? prev : &none, &walk, &snap->coverage) != 0) return -1;
+        } else if (walk_needed && walk_processes(cfg, &walk) < 0) {
+            return -1;
+        }
+        if (query_section(query, QUERY_PROCESSES)) sample_processes(&walk.processes);
+
+        // Processes that came and went since the last scan, never walked
+        if (cfg->proc_events &&
+            proc_events_take_exited(query_section(query, QUERY_PROCESSES) ? &walk.processes
+                                                                            : NULL,
+                                    walk.arena, &walk.strings, query) != 0) {
+            return -1;
+        }
+    }
+    if (!(refresh & QUERY_MEMORY) && !sliced && carry_memory(prev, &walk) != 0) return -1;
+
+    // Rows this scan read, rather than carried over, are as of this scan
+    for (int i = 0; i < walk.processes.count; i++) {
+        if (walk.processes.scanned_at[i] == 0) walk.processes.scanned_at[i] = snap->timestamp;
+    }
+
+    if (query_section(query, QUERY_SOCKETS)) {
+        int failed = (refresh & QUERY_SOCKETS)
+            ? socket_table_reserve(&snap->sockets, &snap->arena, expected_sockets) != 0 ||
+              scan_sockets(cfg, &snap->arena, &walk.owners, &snap->sockets) < 0
+            : carry_sockets(prev, &walk, walking, &snap->arena, &snap->sockets) != 0;
+        if (failed) {
+            memset(&snap->sockets, 0, sizeof(snap->sockets));
+            return -1;
+        }
+    }
+
+    snap->memory = walk.memory;
+    snap->rollups = walk.rollups;
+    snap->processes = walk.processes;
+    snap->strings = walk.strings;
+    scan_stats_end(&snap->arena, &snap->stats);
+    return 0;
+}
+
+void free_snapshot(struct sockmap_snapshot *snap) {
+    arena_free(&snap->arena);
+    memset(snap, 0, sizeof(*snap));
+}
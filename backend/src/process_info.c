@@ -9,359 +9,415 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include "../include/sockmap.h"
-
-int scan_processes(struct process_info **processes) {
-    DIR *proc_dir = opendir("/proc");
-    if (!proc_dir) {
+#include "../include/proc_walk.h"
+#include "../include/proc_parse.h"
+#include "../include/json_writer.h"
+#include "../include/scan_query.h"
+#include "../include/metrics.h"
+#include "../include/aggregate.h"
+
+/* Returns -1 if stat is malformed, i.e. the process is gone */
+int parse_process_stat(const char *buf, size_t len, struct process_info *proc) {
+    struct stat_fields stat;
+    if (pp_parse_stat(buf, len, &stat) != 0) {
         return -1;
     }
+    proc->state = stat.state;
+    proc->cpu_ticks = (unsigned long long)stat.utime + stat.stime;
+    proc->start_time = stat.starttime;
+    return 0;
+}
 
-    // Count processes first
-    int count = 0;
-    struct dirent *proc_entry;
-    while ((proc_entry = readdir(proc_dir)) != NULL) {
-        if (proc_entry->d_type == DT_DIR && atoi(proc_entry->d_name) > 0) {
-            count++;
-        }
-    }
-    closedir(proc_dir);
+void parse_process_comm(const char *buf, size_t len, struct process_info *proc) {
+    size_t name_len = pp_find_eol(buf, buf + len) - buf;
+    if (name_len == 0) return;
+    if (name_len >= sizeof(proc->name)) name_len = sizeof(proc->name) - 1;
+    memcpy(proc->name, buf, name_len);
+    proc->name[name_len] = '\0';
+}
 
-    if (count == 0) {
-        *processes = NULL;
-        return 0;
+void parse_process_status(const char *buf, size_t len, struct process_info *proc) {
+    unsigned long rss_kb;
+    if (pp_status_value(buf, len, "VmRSS", &rss_kb) == 0) {
+        proc->rss_kb = rss_kb;
     }
+}
 
-    *processes = malloc(count * sizeof(struct process_info));
-    if (!*processes) {
-        return -1;
-    }
+void init_process_info(pid_t pid, struct process_info *proc) {
+    proc->pid = pid;
+    proc->socket_count = 0;
+    proc->rss_kb = 0;
+    proc->cpu_ticks = 0;
+    proc->start_time = 0;
+    proc->cpu_usage = 0.0;
+    proc->state = '?';
+    strcpy(proc->name, "unknown");
+}
 
-    // Collect process information
-    proc_dir = opendir("/proc");
-    if (!proc_dir) {
-        free(*processes);
-        return -1;
-    }
+/*
+ * Fill everything but socket_count from stat, comm and, if asked, status,
+ * each read once. Returns -1 if the process vanished before its stat was read.
+ */
+int collect_process_info(int pid_fd, pid_t pid, int with_status, struct process_info *proc) {
+    SCAN_STAT_START(started);
+    const char *buf;
+    size_t len;
+    int result = -1;
+
+    init_process_info(pid, proc);
+
+    buf = proc_read_at(pid_fd, "stat", &len);
+    if (!buf) {
+        SCAN_STAT_ADD(pids_vanished, 1);
+    } else if (parse_process_stat(buf, len, proc) != 0) {
+        SCAN_STAT_ADD(parse_errors, 1);
+    } else {
+        buf = proc_read_at(pid_fd, "comm", &len);
+        if (buf) parse_process_comm(buf, len, proc);
 
-    int index = 0;
-    while ((proc_entry = readdir(proc_dir)) != NULL && index < count) {
-        if (proc_entry->d_type != DT_DIR) continue;
-        
-        pid_t pid = atoi(proc_entry->d_name);
-        if (pid <= 0) continue;
-
-        struct process_info *proc = &(*processes)[index];
-        proc->pid = pid;
-
-        // Get process name
-        char *name = get_process_name(pid);
-        if (name) {
-            strncpy(proc->name, name, sizeof(proc->name) - 1);
-            proc->name[sizeof(proc->name) - 1] = '\0';
-            free(name);
-        } else {
-            strcpy(proc->name, "unknown");
+        if (with_status) {
+            buf = proc_read_at(pid_fd, "status", &len);
+            if (buf) parse_process_status(buf, len, proc);
         }
+        result = 0;
+    }
 
-        // Count sockets for this process
-        proc->socket_count = count_process_sockets(pid);
+    SCAN_STAT_STOP(SCAN_PHASE_STAT, started);
+    return result;
+}
 
-        // Get memory usage
-        proc->memory_usage = get_process_memory_usage(pid);
+const char *const socket_field_names[SOCKET_FIELD_COUNT] = {
+    "pid", "process_name", "local_address", "remote_address", "state", "protocol", "inode",
+    "uid", "rx_queue", "tx_queue", "rmem", "wmem", "fwd_alloc", "memory_usage", "is_hung",
+    "has_leak",
+};
 
-        // Get CPU usage (simplified)
-        proc->cpu_usage = get_process_cpu_usage(pid);
+const char *const memory_field_names[MEMORY_FIELD_COUNT] = {
+    "pid", "address", "size", "permissions", "type", "path", "is_shared",
+};
 
-        // Get process status
-        get_process_status(pid, proc->status, sizeof(proc->status));
+const char *const rollup_field_names[ROLLUP_FIELD_COUNT] = {
+    "pid", "type", "rss_kb", "pss_kb", "swap_kb", "shared_dirty_kb", "private_dirty_kb",
+};
 
-        index++;
-    }
-    closedir(proc_dir);
+const char *const process_field_names[PROCESS_FIELD_COUNT] = {
+    "pid", "name", "socket_count", "memory_usage", "cpu_usage", "status", "has_leak",
+    "scanned_at",
+};
 
-    return index;
-}
+/* --top and --group-by: one JSON line holding just the rankings asked for */
+static int output_aggregates(const struct sockmap_config *cfg,
+                             const struct sockmap_snapshot *snap, struct json_writer *out) {
+    static struct top_list top;
+    static struct group_list groups;
 
-char* get_process_name(pid_t pid) {
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
-    
-    FILE *file = fopen(path, "r");
-    if (!file) return NULL;
-
-    char *name = malloc(MAX_PROCESS_NAME);
-    if (!name) {
-        fclose(file);
-        return NULL;
+    if (cfg->top_limit && aggregate_top(snap, cfg->top_metric, cfg->top_limit, &top) != 0) {
+        return -1;
     }
-
-    if (fgets(name, MAX_PROCESS_NAME, file)) {
-        // Remove newline
-        char *newline = strchr(name, '\n');
-        if (newline) *newline = '\0';
-    } else {
-        strcpy(name, "unknown");
+    if (cfg->group_limit &&
+        aggregate_groups(snap, cfg->group_key, cfg->group_limit, &groups) != 0) {
+        return -1;
     }
 
-    fclose(file);
-    return name;
+    json_begin_object(out);
+    json_key(out, "timestamp");
+    json_int(out, (long long)snap->timestamp);
+    if (cfg->top_limit) {
+        json_key(out, "top");
+        json_begin_object(out);
+        output_top_list(&top, cfg->top_limit, out);
+        json_end_object(out);
+    }
+    if (cfg->group_limit) {
+        json_key(out, "groups");
+        json_begin_object(out);
+        output_group_list(&groups, cfg->group_limit, out);
+        json_end_object(out);
+    }
+    json_end_object(out);
+    json_newline(out);
+    return 0;
 }
 
-int count_process_sockets(pid_t pid) {
-    char fd_path[256];
-    snprintf(fd_path, sizeof(fd_path), "/proc/%d/fd", pid);
-    
-    DIR *fd_dir = opendir(fd_path);
-    if (!fd_dir) return 0;
-
-    int socket_count = 0;
-    struct dirent *fd_entry;
-    while ((fd_entry = readdir(fd_dir)) != NULL) {
-        char link_path[512];
-        char target[256];
-        
-        snprintf(link_path, sizeof(link_path), "%s/%s", fd_path, fd_entry->d_name);
-        ssize_t len = readlink(link_path, target, sizeof(target) - 1);
-        
-        if (len > 0) {
-            target[len] = '\0';
-            if (strncmp(target, "socket:", 7) == 0) {
-                socket_count++;
-            }
+void output_results(const struct sockmap_config *cfg, const struct sockmap_snapshot *snap,
+                    struct json_writer *out) {
+    if (cfg->top_limit || cfg->group_limit) {
+        if (output_aggregates(cfg, snap, out) != 0) {
+            fprintf(stderr, "Out of memory ranking the snapshot\n");
+        } else if (json_flush(out) != 0) {
+            perror("write");
+        }
+    } else if (cfg->output_format == OUTPUT_JSON) {
+        output_json(snap, cfg->query, out);
+    } else if (cfg->output_format == OUTPUT_METRICS) {
+        if (output_metrics(snap, cfg->metrics_max_processes, out) != 0) {
+            fprintf(stderr, "Out of memory rendering metrics\n");
+        } else if (json_flush(out) != 0) {
+            perror("write");
         }
+    } else {
+        output_table(snap, cfg->query);
     }
-    closedir(fd_dir);
-
-    return socket_count;
 }
 
-double get_process_memory_usage(pid_t pid) {
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/status", pid);
-    
-    FILE *file = fopen(path, "r");
-    if (!file) return 0.0;
+/* Owning process's pid and name for a socket row */
+pid_t socket_pid(const struct sockmap_snapshot *snap, int row) {
+    int owner = snap->sockets.owner[row];
+    return owner >= 0 ? snap->processes.pid[owner] : 0;
+}
 
-    char line[256];
-    double memory_kb = 0.0;
-    
-    while (fgets(line, sizeof(line), file)) {
-        if (strncmp(line, "VmRSS:", 6) == 0) {
-            sscanf(line, "VmRSS: %lf kB", &memory_kb);
-            break;
-        }
-    }
-    fclose(file);
+const char *socket_process_name(const struct sockmap_snapshot *snap, int row) {
+    int owner = snap->sockets.owner[row];
+    return owner >= 0 ? string_pool_get(&snap->strings, snap->processes.name[owner]) : "unknown";
+}
 
-    return memory_kb / 1024.0; // Convert to MB
+/* Writes field f's key and returns nonzero if the projection selects it */
+static int field_key(struct json_writer *out, unsigned int fields, const char *const *names, int f) {
+    if (!(fields & (1u << f))) return 0;
+    json_key(out, names[f]);
+    return 1;
 }
 
-double get_process_cpu_usage(pid_t pid) {
-    // Simplified CPU usage calculation
-    // In a real implementation, you'd need to calculate this over time
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-    
-    FILE *file = fopen(path, "r");
-    if (!file) return 0.0;
-
-    unsigned long utime, stime;
-    if (fscanf(file, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
-        fclose(file);
-        // This is a simplified calculation - real CPU usage requires time sampling
-        return ((double)(utime + stime)) / 100.0; // Rough approximation
+#define SOCKET_FIELD(f) field_key(out, fields, socket_field_names, SOCKET_FIELD_##f)
+#define MEMORY_FIELD(f) field_key(out, fields, memory_field_names, MEMORY_FIELD_##f)
+#define ROLLUP_FIELD(f) field_key(out, fields, rollup_field_names, ROLLUP_FIELD_##f)
+#define PROCESS_FIELD(f) field_key(out, fields, process_field_names, PROCESS_FIELD_##f)
+
+void output_socket_fields(struct json_writer *out, const struct socket_table *sockets, int row,
+                          pid_t pid, const char *process_name, unsigned int fields) {
+    char address[MAX_ADDRESS_LEN];
+
+    if (SOCKET_FIELD(PID)) json_int(out, pid);
+    if (SOCKET_FIELD(PROCESS_NAME)) json_string(out, process_name);
+    if (SOCKET_FIELD(LOCAL_ADDRESS)) {
+        format_socket_address(address, sizeof(address), sockets->family[row],
+                              sockets->local[row].addr, sockets->local[row].port);
+        json_string(out, address);
     }
-    
-    fclose(file);
-    return 0.0;
+    if (SOCKET_FIELD(REMOTE_ADDRESS)) {
+        format_socket_address(address, sizeof(address), sockets->family[row],
+                              sockets->remote[row].addr, sockets->remote[row].port);
+        json_string(out, address);
+    }
+    if (SOCKET_FIELD(STATE)) json_string(out, socket_state_name(sockets->state[row]));
+    if (SOCKET_FIELD(PROTOCOL)) json_string(out, socket_protocol_name(sockets->protocol[row]));
+    if (SOCKET_FIELD(INODE)) json_uint(out, sockets->inode[row]);
+    if (SOCKET_FIELD(UID)) json_uint(out, sockets->uid[row]);
+    if (SOCKET_FIELD(RX_QUEUE)) json_uint(out, sockets->rx_queue[row]);
+    if (SOCKET_FIELD(TX_QUEUE)) json_uint(out, sockets->tx_queue[row]);
+    if (SOCKET_FIELD(RMEM)) json_uint(out, sockets->rmem[row]);
+    if (SOCKET_FIELD(WMEM)) json_uint(out, sockets->wmem[row]);
+    if (SOCKET_FIELD(FWD_ALLOC)) json_uint(out, sockets->fwd_alloc[row]);
+    if (SOCKET_FIELD(MEMORY_USAGE)) json_uint(out, sockets->memory_usage[row]);
+    if (SOCKET_FIELD(IS_HUNG)) json_bool(out, sockets->flags[row] & SOCKET_FLAG_HUNG);
+    if (SOCKET_FIELD(HAS_LEAK)) json_bool(out, sockets->flags[row] & SOCKET_FLAG_LEAK);
 }
 
-void get_process_status(pid_t pid, char *status, size_t status_len) {
-    (void)status_len; // Suppress unused parameter warning
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-    
-    FILE *file = fopen(path, "r");
-    if (!file) {
-        strcpy(status, "unknown");
-        return;
-    }
+void output_memory_fields(struct json_writer *out, const struct memory_table *memory, int row,
+                          const struct string_pool *strings, unsigned int fields) {
+    char perms[MAX_PERMISSIONS_LEN];
 
-    char state;
-    if (fscanf(file, "%*d %*s %c", &state) == 1) {
-        switch (state) {
-            case 'R': strcpy(status, "running"); break;
-            case 'S': strcpy(status, "sleeping"); break;
-            case 'D': strcpy(status, "waiting"); break;
-            case 'Z': strcpy(status, "zombie"); break;
-            case 'T': strcpy(status, "stopped"); break;
-            default: strcpy(status, "unknown"); break;
-        }
-    } else {
-        strcpy(status, "unknown");
+    if (MEMORY_FIELD(PID)) json_int(out, memory->pid[row]);
+    if (MEMORY_FIELD(ADDRESS)) json_hex_string(out, memory->start[row]);
+    if (MEMORY_FIELD(SIZE)) json_uint(out, memory->size[row]);
+    if (MEMORY_FIELD(PERMISSIONS)) {
+        format_memory_perms(memory->perms[row], perms);
+        json_string(out, perms);
     }
-    
-    fclose(file);
+    if (MEMORY_FIELD(TYPE)) json_string(out, memory_type_name(memory->type[row]));
+    if (MEMORY_FIELD(PATH)) json_string(out, string_pool_get(strings, memory->path[row]));
+    if (MEMORY_FIELD(IS_SHARED)) json_bool(out, memory->perms[row] & MEMORY_PERM_SHARED);
 }
 
-int is_socket_hung(struct socket_info *socket) {
-    // Simple heuristic: if socket is in CLOSE_WAIT state for too long
-    return (strcmp(socket->state, "CLOSE_WAIT") == 0);
+void output_rollup_fields(struct json_writer *out, const struct rollup_table *rollups, int row,
+                          unsigned int fields) {
+    const struct memory_usage *usage = &rollups->usage[row];
+
+    if (ROLLUP_FIELD(PID)) json_int(out, rollups->pid[row]);
+    if (ROLLUP_FIELD(TYPE)) json_string(out, memory_type_name(rollups->type[row]));
+    if (ROLLUP_FIELD(RSS_KB)) json_uint(out, usage->rss_kb);
+    if (ROLLUP_FIELD(PSS_KB)) json_uint(out, usage->pss_kb);
+    if (ROLLUP_FIELD(SWAP_KB)) json_uint(out, usage->swap_kb);
+    if (ROLLUP_FIELD(SHARED_DIRTY_KB)) json_uint(out, usage->shared_dirty_kb);
+    if (ROLLUP_FIELD(PRIVATE_DIRTY_KB)) json_uint(out, usage->private_dirty_kb);
 }
 
-int detect_memory_leak(struct socket_info *socket) {
-    // Simple heuristic: if memory usage is unusually high
-    return (socket->memory_usage > 10240); // > 10KB
+void output_process_fields(struct json_writer *out, const struct process_table *processes, int row,
+                           const struct string_pool *strings, unsigned int fields) {
+    if (PROCESS_FIELD(PID)) json_int(out, processes->pid[row]);
+    if (PROCESS_FIELD(NAME)) json_string(out, string_pool_get(strings, processes->name[row]));
+    if (PROCESS_FIELD(SOCKET_COUNT)) json_int(out, processes->socket_count[row]);
+    if (PROCESS_FIELD(MEMORY_USAGE)) json_fixed2(out, processes->rss_kb[row] / 1024.0);
+    if (PROCESS_FIELD(CPU_USAGE)) json_fixed2(out, processes->cpu_usage[row]);
+    if (PROCESS_FIELD(STATUS)) json_string(out, process_status_name(processes->state[row]));
+    if (PROCESS_FIELD(HAS_LEAK)) json_bool(out, processes->flags[row] & PROCESS_FLAG_LEAK);
+    if (PROCESS_FIELD(SCANNED_AT)) json_int(out, (long long)processes->scanned_at[row]);
 }
 
-int get_socket_memory_usage(pid_t pid, int socket_fd) {
-    (void)socket_fd; // Suppress unused parameter warning
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/status", pid);
-    
-    FILE *file = fopen(path, "r");
-    if (!file) return 1024; // Default fallback
+void output_socket_array(const struct sockmap_snapshot *snap, unsigned int fields,
+                         struct json_writer *out) {
+    json_begin_array(out);
+    for (int i = 0; i < snap->sockets.count; i++) {
+        json_begin_object(out);
+        output_socket_fields(out, &snap->sockets, i, socket_pid(snap, i),
+                             socket_process_name(snap, i), fields);
+        json_end_object(out);
+    }
+    json_end_array(out);
+}
 
-    char line[256];
-    unsigned long socket_mem = 1024; // Base socket overhead
-    
-    while (fgets(line, sizeof(line), file)) {
-        if (strncmp(line, "VmData:", 7) == 0) {
-            unsigned long data_kb;
-            if (sscanf(line, "VmData: %lu kB", &data_kb) == 1) {
-                // Estimate socket memory as a fraction of data segment
-                socket_mem = (data_kb * 1024) / 100; // Rough estimate
-                break;
-            }
-        }
+/* Mapping rows [first, last) */
+static void write_memory_rows(const struct sockmap_snapshot *snap, int first, int last,
+                              unsigned int fields, struct json_writer *out) {
+    json_begin_array(out);
+    for (int i = first; i < last; i++) {
+        json_begin_object(out);
+        output_memory_fields(out, &snap->memory, i, &snap->strings, fields);
+        json_end_object(out);
     }
-    fclose(file);
+    json_end_array(out);
+}
 
-    return (int)socket_mem;
+void output_memory_array(const struct sockmap_snapshot *snap, unsigned int fields,
+                         struct json_writer *out) {
+    write_memory_rows(snap, 0, snap->memory.count, fields, out);
 }
 
-void output_results(struct sockmap_config *cfg, 
-                   struct socket_info *sockets, int socket_count,
-                   struct memory_info *memory, int memory_count,
-                   struct process_info *processes, int process_count) {
-    time_t timestamp = time(NULL);
-    
-    if (cfg->output_format == OUTPUT_JSON) {
-        output_json(sockets, socket_count, memory, memory_count, processes, process_count, timestamp);
-    } else {
-        output_table(sockets, socket_count, memory, memory_count, processes, process_count, timestamp);
+void output_rollup_array(const struct sockmap_snapshot *snap, unsigned int fields,
+                         struct json_writer *out) {
+    json_begin_array(out);
+    for (int i = 0; i < snap->rollups.count; i++) {
+        json_begin_object(out);
+        output_rollup_fields(out, &snap->rollups, i, fields);
+        json_end_object(out);
     }
+    json_end_array(out);
 }
 
-void output_json(struct socket_info *sockets, int socket_count,
-                struct memory_info *memory, int memory_count,
-                struct process_info *processes, int process_count,
-                time_t timestamp) {
-    printf("{\n");
-    printf("  \"timestamp\": %ld,\n", timestamp);
-    
-    // Output sockets
-    printf("  \"sockets\": [\n");
-    for (int i = 0; i < socket_count; i++) {
-        printf("    {\n");
-        printf("      \"pid\": %d,\n", sockets[i].pid);
-        printf("      \"process_name\": \"%s\",\n", sockets[i].process_name);
-        printf("      \"local_address\": \"%s\",\n", sockets[i].local_address);
-        printf("      \"remote_address\": \"%s\",\n", sockets[i].remote_address);
-        printf("      \"state\": \"%s\",\n", sockets[i].state);
-        printf("      \"protocol\": \"%s\",\n", sockets[i].protocol);
-        printf("      \"memory_usage\": %lu,\n", sockets[i].memory_usage);
-        printf("      \"is_hung\": %s,\n", sockets[i].is_hung ? "true" : "false");
-        printf("      \"has_leak\": %s\n", sockets[i].has_leak ? "true" : "false");
-        printf("    }%s\n", (i < socket_count - 1) ? "," : "");
+void output_process_array(const struct sockmap_snapshot *snap, unsigned int fields,
+                          struct json_writer *out) {
+    json_begin_array(out);
+    for (int i = 0; i < snap->processes.count; i++) {
+        json_begin_object(out);
+        output_process_fields(out, &snap->processes, i, &snap->strings, fields);
+        json_end_object(out);
     }
-    printf("  ],\n");
-    
-    // Output memory
-    printf("  \"memory\": [\n");
-    for (int i = 0; i < memory_count; i++) {
-        printf("    {\n");
-        printf("      \"pid\": %d,\n", memory[i].pid);
-        printf("      \"address\": \"%s\",\n", memory[i].address);
-        printf("      \"size\": %lu,\n", memory[i].size);
-        printf("      \"permissions\": \"%s\",\n", memory[i].permissions);
-        printf("      \"type\": \"%s\",\n", memory[i].type);
-        printf("      \"is_shared\": %s\n", memory[i].is_shared ? "true" : "false");
-        printf("    }%s\n", (i < memory_count - 1) ? "," : "");
+    json_end_array(out);
+}
+
+void output_memory_section(const struct sockmap_snapshot *snap, const struct scan_query *query,
+                           struct json_writer *out) {
+    json_key(out, "memory_rollup");
+    output_rollup_array(snap, query_rollup_fields(query), out);
+    if (!query_wants_maps(query)) return;
+
+    int count = snap->memory.count;
+    int first = query->map_offset < count ? query->map_offset : count;
+    int last = query->map_limit > 0 && query->map_limit < count - first ? first + query->map_limit
+                                                                        : count;
+    json_key(out, "memory");
+    write_memory_rows(snap, first, last, query_memory_fields(query), out);
+    json_key(out, "memory_total");
+    json_int(out, count);
+}
+
+void output_json(const struct sockmap_snapshot *snap, const struct scan_query *query,
+                 struct json_writer *out) {
+    json_begin_object(out);
+    json_key(out, "timestamp");
+    json_int(out, (long long)snap->timestamp);
+    json_key(out, "coverage_percent");
+    json_fixed2(out, snap->coverage);
+    if (query_section(query, QUERY_SOCKETS)) {
+        json_key(out, "sockets");
+        output_socket_array(snap, query_socket_fields(query), out);
     }
-    printf("  ],\n");
-    
-    // Output processes
-    printf("  \"processes\": [\n");
-    for (int i = 0; i < process_count; i++) {
-        printf("    {\n");
-        printf("      \"pid\": %d,\n", processes[i].pid);
-        printf("      \"name\": \"%s\",\n", processes[i].name);
-        printf("      \"socket_count\": %d,\n", processes[i].socket_count);
-        printf("      \"memory_usage\": %.2f,\n", processes[i].memory_usage);
-        printf("      \"cpu_usage\": %.2f,\n", processes[i].cpu_usage);
-        printf("      \"status\": \"%s\"\n", processes[i].status);
-        printf("    }%s\n", (i < process_count - 1) ? "," : "");
+    if (query_section(query, QUERY_MEMORY)) {
+        output_memory_section(snap, query, out);
+    }
+    if (query_section(query, QUERY_PROCESSES)) {
+        json_key(out, "processes");
+        output_process_array(snap, query_process_fields(query), out);
+    }
+    if (SCAN_STATS_ENABLED) {
+        json_key(out, "scan_stats");
+        output_scan_stats(&snap->stats, out);
+    }
+    json_end_object(out);
+    json_newline(out);
+    if (json_flush(out) != 0) {
+        perror("write");
     }
-    printf("  ]\n");
-    printf("}\n");
 }
 
-void output_table(struct socket_info *sockets, int socket_count,
-                 struct memory_info *memory, int memory_count,
-                 struct process_info *processes, int process_count,
-                 time_t timestamp) {
-    (void)memory; // Suppress unused parameter warning
-    (void)memory_count; // Suppress unused parameter warning
-    printf("=== SockMap Report (Timestamp: %ld) ===\n\n", timestamp);
-    
-    printf("SOCKETS:\n");
-    printf("%-8s %-16s %-20s %-20s %-12s %-8s %-8s %-5s %-5s\n",
-           "PID", "Process", "Local", "Remote", "State", "Protocol", "Memory", "Hung", "Leak");
-    printf("%-8s %-16s %-20s %-20s %-12s %-8s %-8s %-5s %-5s\n",
-           "---", "-------", "-----", "------", "-----", "--------", "------", "----", "----");
-    
-    for (int i = 0; i < socket_count; i++) {
-        printf("%-8d %-16s %-20s %-20s %-12s %-8s %-8lu %-5s %-5s\n",
-               sockets[i].pid, sockets[i].process_name,
-               sockets[i].local_address, sockets[i].remote_address,
-               sockets[i].state, sockets[i].protocol,
-               sockets[i].memory_usage,
-               sockets[i].is_hung ? "YES" : "NO",
-               sockets[i].has_leak ? "YES" : "NO");
+void output_table(const struct sockmap_snapshot *snap, const struct scan_query *query) {
+    const struct socket_table *sockets = &snap->sockets;
+    const struct process_table *processes = &snap->processes;
+    char local[MAX_ADDRESS_LEN], remote[MAX_ADDRESS_LEN];
+
+    printf("=== SockMap Report (Timestamp: %ld) ===\n\n", (long)snap->timestamp);
+    if (snap->coverage < 100.0) {
+        printf("Sliced scan: %.1f%% of processes walked so far\n\n", snap->coverage);
     }
     
-    printf("\nPROCESSES:\n");
-    printf("%-8s %-16s %-8s %-10s %-8s %-10s\n",
-           "PID", "Name", "Sockets", "Memory(MB)", "CPU(%)", "Status");
-    printf("%-8s %-16s %-8s %-10s %-8s %-10s\n",
-           "---", "----", "-------", "---------", "-----", "------");
-    
-    for (int i = 0; i < process_count; i++) {
-        printf("%-8d %-16s %-8d %-10.2f %-8.2f %-10s\n",
-               processes[i].pid, processes[i].name,
-               processes[i].socket_count, processes[i].memory_usage,
-               processes[i].cpu_usage, processes[i].status);
+    // Table columns are fixed; queries choose sections and rows only
+    if (query_section(query, QUERY_SOCKETS)) {
+        printf("SOCKETS:\n");
+        printf("%-8s %-16s %-20s %-20s %-12s %-8s %-8s %-5s %-5s\n",
+               "PID", "Process", "Local", "Remote", "State", "Protocol", "Memory", "Hung", "Leak");
+        printf("%-8s %-16s %-20s %-20s %-12s %-8s %-8s %-5s %-5s\n",
+               "---", "-------", "-----", "------", "-----", "--------", "------", "----", "----");
+
+        for (int i = 0; i < sockets->count; i++) {
+            format_socket_address(local, sizeof(local), sockets->family[i],
+                                  sockets->local[i].addr, sockets->local[i].port);
+            format_socket_address(remote, sizeof(remote), sockets->family[i],
+                                  sockets->remote[i].addr, sockets->remote[i].port);
+
+            printf("%-8d %-16s %-20s %-20s %-12s %-8s %-8lu %-5s %-5s\n",
+                   socket_pid(snap, i), socket_process_name(snap, i),
+                   local, remote,
+                   socket_state_name(sockets->state[i]), socket_protocol_name(sockets->protocol[i]),
+                   sockets->memory_usage[i],
+                   (sockets->flags[i] & SOCKET_FLAG_HUNG) ? "YES" : "NO",
+                   (sockets->flags[i] & SOCKET_FLAG_LEAK) ? "YES" : "NO");
+        }
+        printf("\n");
     }
-}
 
-void free_socket_info(struct socket_info *sockets, int count) {
-    (void)count; // Suppress unused parameter warning
-    if (sockets) {
-        free(sockets);
+    if (query_section(query, QUERY_MEMORY)) {
+        const struct rollup_table *rollups = &snap->rollups;
+        printf("MEMORY (kB):\n");
+        printf("%-8s %-10s %-10s %-10s %-10s %-12s %-12s\n",
+               "PID", "Type", "RSS", "PSS", "Swap", "SharedDirty", "PrivateDirty");
+        printf("%-8s %-10s %-10s %-10s %-10s %-12s %-12s\n",
+               "---", "----", "---", "---", "----", "-----------", "------------");
+
+        for (int i = 0; i < rollups->count; i++) {
+            const struct memory_usage *usage = &rollups->usage[i];
+            printf("%-8d %-10s %-10lu %-10lu %-10lu %-12lu %-12lu\n",
+                   rollups->pid[i], memory_type_name(rollups->type[i]), usage->rss_kb,
+                   usage->pss_kb, usage->swap_kb, usage->shared_dirty_kb, usage->private_dirty_kb);
+        }
+        printf("\n");
     }
-}
 
-void free_memory_info(struct memory_info *memory, int count) {
-    (void)count; // Suppress unused parameter warning
-    if (memory) {
-        free(memory);
+    if (query_section(query, QUERY_PROCESSES)) {
+        printf("PROCESSES:\n");
+        printf("%-8s %-16s %-8s %-10s %-8s %-10s %-5s\n",
+               "PID", "Name", "Sockets", "Memory(MB)", "CPU(%)", "Status", "Leak");
+        printf("%-8s %-16s %-8s %-10s %-8s %-10s %-5s\n",
+               "---", "----", "-------", "---------", "-----", "------", "----");
+
+        for (int i = 0; i < processes->count; i++) {
+            printf("%-8d %-16s %-8d %-10.2f %-8.2f %-10s %-5s\n",
+                   processes->pid[i], string_pool_get(&snap->strings, processes->name[i]),
+                   processes->socket_count[i], processes->rss_kb[i] / 1024.0,
+                   processes->cpu_usage[i], process_status_name(processes->state[i]),
+                   (processes->flags[i] & PROCESS_FLAG_LEAK) ? "YES" : "NO");
+        }
+        printf("\n");
     }
-}
 
-void free_process_info(struct process_info *processes, int count) {
-    (void)count; // Suppress unused parameter warning
-    if (processes) {
-        free(processes);
-    }
-}
\ No newline at end of file
+    if (SCAN_STATS_ENABLED) print_scan_stats(&snap->stats);
+}
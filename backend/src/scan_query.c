@@ -0,0 +1,268 @@
+/*
+ * Scan queries
+ *
+ * Options are parsed once into flat arrays and bitmasks, so the checks
+ * the walker makes per pid and per socket are a few compares, and
+ * state and protocol terms can be handed to the kernel as-is. The
+ * server's URL options are decoded and go through the same parsing.
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "../include/sockmap.h"
+#include "../include/scan_query.h"
+
+void scan_query_init(struct scan_query *query) {
+    memset(query, 0, sizeof(*query));
+    query->sections = QUERY_ALL;
+    query->socket_fields = FIELDS_ALL;
+    query->memory_fields = FIELDS_ALL;
+    query->rollup_fields = FIELDS_ALL;
+    query->process_fields = FIELDS_ALL;
+}
+
+static int parse_number(const char *term, unsigned long max, unsigned long *value) {
+    char *end;
+    *value = strtoul(term, &end, 10);
+    return (*term == '\0' || *end != '\0' || *value > max) ? -1 : 0;
+}
+
+static int add_pid_term(pid_t *pids, int *count, const char *term) {
+    unsigned long pid;
+    if (*count == QUERY_MAX_TERMS || parse_number(term, 0x7fffffff, &pid) != 0 || pid == 0) {
+        return -1;
+    }
+    pids[(*count)++] = (pid_t)pid;
+    return 0;
+}
+
+static int add_pid(struct scan_query *query, const char *term) {
+    return add_pid_term(query->pids, &query->pid_count, term);
+}
+
+static int add_smaps(struct scan_query *query, const char *term) {
+    return add_pid_term(query->smaps, &query->smaps_count, term);
+}
+
+/* "" for every mapping, or "OFFSET:LIMIT" for one page of them */
+static int add_maps(struct scan_query *query, const char *term) {
+    query->maps = 1;
+    if (*term == '\0') return 0;
+
+    char offset[16];
+    const char *colon = strchr(term, ':');
+    unsigned long value;
+    if (!colon || (size_t)(colon - term) >= sizeof(offset)) return -1;
+    memcpy(offset, term, colon - term);
+    offset[colon - term] = '\0';
+    if (parse_number(offset, 0x7fffffff, &value) != 0) return -1;
+    query->map_offset = (int)value;
+    if (parse_number(colon + 1, 0x7fffffff, &value) != 0) return -1;
+    query->map_limit = (int)value;
+    return 0;
+}
+
+static int add_name(struct scan_query *query, const char *term) {
+    if (query->name_count == QUERY_MAX_TERMS || *term == '\0') return -1;
+
+    // The kernel keeps only the first 15 bytes of a name, so compare those
+    snprintf(query->names[query->name_count++], QUERY_NAME_LEN, "%s", term);
+    return 0;
+}
+
+static int add_port(struct scan_query *query, const char *term) {
+    unsigned long port;
+    if (query->port_count == QUERY_MAX_TERMS || parse_number(term, 65535, &port) != 0) return -1;
+    query->ports[query->port_count++] = (unsigned short)port;
+    return 0;
+}
+
+static int add_protocol(struct scan_query *query, const char *term) {
+    for (int protocol = SOCKET_PROTO_TCP; protocol <= SOCKET_PROTO_UDP; protocol++) {
+        if (strcasecmp(term, socket_protocol_name(protocol)) == 0) {
+            query->protocols |= 1u << protocol;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* States by their output names; SYN_RECV covers request sockets too */
+static int add_state(struct scan_query *query, const char *term) {
+    unsigned int states = 0;
+    for (int state = SOCKET_STATE_ESTABLISHED; state <= SOCKET_STATE_NEW_SYN_RECV; state++) {
+        if (strcasecmp(term, socket_state_name(state)) == 0) states |= 1u << state;
+    }
+    if (strcasecmp(term, "LISTEN") == 0) states |= 1u << SOCKET_STATE_LISTEN;
+    if (states == 0) return -1;
+    query->states |= states;
+    return 0;
+}
+
+static unsigned int field_bit(const char *const *names, int count, const char *term) {
+    for (int f = 0; f < count; f++) {
+        if (strcmp(term, names[f]) == 0) return 1u << f;
+    }
+    return 0;
+}
+
+/* A name selects that field in every section that has it */
+static int add_field(struct scan_query *query, const char *term) {
+    unsigned int socket = field_bit(socket_field_names, SOCKET_FIELD_COUNT, term);
+    unsigned int memory = field_bit(memory_field_names, MEMORY_FIELD_COUNT, term);
+    unsigned int rollup = field_bit(rollup_field_names, ROLLUP_FIELD_COUNT, term);
+    unsigned int process = field_bit(process_field_names, PROCESS_FIELD_COUNT, term);
+    if (!socket && !memory && !rollup && !process) return -1;
+
+    // The first field listed replaces the default of all fields
+    if (query->socket_fields == FIELDS_ALL) {
+        query->socket_fields = query->memory_fields = 0;
+        query->rollup_fields = query->process_fields = 0;
+    }
+    query->socket_fields |= socket;
+    query->memory_fields |= memory;
+    query->rollup_fields |= rollup;
+    query->process_fields |= process;
+    return 0;
+}
+
+int scan_query_add(struct scan_query *query, const char *option, const char *terms) {
+    static const struct {
+        const char *name;
+        int (*add)(struct scan_query *query, const char *term);
+    } options[] = {
+        { "pid", add_pid }, { "name", add_name }, { "port", add_port },
+        { "protocol", add_protocol }, { "state", add_state }, { "fields", add_field },
+        { "smaps", add_smaps }, { "maps", add_maps },
+    };
+
+    int (*add)(struct scan_query *, const char *) = NULL;
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        if (strcmp(option, options[i].name) == 0) add = options[i].add;
+    }
+    if (!add) return -1;
+
+    char term[64];
+    for (const char *p = terms; ; ) {
+        const char *comma = strchr(p, ',');
+        size_t len = comma ? (size_t)(comma - p) : strlen(p);
+        if (len >= sizeof(term)) return -1;
+        memcpy(term, p, len);
+        term[len] = '\0';
+        if (add(query, term) != 0) return -1;
+        if (!comma) return 0;
+        p = comma + 1;
+    }
+}
+
+int query_wants_pid(const struct scan_query *query, pid_t pid) {
+    if (!query || query->pid_count == 0) return 1;
+    for (int i = 0; i < query->pid_count; i++) {
+        if (query->pids[i] == pid) return 1;
+    }
+    return 0;
+}
+
+int query_wants_smaps(const struct scan_query *query, pid_t pid) {
+    if (!query) return 0;
+    for (int i = 0; i < query->smaps_count; i++) {
+        if (query->smaps[i] == pid) return 1;
+    }
+    return 0;
+}
+
+int query_wants_name(const struct scan_query *query, const char *name) {
+    if (!query || query->name_count == 0) return 1;
+    for (int i = 0; i < query->name_count; i++) {
+        if (strcmp(query->names[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+int query_wants_socket(const struct scan_query *query, const struct socket_info *socket) {
+    if (!query) return 1;
+    if (query->protocols && !(query->protocols & (1u << socket->protocol))) return 0;
+    if (query->states && !(query->states & (1u << socket->state))) return 0;
+    if (query->port_count == 0) return 1;
+    for (int i = 0; i < query->port_count; i++) {
+        if (query->ports[i] == socket->local.port || query->ports[i] == socket->remote.port) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char *scan_query_param(const char *query, const char *end, const char *name) {
+    size_t n = strlen(name);
+    for (const char *p = query; p && p + n < end; p = memchr(p, '&', (size_t)(end - p))) {
+        p++; // Past the '?' or '&'
+        if ((size_t)(end - p) > n && memcmp(p, name, n) == 0 && p[n] == '=') return p + n + 1;
+    }
+    return NULL;
+}
+
+/* Options a URL may narrow the /api documents with, as the command line has them */
+static const char *const query_options[] = {
+    "pid", "name", "port", "protocol", "state", "fields", "smaps", "maps",
+};
+#define QUERY_OPTION_COUNT (int)(sizeof(query_options) / sizeof(query_options[0]))
+
+/* A parameter's value up to the next '&', percent-decoded into buf; -1 if it does not fit */
+static int query_value(const char *value, const char *end, char *buf, size_t size) {
+    size_t len = 0;
+    for (const char *p = value; p < end && *p != '&'; p++) {
+        char c = *p;
+        if (c == '%' && end - p > 2 && isxdigit((unsigned char)p[1]) &&
+            isxdigit((unsigned char)p[2])) {
+            char hex[3] = { p[1], p[2], '\0' };
+            c = (char)strtol(hex, NULL, 16);
+            p += 2;
+        }
+        if (len + 1 >= size) return -1;
+        buf[len++] = c;
+    }
+    buf[len] = '\0';
+    return 0;
+}
+
+int scan_query_parse_params(const struct scan_query *base, const char *query, const char *end,
+                            struct scan_query *out, int *fresh_memory, const char **bad) {
+    scan_query_init(out);
+    *fresh_memory = 0;
+    int given = 0;
+    for (int i = 0; i < QUERY_OPTION_COUNT; i++) {
+        const char *value = scan_query_param(query, end, query_options[i]);
+        if (!value) continue;
+
+        char terms[256];
+        if (query_value(value, end, terms, sizeof(terms)) != 0 ||
+            scan_query_add(out, query_options[i], terms) != 0) {
+            *bad = query_options[i];
+            return -1;
+        }
+        if (strcmp(query_options[i], "maps") == 0 || strcmp(query_options[i], "smaps") == 0) {
+            *fresh_memory = 1;
+        }
+        given++;
+    }
+
+    if (base) {
+        out->sections = base->sections;
+        if (out->socket_fields == FIELDS_ALL) {
+            out->socket_fields = base->socket_fields;
+            out->memory_fields = base->memory_fields;
+            out->rollup_fields = base->rollup_fields;
+            out->process_fields = base->process_fields;
+        }
+        // Mappings the scanner already collected are paged as it would page them
+        if (!*fresh_memory) {
+            out->maps = base->maps;
+            out->map_offset = base->map_offset;
+            out->map_limit = base->map_limit;
+        }
+    }
+    return given;
+}
@@ -0,0 +1,146 @@
+/*
+ * Scan scheduling
+ *
+ * One timerfd is armed at an absolute CLOCK_MONOTONIC deadline: the
+ * earliest collector's, or later if the CPU budget is in debt. Waiting
+ * is a poll on it, so a signal or the caller's wake fd ends the wait at
+ * once rather than after the interval. What a tick may spend is tracked
+ * as a credit in CPU nanoseconds against CLOCK_PROCESS_CPUTIME_ID, which
+ * counts every thread, the HTTP server's included.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "../include/scan_schedule.h"
+#include "../include/scan_query.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+static const unsigned int schedule_sections[SCHEDULE_COUNT] = {
+    QUERY_SOCKETS, QUERY_PROCESSES, QUERY_MEMORY,
+};
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+int scan_schedule_init(struct scan_schedule *schedule, const struct sockmap_config *cfg) {
+    memset(schedule, 0, sizeof(*schedule));
+    schedule->timer_fd = -1;
+    if (cfg->scan_interval == 0) return 0;
+
+    const int intervals[SCHEDULE_COUNT] = {
+        cfg->socket_interval, cfg->process_interval, cfg->memory_interval,
+    };
+    uint64_t now = clock_ns(CLOCK_MONOTONIC), longest = 0;
+    for (int c = 0; c < SCHEDULE_COUNT; c++) {
+        // Processes stay scheduled for the socket owners they resolve
+        if (c != SCHEDULE_PROCESSES && !query_section(cfg->query, schedule_sections[c])) continue;
+        int seconds = intervals[c] > 0 ? intervals[c] : cfg->scan_interval;
+        schedule->interval_ns[c] = (uint64_t)seconds * NSEC_PER_SEC;
+        schedule->due_ns[c] = now + schedule->interval_ns[c];
+        if (schedule->interval_ns[c] > longest) longest = schedule->interval_ns[c];
+    }
+
+    schedule->budget = cfg->cpu_budget / 100.0;
+    schedule->credit_max_ns = (int64_t)(schedule->budget * (double)longest);
+    schedule->charged_at_ns = now;
+    schedule->charged_cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    schedule->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return schedule->timer_fd < 0 ? -1 : 0;
+}
+
+/* Credit earned since the last charge, less the CPU spent meanwhile */
+static void charge(struct scan_schedule *schedule, uint64_t now) {
+    uint64_t cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    if (schedule->budget > 0) {
+        double earned = schedule->budget * (double)(now - schedule->charged_at_ns);
+        schedule->credit_ns += (int64_t)earned;
+        schedule->credit_ns -= (int64_t)(cpu - schedule->charged_cpu_ns);
+        if (schedule->credit_ns > schedule->credit_max_ns) {
+            schedule->credit_ns = schedule->credit_max_ns;
+        }
+    }
+    schedule->charged_at_ns = now;
+    schedule->charged_cpu_ns = cpu;
+}
+
+/* The earliest deadline, pushed back by *deferred until any debt is repaid */
+static uint64_t next_deadline(const struct scan_schedule *schedule, uint64_t now,
+                              uint64_t *deferred) {
+    uint64_t deadline = UINT64_MAX;
+    for (int c = 0; c < SCHEDULE_COUNT; c++) {
+        if (schedule->interval_ns[c] && schedule->due_ns[c] < deadline) {
+            deadline = schedule->due_ns[c];
+        }
+    }
+
+    if (schedule->budget > 0 && schedule->credit_ns < 0) {
+        uint64_t repaid = now + (uint64_t)((double)-schedule->credit_ns / schedule->budget);
+        uint64_t earliest = deadline > now ? deadline : now;
+        if (repaid > earliest) {
+            *deferred = repaid - earliest;
+            deadline = repaid;
+        }
+    }
+    return deadline;
+}
+
+int scan_schedule_wait(struct scan_schedule *schedule, int wake_fd) {
+    struct pollfd fds[2];
+    int nfds = 0;
+    uint64_t deferred = 0;
+
+    if (schedule->timer_fd >= 0) {
+        uint64_t now = clock_ns(CLOCK_MONOTONIC);
+        charge(schedule, now);
+        uint64_t deadline = next_deadline(schedule, now, &deferred);
+
+        // A deadline already past still needs a nonzero it_value to arm
+        struct itimerspec timer;
+        memset(&timer, 0, sizeof(timer));
+        timer.it_value.tv_sec = (time_t)(deadline / NSEC_PER_SEC);
+        timer.it_value.tv_nsec = (long)(deadline % NSEC_PER_SEC);
+        if (deadline == 0) timer.it_value.tv_nsec = 1;
+        if (timerfd_settime(schedule->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL) != 0) return -1;
+        fds[nfds].fd = schedule->timer_fd;
+        fds[nfds++].events = POLLIN;
+    }
+    if (wake_fd >= 0) {
+        fds[nfds].fd = wake_fd;
+        fds[nfds++].events = POLLIN;
+    }
+    if (nfds == 0) return -1;
+
+    if (poll(fds, (nfds_t)nfds, -1) < 0) return errno == EINTR ? 0 : -1;
+    if (schedule->timer_fd < 0 || !(fds[0].revents & POLLIN)) return 0;
+
+    uint64_t expirations;
+    if (read(schedule->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        return -1;
+    }
+    schedule->deferred_ns += deferred;
+
+    // Every collector due by now runs; each moves on to its next grid point
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    unsigned int due = 0;
+    for (int c = 0; c < SCHEDULE_COUNT; c++) {
+        uint64_t interval = schedule->interval_ns[c];
+        if (!interval || schedule->due_ns[c] > now) continue;
+        due |= schedule_sections[c];
+        schedule->due_ns[c] += ((now - schedule->due_ns[c]) / interval + 1) * interval;
+    }
+    return (int)due;
+}
+
+void scan_schedule_close(struct scan_schedule *schedule) {
+    if (schedule->timer_fd >= 0) close(schedule->timer_fd);
+    schedule->timer_fd = -1;
+}
@@ -0,0 +1,174 @@
+/*
+ * Sliced /proc walks
+ *
+ * On hosts too large to walk every pid each scan, a scan walks one slice
+ * of the sorted listing and the rest of the snapshot stands from earlier
+ * slices. A cursor remembers the last pid the round-robin part reached,
+ * so successive slices sweep the whole listing however it churns in
+ * between. The set of listed pids already walked is kept sorted and
+ * rebuilt from each listing, which is what coverage is measured against.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "../include/scan_slice.h"
+
+struct hot_candidate {
+    pid_t pid;
+    time_t scanned_at;
+};
+
+static pid_t cursor;            /* last pid the round-robin part walked */
+static double ns_per_pid;       /* recent walks' pace, for time-budgeted slices */
+static pid_t *walked;           /* listed pids walked since they were listed, sorted */
+static pid_t *spare;            /* rebuild target, same capacity as walked */
+static int walked_count;
+static int walked_capacity;
+
+static int compare_pids(const void *a, const void *b) {
+    pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int contains(const pid_t *sorted, int count, pid_t pid) {
+    return count > 0 && bsearch(&pid, sorted, (size_t)count, sizeof(pid_t), compare_pids) != NULL;
+}
+
+/* Oldest walk first */
+static int compare_staleness(const void *a, const void *b) {
+    const struct hot_candidate *x = a, *y = b;
+    if (x->scanned_at != y->scanned_at) return x->scanned_at < y->scanned_at ? -1 : 1;
+    return compare_pids(&x->pid, &y->pid);
+}
+
+static int is_hot(const struct process_table *processes, int row) {
+    return processes->socket_count[row] >= SLICE_HOT_SOCKETS ||
+           processes->cpu_usage[row] >= SLICE_HOT_CPU_PERCENT;
+}
+
+int scan_slice_enabled(const struct sockmap_config *cfg) {
+    return cfg->slice_pids > 0 || cfg->slice_ms > 0;
+}
+
+/* Pids cfg's limits let one slice of count walk */
+static int slice_length(const struct sockmap_config *cfg, int count) {
+    int length = cfg->slice_pids > 0 && cfg->slice_pids < count ? cfg->slice_pids : count;
+    if (cfg->slice_ms > 0) {
+        double paced = ns_per_pid > 0 ? cfg->slice_ms * 1e6 / ns_per_pid : SLICE_INITIAL_PIDS;
+        if (paced < 1) paced = 1;
+        if (paced < length) length = (int)paced;
+    }
+    return length;
+}
+
+/* Sort and drop repeats, returning the new count */
+static int sort_unique(pid_t *pids, int count) {
+    qsort(pids, (size_t)count, sizeof(pid_t), compare_pids);
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        if (unique == 0 || pids[unique - 1] != pids[i]) pids[unique++] = pids[i];
+    }
+    return unique;
+}
+
+/* The hot processes still listed, stalest first, up to max of them into slice */
+static int select_hot(const pid_t *pids, int count, const struct process_table *prev,
+                      struct arena *arena, pid_t *slice, int max) {
+    struct hot_candidate *candidates =
+        arena_alloc(arena, (prev->count ? prev->count : 1) * sizeof(*candidates));
+    if (!candidates) return -1;
+
+    int n = 0;
+    for (int i = 0; i < prev->count; i++) {
+        if (!is_hot(prev, i) || !contains(pids, count, prev->pid[i])) continue;
+        candidates[n].pid = prev->pid[i];
+        candidates[n++].scanned_at = prev->scanned_at[i];
+    }
+    qsort(candidates, (size_t)n, sizeof(*candidates), compare_staleness);
+
+    int taken = 0;
+    for (int i = 0; i < n && taken < max; i++) {
+        slice[taken++] = candidates[i].pid;
+    }
+    return sort_unique(slice, taken);
+}
+
+int scan_slice_select(const struct sockmap_config *cfg, pid_t *pids, int count,
+                      const struct process_table *prev, struct arena *arena, pid_t **slice,
+                      int *hot) {
+    qsort(pids, (size_t)count, sizeof(pid_t), compare_pids);
+    int length = slice_length(cfg, count);
+    *hot = 0;
+    *slice = arena_alloc(arena, (length ? length : 1) * sizeof(pid_t));
+    if (!*slice) return -1;
+
+    // A slice that takes the whole listing has nothing to favour
+    if (prev && length < count) {
+        *hot = select_hot(pids, count, prev, arena, *slice, length / SLICE_HOT_SHARE);
+        if (*hot < 0) return -1;
+    }
+
+    // The rest goes on round the listing from the first pid past the cursor
+    int start = 0, end = count;
+    while (start < end) {
+        int mid = start + (end - start) / 2;
+        if (pids[mid] <= cursor) start = mid + 1;
+        else end = mid;
+    }
+    int taken = *hot;
+    for (int i = 0; i < count && taken < length; i++) {
+        pid_t pid = pids[(start + i) % count];
+        if (contains(*slice, *hot, pid)) continue;
+        (*slice)[taken++] = pid;
+        cursor = pid;
+    }
+
+    qsort(*slice, (size_t)taken, sizeof(pid_t), compare_pids);
+    return taken;
+}
+
+double scan_slice_done(const pid_t *pids, int count, const pid_t *slice, int slice_count,
+                       uint64_t elapsed_ns) {
+    if (slice_count > 0) {
+        double pace = (double)elapsed_ns / slice_count;
+        ns_per_pid = ns_per_pid > 0 ? (3 * ns_per_pid + pace) / 4 : pace;
+    }
+
+    if (count > walked_capacity) {
+        pid_t *grown = realloc(walked, (size_t)count * sizeof(pid_t));
+        if (!grown) return -1;
+        walked = grown;
+        grown = realloc(spare, (size_t)count * sizeof(pid_t));
+        if (!grown) return -1;
+        spare = grown;
+        walked_capacity = count;
+    }
+
+    // Listed pids walked now or before; pids no longer listed drop out
+    int covered = 0, w = 0, s = 0;
+    for (int i = 0; i < count; i++) {
+        while (w < walked_count && walked[w] < pids[i]) w++;
+        while (s < slice_count && slice[s] < pids[i]) s++;
+        if ((w < walked_count && walked[w] == pids[i]) ||
+            (s < slice_count && slice[s] == pids[i])) {
+            spare[covered++] = pids[i];
+        }
+    }
+
+    pid_t *rebuilt = spare;
+    spare = walked;
+    walked = rebuilt;
+    walked_count = covered;
+    return count > 0 ? covered * 100.0 / count : 100.0;
+}
+
+void scan_slice_release(void) {
+    free(walked);
+    free(spare);
+    walked = NULL;
+    spare = NULL;
+    walked_count = 0;
+    walked_capacity = 0;
+    cursor = 0;
+    ns_per_pid = 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Scan self-instrumentation
+ *
+ * Collectors bump counters in their own thread's scan_counters_local, so
+ * the hot loop never takes a lock or shares a cache line. Parallel
+ * workers fold theirs into the scan's totals as they exit, and the
+ * scanning thread folds its own in when the scan ends.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "../include/scan_stats.h"
+#include "../include/arena.h"
+#include "../include/json_writer.h"
+
+const char *const scan_phase_names[SCAN_PHASE_COUNT] = {
+    "sockets", "fds", "maps", "stat", "output",
+};
+
+#if SCAN_STATS_ENABLED
+__thread struct scan_counters scan_counters_local;
+
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct scan_counters totals;    /* the running scan's, from threads that flushed */
+static uint64_t scan_started;
+static size_t arena_peak;
+
+static void add_counters(struct scan_counters *into, const struct scan_counters *from) {
+    for (int p = 0; p < SCAN_PHASE_COUNT; p++) into->phase_ns[p] += from->phase_ns[p];
+    into->files_opened += from->files_opened;
+    into->bytes_read += from->bytes_read;
+    into->parse_errors += from->parse_errors;
+    into->pids_vanished += from->pids_vanished;
+}
+
+void scan_stats_begin(void) {
+    // The last document went out after the last scan ended, so it is charged to this one
+    uint64_t output_ns = scan_counters_local.phase_ns[SCAN_PHASE_OUTPUT];
+    memset(&scan_counters_local, 0, sizeof(scan_counters_local));
+
+    pthread_mutex_lock(&totals_lock);
+    memset(&totals, 0, sizeof(totals));
+    totals.phase_ns[SCAN_PHASE_OUTPUT] = output_ns;
+    pthread_mutex_unlock(&totals_lock);
+    scan_started = scan_stats_now();
+}
+
+void scan_stats_flush(void) {
+    pthread_mutex_lock(&totals_lock);
+    add_counters(&totals, &scan_counters_local);
+    pthread_mutex_unlock(&totals_lock);
+    memset(&scan_counters_local, 0, sizeof(scan_counters_local));
+}
+
+void scan_stats_end(const struct arena *arena, struct scan_stats *stats) {
+    scan_stats_flush();
+
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&totals_lock);
+    stats->counters = totals;
+    pthread_mutex_unlock(&totals_lock);
+    stats->duration_ns = scan_stats_now() - scan_started;
+
+    stats->arena_bytes = arena_footprint(arena);
+    if (stats->arena_bytes > arena_peak) arena_peak = stats->arena_bytes;
+    stats->arena_peak_bytes = arena_peak;
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) stats->peak_rss_kb = usage.ru_maxrss;
+}
+#else
+void scan_stats_begin(void) {
+}
+
+void scan_stats_flush(void) {
+}
+
+void scan_stats_end(const struct arena *arena, struct scan_stats *stats) {
+    (void)arena;
+    memset(stats, 0, sizeof(*stats));
+}
+#endif
+
+void output_scan_stats(const struct scan_stats *stats, struct json_writer *out) {
+    const struct scan_counters *counters = &stats->counters;
+
+    json_begin_object(out);
+    json_key(out, "duration_ms");
+    json_fixed2(out, stats->duration_ns / 1e6);
+    json_key(out, "phases_ms");
+    json_begin_object(out);
+    for (int p = 0; p < SCAN_PHASE_COUNT; p++) {
+        json_key(out, scan_phase_names[p]);
+        json_fixed2(out, counters->phase_ns[p] / 1e6);
+    }
+    json_end_object(out);
+    json_key(out, "files_opened");
+    json_uint(out, counters->files_opened);
+    json_key(out, "bytes_read");
+    json_uint(out, counters->bytes_read);
+    json_key(out, "parse_errors");
+    json_uint(out, counters->parse_errors);
+    json_key(out, "pids_vanished");
+    json_uint(out, counters->pids_vanished);
+    json_key(out, "arena_bytes");
+    json_uint(out, stats->arena_bytes);
+    json_key(out, "arena_peak_bytes");
+    json_uint(out, stats->arena_peak_bytes);
+    json_key(out, "peak_rss_kb");
+    json_int(out, stats->peak_rss_kb);
+    json_end_object(out);
+}
+
+void print_scan_stats(const struct scan_stats *stats) {
+    const struct scan_counters *counters = &stats->counters;
+
+    printf("SCAN STATS:\n");
+    printf("%-10s %.2f ms\n", "duration", stats->duration_ns / 1e6);
+    for (int p = 0; p < SCAN_PHASE_COUNT; p++) {
+        printf("%-10s %.2f ms\n", scan_phase_names[p], counters->phase_ns[p] / 1e6);
+    }
+    printf("%llu files opened, %llu bytes read, %llu parse errors, %llu pids vanished\n",
+           (unsigned long long)counters->files_opened, (unsigned long long)counters->bytes_read,
+           (unsigned long long)counters->parse_errors,
+           (unsigned long long)counters->pids_vanished);
+    printf("arena %zu KB (peak %zu KB), peak RSS %ld KB\n", stats->arena_bytes / 1024,
+           stats->arena_peak_bytes / 1024, stats->peak_rss_kb);
+}
@@ -0,0 +1,210 @@
+/*
+ * Streaming scan-to-output pipeline
+ *
+ * The snapshot path holds every process, mapping and socket of the host
+ * before the first byte is written. Here sockets are enumerated first
+ * (they are needed to resolve owners and are few next to mappings), then
+ * /proc is walked one pid at a time and each process is serialized and
+ * flushed together with its mappings and the sockets it holds, before the
+ * next pid is read. Peak memory is the socket table plus the largest
+ * single process, and consumers can parse records as they arrive.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/sockmap.h"
+#include "../include/inode_index.h"
+#include "../include/proc_walk.h"
+#include "../include/json_writer.h"
+#include "../include/scan_stream.h"
+#include "../include/scan_query.h"
+
+/* Socket rows ordered by inode, so a process's fds resolve by binary search */
+struct socket_ref {
+    unsigned long inode;
+    int row;
+};
+
+struct stream_context {
+    struct json_writer *out;
+    const struct scan_query *query;
+    struct socket_table *sockets;
+    struct socket_ref *by_inode;
+    struct inode_index claimed;   /* sockets already written with an owner */
+    int socket_records;
+    int mapping_records;
+    int mappings_seen;            /* before paging, to find the requested page */
+};
+
+static int compare_socket_refs(const void *a, const void *b) {
+    const struct socket_ref *x = a, *y = b;
+    return x->inode < y->inode ? -1 : x->inode > y->inode;
+}
+
+static int find_socket(const struct stream_context *ctx, unsigned long inode) {
+    int low = 0, high = ctx->sockets->count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (ctx->by_inode[mid].inode < inode) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < ctx->sockets->count && ctx->by_inode[low].inode == inode) {
+        return ctx->by_inode[low].row;
+    }
+    return -1;
+}
+
+static void begin_record(struct json_writer *out, const char *kind) {
+    json_begin_object(out);
+    json_key(out, "record");
+    json_string(out, kind);
+}
+
+static void end_record(struct json_writer *out) {
+    json_end_object(out);
+    json_newline(out);
+}
+
+static int emit_process(void *arg, const struct proc_walk *walk) {
+    struct stream_context *ctx = arg;
+    struct json_writer *out = ctx->out;
+    const struct process_table *processes = &walk->processes;
+    pid_t pid = processes->pid[0];
+    const char *name = string_pool_get(&walk->strings, processes->name[0]);
+
+    if (query_section(ctx->query, QUERY_PROCESSES)) {
+        begin_record(out, "process");
+        output_process_fields(out, processes, 0, &walk->strings,
+                              query_process_fields(ctx->query));
+        end_record(out);
+    }
+
+    unsigned int rollup_fields = query_rollup_fields(ctx->query);
+    for (int i = 0; i < walk->rollups.count; i++) {
+        begin_record(out, "memory_rollup");
+        output_rollup_fields(out, &walk->rollups, i, rollup_fields);
+        end_record(out);
+    }
+
+    // Mappings are only collected on request, and written a page at a time
+    const struct scan_query *query = ctx->query;
+    unsigned int memory_fields = query_memory_fields(query);
+    for (int i = 0; i < walk->memory.count; i++) {
+        if (ctx->mappings_seen++ < query->map_offset) continue;
+        if (query->map_limit > 0 && ctx->mapping_records >= query->map_limit) break;
+        begin_record(out, "memory");
+        output_memory_fields(out, &walk->memory, i, &walk->strings, memory_fields);
+        end_record(out);
+        ctx->mapping_records++;
+    }
+
+    // As in a snapshot, a socket shared after fork belongs to the first
+    // process found holding it
+    for (size_t i = 0; i < walk->owners.capacity; i++) {
+        const struct inode_owner *owner = &walk->owners.slots[i];
+        if (owner->inode == 0) continue;
+
+        int row = find_socket(ctx, owner->inode);
+        if (row < 0) continue; // Not TCP/UDP, e.g. a unix socket
+
+        int inserted = inode_index_insert(&ctx->claimed, owner->inode, pid, owner->fd, 0);
+        if (inserted < 0) return -1;
+        if (inserted == 0) continue;
+
+        ctx->sockets->owner[row] = 0;
+        begin_record(out, "socket");
+        output_socket_fields(out, ctx->sockets, row, pid, name,
+                             query_socket_fields(ctx->query));
+        end_record(out);
+        ctx->socket_records++;
+    }
+
+    // Hand each process to the consumer as soon as it is complete
+    return json_flush(out);
+}
+
+int stream_scan(const struct sockmap_config *cfg, struct scan_stream *stream,
+                struct json_writer *out) {
+    struct socket_table sockets;
+    struct stream_context ctx;
+    memset(&sockets, 0, sizeof(sockets));
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.out = out;
+    ctx.query = cfg->query;
+    ctx.sockets = &sockets;
+
+    scan_stats_begin();
+    arena_reset(&stream->arena);
+    time_t timestamp = time(NULL);
+
+    // Without a socket section the table stays empty and fds resolve to nothing
+    if ((query_section(cfg->query, QUERY_SOCKETS) &&
+         scan_sockets(cfg, &stream->arena, NULL, &sockets) < 0) ||
+        inode_index_init(&ctx.claimed, &stream->arena) != 0) {
+        return -1;
+    }
+
+    ctx.by_inode = arena_alloc(&stream->arena, (sockets.count + 1) * sizeof(struct socket_ref));
+    if (!ctx.by_inode) return -1;
+    for (int i = 0; i < sockets.count; i++) {
+        ctx.by_inode[i].inode = sockets.inode[i];
+        ctx.by_inode[i].row = i;
+    }
+    qsort(ctx.by_inode, sockets.count, sizeof(struct socket_ref), compare_socket_refs);
+
+    begin_record(out, "scan");
+    json_key(out, "timestamp");
+    json_int(out, (long long)timestamp);
+    end_record(out);
+
+    int processes = stream_processes(cfg->proc_root, &stream->arena, &stream->scratch,
+                                     cfg->query, emit_process, &ctx);
+    if (processes < 0) {
+        json_flush(out);
+        return -1;
+    }
+
+    // Unowned sockets cannot pass a process predicate
+    int unowned = !query_selects_processes(cfg->query);
+    for (int i = 0; unowned && i < sockets.count; i++) {
+        if (sockets.owner[i] >= 0) continue;
+        begin_record(out, "socket");
+        output_socket_fields(out, &sockets, i, 0, "unknown", query_socket_fields(cfg->query));
+        end_record(out);
+        ctx.socket_records++;
+    }
+
+    begin_record(out, "end");
+    json_key(out, "timestamp");
+    json_int(out, (long long)timestamp);
+    json_key(out, "processes");
+    json_int(out, processes);
+    json_key(out, "sockets");
+    json_int(out, ctx.socket_records);
+    json_key(out, "mappings");
+    json_int(out, ctx.mapping_records);
+    if (SCAN_STATS_ENABLED) {
+        struct scan_stats stats;
+        scan_stats_end(&stream->arena, &stats);
+        json_key(out, "scan_stats");
+        output_scan_stats(&stats, out);
+    }
+    end_record(out);
+
+    if (cfg->verbose) {
+        fprintf(stderr, "Streamed %d processes, %d sockets, %d mappings (arena %zu KB + %zu KB)\n",
+                processes, ctx.socket_records, ctx.mapping_records,
+                arena_footprint(&stream->arena) / 1024, arena_footprint(&stream->scratch) / 1024);
+    }
+    return json_flush(out);
+}
+
+void free_scan_stream(struct scan_stream *stream) {
+    arena_free(&stream->arena);
+    arena_free(&stream->scratch);
+}
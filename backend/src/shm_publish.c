@@ -0,0 +1,209 @@
+/*
+ * Shared-memory snapshot publisher
+ *
+ * Each finished snapshot is written into whichever of the region's two
+ * slots readers are not pointed at, under that slot's seqlock, and then
+ * made current. Readers never block the daemon and the daemon never
+ * waits for readers. A snapshot larger than a slot spills to the heap
+ * and is published into a new, larger region that replaces the old one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/shm_publish.h"
+
+#define PAGE_ROUND(n) (((n) + 4095) & ~(size_t)4095)
+
+/* Create and map a fresh region under a temporary name */
+static struct shm_header *create_region(const char *tmp_path, size_t slot_capacity,
+                                        size_t *map_size) {
+    size_t size = SHM_DATA_OFFSET + 2 * slot_capacity;
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return NULL;
+
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        unlink(tmp_path);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        unlink(tmp_path);
+        return NULL;
+    }
+
+    struct shm_header *header = map;
+    header->magic = SHM_SNAPSHOT_MAGIC;
+    header->version = SHM_SNAPSHOT_VERSION;
+    header->region_size = size;
+    header->slot_capacity = slot_capacity;
+    header->writer_pid = getpid();
+    *map_size = size;
+    return header;
+}
+
+static void retire(struct shm_header *header) {
+    __atomic_store_n(&header->retired, 1, __ATOMIC_RELEASE);
+}
+
+/* Retire a region left at path by an earlier daemon, if it is one of ours */
+static void retire_previous(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SHM_DATA_OFFSET) return;
+
+    struct shm_header *header = mmap(NULL, SHM_DATA_OFFSET, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) return;
+    if (header->magic == SHM_SNAPSHOT_MAGIC) retire(header);
+    munmap(header, SHM_DATA_OFFSET);
+}
+
+/*
+ * Put a new region in place of the current one. Readers that map the path
+ * from here on get the new region; readers of the old one see it retired
+ * on their next read and remap.
+ */
+static int replace_region(struct shm_publisher *pub, struct shm_header *header, size_t map_size,
+                          const char *tmp_path) {
+    int previous = pub->header ? -1 : open(pub->path, O_RDWR | O_CLOEXEC);
+
+    if (rename(tmp_path, pub->path) != 0) {
+        if (previous >= 0) close(previous);
+        munmap(header, map_size);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (pub->header) {
+        retire(pub->header);
+        munmap(pub->header, pub->map_size);
+    } else if (previous >= 0) {
+        retire_previous(previous);
+    }
+    if (previous >= 0) close(previous);
+
+    pub->header = header;
+    pub->map_size = map_size;
+    return 0;
+}
+
+static void temp_path(const struct shm_publisher *pub, char *buf, size_t len) {
+    snprintf(buf, len, "%s.%d.new", pub->path, (int)getpid());
+}
+
+int shm_publisher_open(struct shm_publisher *pub, const char *path, size_t slot_capacity) {
+    char tmp_path[300];
+    size_t map_size;
+
+    memset(pub, 0, sizeof(*pub));
+    snprintf(pub->path, sizeof(pub->path), "%s", path ? path : SHM_SNAPSHOT_PATH);
+    temp_path(pub, tmp_path, sizeof(tmp_path));
+
+    struct shm_header *header = create_region(tmp_path, PAGE_ROUND(slot_capacity), &map_size);
+    if (!header) return -1;
+    return replace_region(pub, header, map_size, tmp_path);
+}
+
+static unsigned char *slot_data(struct shm_header *header, int slot) {
+    return (unsigned char *)header + SHM_DATA_OFFSET + (size_t)slot * header->slot_capacity;
+}
+
+void shm_publish_begin(struct shm_publisher *pub) {
+    struct shm_header *header = pub->header;
+    pub->slot = (int)(__atomic_load_n(&header->current, __ATOMIC_RELAXED) & 1) ^ 1;
+    pub->length = 0;
+
+    // Odd seq before any data lands, so readers of this slot retry. It is
+    // already odd if the last publish into this slot failed to commit.
+    struct shm_slot *slot = &header->slots[pub->slot];
+    if ((slot->seq & 1) == 0) {
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+int shm_publish_write(void *ctx, const char *data, size_t len) {
+    struct shm_publisher *pub = ctx;
+    size_t capacity = pub->header->slot_capacity;
+
+    // Fill the slot, then keep the rest until commit grows the region
+    if (pub->length < capacity) {
+        size_t n = capacity - pub->length < len ? capacity - pub->length : len;
+        memcpy(slot_data(pub->header, pub->slot) + pub->length, data, n);
+        pub->length += n;
+        data += n;
+        len -= n;
+    }
+    if (len == 0) return 0;
+
+    size_t spilled = pub->length - capacity;
+    if (spilled + len > pub->spill_capacity) {
+        size_t new_capacity = pub->spill_capacity ? pub->spill_capacity : 1 << 20;
+        while (new_capacity < spilled + len) new_capacity *= 2;
+        char *grown = realloc(pub->spill, new_capacity);
+        if (!grown) return -1;
+        pub->spill = grown;
+        pub->spill_capacity = new_capacity;
+    }
+    memcpy(pub->spill + spilled, data, len);
+    pub->length += len;
+    return 0;
+}
+
+static void finish_slot(struct shm_header *header, int index, uint64_t length,
+                        int64_t timestamp, uint64_t sequence) {
+    struct shm_slot *slot = &header->slots[index];
+    __atomic_store_n(&slot->length, length, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->timestamp, timestamp, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->current, (uint32_t)index, __ATOMIC_RELEASE);
+}
+
+/* Publish an oversized snapshot as slot 0 of a region with room to spare */
+static int publish_grown(struct shm_publisher *pub, int64_t timestamp) {
+    char tmp_path[300];
+    size_t map_size;
+    size_t old_capacity = pub->header->slot_capacity;
+
+    temp_path(pub, tmp_path, sizeof(tmp_path));
+    struct shm_header *header = create_region(tmp_path, PAGE_ROUND(pub->length + pub->length / 2),
+                                              &map_size);
+    if (!header) return -1;
+
+    unsigned char *data = slot_data(header, 0);
+    memcpy(data, slot_data(pub->header, pub->slot), old_capacity);
+    memcpy(data + old_capacity, pub->spill, pub->length - old_capacity);
+    header->slots[0].seq = 1;
+    finish_slot(header, 0, pub->length, timestamp, pub->sequence + 1);
+
+    if (replace_region(pub, header, map_size, tmp_path) != 0) return -1;
+    pub->sequence++;
+    return 0;
+}
+
+int shm_publish_commit(struct shm_publisher *pub, int64_t timestamp) {
+    if (pub->length > pub->header->slot_capacity) {
+        return publish_grown(pub, timestamp);
+    }
+
+    finish_slot(pub->header, pub->slot, pub->length, timestamp, ++pub->sequence);
+    return 0;
+}
+
+void shm_publisher_close(struct shm_publisher *pub) {
+    if (pub->header) {
+        unlink(pub->path);
+        retire(pub->header);
+        munmap(pub->header, pub->map_size);
+    }
+    free(pub->spill);
+    memset(pub, 0, sizeof(*pub));
+}
@@ -0,0 +1,96 @@
+/*
+ * Shared-memory snapshot reader
+ *
+ * Maps the daemon's region once; every read after that is a seqlock-
+ * validated memcpy out of the mapping, with no lock and no syscall. Kept
+ * free of the rest of sockmap so sidecars can link it on its own.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/shm_snapshot.h"
+
+static int map_region(struct shm_reader *reader) {
+    int fd = open(reader->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SHM_DATA_OFFSET) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const struct shm_header *header = map;
+    if (header->magic != SHM_SNAPSHOT_MAGIC || header->version != SHM_SNAPSHOT_VERSION ||
+        header->region_size > (uint64_t)st.st_size) {
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    reader->map = map;
+    reader->map_size = (size_t)st.st_size;
+    return 0;
+}
+
+int shm_reader_open(struct shm_reader *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+    snprintf(reader->path, sizeof(reader->path), "%s", path ? path : SHM_SNAPSHOT_PATH);
+    return map_region(reader);
+}
+
+ssize_t shm_reader_read(struct shm_reader *reader, char *buf, size_t len,
+                        struct shm_snapshot_info *info) {
+    for (;;) {
+        if (!reader->map) return -1;
+        const struct shm_header *header = (const struct shm_header *)reader->map;
+
+        // The daemon replaced the region (it grew, restarted or exited)
+        if (__atomic_load_n(&header->retired, __ATOMIC_ACQUIRE)) {
+            munmap((void *)reader->map, reader->map_size);
+            reader->map = NULL;
+            if (map_region(reader) != 0) return -1;
+            continue;
+        }
+
+        uint32_t current = __atomic_load_n(&header->current, __ATOMIC_ACQUIRE) & 1;
+        const struct shm_slot *slot = &header->slots[current];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == 0) return 0;  // Nothing published yet
+        if (seq & 1) continue;   // The writer lapped us onto this slot
+
+        uint64_t length = __atomic_load_n(&slot->length, __ATOMIC_RELAXED);
+        int64_t timestamp = __atomic_load_n(&slot->timestamp, __ATOMIC_RELAXED);
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+        uint64_t capacity = header->slot_capacity;
+        if (length > capacity) continue; // Torn read of a slot being rewritten
+
+        if (length <= len) {
+            memcpy(buf, reader->map + SHM_DATA_OFFSET + current * capacity, length);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) continue;
+
+        if (info) {
+            info->timestamp = timestamp;
+            info->sequence = sequence;
+        }
+        return (ssize_t)length;
+    }
+}
+
+void shm_reader_close(struct shm_reader *reader) {
+    if (reader->map) {
+        munmap((void *)reader->map, reader->map_size);
+    }
+    reader->map = NULL;
+    reader->map_size = 0;
+}
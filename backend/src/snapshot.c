@@ -0,0 +1,380 @@
+/*
+ * Columnar snapshot tables
+ *
+ * Rows are appended column by column into the generation arena. Names,
+ * addresses and flags stay binary until output formats them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../include/sockmap.h"
+
+#define COLUMNS(array) (int)(sizeof(array) / sizeof(array[0]))
+#define MAX_COLUMNS 16
+
+/* Rows [0, rows) of every column, between two tables of one kind */
+static void copy_columns(void **const to[], void **const from[], const size_t widths[],
+                         int column_count, int rows) {
+    for (int i = 0; i < column_count && rows > 0; i++) {
+        memcpy(*to[i], *from[i], (size_t)rows * widths[i]);
+    }
+}
+
+/* The listed rows of every column, in list order, into rows [0, count) of to */
+static void gather_columns(void **const to[], void **const from[], const size_t widths[],
+                           int column_count, const int *rows, int count) {
+    for (int i = 0; i < column_count; i++) {
+        char *dst = *to[i];
+        const char *src = *from[i];
+        for (int r = 0; r < count; r++) {
+            memcpy(dst + (size_t)r * widths[i], src + (size_t)rows[r] * widths[i], widths[i]);
+        }
+    }
+}
+
+/* Where each of the table's columns is held, and its item width */
+static int socket_columns(struct socket_table *table, void **columns[], size_t widths[]) {
+    void **const list[] = {
+        (void **)&table->family, (void **)&table->protocol, (void **)&table->state,
+        (void **)&table->flags, (void **)&table->local, (void **)&table->remote,
+        (void **)&table->inode, (void **)&table->uid, (void **)&table->rx_queue,
+        (void **)&table->tx_queue, (void **)&table->rmem, (void **)&table->wmem,
+        (void **)&table->fwd_alloc, (void **)&table->memory_usage, (void **)&table->owner,
+    };
+    const size_t sizes[] = {
+        sizeof(*table->family), sizeof(*table->protocol), sizeof(*table->state),
+        sizeof(*table->flags), sizeof(*table->local), sizeof(*table->remote),
+        sizeof(*table->inode), sizeof(*table->uid), sizeof(*table->rx_queue),
+        sizeof(*table->tx_queue), sizeof(*table->rmem), sizeof(*table->wmem),
+        sizeof(*table->fwd_alloc), sizeof(*table->memory_usage), sizeof(*table->owner),
+    };
+    memcpy(columns, list, sizeof(list));
+    memcpy(widths, sizes, sizeof(sizes));
+    return COLUMNS(sizes);
+}
+
+int socket_table_reserve(struct socket_table *table, struct arena *arena, int needed) {
+    if (needed <= table->capacity) return 0;
+
+    void **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = socket_columns(table, columns, widths);
+    return arena_grow_columns(arena, columns, widths, column_count, &table->capacity, needed);
+}
+
+int socket_table_copy(struct socket_table *table, struct arena *arena,
+                      const struct socket_table *from) {
+    if (socket_table_reserve(table, arena, from->count) != 0) return -1;
+
+    void **to[MAX_COLUMNS], **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = socket_columns(table, to, widths);
+    socket_columns((struct socket_table *)from, columns, widths);
+    copy_columns(to, columns, widths, column_count, from->count);
+    table->count = from->count;
+    return 0;
+}
+
+int socket_table_select(struct socket_table *table, struct arena *arena,
+                        const struct socket_table *from, const int *rows, int count) {
+    if (socket_table_reserve(table, arena, count) != 0) return -1;
+
+    void **to[MAX_COLUMNS], **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = socket_columns(table, to, widths);
+    socket_columns((struct socket_table *)from, columns, widths);
+    gather_columns(to, columns, widths, column_count, rows, count);
+    table->count = count;
+    return 0;
+}
+
+int socket_table_append(struct socket_table *table, struct arena *arena,
+                        const struct socket_info *socket) {
+    if (socket_table_reserve(table, arena, table->count + 1) != 0) return -1;
+
+    int row = table->count++;
+    table->family[row] = socket->family;
+    table->protocol[row] = socket->protocol;
+    table->state[row] = socket->state;
+    table->flags[row] = 0;
+    table->local[row] = socket->local;
+    table->remote[row] = socket->remote;
+    table->inode[row] = socket->inode;
+    table->uid[row] = socket->uid;
+    table->rx_queue[row] = socket->rx_queue;
+    table->tx_queue[row] = socket->tx_queue;
+    table->rmem[row] = socket->rmem;
+    table->wmem[row] = socket->wmem;
+    table->fwd_alloc[row] = socket->fwd_alloc;
+    table->memory_usage[row] = socket->memory_usage;
+    table->owner[row] = -1;
+    return 0;
+}
+
+/* Where each of the table's columns is held, and its item width */
+static int memory_columns(struct memory_table *table, void **columns[], size_t widths[]) {
+    void **const list[] = {
+        (void **)&table->pid, (void **)&table->start, (void **)&table->size,
+        (void **)&table->perms, (void **)&table->type, (void **)&table->path,
+    };
+    const size_t sizes[] = {
+        sizeof(*table->pid), sizeof(*table->start), sizeof(*table->size),
+        sizeof(*table->perms), sizeof(*table->type), sizeof(*table->path),
+    };
+    memcpy(columns, list, sizeof(list));
+    memcpy(widths, sizes, sizeof(sizes));
+    return COLUMNS(sizes);
+}
+
+int memory_table_reserve(struct memory_table *table, struct arena *arena, int needed) {
+    if (needed <= table->capacity) return 0;
+
+    void **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = memory_columns(table, columns, widths);
+    return arena_grow_columns(arena, columns, widths, column_count, &table->capacity, needed);
+}
+
+int memory_table_copy(struct memory_table *table, struct arena *arena,
+                      const struct memory_table *from) {
+    if (memory_table_reserve(table, arena, from->count) != 0) return -1;
+
+    void **to[MAX_COLUMNS], **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = memory_columns(table, to, widths);
+    memory_columns((struct memory_table *)from, columns, widths);
+    copy_columns(to, columns, widths, column_count, from->count);
+    table->count = from->count;
+    return 0;
+}
+
+int memory_table_select(struct memory_table *table, struct arena *arena,
+                        const struct memory_table *from, const int *rows, int count) {
+    if (memory_table_reserve(table, arena, count) != 0) return -1;
+
+    void **to[MAX_COLUMNS], **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = memory_columns(table, to, widths);
+    memory_columns((struct memory_table *)from, columns, widths);
+    gather_columns(to, columns, widths, column_count, rows, count);
+    table->count = count;
+    return 0;
+}
+
+int memory_table_append(struct memory_table *table, struct arena *arena, pid_t pid,
+                        unsigned long start, unsigned long size, unsigned char perms,
+                        unsigned char type, unsigned int path) {
+    if (memory_table_reserve(table, arena, table->count + 1) != 0) return -1;
+
+    int row = table->count++;
+    table->pid[row] = pid;
+    table->start[row] = start;
+    table->size[row] = size;
+    table->perms[row] = perms;
+    table->type[row] = type;
+    table->path[row] = path;
+    return 0;
+}
+
+/* Where each of the table's columns is held, and its item width */
+static int rollup_columns(struct rollup_table *table, void **columns[], size_t widths[]) {
+    void **const list[] = {
+        (void **)&table->pid, (void **)&table->type, (void **)&table->usage,
+    };
+    const size_t sizes[] = {
+        sizeof(*table->pid), sizeof(*table->type), sizeof(*table->usage),
+    };
+    memcpy(columns, list, sizeof(list));
+    memcpy(widths, sizes, sizeof(sizes));
+    return COLUMNS(sizes);
+}
+
+int rollup_table_reserve(struct rollup_table *table, struct arena *arena, int needed) {
+    if (needed <= table->capacity) return 0;
+
+    void **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = rollup_columns(table, columns, widths);
+    return arena_grow_columns(arena, columns, widths, column_count, &table->capacity, needed);
+}
+
+int rollup_table_copy(struct rollup_table *table, struct arena *arena,
+                      const struct rollup_table *from) {
+    if (rollup_table_reserve(table, arena, from->count) != 0) return -1;
+
+    void **to[MAX_COLUMNS], **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = rollup_columns(table, to, widths);
+    rollup_columns((struct rollup_table *)from, columns, widths);
+    copy_columns(to, columns, widths, column_count, from->count);
+    table->count = from->count;
+    return 0;
+}
+
+int rollup_table_select(struct rollup_table *table, struct arena *arena,
+                        const struct rollup_table *from, const int *rows, int count) {
+    if (rollup_table_reserve(table, arena, count) != 0) return -1;
+
+    void **to[MAX_COLUMNS], **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = rollup_columns(table, to, widths);
+    rollup_columns((struct rollup_table *)from, columns, widths);
+    gather_columns(to, columns, widths, column_count, rows, count);
+    table->count = count;
+    return 0;
+}
+
+int rollup_table_append(struct rollup_table *table, struct arena *arena, pid_t pid,
+                        unsigned char type, const struct memory_usage *usage) {
+    if (rollup_table_reserve(table, arena, table->count + 1) != 0) return -1;
+
+    int row = table->count++;
+    table->pid[row] = pid;
+    table->type[row] = type;
+    table->usage[row] = *usage;
+    return 0;
+}
+
+/* Where each of the table's columns is held, and its item width */
+static int process_columns(struct process_table *table, void **columns[], size_t widths[]) {
+    void **const list[] = {
+        (void **)&table->pid, (void **)&table->name, (void **)&table->socket_count,
+        (void **)&table->rss_kb, (void **)&table->cpu_ticks, (void **)&table->start_time,
+        (void **)&table->cpu_usage, (void **)&table->state, (void **)&table->flags,
+        (void **)&table->scanned_at,
+    };
+    const size_t sizes[] = {
+        sizeof(*table->pid), sizeof(*table->name), sizeof(*table->socket_count),
+        sizeof(*table->rss_kb), sizeof(*table->cpu_ticks), sizeof(*table->start_time),
+        sizeof(*table->cpu_usage), sizeof(*table->state), sizeof(*table->flags),
+        sizeof(*table->scanned_at),
+    };
+    memcpy(columns, list, sizeof(list));
+    memcpy(widths, sizes, sizeof(sizes));
+    return COLUMNS(sizes);
+}
+
+int process_table_reserve(struct process_table *table, struct arena *arena, int needed) {
+    if (needed <= table->capacity) return 0;
+
+    void **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = process_columns(table, columns, widths);
+    return arena_grow_columns(arena, columns, widths, column_count, &table->capacity, needed);
+}
+
+int process_table_copy(struct process_table *table, struct arena *arena,
+                       const struct process_table *from) {
+    if (process_table_reserve(table, arena, from->count) != 0) return -1;
+
+    void **to[MAX_COLUMNS], **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = process_columns(table, to, widths);
+    process_columns((struct process_table *)from, columns, widths);
+    copy_columns(to, columns, widths, column_count, from->count);
+    table->count = from->count;
+    return 0;
+}
+
+int process_table_select(struct process_table *table, struct arena *arena,
+                         const struct process_table *from, const int *rows, int count) {
+    if (process_table_reserve(table, arena, count) != 0) return -1;
+
+    void **to[MAX_COLUMNS], **columns[MAX_COLUMNS];
+    size_t widths[MAX_COLUMNS];
+    int column_count = process_columns(table, to, widths);
+    process_columns((struct process_table *)from, columns, widths);
+    gather_columns(to, columns, widths, column_count, rows, count);
+    table->count = count;
+    return 0;
+}
+
+int process_table_append(struct process_table *table, struct arena *arena,
+                         struct string_pool *strings, const struct process_info *proc) {
+    int name = string_pool_intern(strings, proc->name, strlen(proc->name));
+    if (name < 0 || process_table_reserve(table, arena, table->count + 1) != 0) return -1;
+
+    int row = table->count++;
+    table->pid[row] = proc->pid;
+    table->name[row] = (unsigned int)name;
+    table->socket_count[row] = proc->socket_count;
+    table->rss_kb[row] = proc->rss_kb;
+    table->cpu_ticks[row] = proc->cpu_ticks;
+    table->start_time[row] = proc->start_time;
+    table->cpu_usage[row] = proc->cpu_usage;
+    table->state[row] = proc->state;
+    table->flags[row] = 0;
+    table->scanned_at[row] = 0;
+    return 0;
+}
+
+const char *socket_state_name(int state) {
+    switch (state) {
+        case SOCKET_STATE_ESTABLISHED: return "ESTABLISHED";
+        case SOCKET_STATE_SYN_SENT: return "SYN_SENT";
+        case SOCKET_STATE_SYN_RECV: return "SYN_RECV";
+        case SOCKET_STATE_FIN_WAIT1: return "FIN_WAIT1";
+        case SOCKET_STATE_FIN_WAIT2: return "FIN_WAIT2";
+        case SOCKET_STATE_TIME_WAIT: return "TIME_WAIT";
+        case SOCKET_STATE_CLOSE: return "CLOSE";
+        case SOCKET_STATE_CLOSE_WAIT: return "CLOSE_WAIT";
+        case SOCKET_STATE_LAST_ACK: return "LAST_ACK";
+        case SOCKET_STATE_LISTEN: return "LISTENING";
+        case SOCKET_STATE_CLOSING: return "CLOSING";
+        case SOCKET_STATE_NEW_SYN_RECV: return "SYN_RECV"; // Request sockets
+        default: return "UNKNOWN";
+    }
+}
+
+const char *socket_protocol_name(int protocol) {
+    return protocol == SOCKET_PROTO_UDP ? "UDP" : "TCP";
+}
+
+void format_socket_address(char *buf, size_t len, int family,
+                           const void *addr, unsigned int port) {
+    char host[INET6_ADDRSTRLEN];
+    if (!inet_ntop(family, addr, host, sizeof(host))) {
+        strcpy(host, "?");
+    }
+
+    if (family == AF_INET6) {
+        snprintf(buf, len, "[%s]:%u", host, port);
+    } else {
+        snprintf(buf, len, "%s:%u", host, port);
+    }
+}
+
+const char *memory_type_name(int type) {
+    switch (type) {
+        case MEMORY_TYPE_HEAP: return "heap";
+        case MEMORY_TYPE_STACK: return "stack";
+        case MEMORY_TYPE_LIBRARY: return "library";
+        case MEMORY_TYPE_FILE: return "file";
+        case MEMORY_TYPE_TOTAL: return "total";
+        default: return "anonymous";
+    }
+}
+
+/* Writes the "rwxp" form; buf needs 5 bytes */
+void format_memory_perms(unsigned char perms, char *buf) {
+    buf[0] = (perms & MEMORY_PERM_READ) ? 'r' : '-';
+    buf[1] = (perms & MEMORY_PERM_WRITE) ? 'w' : '-';
+    buf[2] = (perms & MEMORY_PERM_EXEC) ? 'x' : '-';
+    buf[3] = (perms & MEMORY_PERM_SHARED) ? 's' : 'p';
+    buf[4] = '\0';
+}
+
+const char *process_status_name(char state) {
+    switch (state) {
+        case 'R': return "running";
+        case 'S': return "sleeping";
+        case 'D': return "waiting";
+        case 'Z': return "zombie";
+        case 'T': return "stopped";
+        case 'X': return "exited";
+        default: return "unknown";
+    }
+}
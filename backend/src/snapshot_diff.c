@@ -0,0 +1,430 @@
+/*
+ * Snapshot deltas
+ *
+ * A delta indexes the previous scan's rows by key in an open-addressing
+ * table, then looks every current row up once: rows not found were
+ * added, rows found but different changed, and indexed rows no current
+ * row claimed were removed. Both scans are complete snapshots, so the
+ * cost is linear in the host's size, but what gets serialized, sent and
+ * parsed is linear in churn. The index is reused across scans and
+ * cleared by bumping its generation rather than by memset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/sockmap.h"
+#include "../include/json_writer.h"
+#include "../include/snapshot_diff.h"
+
+#define INITIAL_CAPACITY 4096
+#define KEY_MAX 48
+
+enum { ROW_SAME, ROW_ADDED = DIFF_ADDED, ROW_CHANGED = DIFF_CHANGED };
+
+struct diff_entry {
+    struct row_key key;
+    unsigned int generation;  /* in use when equal to the current build's */
+    int matched;              /* claimed by a row of the current scan */
+    int row;                  /* row in the previous scan */
+};
+
+/* How one table's rows are keyed, compared and written */
+struct table_ops {
+    const char *name;
+    int (*count)(const struct sockmap_snapshot *snap);
+    struct row_key (*key)(const struct sockmap_snapshot *snap, int row);
+    void (*format_key)(struct row_key key, char *buf, size_t len);
+    int (*same)(const struct sockmap_snapshot *prev, int prev_row,
+                const struct sockmap_snapshot *cur, int cur_row);
+    void (*fields)(const struct sockmap_snapshot *snap, int row, struct json_writer *out);
+};
+
+static struct diff_entry *entries;
+static size_t capacity;              /* always a power of two */
+static unsigned int generation;
+static unsigned char *row_status;    /* ROW_* per current row */
+static size_t status_capacity;
+
+/* FNV-1a over a socket's address tuple, for sockets without an inode */
+static unsigned long long tuple_hash(const struct socket_table *sockets, int row) {
+    const struct socket_endpoint *endpoints[2] = { &sockets->local[row], &sockets->remote[row] };
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+
+    hash = (hash ^ sockets->family[row]) * 0x100000001b3ULL;
+    hash = (hash ^ sockets->protocol[row]) * 0x100000001b3ULL;
+    for (int e = 0; e < 2; e++) {
+        for (size_t i = 0; i < sizeof(endpoints[e]->addr); i++) {
+            hash = (hash ^ endpoints[e]->addr[i]) * 0x100000001b3ULL;
+        }
+        hash = (hash ^ (endpoints[e]->port & 0xff)) * 0x100000001b3ULL;
+        hash = (hash ^ (endpoints[e]->port >> 8)) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int socket_count(const struct sockmap_snapshot *snap) {
+    return snap->sockets.count;
+}
+
+static struct row_key socket_key(const struct sockmap_snapshot *snap, int row) {
+    struct row_key key = { 0, snap->sockets.inode[row] };
+    if (key.low == 0) key.high = tuple_hash(&snap->sockets, row);
+    return key;
+}
+
+static void format_socket_key(struct row_key key, char *buf, size_t len) {
+    if (key.low != 0) snprintf(buf, len, "%llu", key.low);
+    else snprintf(buf, len, "t%016llx", key.high);
+}
+
+static int endpoint_equal(const struct socket_endpoint *a, const struct socket_endpoint *b) {
+    return a->port == b->port && memcmp(a->addr, b->addr, sizeof(a->addr)) == 0;
+}
+
+static int socket_same(const struct sockmap_snapshot *prev, int p,
+                       const struct sockmap_snapshot *cur, int c) {
+    const struct socket_table *a = &prev->sockets, *b = &cur->sockets;
+    if (a->state[p] != b->state[c] || a->flags[p] != b->flags[c] ||
+        a->family[p] != b->family[c] || a->protocol[p] != b->protocol[c] ||
+        !endpoint_equal(&a->local[p], &b->local[c]) || !endpoint_equal(&a->remote[p], &b->remote[c]) ||
+        a->uid[p] != b->uid[c] || a->rx_queue[p] != b->rx_queue[c] ||
+        a->tx_queue[p] != b->tx_queue[c] || a->rmem[p] != b->rmem[c] || a->wmem[p] != b->wmem[c] ||
+        a->fwd_alloc[p] != b->fwd_alloc[c] || a->memory_usage[p] != b->memory_usage[c]) {
+        return 0;
+    }
+    // The owner's row moves between scans; its pid and name are what is output
+    return socket_pid(prev, p) == socket_pid(cur, c) &&
+           strcmp(socket_process_name(prev, p), socket_process_name(cur, c)) == 0;
+}
+
+static void socket_fields(const struct sockmap_snapshot *snap, int row, struct json_writer *out) {
+    output_socket_fields(out, &snap->sockets, row, socket_pid(snap, row),
+                         socket_process_name(snap, row), FIELDS_ALL);
+}
+
+static int memory_count(const struct sockmap_snapshot *snap) {
+    return snap->memory.count;
+}
+
+static struct row_key memory_key(const struct sockmap_snapshot *snap, int row) {
+    struct row_key key = { (unsigned long long)(unsigned int)snap->memory.pid[row],
+                           snap->memory.start[row] };
+    return key;
+}
+
+static void format_memory_key(struct row_key key, char *buf, size_t len) {
+    snprintf(buf, len, "%d@%llx", (int)key.high, key.low);
+}
+
+static int memory_same(const struct sockmap_snapshot *prev, int p,
+                       const struct sockmap_snapshot *cur, int c) {
+    const struct memory_table *a = &prev->memory, *b = &cur->memory;
+    return a->size[p] == b->size[c] && a->perms[p] == b->perms[c] && a->type[p] == b->type[c] &&
+           strcmp(string_pool_get(&prev->strings, a->path[p]),
+                  string_pool_get(&cur->strings, b->path[c])) == 0;
+}
+
+static void memory_fields(const struct sockmap_snapshot *snap, int row, struct json_writer *out) {
+    output_memory_fields(out, &snap->memory, row, &snap->strings, FIELDS_ALL);
+}
+
+static int rollup_count(const struct sockmap_snapshot *snap) {
+    return snap->rollups.count;
+}
+
+static struct row_key rollup_key(const struct sockmap_snapshot *snap, int row) {
+    struct row_key key = { (unsigned long long)(unsigned int)snap->rollups.pid[row],
+                           snap->rollups.type[row] };
+    return key;
+}
+
+static void format_rollup_key(struct row_key key, char *buf, size_t len) {
+    snprintf(buf, len, "%d:%s", (int)key.high, memory_type_name((int)key.low));
+}
+
+static int rollup_same(const struct sockmap_snapshot *prev, int p,
+                       const struct sockmap_snapshot *cur, int c) {
+    return memcmp(&prev->rollups.usage[p], &cur->rollups.usage[c],
+                  sizeof(struct memory_usage)) == 0;
+}
+
+static void rollup_fields(const struct sockmap_snapshot *snap, int row, struct json_writer *out) {
+    output_rollup_fields(out, &snap->rollups, row, FIELDS_ALL);
+}
+
+static int process_count(const struct sockmap_snapshot *snap) {
+    return snap->processes.count;
+}
+
+static struct row_key process_key(const struct sockmap_snapshot *snap, int row) {
+    struct row_key key = { (unsigned long long)(unsigned int)snap->processes.pid[row],
+                           snap->processes.start_time[row] };
+    return key;
+}
+
+static void format_process_key(struct row_key key, char *buf, size_t len) {
+    snprintf(buf, len, "%d@%llu", (int)key.high, key.low);
+}
+
+/* What json_fixed2 prints, so invisible jitter is not a change */
+static unsigned long long hundredths(double value) {
+    if (value != value || value < 0) return 0;
+    return (unsigned long long)(value * 100.0 + 0.5);
+}
+
+static int process_same(const struct sockmap_snapshot *prev, int p,
+                        const struct sockmap_snapshot *cur, int c) {
+    const struct process_table *a = &prev->processes, *b = &cur->processes;
+    return a->socket_count[p] == b->socket_count[c] && a->state[p] == b->state[c] &&
+           a->flags[p] == b->flags[c] &&
+           hundredths(a->rss_kb[p] / 1024.0) == hundredths(b->rss_kb[c] / 1024.0) &&
+           hundredths(a->cpu_usage[p]) == hundredths(b->cpu_usage[c]) &&
+           strcmp(string_pool_get(&prev->strings, a->name[p]),
+                  string_pool_get(&cur->strings, b->name[c])) == 0;
+}
+
+static void process_fields(const struct sockmap_snapshot *snap, int row, struct json_writer *out) {
+    output_process_fields(out, &snap->processes, row, &snap->strings, FIELDS_ALL);
+}
+
+static const struct table_ops tables[] = {
+    { "sockets", socket_count, socket_key, format_socket_key, socket_same, socket_fields },
+    { "memory", memory_count, memory_key, format_memory_key, memory_same, memory_fields },
+    { "memory_rollup", rollup_count, rollup_key, format_rollup_key, rollup_same, rollup_fields },
+    { "processes", process_count, process_key, format_process_key, process_same, process_fields },
+};
+
+#define TABLE_COUNT (sizeof(tables) / sizeof(tables[0]))
+
+struct row_key snapshot_row_key(int table, const struct sockmap_snapshot *snap, int row) {
+    return tables[table].key(snap, row);
+}
+
+static void write_key(const struct table_ops *ops, struct row_key key, struct json_writer *out) {
+    char buf[KEY_MAX];
+    ops->format_key(key, buf, sizeof(buf));
+    json_string(out, buf);
+}
+
+static void write_row(const struct table_ops *ops, const struct sockmap_snapshot *snap, int row,
+                      struct json_writer *out) {
+    json_begin_object(out);
+    json_key(out, "key");
+    write_key(ops, ops->key(snap, row), out);
+    ops->fields(snap, row, out);
+    json_end_object(out);
+}
+
+const char *snapshot_table_name(int table) {
+    return tables[table].name;
+}
+
+void output_keyed_row(int table, const struct sockmap_snapshot *snap, int row,
+                      struct json_writer *out) {
+    write_row(&tables[table], snap, row, out);
+}
+
+void output_row_key(int table, struct row_key key, struct json_writer *out) {
+    write_key(&tables[table], key, out);
+}
+
+void output_keyed_snapshot(const struct sockmap_snapshot *snap, unsigned long long sequence,
+                           struct json_writer *out) {
+    json_begin_object(out);
+    json_key(out, "sequence");
+    json_uint(out, sequence);
+    json_key(out, "timestamp");
+    json_int(out, (long long)snap->timestamp);
+    for (size_t t = 0; t < TABLE_COUNT; t++) {
+        const struct table_ops *ops = &tables[t];
+        int count = ops->count(snap);
+        json_key(out, ops->name);
+        json_begin_array(out);
+        for (int row = 0; row < count; row++) {
+            write_row(ops, snap, row, out);
+        }
+        json_end_array(out);
+    }
+    json_end_object(out);
+}
+
+static size_t hash_key(struct row_key key) {
+    unsigned long long mix = key.high * 0x9E3779B97F4A7C15ULL ^ key.low;
+    return (size_t)((mix * 0x9E3779B97F4A7C15ULL) >> 16) & (capacity - 1);
+}
+
+/* Size the index and status array before anything is written */
+static int reserve(size_t rows, size_t current_rows) {
+    size_t needed = INITIAL_CAPACITY;
+    while (needed < rows * 2) needed *= 2;
+    if (needed > capacity) {
+        struct diff_entry *grown = calloc(needed, sizeof(struct diff_entry));
+        if (!grown) return -1;
+        free(entries);
+        entries = grown;
+        capacity = needed;
+        generation = 0;
+    }
+
+    if (current_rows > status_capacity) {
+        unsigned char *status = malloc(current_rows);
+        if (!status) return -1;
+        free(row_status);
+        row_status = status;
+        status_capacity = current_rows;
+    }
+    return 0;
+}
+
+/* Start an empty index; zero never marks a live entry */
+static void index_clear(void) {
+    if (++generation == 0) {
+        memset(entries, 0, capacity * sizeof(struct diff_entry));
+        generation = 1;
+    }
+}
+
+static void index_insert(struct row_key key, int row) {
+    size_t pos = hash_key(key);
+    while (entries[pos].generation == generation) {
+        // A duplicate key keeps its first row
+        if (entries[pos].key.high == key.high && entries[pos].key.low == key.low) return;
+        pos = (pos + 1) & (capacity - 1);
+    }
+    entries[pos].key = key;
+    entries[pos].generation = generation;
+    entries[pos].matched = 0;
+    entries[pos].row = row;
+}
+
+static struct diff_entry *index_lookup(struct row_key key) {
+    size_t pos = hash_key(key);
+    while (entries[pos].generation == generation) {
+        if (entries[pos].key.high == key.high && entries[pos].key.low == key.low) {
+            return &entries[pos];
+        }
+        pos = (pos + 1) & (capacity - 1);
+    }
+    return NULL;
+}
+
+static void write_rows_with_status(const struct table_ops *ops, const struct sockmap_snapshot *cur,
+                                   int count, unsigned char status, struct json_writer *out) {
+    json_begin_array(out);
+    for (int row = 0; row < count; row++) {
+        if (row_status[row] == status) write_row(ops, cur, row, out);
+    }
+    json_end_array(out);
+}
+
+/* Mark each of cur's rows with a ROW_*; prev's rows left unmatched in the index were removed */
+static void classify_rows(const struct table_ops *ops, const struct sockmap_snapshot *prev,
+                          const struct sockmap_snapshot *cur) {
+    int prev_count = ops->count(prev);
+    int cur_count = ops->count(cur);
+
+    index_clear();
+    for (int row = 0; row < prev_count; row++) {
+        index_insert(ops->key(prev, row), row);
+    }
+
+    for (int row = 0; row < cur_count; row++) {
+        struct diff_entry *entry = index_lookup(ops->key(cur, row));
+        if (!entry || entry->matched) {
+            row_status[row] = ROW_ADDED;
+            continue;
+        }
+        entry->matched = 1;
+        row_status[row] = ops->same(prev, entry->row, cur, row) ? ROW_SAME : ROW_CHANGED;
+    }
+}
+
+static void write_table_delta(const struct table_ops *ops, const struct sockmap_snapshot *prev,
+                              const struct sockmap_snapshot *cur, struct json_writer *out) {
+    int cur_count = ops->count(cur);
+    classify_rows(ops, prev, cur);
+
+    json_key(out, ops->name);
+    json_begin_object(out);
+    json_key(out, "added");
+    write_rows_with_status(ops, cur, cur_count, ROW_ADDED, out);
+    json_key(out, "changed");
+    write_rows_with_status(ops, cur, cur_count, ROW_CHANGED, out);
+
+    json_key(out, "removed");
+    json_begin_array(out);
+    for (size_t pos = 0; pos < capacity; pos++) {
+        if (entries[pos].generation == generation && !entries[pos].matched) {
+            write_key(ops, entries[pos].key, out);
+        }
+    }
+    json_end_array(out);
+    json_end_object(out);
+}
+
+/* Size the index for the largest table of either scan */
+static int reserve_tables(const struct sockmap_snapshot *prev, const struct sockmap_snapshot *cur) {
+    size_t prev_rows = 0, cur_rows = 0;
+    for (size_t t = 0; t < TABLE_COUNT; t++) {
+        size_t rows = (size_t)tables[t].count(prev);
+        if (rows > prev_rows) prev_rows = rows;
+        rows = (size_t)tables[t].count(cur);
+        if (rows > cur_rows) cur_rows = rows;
+    }
+    return reserve(prev_rows, cur_rows);
+}
+
+int output_snapshot_delta(const struct sockmap_snapshot *prev, const struct sockmap_snapshot *cur,
+                          unsigned long long sequence, struct json_writer *out) {
+    if (reserve_tables(prev, cur) != 0) return -1;
+
+    json_begin_object(out);
+    json_key(out, "sequence");
+    json_uint(out, sequence);
+    json_key(out, "base");
+    json_uint(out, sequence - 1);
+    json_key(out, "timestamp");
+    json_int(out, (long long)cur->timestamp);
+    for (size_t t = 0; t < TABLE_COUNT; t++) {
+        write_table_delta(&tables[t], prev, cur, out);
+    }
+    json_end_object(out);
+    return 0;
+}
+
+int snapshot_diff_rows(const struct sockmap_snapshot *prev, const struct sockmap_snapshot *cur,
+                       unsigned int table_mask, diff_row_fn fn, void *ctx) {
+    if (reserve_tables(prev, cur) != 0) return -1;
+
+    for (size_t t = 0; t < TABLE_COUNT; t++) {
+        if (!(table_mask & (1u << t))) continue;
+        const struct table_ops *ops = &tables[t];
+        int cur_count = ops->count(cur);
+        classify_rows(ops, prev, cur);
+
+        for (int row = 0; row < cur_count; row++) {
+            if (row_status[row] != ROW_SAME &&
+                fn(ctx, (int)t, row_status[row], cur, row, ops->key(cur, row)) != 0) {
+                return -1;
+            }
+        }
+        for (size_t pos = 0; pos < capacity; pos++) {
+            if (entries[pos].generation == generation && !entries[pos].matched &&
+                fn(ctx, (int)t, DIFF_REMOVED, prev, entries[pos].row, entries[pos].key) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+void snapshot_diff_release(void) {
+    free(entries);
+    free(row_status);
+    entries = NULL;
+    row_status = NULL;
+    capacity = 0;
+    status_capacity = 0;
+    generation = 0;
+}
@@ -0,0 +1,972 @@
+/*
+ * On-disk snapshot history
+ *
+ * Records are built in a staging buffer and copied into the mapped data
+ * ring, so a tick costs the diff the event stream already does plus a
+ * memcpy of what changed. Rows are fixed-size binary structs behind their
+ * diff key; a delta lists each table's added and changed rows, then the
+ * keys of its removed ones, in the order snapshot_diff_rows reports them.
+ *
+ * A query binary-searches the time index for its start, replays from the
+ * keyframe before it into a key-indexed row set, writes that state once
+ * and then turns each later record straight into a delta, decoding only
+ * the rows it lists. Nothing outside that span of the file is touched.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/sockmap.h"
+#include "../include/json_writer.h"
+#include "../include/proc_walk.h"
+#include "../include/snapshot_diff.h"
+#include "../include/snapshot_log.h"
+
+#define HEADER_SIZE 4096
+#define MIN_SIZE (1UL << 20)
+/* Index entries per byte of file; records average well over this */
+#define BYTES_PER_INDEX_ENTRY 1024
+#define NAME_MAX_LEN 16           /* comm names, NUL included */
+#define QUERY_ATTEMPTS 3
+
+/* Tables kept, as DIFF_* ids; mappings are left out */
+static const int log_tables[] = { DIFF_SOCKETS, DIFF_ROLLUPS, DIFF_PROCESSES };
+#define LOG_TABLES (int)(sizeof(log_tables) / sizeof(log_tables[0]))
+#define LOG_TABLE_MASK ((1u << DIFF_SOCKETS) | (1u << DIFF_ROLLUPS) | (1u << DIFF_PROCESSES))
+
+struct log_record {
+    uint32_t length;          /* header and rows */
+    uint32_t kind;            /* SNAPSHOT_LOG_* */
+    int64_t timestamp;
+    uint32_t upserts[LOG_TABLES];
+    uint32_t removals[LOG_TABLES];
+};
+
+/* Ahead of each added or changed row; removed rows are the key alone */
+struct log_upsert {
+    struct row_key key;
+    uint32_t change;          /* DIFF_ADDED or DIFF_CHANGED */
+    uint32_t reserved;
+};
+
+struct log_socket {
+    uint64_t inode;
+    uint64_t memory_usage;
+    uint32_t uid;
+    uint32_t rx_queue;
+    uint32_t tx_queue;
+    uint32_t rmem;
+    uint32_t wmem;
+    uint32_t fwd_alloc;
+    int32_t pid;              /* owner, 0 if none was found */
+    uint16_t local_port;
+    uint16_t remote_port;
+    uint8_t local[16];
+    uint8_t remote[16];
+    uint8_t family;
+    uint8_t protocol;
+    uint8_t state;
+    uint8_t flags;
+    char process_name[NAME_MAX_LEN];
+};
+
+struct log_rollup {
+    int32_t pid;
+    uint32_t type;
+    uint64_t rss_kb;
+    uint64_t pss_kb;
+    uint64_t swap_kb;
+    uint64_t shared_dirty_kb;
+    uint64_t private_dirty_kb;
+};
+
+struct log_process {
+    uint64_t start_time;
+    uint64_t rss_kb;
+    double cpu_usage;
+    int32_t pid;
+    int32_t socket_count;
+    char state;
+    uint8_t flags;
+    char name[NAME_MAX_LEN];
+};
+
+static const size_t row_sizes[LOG_TABLES] = {
+    sizeof(struct log_socket), sizeof(struct log_rollup), sizeof(struct log_process),
+};
+
+static void copy_name(char *dst, const char *src) {
+    size_t len = strnlen(src, NAME_MAX_LEN - 1);
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+static void encode_row(int table, const struct sockmap_snapshot *snap, int row, void *payload) {
+    memset(payload, 0, row_sizes[table]);
+    if (table == 0) {
+        const struct socket_table *s = &snap->sockets;
+        struct log_socket *out = payload;
+        out->inode = s->inode[row];
+        out->memory_usage = s->memory_usage[row];
+        out->uid = s->uid[row];
+        out->rx_queue = s->rx_queue[row];
+        out->tx_queue = s->tx_queue[row];
+        out->rmem = s->rmem[row];
+        out->wmem = s->wmem[row];
+        out->fwd_alloc = s->fwd_alloc[row];
+        out->pid = socket_pid(snap, row);
+        out->local_port = s->local[row].port;
+        out->remote_port = s->remote[row].port;
+        memcpy(out->local, s->local[row].addr, sizeof(out->local));
+        memcpy(out->remote, s->remote[row].addr, sizeof(out->remote));
+        out->family = s->family[row];
+        out->protocol = s->protocol[row];
+        out->state = s->state[row];
+        out->flags = s->flags[row];
+        copy_name(out->process_name, socket_process_name(snap, row));
+    } else if (table == 1) {
+        const struct rollup_table *r = &snap->rollups;
+        const struct memory_usage *usage = &r->usage[row];
+        struct log_rollup *out = payload;
+        out->pid = r->pid[row];
+        out->type = r->type[row];
+        out->rss_kb = usage->rss_kb;
+        out->pss_kb = usage->pss_kb;
+        out->swap_kb = usage->swap_kb;
+        out->shared_dirty_kb = usage->shared_dirty_kb;
+        out->private_dirty_kb = usage->private_dirty_kb;
+    } else {
+        const struct process_table *p = &snap->processes;
+        struct log_process *out = payload;
+        out->start_time = p->start_time[row];
+        out->rss_kb = p->rss_kb[row];
+        out->cpu_usage = p->cpu_usage[row];
+        out->pid = p->pid[row];
+        out->socket_count = p->socket_count[row];
+        out->state = p->state[row];
+        out->flags = p->flags[row];
+        copy_name(out->name, string_pool_get(&snap->strings, p->name[row]));
+    }
+}
+
+/* ---- Writer ---- */
+
+static struct snapshot_log_entry *log_entry(const struct snapshot_log_header *header,
+                                            uint64_t record) {
+    return (struct snapshot_log_entry *)((char *)header + header->index_offset) +
+           record % header->index_capacity;
+}
+
+static char *log_data(const struct snapshot_log_header *header) {
+    return (char *)header + header->data_offset;
+}
+
+static void format_header(struct snapshot_log_header *header, size_t size) {
+    memset(header, 0, HEADER_SIZE);
+    header->version = SNAPSHOT_LOG_VERSION;
+    header->file_size = size;
+    header->index_offset = HEADER_SIZE;
+    header->index_capacity = size / BYTES_PER_INDEX_ENTRY;
+    size_t index_end = HEADER_SIZE + header->index_capacity * sizeof(struct snapshot_log_entry);
+    header->data_offset = (index_end + HEADER_SIZE - 1) / HEADER_SIZE * HEADER_SIZE;
+    header->data_size = size - header->data_offset;
+    // Readers ignore the file until the magic is in place
+    __atomic_store_n(&header->magic, SNAPSHOT_LOG_MAGIC, __ATOMIC_RELEASE);
+}
+
+static int header_valid(const struct snapshot_log_header *header, size_t size) {
+    return header->magic == SNAPSHOT_LOG_MAGIC && header->version == SNAPSHOT_LOG_VERSION &&
+           header->file_size == size && header->data_offset < size &&
+           header->first <= header->next && header->write_pos <= header->data_size;
+}
+
+int snapshot_log_open(struct snapshot_log *log, const char *path, size_t size) {
+    memset(log, 0, sizeof(*log));
+    log->fd = -1;
+    if (size < MIN_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    int reuse = fstat(fd, &st) == 0 && (size_t)st.st_size == size;
+    if (!reuse) {
+        // Reserve every block now so a full disk cannot fault a later write
+        int err = ftruncate(fd, 0) != 0 ? errno : posix_fallocate(fd, 0, (off_t)size);
+        if (err != 0) {
+            close(fd);
+            errno = err;
+            return -1;
+        }
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    log->fd = fd;
+    log->header = map;
+    log->map_size = size;
+    log->need_keyframe = 1;
+    if (!reuse || !header_valid(log->header, size)) {
+        format_header(log->header, size);
+    }
+    return 0;
+}
+
+static int stage(struct snapshot_log *log, const void *data, size_t len) {
+    if (log->staging_len + len > log->staging_capacity) {
+        size_t capacity = log->staging_capacity ? log->staging_capacity : 64 * 1024;
+        while (capacity < log->staging_len + len) capacity *= 2;
+        char *grown = realloc(log->staging, capacity);
+        if (!grown) return -1;
+        log->staging = grown;
+        log->staging_capacity = capacity;
+    }
+    memcpy(log->staging + log->staging_len, data, len);
+    log->staging_len += len;
+    return 0;
+}
+
+static struct log_record *staged_record(struct snapshot_log *log) {
+    return (struct log_record *)log->staging;
+}
+
+static int log_table_of(int diff_table) {
+    for (int t = 0; t < LOG_TABLES; t++) {
+        if (log_tables[t] == diff_table) return t;
+    }
+    return -1;
+}
+
+static int stage_upsert(struct snapshot_log *log, int table, int change,
+                        const struct sockmap_snapshot *snap, int row, struct row_key key) {
+    struct log_upsert head;
+    char payload[sizeof(struct log_socket)];   /* the largest row */
+    memset(&head, 0, sizeof(head));
+    head.key = key;
+    head.change = (uint32_t)change;
+    encode_row(table, snap, row, payload);
+    if (stage(log, &head, sizeof(head)) != 0 || stage(log, payload, row_sizes[table]) != 0) {
+        return -1;
+    }
+    staged_record(log)->upserts[table]++;
+    return 0;
+}
+
+/* diff_row_fn staging one row of a delta */
+static int stage_change(void *ctx, int diff_table, int change, const struct sockmap_snapshot *snap,
+                        int row, struct row_key key) {
+    struct snapshot_log *log = ctx;
+    int table = log_table_of(diff_table);
+    if (change != DIFF_REMOVED) return stage_upsert(log, table, change, snap, row, key);
+
+    if (stage(log, &key, sizeof(key)) != 0) return -1;
+    staged_record(log)->removals[table]++;
+    return 0;
+}
+
+/* Build the record in staging: every row of cur, or what changed since prev */
+static int encode_record(struct snapshot_log *log, const struct sockmap_snapshot *prev,
+                         const struct sockmap_snapshot *cur) {
+    struct log_record record;
+    memset(&record, 0, sizeof(record));
+    record.kind = prev ? SNAPSHOT_LOG_DELTA : SNAPSHOT_LOG_KEYFRAME;
+    record.timestamp = (int64_t)cur->timestamp;
+    log->staging_len = 0;
+    if (stage(log, &record, sizeof(record)) != 0) return -1;
+
+    if (prev) {
+        if (snapshot_diff_rows(prev, cur, LOG_TABLE_MASK, stage_change, log) != 0) return -1;
+    } else {
+        const int counts[LOG_TABLES] = {
+            cur->sockets.count, cur->rollups.count, cur->processes.count,
+        };
+        for (int t = 0; t < LOG_TABLES; t++) {
+            for (int row = 0; row < counts[t]; row++) {
+                if (stage_upsert(log, t, DIFF_ADDED, cur, row,
+                                 snapshot_row_key(log_tables[t], cur, row)) != 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    staged_record(log)->length = (uint32_t)log->staging_len;
+    return 0;
+}
+
+/*
+ * Copy the staged record into the ring, evicting the oldest keyframe
+ * groups in its way. Returns 1 when written, 0 when it is a delta that
+ * eviction left nothing to replay from, -1 when it cannot fit at all.
+ */
+static int place_record(struct snapshot_log *log) {
+    struct snapshot_log_header *header = log->header;
+    const struct log_record *record = staged_record(log);
+    uint64_t len = log->staging_len;
+    if (len > header->data_size || len > UINT32_MAX) return -1;
+
+    uint64_t pos = header->write_pos, tail = header->data_size;
+    if (pos + len > header->data_size) {
+        tail = pos;
+        pos = 0;
+    }
+
+    // Records lie in ring order from the write position on. A wrap
+    // abandons the tail past the old write position, whose records are
+    // the oldest and go first; after that only the oldest can be in the way
+    uint64_t first = header->first, next = header->next;
+    while (first < next) {
+        const struct snapshot_log_entry *oldest = log_entry(header, first);
+        int overlaps = oldest->offset >= tail ||
+                       (oldest->offset < pos + len && pos < oldest->offset + oldest->length);
+        if (!overlaps && next - first < header->index_capacity) break;
+        do {
+            first++;
+        } while (first < next && log_entry(header, first)->kind != SNAPSHOT_LOG_KEYFRAME);
+    }
+    __atomic_store_n(&header->first, first, __ATOMIC_RELEASE);
+    if (first == next && record->kind == SNAPSHOT_LOG_DELTA) return 0;
+
+    memcpy(log_data(header) + pos, log->staging, len);
+    struct snapshot_log_entry *entry = log_entry(header, next);
+    entry->timestamp = record->timestamp;
+    entry->offset = pos;
+    entry->length = (uint32_t)len;
+    entry->kind = record->kind;
+    header->write_pos = pos + len;
+    __atomic_store_n(&header->next, next + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int snapshot_log_append(struct snapshot_log *log, const struct sockmap_snapshot *prev,
+                        const struct sockmap_snapshot *cur) {
+    int keyframe = !prev || log->need_keyframe || log->deltas >= SNAPSHOT_LOG_KEYFRAME_MAX ||
+                   log->delta_bytes >= log->keyframe_bytes;
+    log->need_keyframe = 1;   /* until this append succeeds */
+
+    if (encode_record(log, keyframe ? NULL : prev, cur) != 0) return -1;
+    int placed = place_record(log);
+    if (placed == 0) {
+        keyframe = 1;
+        if (encode_record(log, NULL, cur) != 0) return -1;
+        placed = place_record(log);
+    }
+    if (placed <= 0) return -1;
+
+    if (keyframe) {
+        log->keyframe_bytes = log->staging_len;
+        log->delta_bytes = 0;
+        log->deltas = 0;
+    } else {
+        log->delta_bytes += log->staging_len;
+        log->deltas++;
+    }
+    log->need_keyframe = 0;
+    return 0;
+}
+
+void snapshot_log_close(struct snapshot_log *log) {
+    if (log->header) munmap(log->header, log->map_size);
+    if (log->fd >= 0) close(log->fd);
+    free(log->staging);
+    memset(log, 0, sizeof(*log));
+    log->fd = -1;
+}
+
+/* ---- Reader ---- */
+
+/* One table's rows by key, as of the record last replayed */
+struct row_set {
+    size_t row_size;
+    char *rows;
+    struct row_key *keys;
+    int count;
+    int capacity;
+    unsigned int *slots;      /* row + 1, 0 marks an empty slot */
+    size_t slot_capacity;     /* always a power of two */
+};
+
+struct log_reader {
+    const struct snapshot_log_header *header;
+    size_t map_size;
+    char *record;             /* private copy of the record being read */
+    size_t record_capacity;
+    struct row_set sets[LOG_TABLES];
+    struct sockmap_snapshot scratch;   /* rows decoded for output */
+    char *delta;              /* a keyframe met mid-range, recast as a delta */
+    size_t delta_len;
+    size_t delta_capacity;
+    unsigned char *seen;      /* row set rows the keyframe also has */
+    size_t seen_capacity;
+};
+
+static size_t hash_row_key(struct row_key key, size_t cap) {
+    unsigned long long mix = key.high * 0x9E3779B97F4A7C15ULL ^ key.low;
+    return (size_t)((mix * 0x9E3779B97F4A7C15ULL) >> 16) & (cap - 1);
+}
+
+static int keys_equal(struct row_key a, struct row_key b) {
+    return a.high == b.high && a.low == b.low;
+}
+
+/* Slot holding key, or the empty slot where it would go */
+static size_t set_find(const struct row_set *set, struct row_key key) {
+    size_t pos = hash_row_key(key, set->slot_capacity);
+    while (set->slots[pos] != 0 && !keys_equal(set->keys[set->slots[pos] - 1], key)) {
+        pos = (pos + 1) & (set->slot_capacity - 1);
+    }
+    return pos;
+}
+
+static int set_rehash(struct row_set *set, size_t slot_capacity) {
+    unsigned int *slots = calloc(slot_capacity, sizeof(unsigned int));
+    if (!slots) return -1;
+    free(set->slots);
+    set->slots = slots;
+    set->slot_capacity = slot_capacity;
+    for (int i = 0; i < set->count; i++) {
+        set->slots[set_find(set, set->keys[i])] = (unsigned int)i + 1;
+    }
+    return 0;
+}
+
+static void set_clear(struct row_set *set) {
+    set->count = 0;
+    if (set->slots) memset(set->slots, 0, set->slot_capacity * sizeof(unsigned int));
+}
+
+static int set_upsert(struct row_set *set, struct row_key key, const void *payload) {
+    if ((size_t)(set->count + 1) * 2 > set->slot_capacity &&
+        set_rehash(set, set->slot_capacity ? set->slot_capacity * 2 : 1024) != 0) {
+        return -1;
+    }
+
+    size_t pos = set_find(set, key);
+    int row;
+    if (set->slots[pos] != 0) {
+        row = (int)set->slots[pos] - 1;
+    } else {
+        if (set->count == set->capacity) {
+            int capacity = set->capacity ? set->capacity * 2 : 1024;
+            char *rows = realloc(set->rows, (size_t)capacity * set->row_size);
+            if (!rows) return -1;
+            set->rows = rows;
+            struct row_key *keys = realloc(set->keys, (size_t)capacity * sizeof(struct row_key));
+            if (!keys) return -1;
+            set->keys = keys;
+            set->capacity = capacity;
+        }
+        row = set->count++;
+        set->keys[row] = key;
+        set->slots[pos] = (unsigned int)row + 1;
+    }
+    memcpy(set->rows + (size_t)row * set->row_size, payload, set->row_size);
+    return 0;
+}
+
+static void set_remove(struct row_set *set, struct row_key key) {
+    if (set->count == 0) return;
+    size_t mask = set->slot_capacity - 1;
+    size_t hole = set_find(set, key);
+    if (set->slots[hole] == 0) return;
+    int row = (int)set->slots[hole] - 1;
+
+    // Backward-shift deletion: pull later entries of the chain into the hole
+    for (size_t pos = (hole + 1) & mask; set->slots[pos] != 0; pos = (pos + 1) & mask) {
+        size_t home = hash_row_key(set->keys[set->slots[pos] - 1], set->slot_capacity);
+        if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+            set->slots[hole] = set->slots[pos];
+            hole = pos;
+        }
+    }
+    set->slots[hole] = 0;
+
+    // Keep rows dense by moving the last one into the gap
+    int last = --set->count;
+    if (row != last) {
+        set->keys[row] = set->keys[last];
+        memcpy(set->rows + (size_t)row * set->row_size, set->rows + (size_t)last * set->row_size,
+               set->row_size);
+        set->slots[set_find(set, set->keys[row])] = (unsigned int)row + 1;
+    }
+}
+
+static int reader_open(struct log_reader *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= MIN_SIZE) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    reader->header = map;
+    reader->map_size = (size_t)st.st_size;
+    if (__atomic_load_n(&reader->header->magic, __ATOMIC_ACQUIRE) != SNAPSHOT_LOG_MAGIC ||
+        reader->header->version != SNAPSHOT_LOG_VERSION ||
+        reader->header->file_size != reader->map_size) {
+        munmap(map, reader->map_size);
+        reader->header = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+    for (int t = 0; t < LOG_TABLES; t++) {
+        reader->sets[t].row_size = row_sizes[t];
+    }
+    return 0;
+}
+
+static void reader_close(struct log_reader *reader) {
+    if (reader->header) munmap((void *)reader->header, reader->map_size);
+    free(reader->record);
+    for (int t = 0; t < LOG_TABLES; t++) {
+        free(reader->sets[t].rows);
+        free(reader->sets[t].keys);
+        free(reader->sets[t].slots);
+    }
+    free(reader->delta);
+    free_snapshot(&reader->scratch);
+}
+
+static uint64_t load_first(const struct log_reader *reader) {
+    return __atomic_load_n(&reader->header->first, __ATOMIC_ACQUIRE);
+}
+
+static struct snapshot_log_entry read_entry(const struct log_reader *reader, uint64_t record) {
+    return *log_entry(reader->header, record);
+}
+
+/*
+ * Copy record n out of the ring. Returns 0 once the copy is known to
+ * predate any overwrite, 1 if the writer evicted it meanwhile, -1 on OOM.
+ */
+static int copy_record(struct log_reader *reader, uint64_t n, struct snapshot_log_entry *entry) {
+    *entry = read_entry(reader, n);
+    const struct snapshot_log_header *header = reader->header;
+    if (entry->length < sizeof(struct log_record) || entry->offset > header->data_size ||
+        entry->length > header->data_size - entry->offset) {
+        return load_first(reader) > n ? 1 : -1;
+    }
+
+    if (entry->length > reader->record_capacity) {
+        char *grown = realloc(reader->record, entry->length);
+        if (!grown) return -1;
+        reader->record = grown;
+        reader->record_capacity = entry->length;
+    }
+    memcpy(reader->record, log_data(header) + entry->offset, entry->length);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (load_first(reader) > n) return 1;
+
+    // A record that passed the check is whole, but check its counts anyway
+    const struct log_record *record = (const struct log_record *)reader->record;
+    uint64_t needed = sizeof(*record);
+    for (int t = 0; t < LOG_TABLES; t++) {
+        needed += (uint64_t)record->upserts[t] * (sizeof(struct log_upsert) + row_sizes[t]) +
+                  (uint64_t)record->removals[t] * sizeof(struct row_key);
+    }
+    return needed <= entry->length ? 0 : -1;
+}
+
+/* Apply the copied record to the row sets */
+static int replay_record(struct log_reader *reader) {
+    const struct log_record *record = (const struct log_record *)reader->record;
+    const char *p = reader->record + sizeof(*record);
+    for (int t = 0; t < LOG_TABLES; t++) {
+        struct row_set *set = &reader->sets[t];
+        if (record->kind == SNAPSHOT_LOG_KEYFRAME) set_clear(set);
+        for (uint32_t i = 0; i < record->upserts[t]; i++) {
+            const struct log_upsert *head = (const struct log_upsert *)p;
+            if (set_upsert(set, head->key, p + sizeof(*head)) != 0) return -1;
+            p += sizeof(*head) + row_sizes[t];
+        }
+        for (uint32_t i = 0; i < record->removals[t]; i++) {
+            struct row_key key;
+            memcpy(&key, p, sizeof(key));
+            set_remove(set, key);
+            p += sizeof(key);
+        }
+    }
+    return 0;
+}
+
+/* The log keeps no per-row scan times, so decoded processes take their record's */
+static int scratch_reset(struct log_reader *reader, int64_t timestamp) {
+    struct sockmap_snapshot *snap = &reader->scratch;
+    arena_reset(&snap->arena);
+    snap->timestamp = (time_t)timestamp;
+    memset(&snap->sockets, 0, sizeof(snap->sockets));
+    memset(&snap->rollups, 0, sizeof(snap->rollups));
+    memset(&snap->processes, 0, sizeof(snap->processes));
+    return string_pool_init(&snap->strings, &snap->arena);
+}
+
+/* A scratch process row standing in for a socket's owner, -1 if it has none */
+static int scratch_owner(struct log_reader *reader, const struct log_socket *row) {
+    if (row->pid == 0) return -1;
+    struct process_info proc;
+    init_process_info(row->pid, &proc);
+    copy_name(proc.name, row->process_name);
+    if (process_table_append(&reader->scratch.processes, &reader->scratch.arena,
+                             &reader->scratch.strings, &proc) != 0) {
+        return -2;
+    }
+    return reader->scratch.processes.count - 1;
+}
+
+/* Append one payload of log table t to the scratch snapshot */
+static int decode_row(struct log_reader *reader, int table, const void *payload) {
+    struct sockmap_snapshot *snap = &reader->scratch;
+    if (table == 0) {
+        const struct log_socket *row = payload;
+        struct socket_info info;
+        memset(&info, 0, sizeof(info));
+        info.family = row->family;
+        info.protocol = row->protocol;
+        info.state = row->state;
+        memcpy(info.local.addr, row->local, sizeof(row->local));
+        memcpy(info.remote.addr, row->remote, sizeof(row->remote));
+        info.local.port = row->local_port;
+        info.remote.port = row->remote_port;
+        info.inode = row->inode;
+        info.uid = row->uid;
+        info.rx_queue = row->rx_queue;
+        info.tx_queue = row->tx_queue;
+        info.rmem = row->rmem;
+        info.wmem = row->wmem;
+        info.fwd_alloc = row->fwd_alloc;
+        info.memory_usage = row->memory_usage;
+        int owner = scratch_owner(reader, row);
+        if (owner < -1 || socket_table_append(&snap->sockets, &snap->arena, &info) != 0) return -1;
+        snap->sockets.flags[snap->sockets.count - 1] = row->flags;
+        snap->sockets.owner[snap->sockets.count - 1] = owner;
+    } else if (table == 1) {
+        const struct log_rollup *row = payload;
+        struct memory_usage usage = {
+            row->rss_kb, row->pss_kb, row->swap_kb, row->shared_dirty_kb, row->private_dirty_kb,
+        };
+        return rollup_table_append(&snap->rollups, &snap->arena, row->pid,
+                                   (unsigned char)row->type, &usage);
+    } else {
+        const struct log_process *row = payload;
+        struct process_info proc;
+        init_process_info(row->pid, &proc);
+        copy_name(proc.name, row->name);
+        proc.socket_count = row->socket_count;
+        proc.rss_kb = row->rss_kb;
+        proc.start_time = row->start_time;
+        proc.cpu_usage = row->cpu_usage;
+        proc.state = row->state;
+        if (process_table_append(&snap->processes, &snap->arena, &snap->strings, &proc) != 0) {
+            return -1;
+        }
+        snap->processes.flags[snap->processes.count - 1] = row->flags;
+        snap->processes.scanned_at[snap->processes.count - 1] = snap->timestamp;
+    }
+    return 0;
+}
+
+/* The scratch rows of log table t, which hold only that table's decoded rows */
+static int scratch_rows(const struct log_reader *reader, int table) {
+    return table == 0 ? reader->scratch.sockets.count
+         : table == 1 ? reader->scratch.rollups.count : reader->scratch.processes.count;
+}
+
+/* {"sequence":N,"timestamp":T,"sockets":[...],"memory":[],...} from the row sets */
+static int write_state(struct log_reader *reader, uint64_t sequence, int64_t timestamp,
+                       struct json_writer *out) {
+    json_begin_object(out);
+    json_key(out, "sequence");
+    json_uint(out, sequence);
+    json_key(out, "timestamp");
+    json_int(out, timestamp);
+    for (int diff_table = 0; diff_table < DIFF_TABLE_COUNT; diff_table++) {
+        int t = log_table_of(diff_table);
+        json_key(out, snapshot_table_name(diff_table));
+        json_begin_array(out);
+        if (t >= 0) {
+            const struct row_set *set = &reader->sets[t];
+            if (scratch_reset(reader, timestamp) != 0) return -1;
+            for (int i = 0; i < set->count; i++) {
+                if (decode_row(reader, t, set->rows + (size_t)i * set->row_size) != 0) return -1;
+            }
+            for (int row = 0; row < scratch_rows(reader, t); row++) {
+                output_keyed_row(diff_table, &reader->scratch, row, out);
+            }
+        }
+        json_end_array(out);
+    }
+    json_end_object(out);
+    return 0;
+}
+
+static void write_empty_delta(struct json_writer *out) {
+    json_begin_object(out);
+    static const char *const lists[] = { "added", "changed", "removed" };
+    for (int i = 0; i < 3; i++) {
+        json_key(out, lists[i]);
+        json_begin_array(out);
+        json_end_array(out);
+    }
+    json_end_object(out);
+}
+
+/* Delta record data, numbered n, in output_snapshot_delta form */
+static int write_delta(struct log_reader *reader, const char *data, uint64_t n,
+                       struct json_writer *out) {
+    const struct log_record *record = (const struct log_record *)data;
+    json_begin_object(out);
+    json_key(out, "sequence");
+    json_uint(out, n);
+    json_key(out, "base");
+    json_uint(out, n - 1);
+    json_key(out, "timestamp");
+    json_int(out, record->timestamp);
+
+    const char *p = data + sizeof(*record);
+    for (int diff_table = 0; diff_table < DIFF_TABLE_COUNT; diff_table++) {
+        int t = log_table_of(diff_table);
+        json_key(out, snapshot_table_name(diff_table));
+        if (t < 0) {
+            write_empty_delta(out);
+            continue;
+        }
+
+        // Upserts in scratch row order, then the removed keys after them
+        size_t stride = sizeof(struct log_upsert) + row_sizes[t];
+        const char *upserts = p;
+        if (scratch_reset(reader, record->timestamp) != 0) return -1;
+        for (uint32_t i = 0; i < record->upserts[t]; i++) {
+            if (decode_row(reader, t, upserts + i * stride + sizeof(struct log_upsert)) != 0) {
+                return -1;
+            }
+        }
+        const char *removals = upserts + record->upserts[t] * stride;
+        p = removals + record->removals[t] * sizeof(struct row_key);
+
+        json_begin_object(out);
+        for (uint32_t change = DIFF_ADDED; change <= DIFF_CHANGED; change++) {
+            json_key(out, change == DIFF_ADDED ? "added" : "changed");
+            json_begin_array(out);
+            for (uint32_t i = 0; i < record->upserts[t]; i++) {
+                const struct log_upsert *head = (const struct log_upsert *)(upserts + i * stride);
+                if (head->change == change) {
+                    output_keyed_row(diff_table, &reader->scratch, (int)i, out);
+                }
+            }
+            json_end_array(out);
+        }
+        json_key(out, "removed");
+        json_begin_array(out);
+        for (uint32_t i = 0; i < record->removals[t]; i++) {
+            struct row_key key;
+            memcpy(&key, removals + i * sizeof(key), sizeof(key));
+            output_row_key(diff_table, key, out);
+        }
+        json_end_array(out);
+        json_end_object(out);
+    }
+    json_end_object(out);
+    return 0;
+}
+
+static int delta_put(struct log_reader *reader, const void *data, size_t len) {
+    if (reader->delta_len + len > reader->delta_capacity) {
+        size_t capacity = reader->delta_capacity ? reader->delta_capacity : 64 * 1024;
+        while (capacity < reader->delta_len + len) capacity *= 2;
+        char *grown = realloc(reader->delta, capacity);
+        if (!grown) return -1;
+        reader->delta = grown;
+        reader->delta_capacity = capacity;
+    }
+    memcpy(reader->delta + reader->delta_len, data, len);
+    reader->delta_len += len;
+    return 0;
+}
+
+/*
+ * Recast the copied keyframe as a delta from the row sets, which hold the
+ * record before it: its rows that are new or differ, then the keys it lacks
+ */
+static int keyframe_delta(struct log_reader *reader) {
+    const struct log_record *keyframe = (const struct log_record *)reader->record;
+    struct log_record header = *keyframe;
+    header.kind = SNAPSHOT_LOG_DELTA;
+    reader->delta_len = 0;
+    if (delta_put(reader, &header, sizeof(header)) != 0) return -1;
+
+    const char *p = reader->record + sizeof(*keyframe);
+    for (int t = 0; t < LOG_TABLES; t++) {
+        const struct row_set *set = &reader->sets[t];
+        if ((size_t)set->count > reader->seen_capacity) {
+            unsigned char *grown = realloc(reader->seen, (size_t)set->count);
+            if (!grown) return -1;
+            reader->seen = grown;
+            reader->seen_capacity = (size_t)set->count;
+        }
+        if (set->count > 0) memset(reader->seen, 0, (size_t)set->count);
+
+        uint32_t upserts = 0, removals = 0;
+        size_t stride = sizeof(struct log_upsert) + row_sizes[t];
+        for (uint32_t i = 0; i < keyframe->upserts[t]; i++, p += stride) {
+            struct log_upsert head = *(const struct log_upsert *)p;
+            const char *payload = p + sizeof(head);
+            unsigned int slot = set->count > 0 ? set->slots[set_find(set, head.key)] : 0;
+            if (slot != 0) {
+                reader->seen[slot - 1] = 1;
+                if (memcmp(set->rows + (size_t)(slot - 1) * set->row_size, payload,
+                           set->row_size) == 0) {
+                    continue;
+                }
+            }
+            head.change = slot != 0 ? DIFF_CHANGED : DIFF_ADDED;
+            if (delta_put(reader, &head, sizeof(head)) != 0 ||
+                delta_put(reader, payload, row_sizes[t]) != 0) {
+                return -1;
+            }
+            upserts++;
+        }
+        for (int row = 0; row < set->count; row++) {
+            if (reader->seen[row]) continue;
+            if (delta_put(reader, &set->keys[row], sizeof(struct row_key)) != 0) return -1;
+            removals++;
+        }
+        // The counts are final only now; patch them into the copied header
+        struct log_record *delta = (struct log_record *)reader->delta;
+        delta->upserts[t] = upserts;
+        delta->removals[t] = removals;
+        p += keyframe->removals[t] * sizeof(struct row_key);
+    }
+    return 0;
+}
+
+/* Last record in [first, next) stamped at or before t, or first - 1 if none is */
+static uint64_t search_time(const struct log_reader *reader, uint64_t first, uint64_t next,
+                            time_t t) {
+    uint64_t lo = first, hi = next;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (read_entry(reader, mid).timestamp <= (int64_t)t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - 1;
+}
+
+/*
+ * Replay up to the record the answer starts from and set *start to it.
+ * Returns 0 when replayed, 1 when nothing lies in range, 2 when the
+ * writer overtook the replay, -1 on error.
+ */
+static int replay_to_start(struct log_reader *reader, time_t from, time_t to,
+                           uint64_t *start, uint64_t *next, int64_t *oldest) {
+    uint64_t first = load_first(reader);
+    *next = __atomic_load_n(&reader->header->next, __ATOMIC_ACQUIRE);
+    *oldest = -1;
+    if (first == *next) return 1;
+    *oldest = read_entry(reader, first).timestamp;
+
+    uint64_t s = search_time(reader, first, *next, from);
+    if (s + 1 == first) s = first;
+    if (read_entry(reader, s).timestamp > (int64_t)to) return 1;
+
+    uint64_t k = s;
+    while (k > first && read_entry(reader, k).kind != SNAPSHOT_LOG_KEYFRAME) k--;
+    if (load_first(reader) > k) return 2;
+
+    for (uint64_t n = k; n <= s; n++) {
+        struct snapshot_log_entry entry;
+        int copied = copy_record(reader, n, &entry);
+        if (copied != 0) return copied > 0 ? 2 : -1;
+        if (n == k && entry.kind != SNAPSHOT_LOG_KEYFRAME) return -1;
+        if (replay_record(reader) != 0) return -1;
+    }
+    *start = s;
+    return 0;
+}
+
+int snapshot_log_query(const char *path, time_t from, time_t to, struct json_writer *out) {
+    struct log_reader reader;
+    if (reader_open(&reader, path) != 0) return -1;
+
+    uint64_t start = 0, next = 0;
+    int64_t oldest = 0;
+    int replayed = 2;
+    for (int attempt = 0; attempt < QUERY_ATTEMPTS && replayed == 2; attempt++) {
+        replayed = replay_to_start(&reader, from, to, &start, &next, &oldest);
+    }
+    if (replayed < 0 || replayed == 2) {
+        reader_close(&reader);
+        return -1;
+    }
+
+    json_begin_object(out);
+    json_key(out, "from");
+    json_int(out, (long long)from);
+    json_key(out, "to");
+    json_int(out, (long long)to);
+    json_key(out, "oldest");
+    if (oldest < 0) json_null(out);
+    else json_int(out, oldest);
+    json_key(out, "snapshot");
+
+    int result = 0, truncated = 0;
+    if (replayed == 1) {
+        json_null(out);
+        json_key(out, "deltas");
+        json_begin_array(out);
+    } else {
+        const struct log_record *record = (const struct log_record *)reader.record;
+        result = write_state(&reader, start, record->timestamp, out);
+        json_key(out, "deltas");
+        json_begin_array(out);
+
+        int written = 0;
+        for (uint64_t n = start + 1; result == 0 && n < next; n++) {
+            if (read_entry(&reader, n).timestamp > (int64_t)to) break;
+            struct snapshot_log_entry entry;
+            int copied = written < SNAPSHOT_LOG_QUERY_MAX ? copy_record(&reader, n, &entry) : 1;
+            if (copied != 0) {
+                // At the cap, or overtaken by the writer: the rest is another query's
+                truncated = 1;
+                result = copied < 0 ? -1 : 0;
+                break;
+            }
+            // A keyframe mid-range is written as the delta it implies
+            const char *data = reader.record;
+            if (entry.kind == SNAPSHOT_LOG_KEYFRAME) {
+                if (keyframe_delta(&reader) != 0) {
+                    result = -1;
+                    break;
+                }
+                data = reader.delta;
+            }
+            result = write_delta(&reader, data, n, out);
+            if (result == 0) result = replay_record(&reader);
+            written++;
+        }
+    }
+    json_end_array(out);
+    json_key(out, "truncated");
+    json_bool(out, truncated);
+    json_end_object(out);
+    json_newline(out);
+    reader_close(&reader);
+    return result;
+}
@@ -0,0 +1,153 @@
+/*
+ * Snapshot views
+ *
+ * The embedded server serializes each scan once, under the command
+ * line's query. Requests that bring their own predicates are answered
+ * from a view: the rows of the current snapshot those predicates keep,
+ * gathered column by column into a scratch arena, so every existing
+ * writer can output them unchanged. The kept processes' names are copied
+ * too, so a view outlives the scanner's next refill of its snapshot. Only
+ * mappings and smaps types are read fresh, and only for the processes the
+ * view kept.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../include/snapshot_view.h"
+#include "../include/proc_walk.h"
+
+static int compare_pids(const void *a, const void *b) {
+    pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int socket_row_matches(const struct scan_query *query, const struct socket_table *sockets,
+                              int row) {
+    struct socket_info socket;
+    socket.protocol = sockets->protocol[row];
+    socket.state = sockets->state[row];
+    socket.local = sockets->local[row];
+    socket.remote = sockets->remote[row];
+    return query_wants_socket(query, &socket);
+}
+
+/* Rows of a memory or rollup pid column whose pid is in the sorted pids */
+static int select_by_pid(const pid_t *column, int count, const pid_t *pids, int pid_count,
+                         int *rows) {
+    int selected = 0;
+    for (int i = 0; i < count; i++) {
+        if (bsearch(&column[i], pids, (size_t)pid_count, sizeof(pid_t), compare_pids)) {
+            rows[selected++] = i;
+        }
+    }
+    return selected;
+}
+
+int snapshot_view(const struct sockmap_snapshot *snap, const struct scan_query *query,
+                  struct sockmap_snapshot *view) {
+    struct arena *arena = &view->arena;
+    const struct process_table *processes = &snap->processes;
+    const struct socket_table *sockets = &snap->sockets;
+    int selects = query_selects_processes(query);
+
+    int largest = processes->count;
+    if (sockets->count > largest) largest = sockets->count;
+    if (snap->memory.count > largest) largest = snap->memory.count;
+    if (snap->rollups.count > largest) largest = snap->rollups.count;
+    int *rows = arena_alloc(arena, (size_t)(largest ? largest : 1) * sizeof(int));
+    int *moved_to = arena_alloc(arena, (size_t)(processes->count ? processes->count : 1) *
+                                       sizeof(int));
+    pid_t *pids = arena_alloc(arena, (size_t)(processes->count ? processes->count : 1) *
+                                     sizeof(pid_t));
+    if (!rows || !moved_to || !pids) return -1;
+
+    // Processes first, remembering where each kept row went
+    int kept = 0;
+    for (int i = 0; i < processes->count; i++) {
+        moved_to[i] = -1;
+        if (!query_wants_pid(query, processes->pid[i]) ||
+            !query_wants_name(query, string_pool_get(&snap->strings, processes->name[i]))) {
+            continue;
+        }
+        moved_to[i] = kept;
+        pids[kept] = processes->pid[i];
+        rows[kept++] = i;
+    }
+    if (string_pool_init(&view->strings, arena) != 0 ||
+        process_table_select(&view->processes, arena, processes, rows, kept) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < kept; i++) {
+        const char *name = string_pool_get(&snap->strings, view->processes.name[i]);
+        int id = string_pool_intern(&view->strings, name, strlen(name));
+        if (id < 0) return -1;
+        view->processes.name[i] = (unsigned int)id;
+    }
+    qsort(pids, (size_t)kept, sizeof(pid_t), compare_pids);
+
+    // A socket no kept process holds is not one of theirs
+    int count = 0;
+    for (int i = 0; i < sockets->count; i++) {
+        int owner = sockets->owner[i];
+        if (selects && (owner < 0 || moved_to[owner] < 0)) continue;
+        if (socket_row_matches(query, sockets, i)) rows[count++] = i;
+    }
+    if (socket_table_select(&view->sockets, arena, sockets, rows, count) != 0) return -1;
+    for (int i = 0; i < view->sockets.count; i++) {
+        int owner = view->sockets.owner[i];
+        view->sockets.owner[i] = owner >= 0 ? moved_to[owner] : -1;
+    }
+
+    if (selects) {
+        count = select_by_pid(snap->rollups.pid, snap->rollups.count, pids, kept, rows);
+        if (rollup_table_select(&view->rollups, arena, &snap->rollups, rows, count) != 0) {
+            return -1;
+        }
+        count = select_by_pid(snap->memory.pid, snap->memory.count, pids, kept, rows);
+        if (memory_table_select(&view->memory, arena, &snap->memory, rows, count) != 0) {
+            return -1;
+        }
+    } else if (rollup_table_copy(&view->rollups, arena, &snap->rollups) != 0 ||
+               memory_table_copy(&view->memory, arena, &snap->memory) != 0) {
+        return -1;
+    }
+
+    view->timestamp = snap->timestamp;
+    view->coverage = snap->coverage;
+    view->stats = snap->stats;
+    return 0;
+}
+
+int snapshot_view_memory(const char *proc_root, const struct scan_query *query,
+                         struct sockmap_snapshot *view) {
+    struct proc_walk walk;
+    if (proc_walk_init(&walk, &view->arena, 0, 0) != 0) return -1;
+    walk.strings = view->strings;  // Mapping paths join the names
+    walk.query = query;
+    walk.collect = COLLECT_ROLLUP | (query_wants_maps(query) ? COLLECT_MAPS : 0);
+
+    int proc_fd = open(proc_root ? proc_root : PROC_ROOT, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (proc_fd < 0) return -1;
+
+    struct process_table *processes = &view->processes;
+    int result = 0;
+    for (int i = 0; i < processes->count && result == 0; i++) {
+        // A process that has exited since the scan just has no memory rows
+        char pid_name[16];
+        snprintf(pid_name, sizeof(pid_name), "%d", processes->pid[i]);
+        int pid_fd = openat(proc_fd, pid_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (pid_fd < 0) continue;
+        result = collect_memory_usage(pid_fd, processes->pid[i], &walk);
+        close(pid_fd);
+    }
+    close(proc_fd);
+    if (result != 0) return -1;
+
+    view->strings = walk.strings;
+    view->memory = walk.memory;
+    view->rollups = walk.rollups;
+    return 0;
+}
@@ -5,140 +5,154 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include "../include/sockmap.h"
+#include "../include/inode_index.h"
+#include "../include/history.h"
+#include "../include/sock_diag.h"
+#include "../include/proc_parse.h"
+#include "../include/scan_query.h"
 
-int scan_sockets(struct socket_info **sockets) {
-    FILE *tcp_file = fopen("/proc/net/tcp", "r");
-    if (!tcp_file) {
-        return -1;
-    }
+/* Destination for both backends: rows go straight into the snapshot's table */
+struct socket_sink {
+    struct socket_table *table;
+    struct arena *arena;
+    const struct scan_query *query;
+    const struct inode_index *owners;   /* set when only the walked processes' sockets count */
+};
 
-    // Count lines first to allocate memory
-    int count = 0;
-    char line[1024];
-    if (!fgets(line, sizeof(line), tcp_file)) {
-        fclose(tcp_file);
-        return -1;
-    }
-    while (fgets(line, sizeof(line), tcp_file)) {
-        count++;
-    }
-    rewind(tcp_file);
-    if (!fgets(line, sizeof(line), tcp_file)) {
-        fclose(tcp_file);
-        return -1;
+/* (family, protocol) pairs scanned by both backends, with their files under net/ */
+static const struct {
+    int family;
+    int protocol;
+    const char *proc_name;
+} socket_tables[] = {
+    { AF_INET,  IPPROTO_TCP, "tcp" },
+    { AF_INET6, IPPROTO_TCP, "tcp6" },
+    { AF_INET,  IPPROTO_UDP, "udp" },
+    { AF_INET6, IPPROTO_UDP, "udp6" },
+};
+
+static int socket_sink_append(void *ctx, struct socket_info *socket) {
+    struct socket_sink *sink = ctx;
+
+    // Rows a query rules out never reach the table
+    if (!query_wants_socket(sink->query, socket) ||
+        (sink->owners && !inode_index_lookup(sink->owners, socket->inode))) {
+        return 0;
     }
+    return socket_table_append(sink->table, sink->arena, socket);
+}
 
-    *sockets = malloc(count * sizeof(struct socket_info));
-    if (!*sockets) {
-        fclose(tcp_file);
+/* Fallback parser for the text tables in /proc/net */
+static int scan_proc_net(const char *path, int family, int protocol,
+                         socket_emit_fn emit, void *ctx) {
+    size_t len;
+    const char *buf = proc_read_at(AT_FDCWD, path, &len);
+    if (!buf) {
         return -1;
     }
 
-    int index = 0;
-    while (fgets(line, sizeof(line), tcp_file) && index < count) {
-        unsigned int local_addr, local_port, remote_addr, remote_port;
-        int state;
-        unsigned long inode;
-        
-        if (sscanf(line, "%*d: %x:%x %x:%x %x %*s %*s %*s %*s %*s %lu",
-                   &local_addr, &local_port, &remote_addr, &remote_port, &state, &inode) == 6) {
-            
-            struct socket_info *socket = &(*sockets)[index];
-            
-            // Convert addresses to readable format
-            snprintf(socket->local_address, sizeof(socket->local_address),
-                     "%d.%d.%d.%d:%d",
-                     local_addr & 0xFF, (local_addr >> 8) & 0xFF,
-                     (local_addr >> 16) & 0xFF, (local_addr >> 24) & 0xFF,
-                     local_port);
-            
-            snprintf(socket->remote_address, sizeof(socket->remote_address),
-                     "%d.%d.%d.%d:%d",
-                     remote_addr & 0xFF, (remote_addr >> 8) & 0xFF,
-                     (remote_addr >> 16) & 0xFF, (remote_addr >> 24) & 0xFF,
-                     remote_port);
-
-            // Map state to string
-            switch (state) {
-                case 1: strcpy(socket->state, "ESTABLISHED"); break;
-                case 2: strcpy(socket->state, "SYN_SENT"); break;
-                case 3: strcpy(socket->state, "SYN_RECV"); break;
-                case 8: strcpy(socket->state, "CLOSE_WAIT"); break;
-                case 10: strcpy(socket->state, "LISTENING"); break;
-                case 6: strcpy(socket->state, "TIME_WAIT"); break;
-                default: strcpy(socket->state, "UNKNOWN"); break;
-            }
+    const char *end = buf + len;
+    const char *line = pp_find_eol(buf, end) + 1; // Skip the header row
+    int words = (family == AF_INET6) ? 4 : 1;
 
-            strcpy(socket->protocol, "TCP");
-            
-            // Try to find process info for this inode
-            socket->pid = 0;
-            strcpy(socket->process_name, "unknown");
-            char *proc_name = get_process_name_by_inode(inode);
-            if (proc_name) {
-                strncpy(socket->process_name, proc_name, sizeof(socket->process_name) - 1);
-                free(proc_name);
-            }
+    int count = 0;
+    for (; line < end; line = pp_find_eol(line, end) + 1) {
+        struct net_entry entry;
+        if (pp_parse_net_line(line, pp_find_eol(line, end), words, &entry) != 0) {
+            SCAN_STAT_ADD(parse_errors, 1);
+            continue;
+        }
+
+        struct socket_info socket;
+        memset(&socket, 0, sizeof(socket));
+        socket.family = (unsigned char)family;
+        socket.protocol = protocol == IPPROTO_UDP ? SOCKET_PROTO_UDP : SOCKET_PROTO_TCP;
+        socket.state = (unsigned char)entry.state;
+        memcpy(socket.local.addr, entry.local_addr, sizeof(socket.local.addr));
+        socket.local.port = (unsigned short)entry.local_port;
+        memcpy(socket.remote.addr, entry.remote_addr, sizeof(socket.remote.addr));
+        socket.remote.port = (unsigned short)entry.remote_port;
+        socket.inode = entry.inode;
+        socket.uid = entry.uid;
+        socket.rx_queue = entry.rx_queue;
+        socket.tx_queue = entry.tx_queue;
 
-            socket->memory_usage = get_socket_memory_usage(socket->pid, 0);
-            socket->is_hung = is_socket_hung(socket);
-            socket->has_leak = detect_memory_leak(socket);
+        // /proc/net carries no skmeminfo; queued bytes are the best we have
+        socket.memory_usage = entry.rx_queue + entry.tx_queue;
 
-            index++;
+        if (emit(ctx, &socket) != 0) {
+            return -1;
         }
+        count++;
     }
 
-    fclose(tcp_file);
-    return index;
+    return count;
 }
 
-char* get_process_name_by_inode(unsigned long inode) {
-    DIR *proc_dir = opendir("/proc");
-    if (!proc_dir) return NULL;
-
-    struct dirent *proc_entry;
-    while ((proc_entry = readdir(proc_dir)) != NULL) {
-        if (proc_entry->d_type != DT_DIR) continue;
-        
-        pid_t pid = atoi(proc_entry->d_name);
-        if (pid <= 0) continue;
-
-        char fd_path[PATH_MAX];
-        snprintf(fd_path, sizeof(fd_path), "/proc/%d/fd", pid);
-        
-        DIR *fd_dir = opendir(fd_path);
-        if (!fd_dir) continue;
-
-        struct dirent *fd_entry;
-        while ((fd_entry = readdir(fd_dir)) != NULL) {
-            char link_path[PATH_MAX];
-            char target[PATH_MAX];
-            
-            snprintf(link_path, sizeof(link_path), "%s/%s", fd_path, fd_entry->d_name);
-            ssize_t len = readlink(link_path, target, sizeof(target) - 1);
-            
-            if (len > 0) {
-                target[len] = '\0';
-                char expected[64];
-                snprintf(expected, sizeof(expected), "socket:[%lu]", inode);
-                
-                if (strcmp(target, expected) == 0) {
-                    char *proc_name = get_process_name(pid);
-                    closedir(fd_dir);
-                    closedir(proc_dir);
-                    return proc_name;
+int scan_sockets(const struct sockmap_config *cfg, struct arena *arena,
+                 const struct inode_index *owners, struct socket_table *sockets) {
+    const struct scan_query *query = cfg->query;
+    struct socket_sink sink = { sockets, arena, query, NULL };
+    unsigned int states = query && query->states ? query->states : ~0U;
+    const char *proc_root = cfg->proc_root ? cfg->proc_root : PROC_ROOT;
+    SCAN_STAT_START(started);
+
+    // With pid or name predicates only the matching processes were walked,
+    // so a socket no walked process holds is not one of theirs
+    if (query_selects_processes(query)) sink.owners = owners;
+
+    for (size_t i = 0; i < sizeof(socket_tables) / sizeof(socket_tables[0]); i++) {
+        int start = sockets->count;
+        int found = -1;
+
+        int protocol = socket_tables[i].protocol == IPPROTO_UDP ? SOCKET_PROTO_UDP
+                                                                  : SOCKET_PROTO_TCP;
+        if (query && query->protocols && !(query->protocols & (1u << protocol))) continue;
+
+        char proc_path[PATH_MAX];
+        snprintf(proc_path, sizeof(proc_path), "%s/net/%s", proc_root,
+                 socket_tables[i].proc_name);
+
+        if (cfg->socket_backend == SOCKET_BACKEND_NETLINK) {
+            found = sock_diag_dump(socket_tables[i].family, socket_tables[i].protocol, states,
+                                   socket_sink_append, &sink);
+            if (found < 0) {
+                // Drop any partial dump before falling back to /proc/net
+                sockets->count = start;
+                if (cfg->verbose) {
+                    fprintf(stderr, "sock_diag unavailable for %s, using procfs\n",
+                            proc_path);
                 }
             }
         }
-        closedir(fd_dir);
+
+        if (found < 0) {
+            found = scan_proc_net(proc_path, socket_tables[i].family,
+                                  socket_tables[i].protocol, socket_sink_append, &sink);
+            if (found < 0) {
+                sockets->count = start; // Table missing, e.g. IPv6 disabled
+            }
+        }
     }
-    
-    closedir(proc_dir);
-    return NULL;
-}
\ No newline at end of file
+
+    // Owners were recorded by the per-pid collector's fd walk; without an
+    // index (streaming) they are resolved later by the caller
+    history_sockets_begin();
+    for (int i = 0; i < sockets->count; i++) {
+        const struct inode_owner *owner = owners ? inode_index_lookup(owners, sockets->inode[i])
+                                                 : NULL;
+        sockets->owner[i] = owner ? owner->proc_slot : -1;
+        sockets->flags[i] = history_socket(sockets, i);
+    }
+    history_sockets_sweep();
+
+    SCAN_STAT_STOP(SCAN_PHASE_SOCKETS, started);
+    return sockets->count;
+}
@@ -12,14 +12,39 @@
 #include <errno.h>
 #include <signal.h>
 #include "../include/sockmap.h"
+#include "../include/proc_parse.h"
+#include "../include/work_pool.h"
+#include "../include/uring_batch.h"
+#include "../include/proc_walk.h"
+#include "../include/json_writer.h"
+#include "../include/scan_stream.h"
+#include "../include/cpu_sample.h"
+#include "../include/history.h"
+#include "../include/shm_publish.h"
+#include "../include/http_server.h"
+#include "../include/snapshot_diff.h"
+#include "../include/scan_query.h"
+#include "../include/snapshot_log.h"
+#include "../include/proc_events.h"
+#include "../include/metrics.h"
+#include "../include/scan_schedule.h"
+#include "../include/scan_slice.h"
+#include "../include/aggregate.h"
 
 /* Global configuration */
 static struct sockmap_config config = {
     .output_format = OUTPUT_JSON,
+    .socket_backend = SOCKET_BACKEND_NETLINK,
     .scan_interval = 5,
+    .threads = 1,
+    .history_size = SNAPSHOT_LOG_DEFAULT_SIZE,
+    .metrics_max_processes = METRICS_DEFAULT_MAX_PROCESSES,
     .verbose = 0
 };
 
+/* Sections and predicates from the command line; used only if any were given */
+static struct scan_query query;
+
 static volatile int running = 1;
 
 void signal_handler(int sig) {
@@ -32,10 +57,58 @@ void print_usage(const char *program_name) {
     printf("Options:\n");
     printf("  -j, --json         Output in JSON format (default)\n");
     printf("  -t, --table        Output in table format\n");
+    printf("  --stream           Write one JSON record per line as each process is scanned\n");
+    printf("  --metrics          Output aggregated gauges in the Prometheus text format\n");
+    printf("  --metrics-max-processes=N\n");
+    printf("                     Label the N process names with the most sockets in metrics\n");
+    printf("                     and fold the rest into \"other\" (0 = no label, default: %d)\n",
+           METRICS_DEFAULT_MAX_PROCESSES);
     printf("  -i, --interval N   Scan interval in seconds (default: 5)\n");
+    printf("  --socket-interval=N, --process-interval=N, --memory-interval=N\n");
+    printf("                     Rescan sockets, processes or memory every N seconds and\n");
+    printf("                     carry the rest over between (default: the scan interval)\n");
+    printf("  --cpu-budget=PCT   Stretch intervals to keep sockmap under PCT%% of one core\n");
+    printf("  --slice=N          Walk at most N pids per scan, resuming where the last stopped,\n");
+    printf("                     and carry every other process over from earlier scans\n");
+    printf("  --slice-time=MS    Size each slice to take about MS milliseconds\n");
+    printf("  --top=METRIC[:N]   Output only the N processes ranking highest by sockets, rss,\n");
+    printf("                     close_wait or cpu (default N: %d)\n", AGGREGATE_DEFAULT_LIMIT);
+    printf("  --group-by=KEY[:N] Output only the N largest socket groups by remote,\n");
+    printf("                     remote_address, local_port, process or state (default N: %d)\n",
+           AGGREGATE_DEFAULT_LIMIT);
+    printf("  --pretty           Indent JSON output (default: compact, one line per scan)\n");
+    printf("  --threads N        Scan /proc with N threads (0 = one per CPU, default: 1)\n");
+    printf("  --io-uring         Batch per-process /proc reads through io_uring\n");
+    printf("  --proc-events      Track processes from proc connector events between /proc\n");
+    printf("                     listings, and report ones that exit between scans\n");
+    printf("  --daemon[=PATH]    Publish each snapshot to shared memory (default: %s)\n",
+           SHM_SNAPSHOT_PATH);
+    printf("  --read-shm[=PATH]  Print the snapshot a running daemon last published\n");
+    printf("  --serve[=[ADDR:]PORT]  Serve the JSON API and /metrics over HTTP (default: %s)\n",
+           HTTP_DEFAULT_LISTEN);
+    printf("  --history[=PATH]   Record every scan to a fixed-size history log (default: %s)\n",
+           SNAPSHOT_LOG_PATH);
+    printf("  --history-size=MB  Size of the history log (default: %lu)\n",
+           SNAPSHOT_LOG_DEFAULT_SIZE >> 20);
+    printf("  --read-history[=PATH]    Print the recorded history between --from and --to\n");
+    printf("  --from=T, --to=T   Unix times, or seconds before now if negative\n");
+    printf("                     (default: the oldest record to now)\n");
+    printf("  --sockets, --memory, --processes\n");
+    printf("                     Collect and output only these sections (default: all)\n");
+    printf("  --pid=PID[,PID...]       Only these processes\n");
+    printf("  --name=COMM[,COMM...]    Only processes with these names\n");
+    printf("  --port=PORT[,PORT...]    Only sockets with either end on these ports\n");
+    printf("  --protocol=tcp|udp       Only sockets of this protocol\n");
+    printf("  --state=STATE[,STATE...] Only sockets in these states, e.g. CLOSE_WAIT\n");
+    printf("  --fields=NAME[,NAME...]  Output only these fields (JSON output)\n");
+    printf("  --maps[=OFFSET:LIMIT]    Also output individual memory mappings, or a page of them\n");
+    printf("  --smaps=PID[,PID...]     Roll memory up per mapping type for these processes\n");
     printf("  -v, --verbose      Enable verbose output\n");
+    printf("  --proc-net         Read sockets from /proc/net instead of sock_diag\n");
+    printf("  --proc-root=DIR    Scan DIR in place of %s, e.g. a bench/proc_fixture tree;\n",
+           PROC_ROOT);
+    printf("                     sockets then come from DIR/net\n");
     printf("  -h, --help         Show this help message\n");
-    printf("  --test             Run basic tests\n");
 }
 
 int sockmap_init(void) {
@@ -45,63 +118,241 @@ int sockmap_init(void) {
 }
 
 void sockmap_cleanup(void) {
-    // Cleanup resources if needed
+    proc_walk_release();
+    scan_slice_release();
+    proc_parse_release();
+    uring_batch_release();
+    cpu_sample_release();
+    history_release();
+    snapshot_diff_release();
+    proc_events_release();
+    metrics_release();
+    aggregate_release();
 }
 
-int run_monitoring_loop(struct sockmap_config *cfg) {
-    struct socket_info *sockets = NULL;
-    struct memory_info *memory = NULL;
-    struct process_info *processes = NULL;
-    int socket_count, memory_count, process_count;
+/* Slot size of a new shared-memory region; it grows to fit larger snapshots */
+#define SHM_INITIAL_SLOT (4 << 20)
 
-    while (running) {
-        // Scan for socket information
-        socket_count = scan_sockets(&sockets);
-        if (socket_count < 0) {
-            fprintf(stderr, "Error scanning sockets\n");
-            continue;
+/* Copy out the latest published snapshot, growing the buffer until it fits */
+static int print_shm_snapshot(const char *path) {
+    struct shm_reader reader;
+    if (shm_reader_open(&reader, path) != 0) {
+        fprintf(stderr, "No snapshot published at %s\n", path ? path : SHM_SNAPSHOT_PATH);
+        return 1;
+    }
+
+    size_t capacity = 1 << 20;
+    char *buf = NULL;
+    ssize_t length;
+    for (;;) {
+        char *grown = realloc(buf, capacity);
+        if (!grown) {
+            length = -1;
+            break;
         }
+        buf = grown;
+        length = shm_reader_read(&reader, buf, capacity, NULL);
+        if (length <= (ssize_t)capacity) break;
+        capacity = (size_t)length;
+    }
 
-        // Scan for memory information
-        memory_count = scan_memory(&memory);
-        if (memory_count < 0) {
-            fprintf(stderr, "Error scanning memory\n");
-            free_socket_info(sockets, socket_count);
-            continue;
+    int result = 1;
+    if (length > 0) {
+        result = fwrite(buf, 1, (size_t)length, stdout) == (size_t)length ? 0 : 1;
+    } else {
+        fprintf(stderr, "No snapshot published yet\n");
+    }
+    free(buf);
+    shm_reader_close(&reader);
+    return result;
+}
+
+/* Unix time from --from/--to: absolute, or seconds before now if negative */
+static int parse_time(const char *arg, time_t now, time_t *out) {
+    char *end;
+    errno = 0;
+    long long value = strtoll(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0') return -1;
+    *out = value < 0 ? now + (time_t)value : (time_t)value;
+    return 0;
+}
+
+/* "NAME[:N]" into the index lookup finds for NAME, and N or the default limit */
+static int parse_aggregate(const char *arg, int (*lookup)(const char *, size_t),
+                           int *which, int *limit) {
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+    *which = lookup(arg, len);
+    if (*which < 0) return -1;
+    *limit = AGGREGATE_DEFAULT_LIMIT;
+    if (colon) {
+        char *end;
+        errno = 0;
+        long value = strtol(colon + 1, &end, 10);
+        if (errno != 0 || end == colon + 1 || *end != '\0' ||
+            value < 1 || value > AGGREGATE_MAX_LIMIT) {
+            return -1;
         }
+        *limit = (int)value;
+    }
+    return 0;
+}
+
+static int print_history(const char *path, time_t from, time_t to) {
+    struct json_writer out;
+    json_writer_init(&out, STDOUT_FILENO, 0);
+    int result = snapshot_log_query(path, from, to, &out);
+    if (result != 0) {
+        fprintf(stderr, "No history readable at %s\n", path);
+    } else if (json_flush(&out) != 0) {
+        result = -1;
+    }
+    json_writer_release(&out);
+    return result != 0 ? 1 : 0;
+}
 
-        // Scan for process information
-        process_count = scan_processes(&processes);
-        if (process_count < 0) {
-            fprintf(stderr, "Error scanning processes\n");
-            free_socket_info(sockets, socket_count);
-            free_memory_info(memory, memory_count);
-            continue;
+int run_monitoring_loop(struct sockmap_config *cfg) {
+    // Scans alternate between two snapshots; each refill reuses its arena,
+    // and the other one keeps the previous generation intact meanwhile
+    struct sockmap_snapshot snapshots[2];
+    memset(snapshots, 0, sizeof(snapshots));
+    int current = 0;
+    int result = 0;
+
+    struct scan_schedule schedule;
+    if (scan_schedule_init(&schedule, cfg) != 0) {
+        perror("timerfd");
+        return 1;
+    }
+
+    // One writer for the whole run so its buffers are allocated once;
+    // streamed records must each stay on one line
+    struct json_writer out;
+    struct shm_publisher publisher;
+    if (cfg->shm_path) {
+        if (shm_publisher_open(&publisher, cfg->shm_path, SHM_INITIAL_SLOT) != 0) {
+            perror(cfg->shm_path);
+            scan_schedule_close(&schedule);
+            return 1;
         }
+        json_writer_init_sink(&out, shm_publish_write, &publisher, cfg->pretty);
+    } else {
+        json_writer_init(&out, STDOUT_FILENO, cfg->pretty && cfg->output_format == OUTPUT_JSON);
+    }
 
-        // Output results
-        output_results(cfg, sockets, socket_count, memory, memory_count, processes, process_count);
+    struct scan_stream stream;
+    memset(&stream, 0, sizeof(stream));
 
-        // Free allocated memory
-        free_socket_info(sockets, socket_count);
-        free_memory_info(memory, memory_count);
-        free_process_info(processes, process_count);
+    // Streamed scans build no snapshot, so they have nothing to record
+    struct snapshot_log history;
+    int recording = cfg->history_path && cfg->output_format != OUTPUT_STREAM;
+    if (recording && snapshot_log_open(&history, cfg->history_path, cfg->history_size) != 0) {
+        perror(cfg->history_path);
+        recording = 0;
+    }
+    int recorded = 0;
+
+    // Collectors rerun on their own cadences; the first scan takes everything
+    unsigned int refresh = QUERY_ALL;
+    int scanned = 0;
+
+    while (running) {
+        struct sockmap_snapshot *snap = &snapshots[current];
+
+        if (cfg->output_format == OUTPUT_STREAM) {
+            // Streamed scans walk everything, so they follow the process cadence
+            if ((refresh & QUERY_PROCESSES) && stream_scan(cfg, &stream, &out) < 0) {
+                fprintf(stderr, "Error streaming scan\n");
+                result = 1;
+            }
+            refresh = 0;
+        } else if (scan_snapshot_update(cfg, snap, scanned ? &snapshots[current ^ 1] : NULL,
+                                        refresh) < 0) {
+            fprintf(stderr, "Error scanning /proc\n");
+            if (cfg->scan_interval == 0) {
+                result = 1;
+                break;
+            }
+        } else {
+            if (cfg->verbose) {
+                fprintf(stderr, "Scanned %d processes, %d sockets, %d mappings (arena %zu KB)\n",
+                        snap->processes.count, snap->sockets.count, snap->memory.count,
+                        arena_footprint(&snap->arena) / 1024);
+                if (schedule.budget > 0) {
+                    fprintf(stderr, "CPU budget has held scans back %llu ms in all\n",
+                            (unsigned long long)(schedule.deferred_ns / 1000000));
+                }
+            }
+
+            // Output results, or hand them to shared-memory readers
+            SCAN_STAT_START(output_started);
+            if (cfg->shm_path) {
+                shm_publish_begin(&publisher);
+                output_json(snap, cfg->query, &out);
+                if (shm_publish_commit(&publisher, snap->timestamp) != 0) {
+                    fprintf(stderr, "Failed to publish snapshot to %s\n", cfg->shm_path);
+                }
+            } else {
+                output_results(cfg, snap, &out);
+            }
+            SCAN_STAT_STOP(SCAN_PHASE_OUTPUT, output_started);
+
+            // The other snapshot still holds the scan recorded last
+            if (recording) {
+                if (snapshot_log_append(&history, recorded ? &snapshots[current ^ 1] : NULL,
+                                        snap) != 0) {
+                    fprintf(stderr, "Failed to record snapshot to %s\n", cfg->history_path);
+                }
+                recorded = 1;
+            }
+            current ^= 1;
+            scanned = 1;
+            refresh = 0;
+        }
 
         // If interval is 0, run only once
         if (cfg->scan_interval == 0) {
             break;
         }
 
-        sleep(cfg->scan_interval);
+        // A failed scan's sections stay due along with whatever falls due next
+        int due;
+        do {
+            due = scan_schedule_wait(&schedule, -1);
+        } while (due == 0 && running);
+        if (due < 0) {
+            perror("timerfd");
+            result = 1;
+            break;
+        }
+        refresh |= (unsigned int)due;
     }
 
-    return 0;
+    free_snapshot(&snapshots[0]);
+    free_snapshot(&snapshots[1]);
+    free_scan_stream(&stream);
+    scan_schedule_close(&schedule);
+    if (cfg->shm_path) {
+        shm_publisher_close(&publisher);
+    }
+    if (recording) {
+        snapshot_log_close(&history);
+    }
+    json_writer_release(&out);
+    return result;
 }
 
 int main(int argc, char *argv[]) {
     int opt;
     int option_index = 0;
-    int test_mode = 0;
+    unsigned int sections = 0;
+    int queried = 0;
+    const char *read_history = NULL;
+    long history_mb;
+    int *interval;
+    time_t now = time(NULL), from = 0, to = now;
+
+    scan_query_init(&query);
 
     static struct option long_options[] = {
         {"json", no_argument, 0, 'j'},
@@ -109,7 +360,42 @@ int main(int argc, char *argv[]) {
         {"interval", required_argument, 0, 'i'},
         {"verbose", no_argument, 0, 'v'},
         {"help", no_argument, 0, 'h'},
-        {"test", no_argument, 0, 1000},
+        {"proc-net", no_argument, 0, 1001},
+        {"threads", required_argument, 0, 1002},
+        {"io-uring", no_argument, 0, 1003},
+        {"pretty", no_argument, 0, 1004},
+        {"stream", no_argument, 0, 1005},
+        {"daemon", optional_argument, 0, 1006},
+        {"read-shm", optional_argument, 0, 1007},
+        {"serve", optional_argument, 0, 1008},
+        {"sockets", no_argument, 0, 1009},
+        {"memory", no_argument, 0, 1010},
+        {"processes", no_argument, 0, 1011},
+        {"pid", required_argument, 0, 1012},
+        {"name", required_argument, 0, 1012},
+        {"port", required_argument, 0, 1012},
+        {"protocol", required_argument, 0, 1012},
+        {"state", required_argument, 0, 1012},
+        {"fields", required_argument, 0, 1012},
+        {"smaps", required_argument, 0, 1012},
+        {"maps", optional_argument, 0, 1012},
+        {"history", optional_argument, 0, 1013},
+        {"history-size", required_argument, 0, 1014},
+        {"read-history", optional_argument, 0, 1015},
+        {"from", required_argument, 0, 1016},
+        {"to", required_argument, 0, 1017},
+        {"proc-events", no_argument, 0, 1018},
+        {"proc-root", required_argument, 0, 1019},
+        {"metrics", no_argument, 0, 1020},
+        {"metrics-max-processes", required_argument, 0, 1021},
+        {"socket-interval", required_argument, 0, 1022},
+        {"process-interval", required_argument, 0, 1023},
+        {"memory-interval", required_argument, 0, 1024},
+        {"cpu-budget", required_argument, 0, 1025},
+        {"slice", required_argument, 0, 1026},
+        {"slice-time", required_argument, 0, 1027},
+        {"top", required_argument, 0, 1028},
+        {"group-by", required_argument, 0, 1029},
         {0, 0, 0, 0}
     };
 
@@ -134,8 +420,135 @@ int main(int argc, char *argv[]) {
             case 'h':
                 print_usage(argv[0]);
                 return 0;
-            case 1000: // --test
-                test_mode = 1;
+            case 1001: // --proc-net
+                config.socket_backend = SOCKET_BACKEND_PROCFS;
+                break;
+            case 1002: // --threads
+                config.threads = atoi(optarg);
+                if (config.threads < 0 || config.threads > 1024) {
+                    fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                    return 1;
+                }
+                if (config.threads == 0) {
+                    config.threads = work_pool_default_threads();
+                }
+                break;
+            case 1003: // --io-uring
+                config.io_uring = 1;
+                break;
+            case 1004: // --pretty
+                config.pretty = 1;
+                break;
+            case 1005: // --stream
+                config.output_format = OUTPUT_STREAM;
+                break;
+            case 1006: // --daemon
+                config.shm_path = optarg ? optarg : SHM_SNAPSHOT_PATH;
+                break;
+            case 1007: // --read-shm
+                return print_shm_snapshot(optarg);
+            case 1008: // --serve
+                config.http_listen = optarg ? optarg : HTTP_DEFAULT_LISTEN;
+                break;
+            case 1009: // --sockets
+                sections |= QUERY_SOCKETS;
+                break;
+            case 1010: // --memory
+                sections |= QUERY_MEMORY;
+                break;
+            case 1011: // --processes
+                sections |= QUERY_PROCESSES;
+                break;
+            case 1012: // --pid, --name, --port, --protocol, --state, --fields, --smaps, --maps
+                if (scan_query_add(&query, long_options[option_index].name,
+                                   optarg ? optarg : "") != 0) {
+                    fprintf(stderr, "Invalid --%s: %s\n", long_options[option_index].name, optarg);
+                    return 1;
+                }
+                queried = 1;
+                break;
+            case 1013: // --history
+                config.history_path = optarg ? optarg : SNAPSHOT_LOG_PATH;
+                break;
+            case 1014: // --history-size
+                history_mb = atol(optarg);
+                if (history_mb <= 0 || history_mb > (1L << 20)) {
+                    fprintf(stderr, "Invalid history size: %s\n", optarg);
+                    return 1;
+                }
+                config.history_size = (size_t)history_mb << 20;
+                break;
+            case 1015: // --read-history
+                read_history = optarg ? optarg : SNAPSHOT_LOG_PATH;
+                break;
+            case 1016: // --from
+            case 1017: // --to
+                if (parse_time(optarg, now, opt == 1016 ? &from : &to) != 0) {
+                    fprintf(stderr, "Invalid --%s: %s\n", long_options[option_index].name, optarg);
+                    return 1;
+                }
+                break;
+            case 1018: // --proc-events
+                config.proc_events = 1;
+                break;
+            case 1019: // --proc-root
+                config.proc_root = optarg;
+                break;
+            case 1020: // --metrics
+                config.output_format = OUTPUT_METRICS;
+                break;
+            case 1021: // --metrics-max-processes
+                config.metrics_max_processes = atoi(optarg);
+                if (config.metrics_max_processes < 0 || config.metrics_max_processes > 100000) {
+                    fprintf(stderr, "Invalid metrics process cap: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 1022: // --socket-interval
+            case 1023: // --process-interval
+            case 1024: // --memory-interval
+                interval = opt == 1022 ? &config.socket_interval
+                         : opt == 1023 ? &config.process_interval : &config.memory_interval;
+                *interval = atoi(optarg);
+                if (*interval <= 0) {
+                    fprintf(stderr, "Invalid --%s: %s\n", long_options[option_index].name, optarg);
+                    return 1;
+                }
+                break;
+            case 1025: // --cpu-budget
+                config.cpu_budget = atof(optarg);
+                if (config.cpu_budget <= 0 || config.cpu_budget > 100) {
+                    fprintf(stderr, "Invalid CPU budget: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 1026: // --slice
+                config.slice_pids = atoi(optarg);
+                if (config.slice_pids <= 0) {
+                    fprintf(stderr, "Invalid slice size: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 1027: // --slice-time
+                config.slice_ms = atoi(optarg);
+                if (config.slice_ms <= 0) {
+                    fprintf(stderr, "Invalid slice time: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 1028: // --top
+                if (parse_aggregate(optarg, aggregate_top_metric,
+                                    &config.top_metric, &config.top_limit) != 0) {
+                    fprintf(stderr, "Invalid --top: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 1029: // --group-by
+                if (parse_aggregate(optarg, aggregate_group_key,
+                                    &config.group_key, &config.group_limit) != 0) {
+                    fprintf(stderr, "Invalid --group-by: %s\n", optarg);
+                    return 1;
+                }
                 break;
             default:
                 print_usage(argv[0]);
@@ -143,10 +556,36 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (test_mode) {
-        printf("Running basic tests...\n");
-        printf("Test passed!\n");
-        return 0;
+    if (read_history) {
+        return print_history(read_history, from, to);
+    }
+
+    if (sections) {
+        query.sections = sections;
+        queried = 1;
+    }
+    if (queried) {
+        config.query = &query;
+    }
+
+    // sock_diag and the proc connector only ever see the host
+    if (config.proc_root) {
+        if (config.proc_events) {
+            fprintf(stderr, "--proc-events cannot follow --proc-root %s\n", config.proc_root);
+            return 1;
+        }
+        config.socket_backend = SOCKET_BACKEND_PROCFS;
+    }
+
+    // Rankings need the whole snapshot, which a stream never holds
+    if ((config.top_limit || config.group_limit) && config.output_format == OUTPUT_STREAM) {
+        fprintf(stderr, "--top and --group-by cannot be combined with --stream\n");
+        return 1;
+    }
+
+    // The daemon publishes whole documents
+    if (config.shm_path) {
+        config.output_format = OUTPUT_JSON;
     }
 
     if (sockmap_init() != 0) {
@@ -154,7 +593,14 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    int result = run_monitoring_loop(&config);
+    // Without the connector, every scan lists /proc as before
+    if (config.proc_events && proc_events_open() != 0) {
+        perror("proc connector");
+        config.proc_events = 0;
+    }
+
+    int result = config.http_listen ? run_http_server(&config, &running)
+                                    : run_monitoring_loop(&config);
 
     sockmap_cleanup();
     return result;
@@ -0,0 +1,83 @@
+/*
+ * Interned strings
+ *
+ * Mapping paths repeat across thousands of VMAs (every process maps libc)
+ * and names repeat across threads of a service, so the snapshot keeps one
+ * copy of each and the tables store 32-bit ids.
+ */
+
+#include <string.h>
+#include "../include/string_pool.h"
+
+#define INITIAL_SLOTS 1024
+
+static unsigned int hash_string(const char *str, size_t len) {
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int pool_rehash(struct string_pool *pool) {
+    size_t new_capacity = pool->slot_capacity ? pool->slot_capacity * 2 : INITIAL_SLOTS;
+    unsigned int *slots = arena_calloc(pool->arena, new_capacity, sizeof(unsigned int));
+    if (!slots) return -1;
+
+    for (int id = 0; id < pool->count; id++) {
+        size_t pos = pool->hashes[id] & (new_capacity - 1);
+        while (slots[pos] != 0) {
+            pos = (pos + 1) & (new_capacity - 1);
+        }
+        slots[pos] = (unsigned int)id + 1;
+    }
+
+    pool->slots = slots;
+    pool->slot_capacity = new_capacity;
+    return 0;
+}
+
+int string_pool_init(struct string_pool *pool, struct arena *arena) {
+    memset(pool, 0, sizeof(*pool));
+    pool->arena = arena;
+    if (pool_rehash(pool) != 0) return -1;
+    return string_pool_intern(pool, "", 0) == STRING_NONE ? 0 : -1;
+}
+
+int string_pool_intern(struct string_pool *pool, const char *str, size_t len) {
+    unsigned int hash = hash_string(str, len);
+    size_t pos = hash & (pool->slot_capacity - 1);
+
+    while (pool->slots[pos] != 0) {
+        unsigned int id = pool->slots[pos] - 1;
+        const char *existing = pool->strings[id];
+        if (pool->hashes[id] == hash && strncmp(existing, str, len) == 0 && existing[len] == '\0') {
+            return (int)id;
+        }
+        pos = (pos + 1) & (pool->slot_capacity - 1);
+    }
+
+    void **const columns[] = { (void **)&pool->strings, (void **)&pool->hashes };
+    const size_t widths[] = { sizeof(const char *), sizeof(unsigned int) };
+    if (arena_grow_columns(pool->arena, columns, widths, 2, &pool->capacity, pool->count + 1) != 0) {
+        return -1;
+    }
+
+    char *copy = arena_alloc(pool->arena, len + 1);
+    if (!copy) return -1;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    int id = pool->count++;
+    pool->strings[id] = copy;
+    pool->hashes[id] = hash;
+    pool->slots[pos] = (unsigned int)id + 1;
+
+    // Keep the load factor below 70%
+    if ((size_t)pool->count * 10 > pool->slot_capacity * 7) {
+        if (pool_rehash(pool) != 0) return -1;
+    }
+    return id;
+}
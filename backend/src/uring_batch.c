@@ -0,0 +1,329 @@
+/*
+ * Batched /proc file reads through io_uring
+ *
+ * Each file becomes an openat -> read... -> close chain on a direct
+ * descriptor slot, so a batch of hundreds of files costs a handful of
+ * io_uring_enter calls instead of three or more syscalls per file. The
+ * ring is set up with raw syscalls (no liburing dependency) and lives per
+ * thread.
+ * Anything the ring cannot serve is read with plain syscalls instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "../include/uring_batch.h"
+
+#define RING_ENTRIES 1024
+#define FILE_SLOTS 256          /* chains in flight per submission round */
+
+enum { OP_OPEN, OP_READ, OP_CLOSE };
+
+struct ring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sq_local_tail;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_sqe *sqes;
+    void *ring_map;
+    size_t ring_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+};
+
+static __thread struct ring *thread_ring;
+static __thread int ring_unavailable;
+
+static void ring_destroy(struct ring *ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map && ring->cq_map != ring->ring_map) munmap(ring->cq_map, ring->cq_map_len);
+    if (ring->ring_map) munmap(ring->ring_map, ring->ring_map_len);
+    if (ring->fd >= 0) close(ring->fd);
+    free(ring);
+}
+
+static struct ring *ring_create(void) {
+    struct ring *ring = calloc(1, sizeof(*ring));
+    if (!ring) return NULL;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && cq_len > sq_len) sq_len = cq_len;
+
+    ring->ring_map_len = sq_len;
+    ring->ring_map = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring->fd, IORING_OFF_SQ_RING);
+    if (ring->ring_map == MAP_FAILED) {
+        ring->ring_map = NULL;
+        ring_destroy(ring);
+        return NULL;
+    }
+
+    if (single_mmap) {
+        ring->cq_map = ring->ring_map;
+    } else {
+        ring->cq_map_len = cq_len;
+        ring->cq_map = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            ring_destroy(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        ring_destroy(ring);
+        return NULL;
+    }
+
+    char *sq = ring->ring_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    char *cq = ring->cq_map;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Sparse direct-descriptor table: openat fills a slot, close empties it
+    struct io_uring_rsrc_register files;
+    memset(&files, 0, sizeof(files));
+    files.nr = FILE_SLOTS;
+    files.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES2,
+                &files, sizeof(files)) < 0) {
+        ring_destroy(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+static struct ring *get_ring(void) {
+    if (!thread_ring && !ring_unavailable) {
+        thread_ring = ring_create();
+        if (!thread_ring) ring_unavailable = 1;
+    }
+    return thread_ring;
+}
+
+static struct io_uring_sqe *next_sqe(struct ring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries) return NULL;
+
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/* Progress of one file within a submission window */
+struct chain_state {
+    size_t filled;
+    int finished;
+};
+
+static void queue_open(struct ring *ring, struct uring_read *read, unsigned slot) {
+    struct io_uring_sqe *sqe = next_sqe(ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = read->dir_fd;
+    sqe->addr = (uint64_t)(uintptr_t)read->name;
+    sqe->open_flags = O_RDONLY; // O_CLOEXEC is invalid for direct descriptors
+    sqe->file_index = slot + 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = ((uint64_t)slot << 2) | OP_OPEN;
+}
+
+static void queue_read(struct ring *ring, struct uring_read *read, size_t filled,
+                       unsigned slot) {
+    struct io_uring_sqe *sqe = next_sqe(ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = (int)slot;
+    sqe->addr = (uint64_t)(uintptr_t)(read->buf + filled);
+    sqe->len = (unsigned)(read->len - 1 - filled);
+    sqe->off = (uint64_t)-1; // Sequential reads from the file position, as seq_file expects
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->user_data = ((uint64_t)slot << 2) | OP_READ;
+}
+
+static void queue_close(struct ring *ring, unsigned slot) {
+    struct io_uring_sqe *sqe = next_sqe(ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+    sqe->user_data = ((uint64_t)slot << 2) | OP_CLOSE;
+}
+
+static void finish_read(struct uring_read *read, struct chain_state *state, ssize_t result,
+                        uring_complete_fn on_complete, void *ctx) {
+    state->finished = 1;
+    read->result = result;
+    read->buf[result > 0 ? (size_t)result : 0] = '\0';
+    read->done = 1;
+    on_complete(ctx, read);
+}
+
+/*
+ * Run one window of at most FILE_SLOTS files, slot i serving reads[i].
+ * /proc files such as maps come back roughly a page per read, so each file
+ * keeps getting another read until EOF or a full buffer, and all files
+ * advance together: one io_uring_enter per round for the whole window.
+ */
+static int run_window(struct ring *ring, struct uring_read *reads, int count,
+                      uring_complete_fn on_complete, void *ctx) {
+    struct chain_state states[FILE_SLOTS];
+    memset(states, 0, sizeof(states));
+
+    for (int i = 0; i < count; i++) {
+        queue_open(ring, &reads[i], (unsigned)i);
+        queue_read(ring, &reads[i], 0, (unsigned)i);
+    }
+    int inflight = count * 2;
+
+    while (inflight > 0) {
+        __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+        unsigned to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+        int ret = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+                               IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            unsigned slot = (unsigned)(cqe->user_data >> 2);
+            int op = (int)(cqe->user_data & 3);
+            struct uring_read *read = &reads[slot];
+            struct chain_state *state = &states[slot];
+            inflight--;
+
+            if (op == OP_OPEN) {
+                // On failure the linked read completes as cancelled
+                if (cqe->res < 0) finish_read(read, state, cqe->res, on_complete, ctx);
+                continue;
+            }
+            if (op == OP_CLOSE || state->finished) continue;
+
+            if (cqe->res < 0) {
+                finish_read(read, state, cqe->res, on_complete, ctx);
+            } else if (cqe->res == 0 || state->filled + cqe->res >= read->len - 1) {
+                state->filled += cqe->res;
+                finish_read(read, state, (ssize_t)state->filled, on_complete, ctx);
+            } else {
+                state->filled += cqe->res;
+                queue_read(ring, read, state->filled, slot);
+                inflight++;
+                continue;
+            }
+            queue_close(ring, slot);
+            inflight++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void read_sync(struct uring_read *req) {
+    int fd = openat(req->dir_fd, req->name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        req->result = -errno;
+        req->buf[0] = '\0';
+        return;
+    }
+
+    size_t total = 0;
+    while (total < req->len - 1) {
+        ssize_t n = read(fd, req->buf + total, req->len - 1 - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        total += n;
+    }
+    close(fd);
+
+    req->result = (ssize_t)total;
+    req->buf[total] = '\0';
+}
+
+int uring_read_batch(struct uring_read *reads, int count,
+                     uring_complete_fn on_complete, void *ctx) {
+    struct ring *ring = get_ring();
+    int served = 0;
+
+    for (int i = 0; i < count; i++) {
+        reads[i].done = 0;
+    }
+
+    while (ring && served < count) {
+        int window = count - served;
+        if (window > FILE_SLOTS) window = FILE_SLOTS;
+
+        if (run_window(ring, reads + served, window, on_complete, ctx) != 0) {
+            // The ring is in an unknown state; retire it for this thread
+            uring_batch_release();
+            ring_unavailable = 1;
+            ring = NULL;
+            break;
+        }
+        served += window;
+    }
+
+    // Plain syscalls for whatever the ring did not serve
+    for (int i = served; i < count; i++) {
+        if (reads[i].done) continue;
+        read_sync(&reads[i]);
+        reads[i].done = 1;
+        on_complete(ctx, &reads[i]);
+    }
+    return served;
+}
+
+int uring_batch_available(void) {
+    return get_ring() != NULL;
+}
+
+void uring_batch_release(void) {
+    if (thread_ring) {
+        ring_destroy(thread_ring);
+        thread_ring = NULL;
+    }
+}
@@ -0,0 +1,148 @@
+/*
+ * Work-stealing thread pool
+ *
+ * Every worker owns a range of item indices. It consumes its range from
+ * the front; an idle worker steals the back half of another worker's
+ * range. Ranges are only ever split and moved, never created, so once a
+ * full sweep finds every range empty the worker can exit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../include/work_pool.h"
+
+/* Padded to a cache line so neighbouring locks do not false-share */
+struct work_range {
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+    char pad[64 - sizeof(pthread_mutex_t) % 64 - 2 * sizeof(int)];
+};
+
+struct work_pool {
+    struct work_range *ranges;
+    int threads;
+    work_fn fn;
+    void (*thread_exit)(void);
+    void *ctx;
+};
+
+struct worker_arg {
+    struct work_pool *pool;
+    int index;
+};
+
+static int take_own(struct work_range *range) {
+    int item = -1;
+    pthread_mutex_lock(&range->lock);
+    if (range->head < range->tail) {
+        item = range->head++;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return item;
+}
+
+/* Move the back half of a victim's range into ours; returns items stolen */
+static int steal(struct work_pool *pool, int self) {
+    for (int i = 1; i < pool->threads; i++) {
+        struct work_range *victim = &pool->ranges[(self + i) % pool->threads];
+
+        pthread_mutex_lock(&victim->lock);
+        int remaining = victim->tail - victim->head;
+        if (remaining <= 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        int mid = victim->head + remaining / 2;
+        int tail = victim->tail;
+        victim->tail = mid;
+        pthread_mutex_unlock(&victim->lock);
+
+        struct work_range *own = &pool->ranges[self];
+        pthread_mutex_lock(&own->lock);
+        own->head = mid;
+        own->tail = tail;
+        pthread_mutex_unlock(&own->lock);
+        return tail - mid;
+    }
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    struct worker_arg *worker = arg;
+    struct work_pool *pool = worker->pool;
+    struct work_range *own = &pool->ranges[worker->index];
+
+    for (;;) {
+        int item = take_own(own);
+        if (item >= 0) {
+            pool->fn(pool->ctx, worker->index, item);
+            continue;
+        }
+        if (steal(pool, worker->index) == 0) {
+            break;
+        }
+    }
+
+    if (pool->thread_exit) {
+        pool->thread_exit();
+    }
+    return NULL;
+}
+
+int work_pool_run(int threads, int item_count, work_fn fn,
+                  void (*thread_exit)(void), void *ctx) {
+    if (threads < 1) threads = 1;
+    if (threads > item_count) threads = item_count > 0 ? item_count : 1;
+
+    struct work_pool pool = { NULL, threads, fn, thread_exit, ctx };
+    pool.ranges = calloc(threads, sizeof(struct work_range));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    struct worker_arg *args = calloc(threads, sizeof(struct worker_arg));
+    if (!pool.ranges || !tids || !args) {
+        free(pool.ranges);
+        free(tids);
+        free(args);
+        return -1;
+    }
+
+    // Seed each worker with a contiguous slice
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&pool.ranges[i].lock, NULL);
+        pool.ranges[i].head = (int)((long long)item_count * i / threads);
+        pool.ranges[i].tail = (int)((long long)item_count * (i + 1) / threads);
+        args[i].pool = &pool;
+        args[i].index = i;
+    }
+
+    // The calling thread works as worker 0
+    int started = 1;
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&tids[i], NULL, worker_main, &args[i]) != 0) {
+            break; // Remaining slices get stolen by the running workers
+        }
+        started++;
+    }
+
+    worker_main(&args[0]);
+
+    for (int i = 1; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&pool.ranges[i].lock);
+    }
+    free(pool.ranges);
+    free(tids);
+    free(args);
+    return 0;
+}
+
+int work_pool_default_threads(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
@@ -0,0 +1,966 @@
+/*
+ * SockMap - Scanner tests
+ *
+ * Scans a proc root built by proc_fixture, whose content follows fixed
+ * rules, and checks the sockets, rollups and processes against them, in
+ * the sequential, threaded and io_uring walks and through the binary's
+ * --proc-root. Then runs the /proc parsers, the snapshot diff, query
+ * parsing and snapshot views, the rankings, the history log's ring, the
+ * history trends and cpu_sample on inputs made up here. -p and -s must
+ * match the fixture's; -b names the binary to run, if any.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "../include/sockmap.h"
+#include "../include/proc_parse.h"
+#include "../include/snapshot_diff.h"
+#include "../include/history.h"
+#include "../include/cpu_sample.h"
+#include "../include/json_writer.h"
+#include "../include/snapshot_log.h"
+#include "../include/scan_query.h"
+#include "../include/snapshot_view.h"
+#include "../include/aggregate.h"
+
+/* proc_fixture's numbering: pid FIRST_PID + i holds net rows i, i + pids, ... */
+#define FIRST_PID 100
+#define FIRST_INODE 1000000UL
+#define FIXTURE_NAME_COUNT 8
+
+static const char *fixture_names[FIXTURE_NAME_COUNT] = {
+    "nginx", "postgres", "java", "python3", "redis-server", "envoy", "node", "sshd",
+};
+
+static int failures;
+
+#define CHECK(cond) do {                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+/* Stops a table's row checks after its first bad row, so one bug prints one line */
+#define CHECK_ROW(cond, table, row) do {                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: %s row %d: check failed: %s\n", __FILE__, __LINE__, \
+                    table, row, #cond);                                        \
+            failures++;                                                        \
+            return;                                                            \
+        }                                                                      \
+    } while (0)
+
+struct buffer {
+    char *data;
+    size_t len;
+};
+
+static int buffer_append(void *ctx, const char *data, size_t len) {
+    struct buffer *buf = ctx;
+    char *grown = realloc(buf->data, buf->len + len + 1);
+    if (!grown) return -1;
+    memcpy(grown + buf->len, data, len);
+    buf->data = grown;
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+static int count_matches(const char *haystack, const char *needle) {
+    int count = 0;
+    for (const char *p = haystack; (p = strstr(p, needle)) != NULL; p += strlen(needle)) count++;
+    return count;
+}
+
+/* Fixture scans */
+
+struct fixture {
+    const char *root;
+    int pids;
+    long sockets;
+};
+
+static int process_row(const struct sockmap_snapshot *snap, pid_t pid) {
+    for (int i = 0; i < snap->processes.count; i++) {
+        if (snap->processes.pid[i] == pid) return i;
+    }
+    return -1;
+}
+
+static void check_processes(const struct fixture *fx, const struct sockmap_snapshot *snap) {
+    const struct process_table *processes = &snap->processes;
+    CHECK(processes->count == fx->pids);
+    for (int row = 0; row < processes->count; row++) {
+        int index = processes->pid[row] - FIRST_PID;
+        CHECK_ROW(index >= 0 && index < fx->pids, "process", row);
+        const char *name = string_pool_get(&snap->strings, processes->name[row]);
+        CHECK_ROW(strcmp(name, fixture_names[index % FIXTURE_NAME_COUNT]) == 0, "process", row);
+        CHECK_ROW(processes->state[row] == 'S', "process", row);
+        CHECK_ROW(processes->start_time[row] == 1000 + (unsigned long long)processes->pid[row] * 3,
+                  "process", row);
+        long owned = fx->sockets > index ? (fx->sockets - index - 1) / fx->pids + 1 : 0;
+        CHECK_ROW(processes->socket_count[row] == owned, "process", row);
+    }
+}
+
+static void check_rollups(const struct fixture *fx, const struct sockmap_snapshot *snap) {
+    const struct rollup_table *rollups = &snap->rollups;
+    CHECK(rollups->count == fx->pids);
+    for (int row = 0; row < rollups->count; row++) {
+        const struct memory_usage *usage = &rollups->usage[row];
+        int process = process_row(snap, rollups->pid[row]);
+        CHECK_ROW(process >= 0, "rollup", row);
+        CHECK_ROW(rollups->type[row] == MEMORY_TYPE_TOTAL, "rollup", row);
+        CHECK_ROW(usage->rss_kb >= 4096, "rollup", row);
+        CHECK_ROW(usage->pss_kb == usage->rss_kb * 9 / 10, "rollup", row);
+        CHECK_ROW(usage->swap_kb == 0 && usage->shared_dirty_kb == 0, "rollup", row);
+        CHECK_ROW(usage->private_dirty_kb == usage->rss_kb * 3 / 4, "rollup", row);
+        // stat has the same resident size in whole pages
+        CHECK_ROW(snap->processes.rss_kb[process] / 4 == usage->rss_kb / 4, "rollup", row);
+    }
+    CHECK(snap->memory.count == 0);
+}
+
+static void check_sockets(const struct fixture *fx, const struct sockmap_snapshot *snap) {
+    const struct socket_table *sockets = &snap->sockets;
+    CHECK(sockets->count == fx->sockets);
+    int tcp = 0, udp = 0, ipv6 = 0, listening = 0;
+    for (int row = 0; row < sockets->count; row++) {
+        long index = (long)(sockets->inode[row] - FIRST_INODE);
+        CHECK_ROW(index >= 0 && index < fx->sockets, "socket", row);
+        CHECK_ROW(socket_pid(snap, row) == FIRST_PID + index % fx->pids, "socket", row);
+        CHECK_ROW(sockets->uid[row] == 1000 + (uid_t)(index % 4), "socket", row);
+
+        // Every local address is loopback, IPv4-mapped in the v6 tables
+        const unsigned char *local = sockets->local[row].addr;
+        if (sockets->family[row] == AF_INET6) {
+            ipv6++;
+            CHECK_ROW(local[10] == 0xff && local[11] == 0xff && local[12] == 127, "socket", row);
+        } else {
+            CHECK_ROW(sockets->family[row] == AF_INET && local[0] == 127 && local[3] == 1,
+                      "socket", row);
+        }
+
+        if (sockets->protocol[row] == SOCKET_PROTO_UDP) {
+            udp++;
+            CHECK_ROW(sockets->state[row] == SOCKET_STATE_CLOSE, "socket", row);
+        } else if (sockets->state[row] == SOCKET_STATE_LISTEN) {
+            tcp++;
+            listening++;
+            CHECK_ROW(sockets->local[row].port >= 8000 && sockets->local[row].port < 8016,
+                      "socket", row);
+            CHECK_ROW(sockets->remote[row].port == 0, "socket", row);
+        } else {
+            tcp++;
+            CHECK_ROW(sockets->local[row].port >= 32768, "socket", row);
+            CHECK_ROW(sockets->remote[row].port == 443, "socket", row);
+        }
+    }
+
+    // Shares of 20 per table: tcp 12, tcp6 5, udp 2, udp6 1
+    long tcp4 = fx->sockets * 12 / 20, tcp6 = fx->sockets * 5 / 20, udp4 = fx->sockets * 2 / 20;
+    CHECK(tcp == tcp4 + tcp6);
+    CHECK(udp == fx->sockets - tcp4 - tcp6);
+    CHECK(ipv6 == tcp6 + fx->sockets - tcp4 - tcp6 - udp4);
+    CHECK(listening > 0 && listening < tcp);
+}
+
+static int scan_fixture(const struct fixture *fx, int threads, int io_uring,
+                        struct sockmap_snapshot *snap) {
+    struct sockmap_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.output_format = OUTPUT_JSON;
+    cfg.socket_backend = SOCKET_BACKEND_PROCFS;
+    cfg.threads = threads;
+    cfg.io_uring = io_uring;
+    cfg.proc_root = fx->root;
+    memset(snap, 0, sizeof(*snap));
+    return scan_snapshot(&cfg, snap);
+}
+
+static void test_fixture_scan(const struct fixture *fx) {
+    static const struct { int threads; int io_uring; } walks[] = { { 1, 0 }, { 4, 0 }, { 1, 1 } };
+    for (size_t i = 0; i < sizeof(walks) / sizeof(walks[0]); i++) {
+        struct sockmap_snapshot snap;
+        int result = scan_fixture(fx, walks[i].threads, walks[i].io_uring, &snap);
+        CHECK(result == 0);
+        if (result == 0) {
+            check_processes(fx, &snap);
+            check_rollups(fx, &snap);
+            check_sockets(fx, &snap);
+        }
+        free_snapshot(&snap);
+    }
+}
+
+/* The binary's own scan of the fixture, counted in its JSON */
+static void test_proc_root_option(const struct fixture *fx, const char *binary) {
+    char command[512];
+    snprintf(command, sizeof(command), "%s -i 0 --proc-root=%s", binary, fx->root);
+    FILE *pipe = popen(command, "r");
+    CHECK(pipe != NULL);
+    if (!pipe) return;
+
+    struct buffer out = { NULL, 0 };
+    char chunk[8192];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), pipe)) > 0) buffer_append(&out, chunk, n);
+    CHECK(pclose(pipe) == 0);
+    CHECK(out.data != NULL);
+    if (out.data) {
+        CHECK(count_matches(out.data, "\"inode\":") == fx->sockets);
+        CHECK(count_matches(out.data, "\"socket_count\":") == fx->pids);
+        CHECK(count_matches(out.data, "\"type\":\"total\"") == fx->pids);
+        CHECK(strstr(out.data, "\"name\":\"redis-server\"") != NULL);
+    }
+    free(out.data);
+}
+
+/* Parsers */
+
+static void test_parse_stat(void) {
+    static const char stat[] =
+        "4242 (a (b) c) R 17 4242 4242 0 -1 4194560 100 0 12 0 250 75 0 0 20 0 4 0 98765 "
+        "1048576 256 18446744073709551615 1 1 0 0 0 0 0 4096 17663 0 0 0 17 3 0 0\n";
+    struct stat_fields fields;
+    CHECK(pp_parse_stat(stat, sizeof(stat) - 1, &fields) == 0);
+    CHECK(fields.state == 'R');
+    CHECK(fields.ppid == 17);
+    CHECK(fields.utime == 250 && fields.stime == 75);
+    CHECK(fields.starttime == 98765);
+
+    static const char truncated[] = "4242 (sh) S 1 4242 4242 0 -1";
+    CHECK(pp_parse_stat(truncated, sizeof(truncated) - 1, &fields) == -1);
+}
+
+static void test_parse_status(void) {
+    static const char status[] =
+        "Name:\tjava\nVmRSSMax:\t9 kB\nVmHWM:\t   2048 kB\nVmRSS:\t   1536 kB\nThreads:\t12\n";
+    unsigned long value = 0;
+    CHECK(pp_status_value(status, sizeof(status) - 1, "VmRSS", &value) == 0 && value == 1536);
+    CHECK(pp_status_value(status, sizeof(status) - 1, "Threads", &value) == 0 && value == 12);
+    CHECK(pp_status_value(status, sizeof(status) - 1, "VmSwap", &value) == -1);
+    // A key is only matched at the start of a line
+    CHECK(pp_status_value(status, sizeof(status) - 1, "RSS", &value) == -1);
+}
+
+static void test_parse_maps(void) {
+    static const char line[] =
+        "7f1c2a000000-7f1c2a021000 r-xp 0001c000 08:01 131090     /opt/my app/lib.so";
+    struct maps_entry entry;
+    CHECK(pp_parse_maps_line(line, line + sizeof(line) - 1, &entry) == 0);
+    CHECK(entry.start == 0x7f1c2a000000UL && entry.end == 0x7f1c2a021000UL);
+    CHECK(strcmp(entry.perms, "r-xp") == 0);
+    CHECK(entry.offset == 0x1c000 && entry.inode == 131090);
+    CHECK(entry.path_len == strlen("/opt/my app/lib.so") &&
+          memcmp(entry.path, "/opt/my app/lib.so", entry.path_len) == 0);
+
+    static const char anonymous[] = "7ffd00000000-7ffd00021000 rw-p 00000000 00:00 0";
+    CHECK(pp_parse_maps_line(anonymous, anonymous + sizeof(anonymous) - 1, &entry) == 0);
+    CHECK(entry.inode == 0 && entry.path_len == 0);
+
+    static const char broken[] = "7ffd00000000 rw-p";
+    CHECK(pp_parse_maps_line(broken, broken + sizeof(broken) - 1, &entry) == -1);
+}
+
+static void test_parse_net(void) {
+    static const char tcp[] =
+        "    3: 0100007F:1F90 0200000A:01BB 01 00000010:00000020 00:00000000 00000000  1001 "
+        "       0 123456 1 0000000000000000 20 4 30 10 -1";
+    struct net_entry entry;
+    CHECK(pp_parse_net_line(tcp, tcp + sizeof(tcp) - 1, 1, &entry) == 0);
+    CHECK(entry.local_addr[0] == 127 && entry.local_addr[3] == 1);
+    CHECK(entry.remote_addr[0] == 10 && entry.remote_addr[3] == 2);
+    CHECK(entry.local_port == 8080 && entry.remote_port == 443);
+    CHECK(entry.state == 0x01);
+    CHECK(entry.tx_queue == 0x10 && entry.rx_queue == 0x20);
+    CHECK(entry.uid == 1001 && entry.inode == 123456);
+
+    static const char tcp6[] =
+        "    0: 0000000000000000FFFF00000100007F:0050 00000000000000000000000000000000:0000 0A "
+        "00000000:00000000 00:00000000 00000000     0        0 777 1 0000000000000000 100 0 0 "
+        "10 0";
+    CHECK(pp_parse_net_line(tcp6, tcp6 + sizeof(tcp6) - 1, 4, &entry) == 0);
+    CHECK(entry.local_addr[10] == 0xff && entry.local_addr[11] == 0xff);
+    CHECK(entry.local_addr[12] == 127 && entry.local_addr[15] == 1);
+    CHECK(entry.local_port == 80 && entry.state == 0x0A && entry.inode == 777);
+
+    static const char header[] =
+        "  sl  local_address rem_address   st tx_queue rx_queue tr tm->when retrnsmt   uid";
+    CHECK(pp_parse_net_line(header, header + sizeof(header) - 1, 1, &entry) == -1);
+}
+
+/* Snapshot diff */
+
+static void add_process(struct sockmap_snapshot *snap, pid_t pid, const char *name,
+                        unsigned long long start_time, unsigned long rss_kb) {
+    struct process_info proc;
+    memset(&proc, 0, sizeof(proc));
+    proc.pid = pid;
+    snprintf(proc.name, sizeof(proc.name), "%s", name);
+    proc.rss_kb = rss_kb;
+    proc.start_time = start_time;
+    proc.state = 'S';
+    CHECK(process_table_append(&snap->processes, &snap->arena, &snap->strings, &proc) == 0);
+}
+
+static void add_socket(struct sockmap_snapshot *snap, unsigned long inode, int state, int owner) {
+    struct socket_info socket;
+    memset(&socket, 0, sizeof(socket));
+    socket.family = AF_INET;
+    socket.protocol = SOCKET_PROTO_TCP;
+    socket.state = (unsigned char)state;
+    socket.local.port = 8080;
+    socket.inode = inode;
+    CHECK(socket_table_append(&snap->sockets, &snap->arena, &socket) == 0);
+    snap->sockets.owner[snap->sockets.count - 1] = owner;
+}
+
+struct diff_counts {
+    int changes[DIFF_TABLE_COUNT][DIFF_REMOVED + 1];
+};
+
+static int count_change(void *ctx, int table, int change, const struct sockmap_snapshot *snap,
+                        int row, struct row_key key) {
+    (void)snap;
+    (void)row;
+    (void)key;
+    ((struct diff_counts *)ctx)->changes[table][change]++;
+    return 0;
+}
+
+static void test_snapshot_diff(void) {
+    struct sockmap_snapshot prev, cur;
+    memset(&prev, 0, sizeof(prev));
+    memset(&cur, 0, sizeof(cur));
+    CHECK(string_pool_init(&prev.strings, &prev.arena) == 0);
+    CHECK(string_pool_init(&cur.strings, &cur.arena) == 0);
+
+    // Pid 11 is reused by a new process; pid 10 grows
+    add_process(&prev, 10, "nginx", 100, 2048);
+    add_process(&prev, 11, "redis", 200, 4096);
+    add_process(&cur, 11, "redis", 300, 4096);
+    add_process(&cur, 10, "nginx", 100, 3072);
+
+    // Socket 1 closes, 2 changes state, 3 only changes owner row, 4 opens
+    add_socket(&prev, 1, SOCKET_STATE_ESTABLISHED, 0);
+    add_socket(&prev, 2, SOCKET_STATE_ESTABLISHED, 0);
+    add_socket(&prev, 3, SOCKET_STATE_LISTEN, 0);
+    add_socket(&cur, 2, SOCKET_STATE_CLOSE_WAIT, 1);
+    add_socket(&cur, 3, SOCKET_STATE_LISTEN, 1);
+    add_socket(&cur, 4, SOCKET_STATE_ESTABLISHED, 0);
+
+    struct diff_counts counts;
+    memset(&counts, 0, sizeof(counts));
+    CHECK(snapshot_diff_rows(&prev, &cur, ~0u, count_change, &counts) == 0);
+    CHECK(counts.changes[DIFF_SOCKETS][DIFF_ADDED] == 1);
+    CHECK(counts.changes[DIFF_SOCKETS][DIFF_CHANGED] == 1);
+    CHECK(counts.changes[DIFF_SOCKETS][DIFF_REMOVED] == 1);
+    CHECK(counts.changes[DIFF_PROCESSES][DIFF_ADDED] == 1);
+    CHECK(counts.changes[DIFF_PROCESSES][DIFF_CHANGED] == 1);
+    CHECK(counts.changes[DIFF_PROCESSES][DIFF_REMOVED] == 1);
+
+    // The same rows again are no change at all
+    memset(&counts, 0, sizeof(counts));
+    CHECK(snapshot_diff_rows(&cur, &cur, ~0u, count_change, &counts) == 0);
+    for (int t = 0; t < DIFF_TABLE_COUNT; t++) {
+        CHECK(counts.changes[t][DIFF_ADDED] + counts.changes[t][DIFF_CHANGED] +
+              counts.changes[t][DIFF_REMOVED] == 0);
+    }
+
+    struct buffer out = { NULL, 0 };
+    struct json_writer writer;
+    json_writer_init_sink(&writer, buffer_append, &out, 0);
+    CHECK(output_snapshot_delta(&prev, &cur, 7, &writer) == 0);
+    CHECK(json_flush(&writer) == 0);
+    json_writer_release(&writer);
+    CHECK(out.data != NULL);
+    if (out.data) {
+        CHECK(strncmp(out.data, "{\"sequence\":7,\"base\":6,", 23) == 0);
+        CHECK(strstr(out.data, "\"removed\":[\"1\"]") != NULL);
+        CHECK(strstr(out.data, "\"removed\":[\"11@200\"]") != NULL);
+        CHECK(strstr(out.data, "\"key\":\"4\"") != NULL);
+    }
+    free(out.data);
+
+    snapshot_diff_release();
+    free_snapshot(&prev);
+    free_snapshot(&cur);
+}
+
+/* Queries and views */
+
+static void test_scan_query(void) {
+    static const struct {
+        const char *option;
+        const char *terms;
+        int result;
+    } cases[] = {
+        { "pid", "1,2,3", 0 },        { "pid", "0", -1 },           { "pid", "12x", -1 },
+        { "pid", "", -1 },            { "port", "65535", 0 },       { "port", "65536", -1 },
+        { "protocol", "udp", 0 },     { "protocol", "sctp", -1 },   { "state", "listen", 0 },
+        { "state", "LISTENING", 0 },  { "state", "OPEN", -1 },      { "fields", "pid", 0 },
+        { "fields", "nonesuch", -1 }, { "maps", "", 0 },            { "maps", "10:20", 0 },
+        { "maps", "10", -1 },         { "maps", "10:", -1 },        { "maps", ":5", -1 },
+        { "maps", "1:x", -1 },        { "maps", "-1:5", -1 },       { "smaps", "7", 0 },
+        { "name", "", -1 },           { "name", "a,,b", -1 },       { "color", "red", -1 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        struct scan_query query;
+        scan_query_init(&query);
+        int result = scan_query_add(&query, cases[i].option, cases[i].terms);
+        if (result != cases[i].result) {
+            fprintf(stderr, "scan_query_add(%s, \"%s\") = %d\n", cases[i].option,
+                    cases[i].terms, result);
+        }
+        CHECK(result == cases[i].result);
+    }
+
+    struct scan_query query;
+    scan_query_init(&query);
+    CHECK(scan_query_add(&query, "maps", "10:20") == 0);
+    CHECK(query.maps == 1 && query.map_offset == 10 && query.map_limit == 20);
+
+    // The first field replaces the default of all fields, later ones add to it
+    CHECK(scan_query_add(&query, "fields", "pid,name") == 0);
+    CHECK(query.process_fields == (1u << PROCESS_FIELD_PID | 1u << PROCESS_FIELD_NAME));
+    CHECK(query.socket_fields == 1u << SOCKET_FIELD_PID);
+    CHECK(query.memory_fields == 1u << MEMORY_FIELD_PID);
+    CHECK(scan_query_add(&query, "fields", "state") == 0);
+    CHECK(query.socket_fields == (1u << SOCKET_FIELD_PID | 1u << SOCKET_FIELD_STATE));
+
+    // Names compare as the kernel keeps them, at most 15 bytes
+    CHECK(scan_query_add(&query, "name", "abcdefghijklmnopqrstuvwxyz") == 0);
+    CHECK(strcmp(query.names[0], "abcdefghijklmno") == 0);
+    CHECK(query_wants_name(&query, "abcdefghijklmno"));
+
+    // No more than QUERY_MAX_TERMS terms of a kind
+    char pids[128] = "";
+    for (int i = 1; i <= QUERY_MAX_TERMS; i++) {
+        snprintf(pids + strlen(pids), sizeof(pids) - strlen(pids), "%s%d", i > 1 ? "," : "", i);
+    }
+    scan_query_init(&query);
+    CHECK(scan_query_add(&query, "pid", pids) == 0);
+    CHECK(scan_query_add(&query, "pid", "17") == -1);
+
+    // URL options are percent-decoded before they parse
+    const char *url = "?name=%6eginx&state=LISTEN%2cESTABLISHED&maps=5%3A10&xport=1&port=80";
+    int fresh = -1;
+    const char *bad = NULL;
+    CHECK(scan_query_parse_params(NULL, url, url + strlen(url), &query, &fresh, &bad) == 4);
+    CHECK(query.name_count == 1 && strcmp(query.names[0], "nginx") == 0);
+    CHECK(query.states == (1u << SOCKET_STATE_LISTEN | 1u << SOCKET_STATE_ESTABLISHED));
+    CHECK(query.map_offset == 5 && query.map_limit == 10 && fresh == 1);
+    CHECK(query.port_count == 1 && query.ports[0] == 80);
+
+    // An escape cut short or not hex stays as it is
+    static const struct {
+        const char *url;
+        const char *name;
+    } escapes[] = {
+        { "?name=a%zzb", "a%zzb" }, { "?name=ab%4", "ab%4" }, { "?name=a%2", "a%2" },
+        { "?name=%41%42&pid=1", "AB" }, { "?name=a+b", "a+b" },
+    };
+    for (size_t i = 0; i < sizeof(escapes) / sizeof(escapes[0]); i++) {
+        const char *end = escapes[i].url + strlen(escapes[i].url);
+        CHECK(scan_query_parse_params(NULL, escapes[i].url, end, &query, &fresh, &bad) > 0);
+        CHECK(strcmp(query.names[0], escapes[i].name) == 0);
+    }
+
+    // A bad option is named; a value too long to decode is bad too
+    url = "?pid=1&port=99999";
+    CHECK(scan_query_parse_params(NULL, url, url + strlen(url), &query, &fresh, &bad) == -1);
+    CHECK(bad && strcmp(bad, "port") == 0);
+    char long_url[512] = "?name=";
+    memset(long_url + 6, 'a', 300);
+    long_url[306] = '\0';
+    CHECK(scan_query_parse_params(NULL, long_url, long_url + 306, &query, &fresh, &bad) == -1);
+    CHECK(bad && strcmp(bad, "name") == 0);
+
+    // What the URL leaves out comes from the command line's query
+    struct scan_query base;
+    scan_query_init(&base);
+    base.sections = QUERY_SOCKETS;
+    CHECK(scan_query_add(&base, "fields", "inode") == 0);
+    CHECK(scan_query_add(&base, "maps", "0:50") == 0);
+    url = "?pid=5";
+    CHECK(scan_query_parse_params(&base, url, url + strlen(url), &query, &fresh, &bad) == 1);
+    CHECK(query.sections == QUERY_SOCKETS && fresh == 0);
+    CHECK(query.socket_fields == 1u << SOCKET_FIELD_INODE);
+    CHECK(query.maps == 1 && query.map_limit == 50);
+    url = "?fields=state&maps=";
+    CHECK(scan_query_parse_params(&base, url, url + strlen(url), &query, &fresh, &bad) == 2);
+    CHECK(query.socket_fields == 1u << SOCKET_FIELD_STATE);
+    CHECK(query.map_limit == 0 && fresh == 1);
+}
+
+static void test_snapshot_view(void) {
+    struct sockmap_snapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    CHECK(string_pool_init(&snap.strings, &snap.arena) == 0);
+    add_process(&snap, 10, "nginx", 100, 2048);
+    add_process(&snap, 11, "redis", 100, 2048);
+    add_process(&snap, 12, "postgres", 100, 2048);
+    add_socket(&snap, 1, SOCKET_STATE_ESTABLISHED, 0);
+    add_socket(&snap, 2, SOCKET_STATE_LISTEN, 1);
+    add_socket(&snap, 3, SOCKET_STATE_ESTABLISHED, 2);
+    add_socket(&snap, 4, SOCKET_STATE_LISTEN, 2);
+    add_socket(&snap, 5, SOCKET_STATE_ESTABLISHED, -1);
+
+    // Kept rows in snapshot order, socket owners renumbered to them
+    static const struct {
+        const char *option;
+        const char *terms;
+        int processes;
+        pid_t pids[3];
+        const char *names[3];
+        int sockets;
+        unsigned long inodes[5];
+        int owners[5];
+    } cases[] = {
+        { "name", "redis", 1, { 11 }, { "redis" }, 1, { 2 }, { 0 } },
+        { "pid", "12,10", 2, { 10, 12 }, { "nginx", "postgres" }, 3, { 1, 3, 4 }, { 0, 1, 1 } },
+        { "state", "LISTEN", 3, { 10, 11, 12 }, { "nginx", "redis", "postgres" }, 2, { 2, 4 },
+          { 1, 2 } },
+        { "port", "8080", 3, { 10, 11, 12 }, { "nginx", "redis", "postgres" }, 5,
+          { 1, 2, 3, 4, 5 }, { 0, 1, 2, 2, -1 } },
+        { "pid", "99", 0, { 0 }, { NULL }, 0, { 0 }, { 0 } },
+    };
+    struct sockmap_snapshot views[sizeof(cases) / sizeof(cases[0])];
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        struct scan_query query;
+        scan_query_init(&query);
+        CHECK(scan_query_add(&query, cases[c].option, cases[c].terms) == 0);
+        memset(&views[c], 0, sizeof(views[c]));
+        CHECK(snapshot_view(&snap, &query, &views[c]) == 0);
+    }
+
+    // The views own their names, so they outlive the snapshot
+    free_snapshot(&snap);
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const struct sockmap_snapshot *view = &views[c];
+        CHECK(view->processes.count == cases[c].processes);
+        for (int i = 0; i < view->processes.count && i < cases[c].processes; i++) {
+            CHECK_ROW(view->processes.pid[i] == cases[c].pids[i], "processes", i);
+            CHECK_ROW(strcmp(string_pool_get(&view->strings, view->processes.name[i]),
+                             cases[c].names[i]) == 0, "processes", i);
+        }
+        CHECK(view->sockets.count == cases[c].sockets);
+        for (int i = 0; i < view->sockets.count && i < cases[c].sockets; i++) {
+            CHECK_ROW(view->sockets.inode[i] == cases[c].inodes[i], "sockets", i);
+            CHECK_ROW(view->sockets.owner[i] == cases[c].owners[i], "sockets", i);
+        }
+        free_snapshot(&views[c]);
+    }
+}
+
+/* Rankings */
+
+/* The order aggregate_top promises: most sockets first, ties to the lower pid */
+static int compare_by_sockets(const void *a, const void *b, void *ctx) {
+    const struct process_table *processes = ctx;
+    int x = *(const int *)a, y = *(const int *)b;
+    if (processes->socket_count[x] != processes->socket_count[y]) {
+        return processes->socket_count[y] - processes->socket_count[x];
+    }
+    return (processes->pid[x] > processes->pid[y]) - (processes->pid[x] < processes->pid[y]);
+}
+
+static void test_aggregate_top(void) {
+    struct sockmap_snapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    CHECK(string_pool_init(&snap.strings, &snap.arena) == 0);
+
+    // 150 processes in a shuffled pid order with only 7 socket counts, so
+    // most of every list is settled by ties
+    enum { PROCESSES = 150 };
+    for (int i = 0; i < PROCESSES; i++) {
+        pid_t pid = (pid_t)(1 + (i * 37) % PROCESSES);
+        add_process(&snap, pid, "worker", 100, 1024 * (unsigned long)(i % 11));
+        snap.processes.socket_count[i] = pid % 7;
+    }
+    int expected[PROCESSES];
+    for (int i = 0; i < PROCESSES; i++) expected[i] = i;
+    qsort_r(expected, PROCESSES, sizeof(int), compare_by_sockets, &snap.processes);
+
+    // The limit is clamped to what a list holds
+    static const int limits[] = { 0, 1, 7, 64, AGGREGATE_MAX_LIMIT, AGGREGATE_MAX_LIMIT + 1,
+                                  10000 };
+    static struct top_list list;
+    for (size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); l++) {
+        CHECK(aggregate_top(&snap, TOP_SOCKETS, limits[l], &list) == 0);
+        int count = limits[l] < AGGREGATE_MAX_LIMIT ? limits[l] : AGGREGATE_MAX_LIMIT;
+        CHECK(list.count == count);
+        CHECK(list.total == PROCESSES && list.metric == TOP_SOCKETS);
+        for (int i = 0; i < list.count && i < count; i++) {
+            CHECK_ROW(list.entries[i].pid == snap.processes.pid[expected[i]], "top", i);
+            CHECK_ROW(list.entries[i].sockets == snap.processes.socket_count[expected[i]],
+                      "top", i);
+        }
+    }
+    free_snapshot(&snap);
+
+    // CLOSE_WAIT is counted from the sockets, an unowned one counting for no one
+    memset(&snap, 0, sizeof(snap));
+    CHECK(string_pool_init(&snap.strings, &snap.arena) == 0);
+    add_process(&snap, 13, "idle", 100, 1024);
+    add_process(&snap, 12, "api", 100, 4096);
+    add_process(&snap, 11, "api", 100, 2048);
+    add_process(&snap, 10, "db", 100, 8192);
+    static const struct {
+        int state;
+        int owner;
+    } sockets[] = {
+        { SOCKET_STATE_CLOSE_WAIT, 3 }, { SOCKET_STATE_CLOSE_WAIT, 1 },
+        { SOCKET_STATE_ESTABLISHED, 0 }, { SOCKET_STATE_CLOSE_WAIT, 2 },
+        { SOCKET_STATE_CLOSE_WAIT, 1 }, { SOCKET_STATE_CLOSE_WAIT, 2 },
+        { SOCKET_STATE_CLOSE_WAIT, -1 }, { SOCKET_STATE_CLOSE_WAIT, 3 },
+    };
+    for (size_t i = 0; i < sizeof(sockets) / sizeof(sockets[0]); i++) {
+        add_socket(&snap, 100 + i, sockets[i].state, sockets[i].owner);
+    }
+    static const struct {
+        int metric;
+        pid_t pids[4];
+        int close_wait[4];
+    } rankings[] = {
+        { TOP_CLOSE_WAIT, { 10, 11, 12, 13 }, { 2, 2, 2, 0 } },
+        { TOP_RSS, { 10, 12, 11, 13 }, { 2, 2, 2, 0 } },
+    };
+    for (size_t r = 0; r < sizeof(rankings) / sizeof(rankings[0]); r++) {
+        CHECK(aggregate_top(&snap, rankings[r].metric, 10, &list) == 0);
+        CHECK(list.count == 4);
+        for (int i = 0; i < list.count && i < 4; i++) {
+            CHECK_ROW(list.entries[i].pid == rankings[r].pids[i], "top", i);
+            CHECK_ROW(list.entries[i].close_wait == rankings[r].close_wait[i], "top", i);
+        }
+    }
+    CHECK(strcmp(list.entries[1].name, "api") == 0);
+    free_snapshot(&snap);
+}
+
+static void test_aggregate_groups(void) {
+    struct sockmap_snapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    CHECK(string_pool_init(&snap.strings, &snap.arena) == 0);
+    add_process(&snap, 10, "nginx", 100, 1024);
+
+    // Request sockets group as SYN_RECV; equal groups rank by first socket
+    static const int states[] = {
+        SOCKET_STATE_LISTEN, SOCKET_STATE_NEW_SYN_RECV, SOCKET_STATE_ESTABLISHED,
+        SOCKET_STATE_SYN_RECV, SOCKET_STATE_LISTEN, SOCKET_STATE_CLOSE_WAIT,
+        SOCKET_STATE_NEW_SYN_RECV, SOCKET_STATE_ESTABLISHED, SOCKET_STATE_ESTABLISHED,
+        SOCKET_STATE_LISTEN, SOCKET_STATE_SYN_RECV,
+    };
+    for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); i++) {
+        add_socket(&snap, 100 + i, states[i], i == 5 ? -1 : 0);
+        snap.sockets.rx_queue[i] = (unsigned int)i;
+    }
+    static struct group_list list;
+    CHECK(aggregate_groups(&snap, GROUP_STATE, AGGREGATE_DEFAULT_LIMIT, &list) == 0);
+    CHECK(list.count == 4 && list.total == 4 && list.sockets == 11);
+    static const struct {
+        int state;
+        int sockets;
+        unsigned long long rx_queue;
+    } groups[] = {
+        { SOCKET_STATE_SYN_RECV, 4, 1 + 3 + 6 + 10 }, { SOCKET_STATE_LISTEN, 3, 0 + 4 + 9 },
+        { SOCKET_STATE_ESTABLISHED, 3, 2 + 7 + 8 }, { SOCKET_STATE_CLOSE_WAIT, 1, 5 },
+    };
+    for (int i = 0; i < list.count && i < 4; i++) {
+        CHECK_ROW(strcmp(list.entries[i].key, socket_state_name(groups[i].state)) == 0,
+                  "group", i);
+        CHECK_ROW(list.entries[i].sockets == groups[i].sockets, "group", i);
+        CHECK_ROW(list.entries[i].rx_queue == groups[i].rx_queue, "group", i);
+    }
+    CHECK(aggregate_groups(&snap, GROUP_PROCESS, 1, &list) == 0);
+    CHECK(list.count == 1 && list.total == 2);
+    CHECK(strcmp(list.entries[0].key, "nginx") == 0 && list.entries[0].sockets == 10);
+    CHECK(aggregate_groups(&snap, GROUP_PROCESS, 2, &list) == 0);
+    CHECK(list.count == 2 && strcmp(list.entries[1].key, "unknown") == 0);
+    free_snapshot(&snap);
+
+    // 3000 local ports outgrow the 1024 slots the table starts with, and
+    // every tenth has a second socket that puts it in the list
+    enum { PORTS = 3000 };
+    memset(&snap, 0, sizeof(snap));
+    CHECK(string_pool_init(&snap.strings, &snap.arena) == 0);
+    for (int i = 0; i < PORTS + PORTS / 10; i++) {
+        int port = i < PORTS ? i : (i - PORTS) * 10;
+        add_socket(&snap, 1000 + (unsigned long)i, SOCKET_STATE_ESTABLISHED, -1);
+        snap.sockets.local[i].port = (unsigned short)(20000 + port);
+    }
+    CHECK(aggregate_groups(&snap, GROUP_LOCAL_PORT, 10000, &list) == 0);
+    CHECK(list.count == AGGREGATE_MAX_LIMIT);
+    CHECK(list.total == PORTS && list.sockets == PORTS + PORTS / 10);
+    for (int i = 0; i < list.count; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "%d", 20000 + 10 * i);
+        CHECK_ROW(strcmp(list.entries[i].key, key) == 0, "group", i);
+        CHECK_ROW(list.entries[i].sockets == 2, "group", i);
+    }
+    free_snapshot(&snap);
+    aggregate_release();
+}
+
+/* Snapshot log */
+
+/* Live records must be distinct byte ranges, or a query replays overwritten rows */
+static int log_records_overlap(const struct snapshot_log_header *header) {
+    const struct snapshot_log_entry *index =
+        (const struct snapshot_log_entry *)((const char *)header + header->index_offset);
+    for (uint64_t a = header->first; a < header->next; a++) {
+        const struct snapshot_log_entry *x = &index[a % header->index_capacity];
+        for (uint64_t b = a + 1; b < header->next; b++) {
+            const struct snapshot_log_entry *y = &index[b % header->index_capacity];
+            if (x->offset < y->offset + y->length && y->offset < x->offset + x->length) return 1;
+        }
+    }
+    return 0;
+}
+
+/* The sockets the log has as of time at, or -1 if the query fails */
+static int logged_sockets(const char *path, time_t at) {
+    struct buffer out = { NULL, 0 };
+    struct json_writer writer;
+    json_writer_init_sink(&writer, buffer_append, &out, 0);
+    int result = snapshot_log_query(path, at, at, &writer);
+    if (json_flush(&writer) != 0) result = -1;
+    json_writer_release(&writer);
+    int count = result == 0 && out.data ? count_matches(out.data, "\"inode\":") : -1;
+    free(out.data);
+    return count;
+}
+
+static void test_snapshot_log(void) {
+    char path[] = "/tmp/sockmap-test-history-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0) return;
+    close(fd);
+
+    struct snapshot_log log;
+    CHECK(snapshot_log_open(&log, path, 1UL << 20) == 0);
+    if (!log.header) {
+        unlink(path);
+        return;
+    }
+
+    // Records of up to 150 kB, most of them small, in a 1 MB ring: a big
+    // one that does not fit wraps to 0 while small older ones still sit
+    // past the write position
+    struct sockmap_snapshot snaps[2];
+    memset(snaps, 0, sizeof(snaps));
+    unsigned long long seed = 0x2545F4914F6CDD1DULL;
+    int overlapped = 0, wrong = 0, wraps = 0;
+    uint64_t last_pos = 0;
+    for (int i = 0; i < 600; i++) {
+        struct sockmap_snapshot *cur = &snaps[i % 2], *prev = &snaps[(i + 1) % 2];
+        arena_reset(&cur->arena);
+        memset(&cur->sockets, 0, sizeof(cur->sockets));
+        memset(&cur->processes, 0, sizeof(cur->processes));
+        string_pool_init(&cur->strings, &cur->arena);
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        int count = (int)(seed >> 33) % 1200;
+        if ((seed >> 20) % 3 != 0) count /= 20;
+        for (int row = 0; row < count; row++) {
+            add_socket(cur, 1 + (unsigned long)row + (unsigned long)(i % 4) * 1000,
+                       SOCKET_STATE_ESTABLISHED, -1);
+        }
+        cur->timestamp = 1000000 + i;
+
+        // Mostly keyframes, so record sizes vary; every third one a delta
+        CHECK(snapshot_log_append(&log, i % 3 == 2 ? prev : NULL, cur) == 0);
+        if (log.header->write_pos < last_pos) wraps++;
+        last_pos = log.header->write_pos;
+        overlapped |= log_records_overlap(log.header);
+        wrong |= logged_sockets(path, cur->timestamp) != count;
+    }
+    CHECK(wraps >= 10);
+    CHECK(!overlapped);
+    CHECK(!wrong);
+
+    // The oldest records are gone, and the oldest kept is a keyframe
+    CHECK(log.header->first > 0);
+    const struct snapshot_log_entry *index =
+        (const struct snapshot_log_entry *)((const char *)log.header + log.header->index_offset);
+    CHECK(index[log.header->first % log.header->index_capacity].kind == SNAPSHOT_LOG_KEYFRAME);
+    CHECK(logged_sockets(path, 1000000) == 0);
+
+    snapshot_log_close(&log);
+    unlink(path);
+    snapshot_diff_release();
+    free_snapshot(&snaps[0]);
+    free_snapshot(&snaps[1]);
+}
+
+/* History trends */
+
+static void sleep_ms(long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static void test_history(void) {
+    history_release();
+    struct sockmap_snapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    add_socket(&snap, 501, SOCKET_STATE_ESTABLISHED, -1);
+    add_socket(&snap, 502, SOCKET_STATE_ESTABLISHED, -1);
+    add_socket(&snap, 0, SOCKET_STATE_TIME_WAIT, -1);
+
+    // Socket 501's receive queue grows every scan; 502's stays flat
+    unsigned char flags[3] = { 0 };
+    unsigned char early_flags = 0, early_leak = 0, steady = 0, leak = 0;
+    for (int scan = 0; scan < HISTORY_DEPTH; scan++) {
+        snap.sockets.rx_queue[0] = 100u * (unsigned int)(scan + 1);
+        snap.sockets.rx_queue[1] = 100;
+        history_sockets_begin();
+        for (int row = 0; row < snap.sockets.count; row++) {
+            flags[row] = history_socket(&snap.sockets, row);
+        }
+        history_sockets_sweep();
+        if (scan < HISTORY_TREND_SAMPLES - 2) early_flags |= flags[0];
+
+        // Pid 20 gains 2 MB a scan; pid 21 holds steady
+        history_processes_begin();
+        leak = history_process(20, 1000, 4096 + 2048 * (unsigned long)scan);
+        steady |= history_process(21, 1000, 4096);
+        history_processes_sweep();
+        if (scan < HISTORY_TREND_SAMPLES - 2) early_leak |= leak;
+        sleep_ms(5);
+    }
+    CHECK(early_flags == 0);
+    CHECK(flags[0] & SOCKET_FLAG_HUNG);
+    CHECK(flags[1] == 0);
+    CHECK(flags[2] == 0);
+    CHECK(early_leak == 0);
+    CHECK(leak == PROCESS_FLAG_LEAK);
+    CHECK(steady == 0);
+
+    // A scan that leaves the process out forgets its trend
+    history_processes_begin();
+    history_processes_sweep();
+    history_processes_begin();
+    CHECK(history_process(20, 1000, 1 << 20) == 0);
+    history_processes_sweep();
+
+    // A sliced walk reads pid 22 every other scan and carries it over in
+    // between; its trend spans the scans that read it
+    unsigned char sliced_leak = 0;
+    for (int scan = 0; scan < 2 * HISTORY_TREND_SAMPLES; scan++) {
+        history_processes_begin();
+        if (scan % 2 == 0) {
+            sliced_leak = history_process(22, 1000, 4096 + 2048 * (unsigned long)scan);
+        } else {
+            history_process_keep(22, 1000);
+        }
+        history_processes_sweep();
+        sleep_ms(5);
+    }
+    CHECK(sliced_leak == PROCESS_FLAG_LEAK);
+
+    history_release();
+    free_snapshot(&snap);
+}
+
+/* CPU sampling */
+
+static void test_cpu_sample(void) {
+    cpu_sample_release();
+    long hz = sysconf(_SC_CLK_TCK);
+    unsigned long long ticks_per_second = hz > 0 ? (unsigned long long)hz : 100;
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    unsigned long long uptime_ticks = (unsigned long long)now.tv_sec * ticks_per_second;
+
+    // First sight averages over the lifetime: one CPU-second in the last ten
+    unsigned long long started = uptime_ticks - 10 * ticks_per_second;
+    cpu_sample_begin();
+    double lifetime = cpu_sample_percent(30, started, ticks_per_second);
+    CHECK(lifetime > 8.0 && lifetime < 12.0);
+    CHECK(cpu_sample_percent(31, started, ticks_per_second) > 0.0);
+    cpu_sample_sweep();
+
+    // Later scans divide the ticks since by the time since; half a second of
+    // CPU can only be under 100% over more than half a second
+    sleep_ms(600);
+    cpu_sample_begin();
+    double busy = cpu_sample_percent(30, started, ticks_per_second + ticks_per_second / 2);
+    CHECK(busy > 40.0 && busy < 100.0);
+    // Ticks that went backwards count as none
+    CHECK(cpu_sample_percent(31, started, 0) == 0.0);
+    cpu_sample_sweep();
+
+    // A reused pid starts over from its own start time
+    cpu_sample_begin();
+    double reused = cpu_sample_percent(30, started - 10 * ticks_per_second, ticks_per_second);
+    CHECK(reused > 4.0 && reused < 6.0);
+    cpu_sample_keep(31, started);
+    cpu_sample_sweep();
+
+    // Kept through that sweep, pid 31 is measured from its last reading:
+    // a tenth of a second over at least 0.2, not over its ten-second lifetime
+    sleep_ms(200);
+    cpu_sample_begin();
+    double kept = cpu_sample_percent(31, started, ticks_per_second / 10);
+    CHECK(kept > 20.0 && kept <= 50.0);
+    cpu_sample_sweep();
+
+    // A process missed by a whole scan is forgotten and averages over its lifetime again
+    cpu_sample_begin();
+    cpu_sample_sweep();
+    cpu_sample_begin();
+    double forgotten = cpu_sample_percent(31, started, ticks_per_second);
+    CHECK(forgotten > 8.0 && forgotten < 12.0);
+    cpu_sample_sweep();
+    cpu_sample_release();
+}
+
+int main(int argc, char *argv[]) {
+    struct fixture fx = { NULL, 0, 0 };
+    const char *binary = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:p:s:b:")) != -1) {
+        switch (opt) {
+            case 'r': fx.root = optarg; break;
+            case 'p': fx.pids = atoi(optarg); break;
+            case 's': fx.sockets = atol(optarg); break;
+            case 'b': binary = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s -r fixture -p pids -s sockets [-b sockmap]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (!fx.root || fx.pids <= 0 || fx.sockets < 0) {
+        fprintf(stderr, "Usage: %s -r fixture -p pids -s sockets [-b sockmap]\n", argv[0]);
+        return 1;
+    }
+
+    test_fixture_scan(&fx);
+    if (binary) test_proc_root_option(&fx, binary);
+    test_parse_stat();
+    test_parse_status();
+    test_parse_maps();
+    test_parse_net();
+    test_snapshot_diff();
+    test_scan_query();
+    test_snapshot_view();
+    test_aggregate_top();
+    test_aggregate_groups();
+    test_snapshot_log();
+    test_history();
+    test_cpu_sample();
+
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All tests passed (%d pids, %ld sockets under %s)\n", fx.pids, fx.sockets, fx.root);
+    return 0;
+}
@@ -1,6 +1,13 @@
-import React, { useState, useEffect } from 'react';
+import React, { useState, useEffect, useRef } from 'react';
 import { Activity, Cpu, Database, Globe, HardDrive, RefreshCw, Search, Filter } from 'lucide-react';
-import { apiService, TraceData } from '../services/api';
+import {
+  apiService,
+  Keyed,
+  TableDelta,
+  SocketData as ApiSocket,
+  MemoryRollup as ApiRollup,
+  ProcessData as ApiProcess,
+} from '../services/api';
 import { SocketList } from './SocketList';
 import { MemoryMap } from './MemoryMap';
 import { ProcessInfo } from './ProcessInfo';
@@ -20,14 +27,15 @@ export interface SocketData {
   timestamp: string;
 }
 
-export interface MemorySegment {
+export interface MemoryRollup {
   id: string;
   pid: number;
-  address: string;
-  size: number;
-  permissions: string;
   type: string;
-  isShared: boolean;
+  rssKb: number;
+  pssKb: number;
+  swapKb: number;
+  sharedDirtyKb: number;
+  privateDirtyKb: number;
 }
 
 export interface ProcessData {
@@ -37,11 +45,61 @@ export interface ProcessData {
   memoryUsage: number;
   cpuUsage: number;
   status: string;
+  hasLeak: boolean;
+}
+
+const toSocket = (socket: ApiSocket, id: string, timestamp: number): SocketData => ({
+  id,
+  pid: socket.pid,
+  processName: socket.process_name,
+  localAddress: socket.local_address,
+  remoteAddress: socket.remote_address,
+  state: socket.state as any,
+  protocol: socket.protocol as any,
+  memoryUsage: socket.memory_usage,
+  isHung: socket.is_hung,
+  hasLeak: socket.has_leak,
+  timestamp: new Date(timestamp * 1000).toISOString(),
+});
+
+const toRollup = (usage: ApiRollup, id: string): MemoryRollup => ({
+  id,
+  pid: usage.pid,
+  type: usage.type,
+  rssKb: usage.rss_kb,
+  pssKb: usage.pss_kb,
+  swapKb: usage.swap_kb,
+  sharedDirtyKb: usage.shared_dirty_kb,
+  privateDirtyKb: usage.private_dirty_kb,
+});
+
+const toProcess = (proc: ApiProcess): ProcessData => ({
+  pid: proc.pid,
+  name: proc.name,
+  socketCount: proc.socket_count,
+  memoryUsage: proc.memory_usage,
+  cpuUsage: proc.cpu_usage,
+  status: proc.status,
+  hasLeak: proc.has_leak,
+});
+
+// Rows of the event stream by key; only what a delta touches is converted again
+interface StreamRows {
+  sequence: number;
+  sockets: Map<string, SocketData>;
+  memory: Map<string, MemoryRollup>;
+  processes: Map<string, ProcessData>;
 }
 
+const applyDelta = <T, R>(rows: Map<string, R>, delta: TableDelta<T>, convert: (row: Keyed<T>) => R) => {
+  delta.removed.forEach(key => rows.delete(key));
+  delta.added.forEach(row => rows.set(row.key, convert(row)));
+  delta.changed.forEach(row => rows.set(row.key, convert(row)));
+};
+
 export function Dashboard() {
   const [sockets, setSockets] = useState<SocketData[]>([]);
-  const [memorySegments, setMemorySegments] = useState<MemorySegment[]>([]);
+  const [memoryRollups, setMemoryRollups] = useState<MemoryRollup[]>([]);
   const [processes, setProcesses] = useState<ProcessData[]>([]);
   const [isScanning, setIsScanning] = useState(false);
   const [lastUpdate, setLastUpdate] = useState<Date>(new Date());
@@ -50,6 +108,12 @@ export function Dashboard() {
   const [autoRefresh, setAutoRefresh] = useState(true);
   const [connectionStatus, setConnectionStatus] = useState<'connected' | 'disconnected' | 'checking'>('checking');
   const [error, setError] = useState<string | null>(null);
+  const streamRows = useRef<StreamRows>({
+    sequence: 0,
+    sockets: new Map(),
+    memory: new Map(),
+    processes: new Map(),
+  });
 
   const runScan = async () => {
     setIsScanning(true);
@@ -64,46 +128,20 @@ export function Dashboard() {
         setConnectionStatus('disconnected');
         // Clear data on error
         setSockets([]);
-        setMemorySegments([]);
+        setMemoryRollups([]);
         setProcesses([]);
       } else if (response.data) {
         setConnectionStatus('connected');
         // Transform backend data to frontend format
-        const transformedSockets: SocketData[] = response.data.sockets.map((socket, index) => ({
-          id: `${socket.pid}-${index}`,
-          pid: socket.pid,
-          processName: socket.process_name,
-          localAddress: socket.local_address,
-          remoteAddress: socket.remote_address,
-          state: socket.state as any,
-          protocol: socket.protocol as any,
-          memoryUsage: socket.memory_usage,
-          isHung: socket.is_hung,
-          hasLeak: socket.has_leak,
-          timestamp: new Date(response.data.timestamp * 1000).toISOString(),
-        }));
-        
-        const transformedMemory: MemorySegment[] = response.data.memory.map((mem, index) => ({
-          id: `${mem.pid}-${index}`,
-          pid: mem.pid,
-          address: mem.address,
-          size: mem.size,
-          permissions: mem.permissions,
-          type: mem.type,
-          isShared: mem.is_shared,
-        }));
-        
-        const transformedProcesses: ProcessData[] = response.data.processes.map(proc => ({
-          pid: proc.pid,
-          name: proc.name,
-          socketCount: proc.socket_count,
-          memoryUsage: proc.memory_usage,
-          cpuUsage: proc.cpu_usage,
-          status: proc.status,
-        }));
-        
+        const { timestamp } = response.data;
+        const transformedSockets = response.data.sockets.map((socket, index) =>
+          toSocket(socket, `${socket.pid}-${index}`, timestamp));
+        const transformedMemory = response.data.memory_rollup.map(usage =>
+          toRollup(usage, `${usage.pid}:${usage.type}`));
+        const transformedProcesses = response.data.processes.map(toProcess);
+
         setSockets(transformedSockets);
-        setMemorySegments(transformedMemory);
+        setMemoryRollups(transformedMemory);
         setProcesses(transformedProcesses);
       }
     } catch (err) {
@@ -112,7 +150,7 @@ export function Dashboard() {
       setConnectionStatus('disconnected');
       // Clear data on error
       setSockets([]);
-      setMemorySegments([]);
+      setMemoryRollups([]);
       setProcesses([]);
     }
     
@@ -133,17 +171,56 @@ export function Dashboard() {
     };
     
     checkHealth();
-    runScan();
+    if (!autoRefresh) runScan();
   }, []);
 
+  // Auto-refresh follows the backend's event stream: a snapshot, then per-scan deltas
   useEffect(() => {
     if (!autoRefresh) return;
 
-    const interval = setInterval(() => {
-      runScan();
-    }, 5000); // Refresh every 5 seconds
+    const rows = streamRows.current;
+    const publish = () => {
+      setSockets(Array.from(rows.sockets.values()));
+      setMemoryRollups(Array.from(rows.memory.values()));
+      setProcesses(Array.from(rows.processes.values()));
+      setConnectionStatus('connected');
+      setError(null);
+      setLastUpdate(new Date());
+    };
+
+    let unsubscribe = () => {};
+    const connect = () => {
+      unsubscribe = apiService.subscribe({
+        onSnapshot: (snapshot) => {
+          rows.sequence = snapshot.sequence;
+          rows.sockets = new Map(snapshot.sockets.map(s => [s.key, toSocket(s, s.key, snapshot.timestamp)]));
+          rows.memory = new Map(snapshot.memory_rollup.map(m => [m.key, toRollup(m, m.key)]));
+          rows.processes = new Map(snapshot.processes.map(p => [p.key, toProcess(p)]));
+          publish();
+        },
+        onDelta: (delta) => {
+          if (delta.base !== rows.sequence) {
+            // Missed an event; a fresh connection starts from a full snapshot
+            unsubscribe();
+            connect();
+            return;
+          }
+          rows.sequence = delta.sequence;
+          applyDelta(rows.sockets, delta.sockets, s => toSocket(s, s.key, delta.timestamp));
+          applyDelta(rows.memory, delta.memory_rollup, m => toRollup(m, m.key));
+          applyDelta(rows.processes, delta.processes, toProcess);
+          publish();
+        },
+        onError: () => {
+          // EventSource retries by itself; say so until it is back
+          setConnectionStatus('disconnected');
+          setError('Backend connection lost, reconnecting...');
+        },
+      });
+    };
 
-    return () => clearInterval(interval);
+    connect();
+    return () => unsubscribe();
   }, [autoRefresh]);
 
   const filteredSockets = sockets.filter(socket =>
@@ -239,7 +316,7 @@ export function Dashboard() {
           <nav className="flex space-x-8">
             {[
               { id: 'sockets', label: 'Socket Monitoring', icon: Globe },
-              { id: 'memory', label: 'Memory Mapping', icon: HardDrive },
+              { id: 'memory', label: 'Memory Usage', icon: HardDrive },
               { id: 'processes', label: 'Process Overview', icon: Cpu },
             ].map((tab) => {
               const Icon = tab.icon;
@@ -263,7 +340,7 @@ export function Dashboard() {
 
         {/* Tab Content */}
         {selectedTab === 'sockets' && <SocketList sockets={filteredSockets} isLoading={isScanning} />}
-        {selectedTab === 'memory' && <MemoryMap segments={memorySegments} isLoading={isScanning} />}
+        {selectedTab === 'memory' && <MemoryMap rollups={memoryRollups} isLoading={isScanning} />}
         {selectedTab === 'processes' && <ProcessInfo processes={processes} isLoading={isScanning} />}
       </div>
     </div>
@@ -14,6 +14,7 @@ export function ProcessInfo({ processes, isLoading }: ProcessInfoProps) {
       case 'sleeping': return 'text-blue-400 bg-blue-400/10';
       case 'stopped': return 'text-red-400 bg-red-400/10';
       case 'zombie': return 'text-yellow-400 bg-yellow-400/10';
+      case 'exited': return 'text-purple-400 bg-purple-400/10';
       default: return 'text-gray-400 bg-gray-400/10';
     }
   };
@@ -66,7 +67,9 @@ export function ProcessInfo({ processes, isLoading }: ProcessInfoProps) {
                   <MemoryStick className="w-4 h-4 text-gray-400 mr-2" />
                   <span className="text-sm text-gray-300">Memory</span>
                 </div>
-                <span className="text-sm font-medium text-white">{process.memoryUsage.toFixed(1)} MB</span>
+                <span className={`text-sm font-medium ${process.hasLeak ? 'text-red-400' : 'text-white'}`}>
+                  {process.memoryUsage.toFixed(1)} MB{process.hasLeak && ' (growing)'}
+                </span>
               </div>
 
               <div className="flex items-center justify-between">
@@ -25,9 +25,22 @@ export interface MemorySegment {
   size: number;
   permissions: string;
   type: string;
+  path: string;
   is_shared: boolean;
 }
 
+// One row per process from smaps_rollup; type is "total" unless the full
+// smaps was asked for, which adds a row per mapping type
+export interface MemoryRollup {
+  pid: number;
+  type: string;
+  rss_kb: number;
+  pss_kb: number;
+  swap_kb: number;
+  shared_dirty_kb: number;
+  private_dirty_kb: number;
+}
+
 export interface ProcessData {
   pid: number;
   name: string;
@@ -35,13 +48,77 @@ export interface ProcessData {
   memory_usage: number;
   cpu_usage: number;
   status: string;
+  has_leak: boolean;
+}
+
+// How the scan went; absent when the backend is built with STATS=0
+export interface ScanStats {
+  duration_ms: number;
+  phases_ms: { sockets: number; fds: number; maps: number; stat: number; output: number };
+  files_opened: number;
+  bytes_read: number;
+  parse_errors: number;
+  pids_vanished: number;
+  arena_bytes: number;
+  arena_peak_bytes: number;
+  peak_rss_kb: number;
+}
+
+export interface HealthData {
+  status: string;
+  binary_exists: boolean;
+  binary_path: string;
+  scan_stats?: ScanStats;
 }
 
 export interface TraceData {
   sockets: SocketData[];
-  memory: MemorySegment[];
+  memory_rollup: MemoryRollup[];
   processes: ProcessData[];
   timestamp: number;
+  scan_stats?: ScanStats;
+}
+
+// Event stream rows carry a key that stays the same across scans
+export type Keyed<T> = T & { key: string };
+
+export interface TableDelta<T> {
+  added: Keyed<T>[];
+  changed: Keyed<T>[];
+  removed: string[];
+}
+
+export interface SnapshotEvent {
+  sequence: number;
+  timestamp: number;
+  sockets: Keyed<SocketData>[];
+  memory_rollup: Keyed<MemoryRollup>[];
+  processes: Keyed<ProcessData>[];
+}
+
+export interface DeltaEvent {
+  sequence: number;
+  base: number;
+  timestamp: number;
+  sockets: TableDelta<SocketData>;
+  memory_rollup: TableDelta<MemoryRollup>;
+  processes: TableDelta<ProcessData>;
+}
+
+// Recorded history: the state at `from`, then the deltas that follow it
+export interface HistoryData {
+  from: number;
+  to: number;
+  oldest: number | null;
+  snapshot: SnapshotEvent | null;
+  deltas: DeltaEvent[];
+  truncated: boolean;
+}
+
+export interface EventHandlers {
+  onSnapshot: (event: SnapshotEvent) => void;
+  onDelta: (event: DeltaEvent) => void;
+  onError: () => void;
 }
 
 class ApiService {
@@ -63,7 +140,7 @@ class ApiService {
   }
 
 
-  async healthCheck(): Promise<ApiResponse<{ status: string; binary_exists: boolean; binary_path: string }>> {
+  async healthCheck(): Promise<ApiResponse<HealthData>> {
     try {
       const response = await this.fetchWithTimeout(`${API_BASE_URL}/health`);
       
@@ -104,13 +181,14 @@ class ApiService {
           is_hung: socket.is_hung,
           has_leak: socket.has_leak,
         })) || [],
-        memory: data.memory?.map((mem: any) => ({
-          pid: mem.pid,
-          address: mem.address,
-          size: mem.size,
-          permissions: mem.permissions,
-          type: mem.type,
-          is_shared: mem.is_shared,
+        memory_rollup: data.memory_rollup?.map((usage: any) => ({
+          pid: usage.pid,
+          type: usage.type,
+          rss_kb: usage.rss_kb,
+          pss_kb: usage.pss_kb,
+          swap_kb: usage.swap_kb,
+          shared_dirty_kb: usage.shared_dirty_kb,
+          private_dirty_kb: usage.private_dirty_kb,
         })) || [],
         processes: data.processes?.map((proc: any) => ({
           pid: proc.pid,
@@ -119,8 +197,10 @@ class ApiService {
           memory_usage: proc.memory_usage,
           cpu_usage: proc.cpu_usage,
           status: proc.status,
+          has_leak: proc.has_leak,
         })) || [],
         timestamp: data.timestamp || Date.now(),
+        scan_stats: data.scan_stats,
       };
 
       return { data: transformedData };
@@ -132,6 +212,22 @@ class ApiService {
     }
   }
 
+  // Server-Sent Events: one full snapshot, then a delta per scan. EventSource
+  // reconnects on its own and the server resumes from its Last-Event-ID.
+  subscribe(handlers: EventHandlers): () => void {
+    const source = new EventSource(`${API_BASE_URL}/events`);
+
+    source.addEventListener('snapshot', (event) => {
+      handlers.onSnapshot(JSON.parse((event as MessageEvent).data));
+    });
+    source.addEventListener('delta', (event) => {
+      handlers.onDelta(JSON.parse((event as MessageEvent).data));
+    });
+    source.onerror = () => handlers.onError();
+
+    return () => source.close();
+  }
+
   async getSockets(): Promise<ApiResponse<{ sockets: SocketData[]; timestamp: number }>> {
     try {
       const response = await this.fetchWithTimeout(`${API_BASE_URL}/sockets`);
@@ -150,7 +246,13 @@ class ApiService {
     }
   }
 
-  async getMemory(): Promise<ApiResponse<{ memory: MemorySegment[]; timestamp: number }>> {
+  // Mappings are only included when the request asks for them with maps=
+  async getMemory(): Promise<ApiResponse<{
+    memory_rollup: MemoryRollup[];
+    memory?: MemorySegment[];
+    memory_total?: number;
+    timestamp: number;
+  }>> {
     try {
       const response = await this.fetchWithTimeout(`${API_BASE_URL}/memory`);
       
@@ -185,6 +287,28 @@ class ApiService {
       };
     }
   }
+
+  // Times are Unix seconds, or seconds before now when negative
+  async getHistory(from?: number, to?: number): Promise<ApiResponse<HistoryData>> {
+    try {
+      const params = new URLSearchParams();
+      if (from !== undefined) params.set('from', String(from));
+      if (to !== undefined) params.set('to', String(to));
+      const response = await this.fetchWithTimeout(`${API_BASE_URL}/history?${params}`);
+      
+      if (!response.ok) {
+        throw new Error(`HTTP ${response.status}: ${response.statusText}`);
+      }
+
+      const data = await response.json();
+      return { data };
+    } catch (error) {
+      console.error('Get history failed:', error);
+      return { 
+        error: error instanceof Error ? error.message : 'Failed to get history',
+      };
+    }
+  }
 }
 
 export const apiService = new ApiService();
\ No newline at end of file